@@ -71,6 +71,9 @@ int sandbox_eth_recv_ping_req(struct udevice *dev);
 typedef int sandbox_eth_tx_hand_f(struct udevice *dev, void *pkt,
 				   unsigned int len);
 
+/* Number of buffers which can be posted for header split */
+#define SANDBOX_ETH_SPLIT_BUFS	8
+
 /**
  * struct eth_sandbox_priv - memory for sandbox mock driver
  *
@@ -82,6 +85,11 @@ typedef int sandbox_eth_tx_hand_f(struct udevice *dev, void *pkt,
  * recv_packets - number of packets returned
  * tx_handler - function to generate responses to sent packets
  * priv - a pointer to some structure a test may want to keep track of
+ * split_hdr_len - bytes of each frame kept apart, 0 if header split is off
+ * split_bufs - buffers posted for the rest of received frames, NULL for the
+ *	driver's own
+ * split_lens - lengths of the posted buffers
+ * split_posted - number of buffers posted
  */
 struct eth_sandbox_priv {
 	uchar fake_host_hwaddr[ARP_HLEN];
@@ -92,6 +100,10 @@ struct eth_sandbox_priv {
 	int recv_packets;
 	sandbox_eth_tx_hand_f *tx_handler;
 	void *priv;
+	int split_hdr_len;
+	uchar *split_bufs[SANDBOX_ETH_SPLIT_BUFS];
+	int split_lens[SANDBOX_ETH_SPLIT_BUFS];
+	int split_posted;
 };
 
 /*
@@ -119,6 +119,14 @@ long sandbox_i2c_rtc_get_set_base_time(struct udevice *dev, long base_time);
 
 int sandbox_usb_keyb_add_string(struct udevice *dev, const char *str);
 
+/**
+ * sandbox_flash_get_queued() - find out whether UAS commands were queued
+ *
+ * @dev:	USB flash-stick emulator
+ * Return: number of times more than one UAS command was queued at once
+ */
+int sandbox_flash_get_queued(struct udevice *dev);
+
 /**
  * sandbox_osd_get_mem() - get the internal memory of a sandbox OSD
  *
@@ -255,6 +263,16 @@ int sandbox_get_pch_spi_protect(struct udevice *dev);
  */
 int sandbox_get_pci_ep_irq_count(struct udevice *dev);
 
+/**
+ * sandbox_mmc_get_cmd_count() - Get the number of times a command was sent
+ *
+ * @dev: MMC device to check
+ * @cmdidx: Command index (e.g. MMC_CMD_SET_BLOCK_COUNT)
+ * Return: number of times the command has been sent since the device was
+ * probed
+ */
+uint sandbox_mmc_get_cmd_count(struct udevice *dev, uint cmdidx);
+
 /**
  * sandbox_pci_read_bar() - Read the BAR value for a read_config operation
  *
@@ -13,16 +13,31 @@
 static int blkc_show(struct cmd_tbl *cmdtp, int flag,
 		     int argc, char *const argv[])
 {
+	struct block_cache_dev_stats dstats;
 	struct block_cache_stats stats;
+	int i;
+
 	blkcache_stats(&stats);
 
 	printf("hits: %u\n"
+	       "partial hits: %u\n"
 	       "misses: %u\n"
-	       "entries: %u\n"
+	       "cached blocks: %u\n"
 	       "max blocks/entry: %u\n"
-	       "max cache entries: %u\n",
-	       stats.hits, stats.misses, stats.entries,
-	       stats.max_blocks_per_entry, stats.max_entries);
+	       "max cache entries: %u\n"
+	       "read ahead: %u blocks, %u used\n",
+	       stats.hits, stats.partial, stats.misses, stats.entries,
+	       stats.max_blocks_per_entry, stats.max_entries,
+	       stats.ra_blocks, stats.ra_hits);
+
+	for (i = 0; !blkcache_dev_stats(i, &dstats); i++)
+		printf("%s %d: %u of %u blocks, %u blocks/entry%s\n",
+		       blk_get_uclass_name(dstats.iftype), dstats.devnum,
+		       dstats.blocks,
+		       dstats.max_blocks_per_entry * dstats.max_entries,
+		       dstats.max_blocks_per_entry,
+		       dstats.configured ? " (configured)" : "");
+
 	return 0;
 }
 
@@ -30,20 +45,37 @@ static int blkc_configure(struct cmd_tbl *cmdtp, int flag,
 			  int argc, char *const argv[])
 {
 	unsigned blocks_per_entry, max_entries;
-	if (argc != 3)
+	struct blk_desc *desc;
+
+	if (argc != 3 && argc != 5)
 		return CMD_RET_USAGE;
 
 	blocks_per_entry = simple_strtoul(argv[1], 0, 0);
 	max_entries = simple_strtoul(argv[2], 0, 0);
-	blkcache_configure(blocks_per_entry, max_entries);
-	printf("changed to max of %u entries of %u blocks each\n",
-	       max_entries, blocks_per_entry);
+	if (argc == 3) {
+		blkcache_configure(blocks_per_entry, max_entries);
+		printf("changed to max of %u entries of %u blocks each\n",
+		       max_entries, blocks_per_entry);
+		return 0;
+	}
+
+	desc = blk_get_dev(argv[3], simple_strtoul(argv[4], 0, 0));
+	if (!desc) {
+		printf("no such device: %s %s\n", argv[3], argv[4]);
+		return CMD_RET_FAILURE;
+	}
+	if (blkcache_configure_dev(desc->uclass_id, desc->devnum,
+				   blocks_per_entry, max_entries))
+		return CMD_RET_FAILURE;
+	printf("changed %s %d to max of %u entries of %u blocks each\n",
+	       argv[3], desc->devnum, max_entries, blocks_per_entry);
+
 	return 0;
 }
 
 static struct cmd_tbl cmd_blkc_sub[] = {
 	U_BOOT_CMD_MKENT(show, 0, 0, blkc_show, "", ""),
-	U_BOOT_CMD_MKENT(configure, 3, 0, blkc_configure, "", ""),
+	U_BOOT_CMD_MKENT(configure, 5, 0, blkc_configure, "", ""),
 };
 
 static int do_blkcache(struct cmd_tbl *cmdtp, int flag,
@@ -67,9 +99,10 @@ static int do_blkcache(struct cmd_tbl *cmdtp, int flag,
 }
 
 U_BOOT_CMD(
-	blkcache, 4, 0, do_blkcache,
+	blkcache, 6, 0, do_blkcache,
 	"block cache diagnostics and control",
 	"show - show and reset statistics\n"
-	"blkcache configure <blocks> <entries> "
-	"- set max blocks per entry and max cache entries\n"
+	"blkcache configure <blocks> <entries> [<interface> <dev>] "
+	"- set max blocks per entry and max cache entries, for all devices or\n"
+	"    just one\n"
 );
@@ -289,6 +289,51 @@ int usb_bulk_msg(struct usb_device *dev, unsigned int pipe,
 		return -EIO;
 }
 
+/*-------------------------------------------------------------------
+ * submits several bulk messages, and waits for them to complete. If the
+ * controller can queue them, the device goes from one to the next without
+ * a round trip through U-Boot, otherwise they are sent one at a time.
+ * Stops at the first message which fails, leaving the status of the rest
+ * as USB_ST_NOT_PROC. Returns 0 if Ok or negative if Error.
+ */
+int usb_bulk_msgs(struct usb_device *dev, struct usb_bulk_req *reqs,
+		  int count, int timeout)
+{
+	int i, ret;
+
+	for (i = 0; i < count; i++) {
+		if (reqs[i].length < 0)
+			return -EINVAL;
+		reqs[i].status = USB_ST_NOT_PROC;
+		reqs[i].act_len = 0;
+	}
+#if CONFIG_IS_ENABLED(DM_USB)
+	ret = submit_bulk_queue(dev, reqs, count);
+	if (ret != -ENOSYS && ret != -E2BIG) {
+		if (ret < 0)
+			return -EIO;
+		for (i = 0; i < count; i++) {
+			if (reqs[i].status)
+				return -EIO;
+		}
+		return 0;
+	}
+#endif
+	for (i = 0; i < count; i++) {
+		/* Streams can only be used by queueing */
+		if (reqs[i].stream)
+			return -EINVAL;
+	}
+	for (i = 0; i < count; i++) {
+		ret = usb_bulk_msg(dev, reqs[i].pipe, reqs[i].buffer,
+				   reqs[i].length, &reqs[i].act_len, timeout);
+		reqs[i].status = dev->status;
+		if (ret)
+			return ret;
+	}
+
+	return 0;
+}
 
 /*-------------------------------------------------------------------
  * Max Packet stuff
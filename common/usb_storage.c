@@ -67,6 +67,27 @@ static const unsigned char us_direction[256/8] = {
 #define US_DIRECTION(x) ((us_direction[x>>3] >> (x & 7)) & 1)
 
 static struct scsi_cmd usb_ccb __aligned(ARCH_DMA_MINALIGN);
+
+/* Number of READ(10) commands which the read_queue routines send at once */
+#define USB_STOR_QUEUE_DEPTH	(USB_MAX_BULK_REQS / 3)
+
+/* CBW and CSW of a BBB command, each in its own cache line */
+struct us_bbb_cmd {
+	struct umass_bbb_cbw cbw __aligned(ARCH_DMA_MINALIGN);
+	struct umass_bbb_csw csw __aligned(ARCH_DMA_MINALIGN);
+};
+
+static struct us_bbb_cmd usb_bbb_cmd[USB_STOR_QUEUE_DEPTH];
+
+#if CONFIG_IS_ENABLED(USB_STORAGE_UAS)
+/* Command and Sense IUs of a UAS command, each in its own cache line */
+struct us_uas_cmd {
+	struct uas_command_iu cmd __aligned(ARCH_DMA_MINALIGN);
+	struct uas_sense_iu sense __aligned(ARCH_DMA_MINALIGN);
+};
+
+static struct us_uas_cmd usb_uas_cmd[USB_STOR_QUEUE_DEPTH];
+#endif
 static __u32 CBWTag;
 
 static int usb_max_devs; /* number of highest available usb device */
@@ -78,6 +99,10 @@ static struct blk_desc usb_dev_desc[USB_MAX_STOR_DEV];
 struct us_data;
 typedef int (*trans_cmnd)(struct scsi_cmd *cb, struct us_data *data);
 typedef int (*trans_reset)(struct us_data *data);
+typedef int (*trans_read_queue)(struct scsi_cmd *srb, struct us_data *data,
+				unsigned long blksz, lbaint_t start,
+				lbaint_t blks, uintptr_t buf_addr,
+				lbaint_t *donep);
 
 struct us_data {
 	struct usb_device *pusb_dev;	 /* this usb_device */
@@ -101,8 +126,16 @@ struct us_data {
 	struct scsi_cmd	*srb;			/* current srb */
 	trans_reset	transport_reset;	/* reset routine */
 	trans_cmnd	transport;		/* transport routine */
+	trans_read_queue read_queue;		/* queued read routine */
 	unsigned short	max_xfer_blk;		/* maximum transfer blocks */
 	bool		cmd12;			/* use 12-byte commands (RBC/UFI) */
+#if CONFIG_IS_ENABLED(USB_STORAGE_UAS)
+	unsigned char	ep_cmd;			/* UAS command endpoint */
+	unsigned char	ep_status;		/* UAS status endpoint */
+	unsigned char	num_tags;		/* UAS tags (and streams) */
+	bool		sense_valid;		/* sense from last UAS cmd */
+	unsigned char	sense[18];		/* ... for REQUEST SENSE */
+#endif
 };
 
 #if !CONFIG_IS_ENABLED(BLK)
@@ -177,6 +210,10 @@ static unsigned int usb_get_max_lun(struct us_data *us)
 {
 	int len;
 	ALLOC_CACHE_ALIGN_BUFFER(unsigned char, result, 1);
+
+	/* GET MAX LUN is a Bulk-Only request; UAS is only used for LUN 0 */
+	if (us->protocol == US_PR_UAS)
+		return 0;
 	len = usb_control_msg(us->pusb_dev,
 			      usb_rcvctrlpipe(us->pusb_dev, 0),
 			      US_BBB_GET_MAX_LUN,
@@ -544,6 +581,27 @@ static int usb_stor_CB_reset(struct us_data *us)
 	return 0;
 }
 
+/*
+ * Fill in the CBW for a SCSI command. The actual SCSI command is copied
+ * into cbw.CBWCDB.
+ */
+static void usb_stor_BBB_setup_cbw(struct scsi_cmd *srb,
+				   struct umass_bbb_cbw *cbw)
+{
+	int dir_in = US_DIRECTION(srb->cmd[0]);
+
+	cbw->dCBWSignature = cpu_to_le32(CBWSIGNATURE);
+	cbw->dCBWTag = cpu_to_le32(CBWTag++);
+	cbw->dCBWDataTransferLength = cpu_to_le32(srb->datalen);
+	cbw->bCBWFlags = (dir_in ? CBWFLAGS_IN : CBWFLAGS_OUT);
+	cbw->bCBWLUN = srb->lun;
+	cbw->bCDBLength = srb->cmdlen;
+	/* copy the command data into the CBW command data buffer */
+	/* DST SRC LEN!!! */
+
+	memcpy(cbw->CBWCDB, srb->cmd, srb->cmdlen);
+}
+
 /*
  * Set up the command for a BBB device. Note that the actual SCSI
  * command is copied into cbw.CBWCDB.
@@ -552,16 +610,13 @@ static int usb_stor_BBB_comdat(struct scsi_cmd *srb, struct us_data *us)
 {
 	int result;
 	int actlen;
-	int dir_in;
 	unsigned int pipe;
 	ALLOC_CACHE_ALIGN_BUFFER(struct umass_bbb_cbw, cbw, 1);
 
-	dir_in = US_DIRECTION(srb->cmd[0]);
-
 #ifdef BBB_COMDAT_TRACE
 	printf("dir %d lun %d cmdlen %d cmd %p datalen %lu pdata %p\n",
-		dir_in, srb->lun, srb->cmdlen, srb->cmd, srb->datalen,
-		srb->pdata);
+		US_DIRECTION(srb->cmd[0]), srb->lun, srb->cmdlen, srb->cmd,
+		srb->datalen, srb->pdata);
 	if (srb->cmdlen) {
 		for (result = 0; result < srb->cmdlen; result++)
 			printf("cmd[%d] %#x ", result, srb->cmd[result]);
@@ -577,16 +632,7 @@ static int usb_stor_BBB_comdat(struct scsi_cmd *srb, struct us_data *us)
 	/* always OUT to the ep */
 	pipe = usb_sndbulkpipe(us->pusb_dev, us->ep_out);
 
-	cbw->dCBWSignature = cpu_to_le32(CBWSIGNATURE);
-	cbw->dCBWTag = cpu_to_le32(CBWTag++);
-	cbw->dCBWDataTransferLength = cpu_to_le32(srb->datalen);
-	cbw->bCBWFlags = (dir_in ? CBWFLAGS_IN : CBWFLAGS_OUT);
-	cbw->bCBWLUN = srb->lun;
-	cbw->bCDBLength = srb->cmdlen;
-	/* copy the command data into the CBW command data buffer */
-	/* DST SRC LEN!!! */
-
-	memcpy(cbw->CBWCDB, srb->cmd, srb->cmdlen);
+	usb_stor_BBB_setup_cbw(srb, cbw);
 	result = usb_bulk_msg(us->pusb_dev, pipe, cbw, UMASS_BBB_CBW_SIZE,
 			      &actlen, USB_CNTL_TIMEOUT * 5);
 	if (result < 0)
@@ -956,6 +1002,126 @@ do_retry:
 	return USB_STOR_TRANSPORT_FAILED;
 }
 
+#if CONFIG_IS_ENABLED(USB_STORAGE_UAS)
+static int usb_stor_UAS_reset(struct us_data *us)
+{
+	struct usb_device *udev = us->pusb_dev;
+
+	debug("UAS_reset\n");
+	usb_clear_halt(udev, usb_sndbulkpipe(udev, us->ep_cmd));
+	usb_clear_halt(udev, usb_rcvbulkpipe(udev, us->ep_status));
+	usb_clear_halt(udev, usb_rcvbulkpipe(udev, us->ep_in));
+	usb_clear_halt(udev, usb_sndbulkpipe(udev, us->ep_out));
+
+	return 0;
+}
+
+/*
+ * Set up the transfers of a UAS command: the Sense IU and the data, which
+ * travel on the stream named by the tag, then the Command IU itself.
+ * Returns the number of transfers used in req[].
+ */
+static int usb_stor_UAS_setup(struct scsi_cmd *srb, struct us_data *us,
+			      unsigned int tag, struct usb_bulk_req *req)
+{
+	struct us_uas_cmd *uas = &usb_uas_cmd[tag - 1];
+	struct usb_device *udev = us->pusb_dev;
+	int count = 0;
+
+	memset(&uas->cmd, '\0', sizeof(uas->cmd));
+	uas->cmd.bIUID = UAS_IU_ID_COMMAND;
+	uas->cmd.wTag = cpu_to_be16(tag);
+	uas->cmd.bLUN[1] = srb->lun;
+	memcpy(uas->cmd.CDB, srb->cmd, min_t(unsigned char, srb->cmdlen,
+					     sizeof(uas->cmd.CDB)));
+
+	req[count].pipe = usb_rcvbulkpipe(udev, us->ep_status);
+	req[count].buffer = &uas->sense;
+	req[count].length = UAS_SENSE_IU_SIZE;
+	req[count].stream = tag;
+	count++;
+	if (srb->datalen) {
+		if (US_DIRECTION(srb->cmd[0]))
+			req[count].pipe = usb_rcvbulkpipe(udev, us->ep_in);
+		else
+			req[count].pipe = usb_sndbulkpipe(udev, us->ep_out);
+		req[count].buffer = srb->pdata;
+		req[count].length = srb->datalen;
+		req[count].stream = tag;
+		count++;
+	}
+	req[count].pipe = usb_sndbulkpipe(udev, us->ep_cmd);
+	req[count].buffer = &uas->cmd;
+	req[count].length = UAS_CMD_IU_SIZE;
+	count++;
+
+	return count;
+}
+
+/*
+ * Check the outcome of a UAS command set up by usb_stor_UAS_setup(). Sense
+ * data sent with a CHECK CONDITION status is kept for the REQUEST SENSE
+ * which follows. Returns USB_STOR_TRANSPORT_ERROR if the transfers failed
+ * and the device needs a reset.
+ */
+static int usb_stor_UAS_status(struct us_data *us, unsigned int tag,
+			       struct usb_bulk_req *req, int count)
+{
+	struct uas_sense_iu *sense = &usb_uas_cmd[tag - 1].sense;
+	int i, len;
+
+	for (i = 0; i < count; i++) {
+		if (req[i].status) {
+			debug("UAS: tag %u transfer %d failed, status %lX\n",
+			      tag, i, req[i].status);
+			return USB_STOR_TRANSPORT_ERROR;
+		}
+	}
+	if (sense->bIUID != UAS_IU_ID_SENSE ||
+	    be16_to_cpu(sense->wTag) != tag) {
+		debug("UAS: tag %u got IU %#x tag %u\n", tag, sense->bIUID,
+		      be16_to_cpu(sense->wTag));
+		return USB_STOR_TRANSPORT_ERROR;
+	}
+	if (sense->bStatus == 0)
+		return USB_STOR_TRANSPORT_GOOD;
+
+	debug("UAS: tag %u status %#x\n", tag, sense->bStatus);
+	len = min_t(int, be16_to_cpu(sense->wLength), sizeof(us->sense));
+	memset(us->sense, '\0', sizeof(us->sense));
+	memcpy(us->sense, sense->SenseData, len);
+	us->sense_valid = len > 0;
+
+	return USB_STOR_TRANSPORT_FAILED;
+}
+
+static int usb_stor_UAS_transport(struct scsi_cmd *srb, struct us_data *us)
+{
+	struct usb_bulk_req reqs[3];
+	int count, result;
+
+	/* UAS sends the sense data along with the failed command's status */
+	if (srb->cmd[0] == SCSI_REQ_SENSE && us->sense_valid) {
+		memcpy(srb->pdata, us->sense,
+		       min_t(unsigned long, srb->datalen, sizeof(us->sense)));
+		us->sense_valid = false;
+		return USB_STOR_TRANSPORT_GOOD;
+	}
+	us->sense_valid = false;
+
+	memset(reqs, 0, sizeof(reqs));
+	count = usb_stor_UAS_setup(srb, us, 1, reqs);
+	usb_bulk_msgs(us->pusb_dev, reqs, count, USB_CNTL_TIMEOUT * 5);
+	result = usb_stor_UAS_status(us, 1, reqs, count);
+	if (result == USB_STOR_TRANSPORT_ERROR) {
+		usb_stor_UAS_reset(us);
+		return USB_STOR_TRANSPORT_FAILED;
+	}
+
+	return result;
+}
+#endif
+
 static void usb_stor_set_max_xfer_blk(struct usb_device *udev,
 				      struct us_data *us)
 {
@@ -1083,8 +1249,8 @@ static int usb_read_capacity(struct scsi_cmd *srb, struct us_data *ss)
 	return -1;
 }
 
-static int usb_read_10(struct scsi_cmd *srb, struct us_data *ss,
-		       unsigned long start, unsigned short blocks)
+static void usb_setup_read_10(struct scsi_cmd *srb, struct us_data *ss,
+			      unsigned long start, unsigned short blocks)
 {
 	memset(&srb->cmd[0], 0, 12);
 	srb->cmd[0] = SCSI_READ10;
@@ -1096,10 +1262,148 @@ static int usb_read_10(struct scsi_cmd *srb, struct us_data *ss,
 	srb->cmd[7] = ((unsigned char) (blocks >> 8)) & 0xff;
 	srb->cmd[8] = (unsigned char) blocks & 0xff;
 	srb->cmdlen = ss->cmd12 ? 12 : 10;
+}
+
+static int usb_read_10(struct scsi_cmd *srb, struct us_data *ss,
+		       unsigned long start, unsigned short blocks)
+{
+	usb_setup_read_10(srb, ss, start, blocks);
 	debug("read10: start %lx blocks %x\n", start, blocks);
 	return ss->transport(srb, ss);
 }
 
+/*
+ * Send several READ(10) commands to a BBB device back to back. The CBW, data
+ * and CSW of each are all queued with the controller at once, so that the
+ * device does not wait for U-Boot between commands. The number of blocks
+ * read is returned in *donep. Returns 0 if all the commands succeeded, or
+ * -EIO if one failed, in which case the device has been reset and the rest
+ * should be read with usb_read_10(), which handles errors.
+ */
+static int usb_stor_BBB_read_queue(struct scsi_cmd *srb, struct us_data *ss,
+				   unsigned long blksz, lbaint_t start,
+				   lbaint_t blks, uintptr_t buf_addr,
+				   lbaint_t *donep)
+{
+	struct usb_bulk_req reqs[USB_STOR_QUEUE_DEPTH * 3];
+	unsigned short smallblks[USB_STOR_QUEUE_DEPTH];
+	struct usb_device *udev = ss->pusb_dev;
+	struct usb_bulk_req *req;
+	struct umass_bbb_csw *csw;
+	unsigned int pipein, pipeout;
+	lbaint_t done = 0;
+	int count, i;
+
+	memset(reqs, 0, sizeof(reqs));
+	pipein = usb_rcvbulkpipe(udev, ss->ep_in);
+	pipeout = usb_sndbulkpipe(udev, ss->ep_out);
+	for (count = 0; count < USB_STOR_QUEUE_DEPTH && blks; count++) {
+		smallblks[count] = min(blks, (lbaint_t)ss->max_xfer_blk);
+		usb_setup_read_10(srb, ss, start, smallblks[count]);
+		srb->datalen = blksz * smallblks[count];
+		srb->pdata = (unsigned char *)buf_addr;
+		usb_stor_BBB_setup_cbw(srb, &usb_bbb_cmd[count].cbw);
+		debug("read10 queued: start " LBAF " blocks %x\n", start,
+		      smallblks[count]);
+
+		req = &reqs[count * 3];
+		req[0].pipe = pipeout;
+		req[0].buffer = &usb_bbb_cmd[count].cbw;
+		req[0].length = UMASS_BBB_CBW_SIZE;
+		req[1].pipe = pipein;
+		req[1].buffer = srb->pdata;
+		req[1].length = srb->datalen;
+		req[2].pipe = pipein;
+		req[2].buffer = &usb_bbb_cmd[count].csw;
+		req[2].length = UMASS_BBB_CSW_SIZE;
+
+		start += smallblks[count];
+		blks -= smallblks[count];
+		buf_addr += srb->datalen;
+	}
+
+	/* Check each command in turn, stopping at the first which failed */
+	usb_bulk_msgs(udev, reqs, count * 3, USB_CNTL_TIMEOUT * 5);
+	for (i = 0; i < count; i++) {
+		req = &reqs[i * 3];
+		csw = &usb_bbb_cmd[i].csw;
+		if (req[0].status || req[1].status || req[2].status ||
+		    req[1].act_len != req[1].length ||
+		    req[2].act_len != UMASS_BBB_CSW_SIZE)
+			break;
+		if (CSWSIGNATURE != le32_to_cpu(csw->dCSWSignature) ||
+		    csw->dCSWTag != usb_bbb_cmd[i].cbw.dCBWTag ||
+		    csw->dCSWDataResidue ||
+		    csw->bCSWStatus != CSWSTATUS_GOOD)
+			break;
+		done += smallblks[i];
+	}
+	if (i < count) {
+		debug("read10 queue failed after %d of %d commands\n", i,
+		      count);
+		ss->flags &= ~USB_READY;
+		usb_stor_BBB_reset(ss);
+	}
+	*donep = done;
+
+	return i < count ? -EIO : 0;
+}
+
+#if CONFIG_IS_ENABLED(USB_STORAGE_UAS)
+/*
+ * Send several READ(10) commands to a UAS device at once, each with its own
+ * tag, so that the device may work on them together. Returns as for
+ * usb_stor_BBB_read_queue().
+ */
+static int usb_stor_UAS_read_queue(struct scsi_cmd *srb, struct us_data *ss,
+				   unsigned long blksz, lbaint_t start,
+				   lbaint_t blks, uintptr_t buf_addr,
+				   lbaint_t *donep)
+{
+	struct usb_bulk_req reqs[USB_STOR_QUEUE_DEPTH * 3];
+	unsigned short smallblks[USB_STOR_QUEUE_DEPTH];
+	struct usb_bulk_req *req;
+	lbaint_t done = 0;
+	int count, i;
+
+	memset(reqs, 0, sizeof(reqs));
+	ss->sense_valid = false;
+	for (count = 0; count < ss->num_tags && blks; count++) {
+		smallblks[count] = min(blks, (lbaint_t)ss->max_xfer_blk);
+		usb_setup_read_10(srb, ss, start, smallblks[count]);
+		srb->datalen = blksz * smallblks[count];
+		srb->pdata = (unsigned char *)buf_addr;
+		debug("read10 queued: tag %d start " LBAF " blocks %x\n",
+		      count + 1, start, smallblks[count]);
+		usb_stor_UAS_setup(srb, ss, count + 1, &reqs[count * 3]);
+
+		start += smallblks[count];
+		blks -= smallblks[count];
+		buf_addr += srb->datalen;
+	}
+
+	/* Commands may complete in any order; count those done from the start */
+	usb_bulk_msgs(ss->pusb_dev, reqs, count * 3, USB_CNTL_TIMEOUT * 5);
+	for (i = 0; i < count; i++) {
+		req = &reqs[i * 3];
+		if (usb_stor_UAS_status(ss, i + 1, req, 3) !=
+		    USB_STOR_TRANSPORT_GOOD ||
+		    req[1].act_len != req[1].length)
+			break;
+		done += smallblks[i];
+	}
+	if (i < count) {
+		debug("read10 queue failed after %d of %d commands\n", i,
+		      count);
+		ss->flags &= ~USB_READY;
+		usb_stor_UAS_reset(ss);
+	}
+	*donep = done;
+
+	return i < count ? -EIO : 0;
+}
+#endif
+
 static int usb_write_10(struct scsi_cmd *srb, struct us_data *ss,
 			unsigned long start, unsigned short blocks)
 {
@@ -1149,12 +1453,13 @@ static unsigned long usb_stor_read(struct blk_desc *block_dev, lbaint_t blknr,
 				   lbaint_t blkcnt, void *buffer)
 #endif
 {
-	lbaint_t start, blks;
+	lbaint_t start, blks, done;
 	uintptr_t buf_addr;
 	unsigned short smallblks;
 	struct usb_device *udev;
 	struct us_data *ss;
 	int retry;
+	bool queue;
 	struct scsi_cmd *srb = &usb_ccb;
 #if CONFIG_IS_ENABLED(BLK)
 	struct blk_desc *block_dev;
@@ -1183,11 +1488,29 @@ static unsigned long usb_stor_read(struct blk_desc *block_dev, lbaint_t blknr,
 	buf_addr = (uintptr_t)buffer;
 	start = blknr;
 	blks = blkcnt;
+	queue = ss->read_queue && (ss->flags & USB_READY);
 
 	debug("\nusb_read: dev %d startblk " LBAF ", blccnt " LBAF " buffer %lx\n",
 	      block_dev->devnum, start, blks, buf_addr);
 
 	do {
+		/*
+		 * Keep the device busy with several commands at once while
+		 * there is more than one command's worth left to read
+		 */
+		if (queue && blks > ss->max_xfer_blk) {
+			smallblks = ss->max_xfer_blk;
+			usb_show_progress();
+			/* Read the rest one command at a time after an error */
+			if (ss->read_queue(srb, ss, block_dev->blksz, start,
+					   blks, buf_addr, &done))
+				queue = false;
+			start += done;
+			blks -= done;
+			buf_addr += done * block_dev->blksz;
+			if (queue || !blks)
+				continue;
+		}
 		/* XXX need some comment here */
 		retry = 2;
 		srb->pdata = (unsigned char *)buf_addr;
@@ -1313,6 +1636,104 @@ retry_it:
 }
 
 /* Probe to see if a new device is actually a Storage device */
+#if CONFIG_IS_ENABLED(USB_STORAGE_UAS)
+/*
+ * Look for a UAS alternate setting of the interface and switch to it, with
+ * streams on its status and data pipes. The pipes are only named by the
+ * pipe usage descriptors, which U-Boot does not keep, so this walks the raw
+ * configuration descriptor. Returns true if UAS can be used, else leaves
+ * the interface in the Bulk-Only setting.
+ */
+static bool usb_stor_UAS_probe(struct usb_device *dev, struct us_data *ss,
+			       struct usb_interface *iface)
+{
+	unsigned char eps[UAS_DATA_OUT_PIPE_ID + 1] = { 0 };
+	struct usb_endpoint_descriptor *ep_desc = NULL;
+	struct usb_interface_descriptor *if_desc;
+	struct usb_descriptor_header *head;
+	unsigned long pipes[3];
+	unsigned char *buffer;
+	bool in_uas = false;
+	int len, index, ret;
+	int alt = -1;
+
+	/* Without streams, UAS is no faster than Bulk-Only */
+	if (dev->speed < USB_SPEED_SUPER)
+		return false;
+
+	len = usb_get_configuration_len(dev, dev->configno);
+	if (len < 0)
+		return false;
+	buffer = malloc_cache_aligned(len);
+	if (!buffer)
+		return false;
+	len = usb_get_configuration_no(dev, dev->configno, buffer, len);
+
+	for (index = 0; len > 0 && index + 2 <= len;
+	     index += head->bLength) {
+		head = (struct usb_descriptor_header *)&buffer[index];
+		if (!head->bLength || index + head->bLength > len)
+			break;
+
+		switch (head->bDescriptorType) {
+		case USB_DT_INTERFACE:
+			if_desc = (struct usb_interface_descriptor *)head;
+			in_uas = alt < 0 &&
+				 if_desc->bInterfaceNumber ==
+				 iface->desc.bInterfaceNumber &&
+				 if_desc->bInterfaceClass ==
+				 USB_CLASS_MASS_STORAGE &&
+				 if_desc->bInterfaceProtocol == US_PR_UAS;
+			if (in_uas)
+				alt = if_desc->bAlternateSetting;
+			ep_desc = NULL;
+			break;
+		case USB_DT_ENDPOINT:
+			ep_desc = (struct usb_endpoint_descriptor *)head;
+			break;
+		case USB_DT_PIPE_USAGE:
+			if (in_uas && ep_desc && head->bLength >= 3 &&
+			    buffer[index + 2] >= UAS_CMD_PIPE_ID &&
+			    buffer[index + 2] <= UAS_DATA_OUT_PIPE_ID)
+				eps[buffer[index + 2]] =
+					ep_desc->bEndpointAddress &
+					USB_ENDPOINT_NUMBER_MASK;
+			break;
+		}
+	}
+	free(buffer);
+
+	if (alt < 0 || !eps[UAS_CMD_PIPE_ID] || !eps[UAS_STATUS_PIPE_ID] ||
+	    !eps[UAS_DATA_IN_PIPE_ID] || !eps[UAS_DATA_OUT_PIPE_ID])
+		return false;
+	debug("UAS alt %d: Endpoints Cmd %d Status %d In %d Out %d\n", alt,
+	      eps[UAS_CMD_PIPE_ID], eps[UAS_STATUS_PIPE_ID],
+	      eps[UAS_DATA_IN_PIPE_ID], eps[UAS_DATA_OUT_PIPE_ID]);
+
+	if (usb_set_interface(dev, iface->desc.bInterfaceNumber, alt))
+		return false;
+
+	pipes[0] = usb_rcvbulkpipe(dev, eps[UAS_STATUS_PIPE_ID]);
+	pipes[1] = usb_rcvbulkpipe(dev, eps[UAS_DATA_IN_PIPE_ID]);
+	pipes[2] = usb_sndbulkpipe(dev, eps[UAS_DATA_OUT_PIPE_ID]);
+	ret = usb_alloc_streams(dev, pipes, ARRAY_SIZE(pipes),
+				USB_STOR_QUEUE_DEPTH);
+	if (ret < 1) {
+		debug("UAS: cannot allocate streams (err=%d)\n", ret);
+		usb_set_interface(dev, iface->desc.bInterfaceNumber, 0);
+		return false;
+	}
+
+	ss->ep_cmd = eps[UAS_CMD_PIPE_ID];
+	ss->ep_status = eps[UAS_STATUS_PIPE_ID];
+	ss->ep_in = eps[UAS_DATA_IN_PIPE_ID];
+	ss->ep_out = eps[UAS_DATA_OUT_PIPE_ID];
+	ss->num_tags = min(ret, USB_STOR_QUEUE_DEPTH);
+
+	return true;
+}
+#endif
+
 int usb_storage_probe(struct usb_device *dev, unsigned int ifnum,
 		      struct us_data *ss)
 {
@@ -1364,6 +1785,8 @@ int usb_storage_probe(struct usb_device *dev, unsigned int ifnum,
 		debug("Bulk/Bulk/Bulk\n");
 		ss->transport = usb_stor_BBB_transport;
 		ss->transport_reset = usb_stor_BBB_reset;
+		if (CONFIG_IS_ENABLED(USB_STORAGE_BOT_QUEUE))
+			ss->read_queue = usb_stor_BBB_read_queue;
 		break;
 	default:
 		printf("USB Storage Transport unknown / not yet implemented\n");
@@ -1423,6 +1846,17 @@ int usb_storage_probe(struct usb_device *dev, unsigned int ifnum,
 	if (ss->subclass == US_SC_UFI)
 		ss->cmd12 = true;
 
+#if CONFIG_IS_ENABLED(USB_STORAGE_UAS)
+	if (ss->protocol == US_PR_BULK && ss->subclass == US_SC_SCSI &&
+	    usb_stor_UAS_probe(dev, ss, iface)) {
+		debug("Transport: USB Attached SCSI\n");
+		ss->protocol = US_PR_UAS;
+		ss->transport = usb_stor_UAS_transport;
+		ss->transport_reset = usb_stor_UAS_reset;
+		ss->read_queue = usb_stor_UAS_read_queue;
+	}
+#endif
+
 	if (ss->ep_int) {
 		/* we had found an interrupt endpoint, prepare irq pipe
 		 * set up the IRQ pipe and handler
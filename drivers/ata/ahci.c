@@ -52,6 +52,8 @@ static int ata_io_flush(struct ahci_uc_priv *uc_priv, u8 port);
 #define WAIT_MS_LINKUP	200
 
 #define AHCI_CAP_S64A BIT(31)
+#define AHCI_CAP_SNCQ BIT(30)
+#define AHCI_CAP_SCLO BIT(24)
 
 __weak void __iomem *ahci_port_base(void __iomem *base, u32 port)
 {
@@ -385,17 +387,15 @@ static int ahci_init_one(struct ahci_uc_priv *uc_priv, struct udevice *dev)
 
 #define MAX_DATA_BYTE_COUNT  (4*1024*1024)
 
-static int ahci_fill_sg(struct ahci_uc_priv *uc_priv, u8 port,
-			unsigned char *buf, int buf_len)
+static int ahci_fill_sg(struct ahci_uc_priv *uc_priv, struct ahci_sg *ahci_sg,
+			u32 max_sg, unsigned char *buf, int buf_len)
 {
-	struct ahci_ioports *pp = &(uc_priv->port[port]);
-	struct ahci_sg *ahci_sg = pp->cmd_tbl_sg;
 	phys_addr_t pa = virt_to_phys(buf);
 	u32 sg_count;
 	int i;
 
 	sg_count = ((buf_len - 1) / MAX_DATA_BYTE_COUNT) + 1;
-	if (sg_count > AHCI_MAX_SG) {
+	if (sg_count > max_sg) {
 		printf("Error:Too much sg!\n");
 		return -1;
 	}
@@ -419,18 +419,24 @@ static int ahci_fill_sg(struct ahci_uc_priv *uc_priv, u8 port,
 	return sg_count;
 }
 
-static void ahci_fill_cmd_slot(struct ahci_ioports *pp, u32 opts)
+static void ahci_fill_cmd_hdr(struct ahci_cmd_hdr *cmd_hdr, ulong cmd_tbl,
+			      u32 opts)
 {
-	phys_addr_t pa = virt_to_phys((void *)pp->cmd_tbl);
+	phys_addr_t pa = virt_to_phys((void *)cmd_tbl);
 
-	pp->cmd_slot->opts = cpu_to_le32(opts);
-	pp->cmd_slot->status = 0;
-	pp->cmd_slot->tbl_addr = cpu_to_le32(lower_32_bits(pa));
+	cmd_hdr->opts = cpu_to_le32(opts);
+	cmd_hdr->status = 0;
+	cmd_hdr->tbl_addr = cpu_to_le32(lower_32_bits(pa));
 #ifdef CONFIG_PHYS_64BIT
-	pp->cmd_slot->tbl_addr_hi = cpu_to_le32(upper_32_bits(pa));
+	cmd_hdr->tbl_addr_hi = cpu_to_le32(upper_32_bits(pa));
 #endif
 }
 
+static void ahci_fill_cmd_slot(struct ahci_ioports *pp, u32 opts)
+{
+	ahci_fill_cmd_hdr(pp->cmd_slot, pp->cmd_tbl, opts);
+}
+
 static int wait_spinup(void __iomem *port_mmio)
 {
 	ulong start;
@@ -477,7 +483,7 @@ static int ahci_port_start(struct ahci_uc_priv *uc_priv, u8 port)
 	pp->cmd_slot =
 		(struct ahci_cmd_hdr *)(uintptr_t)virt_to_phys((void *)mem);
 	debug("cmd_slot = %p\n", pp->cmd_slot);
-	mem += (AHCI_CMD_SLOT_SZ + 224);
+	mem += AHCI_CMD_SLOT_SZ * AHCI_MAX_CMD_SLOT;
 
 	/*
 	 * Second item: Received-FIS area
@@ -496,6 +502,21 @@ static int ahci_port_start(struct ahci_uc_priv *uc_priv, u8 port)
 	pp->cmd_tbl_sg =
 			(struct ahci_sg *)(uintptr_t)virt_to_phys((void *)mem);
 
+	/*
+	 * Queued commands each need a table of their own, in a separate
+	 * chunk. Without it the port simply does not use NCQ.
+	 */
+	pp->ncq_depth = 0;
+	pp->ncq_tbl = 0;
+	if (IS_ENABLED(CONFIG_AHCI_NCQ) && (uc_priv->cap & AHCI_CAP_SNCQ)) {
+		mem = memalign(128, AHCI_NCQ_TBL_SZ * AHCI_MAX_CMD_SLOT);
+		if (mem) {
+			memset(mem, 0, AHCI_NCQ_TBL_SZ * AHCI_MAX_CMD_SLOT);
+			pp->ncq_tbl = virt_to_phys((void *)mem);
+		}
+		debug("ncq_tbl = %lx\n", pp->ncq_tbl);
+	}
+
 	dma_addr = (ulong)pp->cmd_slot;
 	writel_with_flush(dma_addr, port_mmio + PORT_LST_ADDR);
 	writel_with_flush(dma_addr >> 32, port_mmio + PORT_LST_ADDR_HI);
@@ -546,7 +567,8 @@ static int ahci_device_data_io(struct ahci_uc_priv *uc_priv, u8 port, u8 *fis,
 
 	memcpy((unsigned char *)pp->cmd_tbl, fis, fis_len);
 
-	sg_count = ahci_fill_sg(uc_priv, port, buf, buf_len);
+	sg_count = ahci_fill_sg(uc_priv, pp->cmd_tbl_sg, AHCI_MAX_SG, buf,
+				buf_len);
 	opts = (fis_len >> 2) | (sg_count << 16) | (is_write << 6);
 	ahci_fill_cmd_slot(pp, opts);
 
@@ -577,6 +599,24 @@ static char *ata_id_strcpy(u16 *target, u16 *src, int len)
 	return (char *)target;
 }
 
+/*
+ * Number of commands to queue on a port: NCQ is used when the controller, the
+ * device and the port's command tables all allow it.
+ */
+static u32 ahci_ncq_depth(struct ahci_uc_priv *uc_priv, u8 port)
+{
+	u16 *id = uc_priv->ataid[port];
+	u32 depth;
+
+	if (!uc_priv->port[port].ncq_tbl || !ata_id_has_ncq(id))
+		return 0;
+
+	depth = min_t(u32, ((uc_priv->cap >> 8) & 0x1f) + 1,
+		      ata_id_queue_depth(id));
+
+	return min_t(u32, depth, AHCI_MAX_CMD_SLOT);
+}
+
 /*
  * SCSI INQUIRY command operation.
  */
@@ -637,6 +677,10 @@ static int ata_scsiop_inquiry(struct ahci_uc_priv *uc_priv,
 	memcpy(idbuf, tmpid, ATA_ID_WORDS * 2);
 	ata_swap_buf_le16(idbuf, ATA_ID_WORDS);
 
+	uc_priv->port[port].ncq_depth = ahci_ncq_depth(uc_priv, port);
+	debug("scsi_ahci: port %d NCQ depth %u\n", port,
+	      uc_priv->port[port].ncq_depth);
+
 	memcpy(&pccb->pdata[8], "ATA     ", 8);
 	ata_id_strcpy((u16 *)&pccb->pdata[16], &idbuf[ATA_ID_PROD], 16);
 	ata_id_strcpy((u16 *)&pccb->pdata[32], &idbuf[ATA_ID_FW_REV], 4);
@@ -649,18 +693,14 @@ static int ata_scsiop_inquiry(struct ahci_uc_priv *uc_priv,
 
 
 /*
- * SCSI READ10/WRITE10 command operation.
+ * Retrieve the base LBA number and the block count of a READ10/READ16/WRITE10
+ * command from the ccb structure.
  */
-static int ata_scsiop_read_write(struct ahci_uc_priv *uc_priv,
-				 struct scsi_cmd *pccb, u8 is_write)
+static void ata_scsi_rw_range(struct scsi_cmd *pccb, lbaint_t *lbap,
+			      u16 *blocksp)
 {
 	lbaint_t lba = 0;
-	u16 blocks = 0;
-	u8 fis[20];
-	u8 *user_buffer = pccb->pdata;
-	u32 user_buffer_size = pccb->datalen;
 
-	/* Retrieve the base LBA number from the ccb structure. */
 	if (pccb->cmd[0] == SCSI_READ16) {
 		memcpy(&lba, pccb->cmd + 2, 8);
 		lba = be64_to_cpu(lba);
@@ -669,6 +709,25 @@ static int ata_scsiop_read_write(struct ahci_uc_priv *uc_priv,
 		memcpy(&temp, pccb->cmd + 2, 4);
 		lba = be32_to_cpu(temp);
 	}
+	*lbap = lba;
+
+	if (pccb->cmd[0] == SCSI_READ16)
+		*blocksp = (((u16)pccb->cmd[13]) << 8) | ((u16)pccb->cmd[14]);
+	else
+		*blocksp = (((u16)pccb->cmd[7]) << 8) | ((u16)pccb->cmd[8]);
+}
+
+/*
+ * SCSI READ10/WRITE10 command operation.
+ */
+static int ata_scsiop_read_write(struct ahci_uc_priv *uc_priv,
+				 struct scsi_cmd *pccb, u8 is_write)
+{
+	lbaint_t lba = 0;
+	u16 blocks = 0;
+	u8 fis[20];
+	u8 *user_buffer = pccb->pdata;
+	u32 user_buffer_size = pccb->datalen;
 
 	/*
 	 * Retrieve the base LBA number and the block count from
@@ -681,10 +740,7 @@ static int ata_scsiop_read_write(struct ahci_uc_priv *uc_priv,
 	 *
 	 * WARNING: one or two older ATA drives treat 0 as 0...
 	 */
-	if (pccb->cmd[0] == SCSI_READ16)
-		blocks = (((u16)pccb->cmd[13]) << 8) | ((u16) pccb->cmd[14]);
-	else
-		blocks = (((u16)pccb->cmd[7]) << 8) | ((u16) pccb->cmd[8]);
+	ata_scsi_rw_range(pccb, &lba, &blocks);
 
 	debug("scsi_ahci: %s %u blocks starting from lba 0x" LBAFU "\n",
 	      is_write ?  "write" : "read", blocks, lba);
@@ -760,6 +816,220 @@ static int ata_scsiop_read_write(struct ahci_uc_priv *uc_priv,
 }
 
 
+/*
+ * Set up a READ/WRITE FPDMA QUEUED command in a command slot, using the slot
+ * number as the NCQ tag.
+ */
+static int ahci_ncq_fill(struct ahci_uc_priv *uc_priv, u8 port, int tag,
+			 lbaint_t lba, u16 blocks, u8 *buf, u8 is_write)
+{
+	struct ahci_ioports *pp = &(uc_priv->port[port]);
+	ulong cmd_tbl = pp->ncq_tbl + tag * AHCI_NCQ_TBL_SZ;
+	u8 *fis = (u8 *)cmd_tbl;
+	int sg_count;
+
+	memset(fis, 0, 20);
+	fis[0] = 0x27;		 /* Host to device FIS. */
+	fis[1] = 1 << 7;	 /* Command FIS. */
+	fis[2] = is_write ? ATA_CMD_FPDMA_WRITE : ATA_CMD_FPDMA_READ;
+
+	/* The sector count goes in the features registers */
+	fis[3] = (blocks >> 0) & 0xff;
+	fis[11] = (blocks >> 8) & 0xff;
+
+	fis[4] = (lba >> 0) & 0xff;
+	fis[5] = (lba >> 8) & 0xff;
+	fis[6] = (lba >> 16) & 0xff;
+	fis[7] = 1 << 6; /* device reg: set LBA mode */
+	fis[8] = ((lba >> 24) & 0xff);
+#ifdef CONFIG_SYS_64BIT_LBA
+	fis[9] = ((lba >> 32) & 0xff);
+	fis[10] = ((lba >> 40) & 0xff);
+#endif
+
+	/* ... and the tag in the sector count register */
+	fis[12] = tag << 3;
+
+	sg_count = ahci_fill_sg(uc_priv,
+				(struct ahci_sg *)(cmd_tbl + AHCI_CMD_TBL_HDR),
+				AHCI_NCQ_MAX_SG, buf, blocks * ATA_SECT_SIZE);
+	if (sg_count < 0)
+		return -EIO;
+	ahci_fill_cmd_hdr(&pp->cmd_slot[tag], cmd_tbl,
+			  5 | (sg_count << 16) | (is_write << 6));
+
+	ahci_dcache_flush_range(cmd_tbl, AHCI_NCQ_TBL_SZ);
+	ahci_dcache_flush_range((unsigned long)buf,
+				(unsigned long)blocks * ATA_SECT_SIZE);
+
+	return 0;
+}
+
+/*
+ * Bring a port back after a failed queued command. Stopping the port clears
+ * the outstanding commands; the device then takes no further commands until
+ * its NCQ error log has been read.
+ */
+static void ahci_ncq_recover(struct ahci_uc_priv *uc_priv, u8 port)
+{
+	struct ahci_ioports *pp = &(uc_priv->port[port]);
+	void __iomem *port_mmio = pp->port_mmio;
+	ALLOC_CACHE_ALIGN_BUFFER(u8, log, ATA_SECT_SIZE);
+	u8 fis[20];
+	u32 cmd;
+
+	cmd = readl(port_mmio + PORT_CMD) & ~PORT_CMD_START;
+	writel_with_flush(cmd, port_mmio + PORT_CMD);
+	if (waiting_for_cmd_completed(port_mmio + PORT_CMD, 500,
+				      PORT_CMD_LIST_ON))
+		debug("scsi_ahci: port %d did not stop.\n", port);
+
+	writel(readl(port_mmio + PORT_SCR_ERR), port_mmio + PORT_SCR_ERR);
+	writel(readl(port_mmio + PORT_IRQ_STAT), port_mmio + PORT_IRQ_STAT);
+
+	if ((readl(port_mmio + PORT_TFDATA) & (ATA_BUSY | ATA_DRQ)) &&
+	    (uc_priv->cap & AHCI_CAP_SCLO)) {
+		writel_with_flush(cmd | PORT_CMD_CLO, port_mmio + PORT_CMD);
+		waiting_for_cmd_completed(port_mmio + PORT_CMD, 500,
+					  PORT_CMD_CLO);
+	}
+	writel_with_flush(cmd | PORT_CMD_START, port_mmio + PORT_CMD);
+
+	memset(fis, 0, sizeof(fis));
+	fis[0] = 0x27;		 /* Host to device FIS. */
+	fis[1] = 1 << 7;	 /* Command FIS. */
+	fis[2] = ATA_CMD_READ_LOG_EXT;
+	fis[4] = ATA_LOG_SATA_NCQ;
+	fis[7] = 1 << 6;
+	fis[12] = 1;
+	if (ahci_device_data_io(uc_priv, port, fis, sizeof(fis), log,
+				ATA_SECT_SIZE, 0))
+		debug("scsi_ahci: cannot read NCQ log of port %d.\n", port);
+}
+
+/*
+ * SCSI READ10/READ16/WRITE10 commands, using native command queuing.
+ *
+ * The commands are split into pieces of MAX_SATA_BLOCKS_READ_WRITE blocks as
+ * in ata_scsiop_read_write(), but the pieces are put in all the command slots
+ * the port has and issued together. Each slot is given the next piece as
+ * soon as it completes, so the device always has a queue to work on.
+ */
+static int ata_ncq_read_write(struct ahci_uc_priv *uc_priv,
+			      struct scsi_cmd *cmds, int count)
+{
+	u8 port = cmds[0].target;
+	struct ahci_ioports *pp = &(uc_priv->port[port]);
+	void __iomem *port_mmio = pp->port_mmio;
+	u8 *slot_buf[AHCI_MAX_CMD_SLOT];
+	u32 slot_len[AHCI_MAX_CMD_SLOT];
+	u32 active = 0, issue, done;
+	u8 *user_buffer = NULL;
+	u8 is_write = 0, wrote = 0;
+	lbaint_t lba = 0;
+	u16 blocks = 0, now_blocks;
+	ulong start;
+	int i, tag, ret = 0;
+
+	for (i = 0; i < count; i++) {
+		ata_scsi_rw_range(&cmds[i], &lba, &blocks);
+		if (ATA_SECT_SIZE * blocks > cmds[i].datalen) {
+			printf("scsi_ahci: Error: buffer too small.\n");
+			return -EIO;
+		}
+	}
+
+	writel(readl(port_mmio + PORT_IRQ_STAT), port_mmio + PORT_IRQ_STAT);
+	blocks = 0;
+	i = 0;
+	do {
+		/* Give the next pieces to the free slots */
+		issue = 0;
+		for (tag = 0; tag < pp->ncq_depth; tag++) {
+			if (active & BIT(tag))
+				continue;
+			while (!blocks && i < count) {
+				ata_scsi_rw_range(&cmds[i], &lba, &blocks);
+				user_buffer = cmds[i].pdata;
+				is_write = cmds[i].cmd[0] == SCSI_WRITE10;
+				i++;
+			}
+			if (!blocks)
+				break;
+
+			now_blocks = min((u16)MAX_SATA_BLOCKS_READ_WRITE,
+					 blocks);
+			ret = ahci_ncq_fill(uc_priv, port, tag, lba, now_blocks,
+					    user_buffer, is_write);
+			if (ret) {
+				/* Finish what was issued, then give up */
+				blocks = 0;
+				i = count;
+				break;
+			}
+			slot_buf[tag] = user_buffer;
+			slot_len[tag] = ATA_SECT_SIZE * now_blocks;
+			issue |= BIT(tag);
+			wrote |= is_write;
+
+			user_buffer += slot_len[tag];
+			blocks -= now_blocks;
+			lba += now_blocks;
+		}
+		if (issue) {
+			ahci_dcache_flush_range((unsigned long)pp->cmd_slot,
+						AHCI_CMD_SLOT_SZ *
+						AHCI_MAX_CMD_SLOT);
+			writel(issue, port_mmio + PORT_SCR_ACT);
+			writel_with_flush(issue, port_mmio + PORT_CMD_ISSUE);
+			active |= issue;
+		}
+		if (!active)
+			break;
+
+		/* Wait for at least one to complete */
+		start = get_timer(0);
+		for (;;) {
+			done = active & ~(readl(port_mmio + PORT_SCR_ACT) |
+					  readl(port_mmio + PORT_CMD_ISSUE));
+			if (done)
+				break;
+			if (readl(port_mmio + PORT_IRQ_STAT) &
+			    (PORT_IRQ_FATAL)) {
+				debug("scsi_ahci: NCQ error on port %d.\n",
+				      port);
+				ret = -EIO;
+				goto err;
+			}
+			if (get_timer(start) > WAIT_MS_DATAIO) {
+				printf("scsi_ahci: NCQ timeout on port %d, disabling NCQ\n",
+				       port);
+				pp->ncq_depth = 0;
+				ret = -EIO;
+				goto err;
+			}
+		}
+
+		for (tag = 0; tag < AHCI_MAX_CMD_SLOT; tag++) {
+			if (done & BIT(tag))
+				ahci_dcache_invalidate_range(
+					(unsigned long)slot_buf[tag],
+					(unsigned long)slot_len[tag]);
+		}
+		active &= ~done;
+	} while (active || blocks || i < count);
+
+	/* As in ata_scsiop_read_write(), but once for all the writes */
+	if (wrote && ata_io_flush(uc_priv, port))
+		return -EIO;
+
+	return ret;
+
+err:
+	ahci_ncq_recover(uc_priv, port);
+	return ret;
+}
+
 /*
  * SCSI READ CAPACITY10 command operation.
  */
@@ -836,10 +1106,16 @@ static int ahci_scsi_exec(struct udevice *dev, struct scsi_cmd *pccb)
 	switch (pccb->cmd[0]) {
 	case SCSI_READ16:
 	case SCSI_READ10:
-		ret = ata_scsiop_read_write(uc_priv, pccb, 0);
+		if (uc_priv->port[pccb->target].ncq_depth)
+			ret = ata_ncq_read_write(uc_priv, pccb, 1);
+		else
+			ret = ata_scsiop_read_write(uc_priv, pccb, 0);
 		break;
 	case SCSI_WRITE10:
-		ret = ata_scsiop_read_write(uc_priv, pccb, 1);
+		if (uc_priv->port[pccb->target].ncq_depth)
+			ret = ata_ncq_read_write(uc_priv, pccb, 1);
+		else
+			ret = ata_scsiop_read_write(uc_priv, pccb, 1);
 		break;
 	case SCSI_RD_CAPAC10:
 		ret = ata_scsiop_read_capacity10(uc_priv, pccb);
@@ -866,6 +1142,32 @@ static int ahci_scsi_exec(struct udevice *dev, struct scsi_cmd *pccb)
 
 }
 
+static int ahci_scsi_exec_queue(struct udevice *dev, struct scsi_cmd *cmds,
+				int count)
+{
+	struct ahci_uc_priv *uc_priv = dev_get_uclass_priv(dev->parent);
+	int i, ret;
+
+	for (i = 0; i < count; i++) {
+		if (cmds[i].target != cmds[0].target)
+			break;
+		if (cmds[i].cmd[0] != SCSI_READ10 &&
+		    cmds[i].cmd[0] != SCSI_READ16 &&
+		    cmds[i].cmd[0] != SCSI_WRITE10)
+			break;
+	}
+	if (i == count && uc_priv->port[cmds[0].target].ncq_depth)
+		return ata_ncq_read_write(uc_priv, cmds, count);
+
+	for (i = 0; i < count; i++) {
+		ret = ahci_scsi_exec(dev, &cmds[i]);
+		if (ret)
+			return ret;
+	}
+
+	return 0;
+}
+
 static int ahci_start_ports(struct ahci_uc_priv *uc_priv)
 {
 	u32 linkmap;
@@ -1025,6 +1327,7 @@ int ahci_probe_scsi_pci(struct udevice *ahci_dev)
 
 struct scsi_ops scsi_ops = {
 	.exec		= ahci_scsi_exec,
+	.exec_queue	= ahci_scsi_exec_queue,
 	.bus_reset	= ahci_scsi_bus_reset,
 };
 
@@ -8,9 +8,12 @@
 
 #include <common.h>
 #include <blk.h>
+#include <cyclic.h>
 #include <dm.h>
+#include <fs.h>
 #include <log.h>
 #include <malloc.h>
+#include <memalign.h>
 #include <part.h>
 #include <dm/device-internal.h>
 #include <dm/lists.h>
@@ -428,19 +431,13 @@ static int blk_buffer_aligned(struct bounce_buffer *state)
 	return 1;	/* Default, any buffer is OK */
 }
 
-long blk_read(struct udevice *dev, lbaint_t start, lbaint_t blkcnt, void *buf)
+static ulong blk_read_dev(struct udevice *dev, lbaint_t start, lbaint_t blkcnt,
+			  void *buf)
 {
 	struct blk_desc *desc = dev_get_uclass_plat(dev);
 	const struct blk_ops *ops = blk_get_ops(dev);
 	ulong blks_read;
 
-	if (!ops->read)
-		return -ENOSYS;
-
-	if (blkcache_read(desc->uclass_id, desc->devnum,
-			  start, blkcnt, desc->blksz, buf))
-		return blkcnt;
-
 	if (IS_ENABLED(CONFIG_BOUNCE_BUFFER) && desc->bb) {
 		struct blk_bounce_buffer bbstate = { .dev = dev };
 		int ret;
@@ -459,13 +456,66 @@ long blk_read(struct udevice *dev, lbaint_t start, lbaint_t blkcnt, void *buf)
 		blks_read = ops->read(dev, start, blkcnt, buf);
 	}
 
-	if (blks_read == blkcnt)
-		blkcache_fill(desc->uclass_id, desc->devnum, start, blkcnt,
-			      desc->blksz, buf);
-
 	return blks_read;
 }
 
+/*
+ * Read ahead into the block cache when @dev is being read sequentially, so
+ * that the next small reads are served from the cache. Errors are ignored,
+ * the blocks are just not cached.
+ */
+static void blk_readahead(struct udevice *dev, lbaint_t start, lbaint_t blkcnt)
+{
+	struct blk_desc *desc = dev_get_uclass_plat(dev);
+	lbaint_t count;
+	void *buf;
+
+	count = blkcache_readahead(desc->uclass_id, desc->devnum, start,
+				   blkcnt, &start);
+	if (!count || start >= desc->lba)
+		return;
+	count = min(count, desc->lba - start);
+
+	buf = malloc_cache_aligned(count * desc->blksz);
+	if (!buf)
+		return;
+	if (blk_read_dev(dev, start, count, buf) == count)
+		blkcache_fill_readahead(desc->uclass_id, desc->devnum, start,
+					count, desc->blksz, buf);
+	free(buf);
+}
+
+long blk_read(struct udevice *dev, lbaint_t start, lbaint_t blkcnt, void *buf)
+{
+	struct blk_desc *desc = dev_get_uclass_plat(dev);
+	const struct blk_ops *ops = blk_get_ops(dev);
+	lbaint_t head, tail, count;
+	ulong blks_read;
+
+	if (!ops->read)
+		return -ENOSYS;
+
+	head = blkcache_read(desc->uclass_id, desc->devnum,
+			     start, blkcnt, desc->blksz, buf, &tail);
+	if (head == blkcnt) {
+		blk_readahead(dev, start, blkcnt);
+		return blkcnt;
+	}
+
+	/* Only read what the cache could not supply */
+	count = blkcnt - head - tail;
+	blks_read = blk_read_dev(dev, start + head, count,
+				 buf + head * desc->blksz);
+	if (blks_read != count)
+		return IS_ERR_VALUE(blks_read) ? blks_read : head + blks_read;
+
+	blkcache_fill(desc->uclass_id, desc->devnum, start + head, count,
+		      desc->blksz, buf + head * desc->blksz);
+	blk_readahead(dev, start, blkcnt);
+
+	return blkcnt;
+}
+
 long blk_write(struct udevice *dev, lbaint_t start, lbaint_t blkcnt,
 	       const void *buf)
 {
@@ -477,6 +527,7 @@ long blk_write(struct udevice *dev, lbaint_t start, lbaint_t blkcnt,
 		return -ENOSYS;
 
 	blkcache_invalidate(desc->uclass_id, desc->devnum);
+	fs_invalidate(desc);
 
 	if (IS_ENABLED(CONFIG_BOUNCE_BUFFER) && desc->bb) {
 		struct blk_bounce_buffer bbstate = { .dev = dev };
@@ -500,6 +551,90 @@ long blk_write(struct udevice *dev, lbaint_t start, lbaint_t blkcnt,
 	return blks_written;
 }
 
+int blk_submit(struct udevice *dev, struct blk_req *req)
+{
+	struct blk_desc *desc = dev_get_uclass_plat(dev);
+	const struct blk_ops *ops = blk_get_ops(dev);
+	lbaint_t tail;
+	int ret;
+
+	if (req->write ? !ops->write : !ops->read)
+		return -ENOSYS;
+
+	req->dev = dev;
+	req->done = 0;
+	req->state = BLK_REQ_PENDING;
+
+	/* The driver gets the caller's buffer, so no bounce buffer is used */
+	if (CONFIG_IS_ENABLED(BLK_ASYNC) && ops->submit &&
+	    !(IS_ENABLED(CONFIG_BOUNCE_BUFFER) && desc->bb)) {
+		if (req->write) {
+			blkcache_invalidate(desc->uclass_id, desc->devnum);
+			fs_invalidate(desc);
+		} else if (blkcache_read(desc->uclass_id, desc->devnum,
+					 req->start, req->blkcnt, desc->blksz,
+					 req->buffer, &tail) == req->blkcnt) {
+			req->result = req->blkcnt;
+			req->state = BLK_REQ_DONE;
+			return 0;
+		}
+
+		ret = ops->submit(dev, req);
+		if (ret != -ENOSYS) {
+			if (ret)
+				req->state = BLK_REQ_IDLE;
+			return ret;
+		}
+	}
+
+	/* Complete the request before returning */
+	if (req->write)
+		req->result = blk_write(dev, req->start, req->blkcnt,
+					req->buffer);
+	else
+		req->result = blk_read(dev, req->start, req->blkcnt,
+				       req->buffer);
+	req->state = BLK_REQ_DONE;
+
+	return 0;
+}
+
+int blk_poll(struct blk_req *req)
+{
+	const struct blk_ops *ops;
+
+	if (req->state == BLK_REQ_DONE)
+		return 0;
+	if (req->state != BLK_REQ_PENDING)
+		return -EINVAL;
+	ops = blk_get_ops(req->dev);
+
+	return ops->poll(req->dev, req);
+}
+
+long blk_wait(struct blk_req *req)
+{
+	int ret;
+
+	while ((ret = blk_poll(req)) == -EAGAIN)
+		schedule();
+	if (ret)
+		return ret;
+
+	return req->result;
+}
+
+void blk_req_complete(struct blk_req *req, long result)
+{
+	struct blk_desc *desc = dev_get_uclass_plat(req->dev);
+
+	req->result = result;
+	req->state = BLK_REQ_DONE;
+	if (!req->write && result == req->blkcnt)
+		blkcache_fill(desc->uclass_id, desc->devnum, req->start,
+			      req->blkcnt, desc->blksz, req->buffer);
+}
+
 long blk_erase(struct udevice *dev, lbaint_t start, lbaint_t blkcnt)
 {
 	struct blk_desc *desc = dev_get_uclass_plat(dev);
@@ -509,6 +644,7 @@ long blk_erase(struct udevice *dev, lbaint_t start, lbaint_t blkcnt)
 		return -ENOSYS;
 
 	blkcache_invalidate(desc->uclass_id, desc->devnum);
+	fs_invalidate(desc);
 
 	return ops->erase(dev, start, blkcnt);
 }
@@ -851,9 +987,18 @@ static int blk_post_probe(struct udevice *dev)
 	return 0;
 }
 
+static int blk_pre_remove(struct udevice *dev)
+{
+	/* Don't keep a filesystem mounted on a device which is going away */
+	fs_invalidate(dev_get_uclass_plat(dev));
+
+	return 0;
+}
+
 UCLASS_DRIVER(blk) = {
 	.id		= UCLASS_BLK,
 	.name		= "blk",
 	.post_probe	= blk_post_probe,
+	.pre_remove	= blk_pre_remove,
 	.per_device_plat_auto	= sizeof(struct blk_desc),
 };
@@ -12,160 +12,480 @@
 #include <asm/global_data.h>
 #include <linux/ctype.h>
 #include <linux/list.h>
+#include <linux/log2.h>
 
-struct block_cache_node {
+/*
+ * The cache holds single blocks, found through a hash table keyed by device
+ * and block number. Each device has its own size limit and its own LRU list,
+ * so a busy device does not push the blocks of another one out of the cache.
+ */
+
+/**
+ * struct block_cache_dev - the cached blocks of one device
+ *
+ * @lh:		entry in the list of devices
+ * @lru:	cached blocks, most recently used first
+ * @iftype:	uclass_id of the device
+ * @devnum:	device number
+ * @blksz:	size in bytes of each block
+ * @blocks:	number of blocks cached
+ * @max_blocks_per_entry: largest read which is added to the cache
+ * @max_entries: size of the cache, in entries of @max_blocks_per_entry blocks
+ * @configured:	true if sized with blkcache_configure_dev(), rather than
+ *		with the defaults
+ * @ra_next:	block following the last read, where a sequential read goes on
+ * @ra_end:	block following the blocks read ahead
+ * @ra_window:	number of blocks to keep read ahead of the reads
+ */
+struct block_cache_dev {
 	struct list_head lh;
+	struct list_head lru;
 	int iftype;
 	int devnum;
-	lbaint_t start;
-	lbaint_t blkcnt;
 	unsigned long blksz;
-	char *cache;
+	unsigned blocks;
+	unsigned max_blocks_per_entry;
+	unsigned max_entries;
+	bool configured;
+	lbaint_t ra_next;
+	lbaint_t ra_end;
+	lbaint_t ra_window;
+};
+
+struct block_cache_node {
+	struct list_head lh;		/* entry in the LRU list of the device */
+	struct hlist_node hn;		/* entry in a hash bucket */
+	struct block_cache_dev *bdev;
+	lbaint_t blk;
+	bool ahead;			/* read ahead and not used yet */
+	char cache[];
 };
 
-static LIST_HEAD(block_cache);
+#define BLOCK_CACHE_MIN_HASH_BITS	6
+#define BLOCK_CACHE_MAX_HASH_BITS	16
+
+static LIST_HEAD(block_cache_devs);
+static struct hlist_head *block_cache_hash;
+static unsigned block_cache_hash_bits;
 
 static struct block_cache_stats _stats = {
-	.max_blocks_per_entry = 8,
-	.max_entries = 32
+	.max_blocks_per_entry = CONFIG_BLOCK_CACHE_MAX_BLOCKS,
+	.max_entries = CONFIG_BLOCK_CACHE_ENTRIES
 };
 
-static struct block_cache_node *cache_find(int iftype, int devnum,
-					   lbaint_t start, lbaint_t blkcnt,
-					   unsigned long blksz)
+static unsigned dev_max_blocks(struct block_cache_dev *bdev)
+{
+	return bdev->max_blocks_per_entry * bdev->max_entries;
+}
+
+static struct hlist_head *cache_bucket(struct block_cache_dev *bdev,
+				       lbaint_t blk)
 {
+	u32 key = (u32)blk ^ (u32)((u64)blk >> 32) ^
+		  ((u32)bdev->devnum << 24) ^ ((u32)bdev->iftype << 16);
+
+	/* Multiplicative hashing, see Knuth vol. 3 section 6.4 */
+	return &block_cache_hash[(key * 0x9e3779b1U) >>
+				 (32 - block_cache_hash_bits)];
+}
+
+/* Size the hash table to the space in all device caches, if memory allows */
+static void cache_resize_hash(void)
+{
+	struct block_cache_dev *bdev;
 	struct block_cache_node *node;
+	struct hlist_head *hash;
+	unsigned long total = 0;
+	unsigned bits;
+	int i;
 
-	list_for_each_entry(node, &block_cache, lh)
-		if ((node->iftype == iftype) &&
-		    (node->devnum == devnum) &&
-		    (node->blksz == blksz) &&
-		    (node->start <= start) &&
-		    (node->start + node->blkcnt >= start + blkcnt)) {
-			if (block_cache.next != &node->lh) {
-				/* maintain MRU ordering */
-				list_del(&node->lh);
-				list_add(&node->lh, &block_cache);
-			}
+	list_for_each_entry(bdev, &block_cache_devs, lh)
+		total += dev_max_blocks(bdev);
+	/* About two blocks per bucket when the caches are full */
+	bits = clamp_t(unsigned, ilog2(__roundup_pow_of_two(max(total, 1UL))),
+		       BLOCK_CACHE_MIN_HASH_BITS + 1,
+		       BLOCK_CACHE_MAX_HASH_BITS + 1) - 1;
+	if (block_cache_hash && bits == block_cache_hash_bits)
+		return;
+
+	hash = malloc(sizeof(*hash) << bits);
+	if (!hash)
+		return;
+	for (i = 0; i < 1 << bits; i++)
+		INIT_HLIST_HEAD(&hash[i]);
+
+	free(block_cache_hash);
+	block_cache_hash = hash;
+	block_cache_hash_bits = bits;
+	list_for_each_entry(bdev, &block_cache_devs, lh) {
+		list_for_each_entry(node, &bdev->lru, lh)
+			hlist_add_head(&node->hn,
+				       cache_bucket(bdev, node->blk));
+	}
+}
+
+static struct block_cache_dev *cache_find_dev(int iftype, int devnum)
+{
+	struct block_cache_dev *bdev;
+
+	list_for_each_entry(bdev, &block_cache_devs, lh) {
+		if (bdev->iftype == iftype && bdev->devnum == devnum)
+			return bdev;
+	}
+
+	return NULL;
+}
+
+static struct block_cache_dev *cache_get_dev(int iftype, int devnum)
+{
+	struct block_cache_dev *bdev;
+
+	bdev = cache_find_dev(iftype, devnum);
+	if (bdev)
+		return bdev;
+
+	bdev = calloc(1, sizeof(*bdev));
+	if (!bdev)
+		return NULL;
+	INIT_LIST_HEAD(&bdev->lru);
+	bdev->iftype = iftype;
+	bdev->devnum = devnum;
+	bdev->max_blocks_per_entry = _stats.max_blocks_per_entry;
+	bdev->max_entries = _stats.max_entries;
+	list_add(&bdev->lh, &block_cache_devs);
+	cache_resize_hash();
+	if (!block_cache_hash) {
+		list_del(&bdev->lh);
+		free(bdev);
+		return NULL;
+	}
+
+	return bdev;
+}
+
+static struct block_cache_node *cache_find(struct block_cache_dev *bdev,
+					   lbaint_t blk)
+{
+	struct block_cache_node *node;
+
+	hlist_for_each_entry(node, cache_bucket(bdev, blk), hn) {
+		if (node->bdev == bdev && node->blk == blk) {
+			/* maintain MRU ordering */
+			list_move(&node->lh, &bdev->lru);
 			return node;
 		}
-	return 0;
+	}
+
+	return NULL;
+}
+
+/* Like cache_find(), but for a read, which uses any block read ahead */
+static struct block_cache_node *cache_use(struct block_cache_dev *bdev,
+					  lbaint_t blk)
+{
+	struct block_cache_node *node = cache_find(bdev, blk);
+
+	if (node && node->ahead) {
+		node->ahead = false;
+		++_stats.ra_hits;
+	}
+
+	return node;
+}
+
+static void cache_drop(struct block_cache_node *node)
+{
+	list_del(&node->lh);
+	hlist_del(&node->hn);
+	node->bdev->blocks--;
+	_stats.entries--;
+	free(node);
+}
+
+static void cache_invalidate_dev(struct block_cache_dev *bdev)
+{
+	struct block_cache_node *node, *n;
+
+	list_for_each_entry_safe(node, n, &bdev->lru, lh)
+		cache_drop(node);
 }
 
 int blkcache_read(int iftype, int devnum,
 		  lbaint_t start, lbaint_t blkcnt,
-		  unsigned long blksz, void *buffer)
+		  unsigned long blksz, void *buffer, lbaint_t *tailp)
 {
-	struct block_cache_node *node = cache_find(iftype, devnum, start,
-						   blkcnt, blksz);
-	if (node) {
-		const char *src = node->cache + (start - node->start) * blksz;
-		memcpy(buffer, src, blksz * blkcnt);
+	struct block_cache_dev *bdev = cache_find_dev(iftype, devnum);
+	struct block_cache_node *node;
+	lbaint_t head, tail;
+
+	*tailp = 0;
+	if (!bdev || bdev->blksz != blksz || !bdev->blocks) {
+		++_stats.misses;
+		return 0;
+	}
+
+	for (head = 0; head < blkcnt; head++) {
+		node = cache_use(bdev, start + head);
+		if (!node)
+			break;
+		memcpy(buffer + head * blksz, node->cache, blksz);
+	}
+	if (head == blkcnt) {
 		debug("hit: start " LBAF ", count " LBAFU "\n",
 		      start, blkcnt);
 		++_stats.hits;
-		return 1;
+		return blkcnt;
 	}
 
-	debug("miss: start " LBAF ", count " LBAFU "\n",
-	      start, blkcnt);
-	++_stats.misses;
-	return 0;
+	/* The block at @head is missing, so look no further back than that */
+	for (tail = 0; tail < blkcnt - head - 1; tail++) {
+		lbaint_t blk = blkcnt - tail - 1;
+
+		node = cache_use(bdev, start + blk);
+		if (!node)
+			break;
+		memcpy(buffer + blk * blksz, node->cache, blksz);
+	}
+	*tailp = tail;
+
+	debug("%s: start " LBAF ", count " LBAFU ", cached " LBAFU "+" LBAFU
+	      "\n", head || tail ? "partial" : "miss", start, blkcnt, head,
+	      tail);
+	if (head || tail)
+		++_stats.partial;
+	else
+		++_stats.misses;
+
+	return head;
+}
+
+static void cache_fill(struct block_cache_dev *bdev, lbaint_t start,
+		       lbaint_t blkcnt, unsigned long blksz,
+		       void const *buffer, bool ahead)
+{
+	struct block_cache_node *node;
+	lbaint_t i;
+
+	if (bdev->blksz != blksz) {
+		cache_invalidate_dev(bdev);
+		bdev->blksz = blksz;
+	}
+
+	debug("fill: start " LBAF ", count " LBAFU "%s\n",
+	      start, blkcnt, ahead ? " ahead" : "");
+
+	for (i = 0; i < blkcnt; i++) {
+		node = cache_find(bdev, start + i);
+		if (!node) {
+			if (bdev->blocks >= dev_max_blocks(bdev)) {
+				/* reuse LRU */
+				node = list_last_entry(&bdev->lru,
+						       struct block_cache_node,
+						       lh);
+				list_del(&node->lh);
+				hlist_del(&node->hn);
+			} else {
+				node = malloc(sizeof(*node) + blksz);
+				if (!node)
+					return;
+				node->bdev = bdev;
+				bdev->blocks++;
+				_stats.entries++;
+			}
+			node->blk = start + i;
+			hlist_add_head(&node->hn, cache_bucket(bdev, node->blk));
+			list_add(&node->lh, &bdev->lru);
+		} else if (ahead) {
+			/* Already cached, so not read ahead for anyone */
+			continue;
+		}
+		node->ahead = ahead;
+		memcpy(node->cache, buffer + i * blksz, blksz);
+	}
 }
 
 void blkcache_fill(int iftype, int devnum,
 		   lbaint_t start, lbaint_t blkcnt,
 		   unsigned long blksz, void const *buffer)
 {
-	lbaint_t bytes;
-	struct block_cache_node *node;
+	struct block_cache_dev *bdev;
 
 	/* don't cache big stuff */
-	if (blkcnt > _stats.max_blocks_per_entry)
+	bdev = cache_find_dev(iftype, devnum);
+	if (bdev ? blkcnt > bdev->max_blocks_per_entry || !dev_max_blocks(bdev) :
+	    blkcnt > _stats.max_blocks_per_entry || !_stats.max_entries)
 		return;
 
-	if (_stats.max_entries == 0)
-		return;
+	bdev = cache_get_dev(iftype, devnum);
+	if (bdev)
+		cache_fill(bdev, start, blkcnt, blksz, buffer, false);
+}
 
-	bytes = blksz * blkcnt;
-	if (_stats.max_entries <= _stats.entries) {
-		/* pop LRU */
-		node = (struct block_cache_node *)block_cache.prev;
-		list_del(&node->lh);
-		_stats.entries--;
-		debug("drop: start " LBAF ", count " LBAFU "\n",
-		      node->start, node->blkcnt);
-		if (node->blkcnt * node->blksz < bytes) {
-			free(node->cache);
-			node->cache = 0;
-		}
-	} else {
-		node = malloc(sizeof(*node));
-		if (!node)
-			return;
-		node->cache = 0;
-	}
+lbaint_t blkcache_readahead(int iftype, int devnum, lbaint_t start,
+			    lbaint_t blkcnt, lbaint_t *startp)
+{
+	struct block_cache_dev *bdev;
+	lbaint_t end = start + blkcnt;
+	lbaint_t max, from;
 
-	if (!node->cache) {
-		node->cache = malloc(bytes);
-		if (!node->cache) {
-			free(node);
-			return;
-		}
+	if (!CONFIG_BLOCK_CACHE_READAHEAD)
+		return 0;
+
+	/* Leave half of the cache for blocks which are read again */
+	bdev = cache_get_dev(iftype, devnum);
+	if (!bdev)
+		return 0;
+	max = min_t(lbaint_t, CONFIG_BLOCK_CACHE_READAHEAD,
+		    dev_max_blocks(bdev) / 2);
+
+	if (start != bdev->ra_next) {
+		/* Not sequential, so start again */
+		bdev->ra_next = end;
+		bdev->ra_end = end;
+		bdev->ra_window = 0;
+		return 0;
 	}
+	bdev->ra_next = end;
+
+	/* Large reads are quicker done straight from the device */
+	if (blkcnt >= max)
+		return 0;
+
+	/* Wait until half of the window is used up */
+	if (bdev->ra_window && bdev->ra_end >= end + bdev->ra_window / 2)
+		return 0;
+
+	bdev->ra_window = min(bdev->ra_window ? bdev->ra_window * 2 :
+			      blkcnt * 4, max);
+	from = max(bdev->ra_end, end);
+	*startp = from;
+	bdev->ra_end = end + bdev->ra_window;
+	if (bdev->ra_end <= from)
+		return 0;
 
-	debug("fill: start " LBAF ", count " LBAFU "\n",
-	      start, blkcnt);
+	return bdev->ra_end - from;
+}
+
+void blkcache_fill_readahead(int iftype, int devnum, lbaint_t start,
+			     lbaint_t blkcnt, unsigned long blksz,
+			     void const *buffer)
+{
+	struct block_cache_dev *bdev = cache_find_dev(iftype, devnum);
 
-	node->iftype = iftype;
-	node->devnum = devnum;
-	node->start = start;
-	node->blkcnt = blkcnt;
-	node->blksz = blksz;
-	memcpy(node->cache, buffer, bytes);
-	list_add(&node->lh, &block_cache);
-	_stats.entries++;
+	if (!bdev)
+		return;
+	cache_fill(bdev, start, blkcnt, blksz, buffer, true);
+	_stats.ra_blocks += blkcnt;
 }
 
 void blkcache_invalidate(int iftype, int devnum)
 {
-	struct list_head *entry, *n;
-	struct block_cache_node *node;
+	struct block_cache_dev *bdev, *n;
+
+	list_for_each_entry_safe(bdev, n, &block_cache_devs, lh) {
+		if (iftype != -1 &&
+		    (bdev->iftype != iftype || bdev->devnum != devnum))
+			continue;
+		cache_invalidate_dev(bdev);
 
-	list_for_each_safe(entry, n, &block_cache) {
-		node = (struct block_cache_node *)entry;
-		if (iftype == -1 ||
-		    (node->iftype == iftype && node->devnum == devnum)) {
-			list_del(entry);
-			free(node->cache);
-			free(node);
-			--_stats.entries;
+		/* Keep a device only for its own size */
+		if (!bdev->configured) {
+			list_del(&bdev->lh);
+			free(bdev);
 		}
 	}
+
+	if (list_empty(&block_cache_devs)) {
+		free(block_cache_hash);
+		block_cache_hash = NULL;
+		block_cache_hash_bits = 0;
+	} else {
+		cache_resize_hash();
+	}
 }
 
 void blkcache_configure(unsigned blocks, unsigned entries)
 {
-	/* invalidate cache if there is a change */
-	if ((blocks != _stats.max_blocks_per_entry) ||
-	    (entries != _stats.max_entries))
-		blkcache_invalidate(-1, 0);
+	struct block_cache_dev *bdev;
 
 	_stats.max_blocks_per_entry = blocks;
 	_stats.max_entries = entries;
 
+	/* The defaults apply to every device again */
+	list_for_each_entry(bdev, &block_cache_devs, lh) {
+		/* invalidate cache if there is a change */
+		if (blocks != bdev->max_blocks_per_entry ||
+		    entries != bdev->max_entries)
+			cache_invalidate_dev(bdev);
+		bdev->max_blocks_per_entry = blocks;
+		bdev->max_entries = entries;
+		bdev->configured = false;
+	}
+	if (!list_empty(&block_cache_devs))
+		cache_resize_hash();
+
 	_stats.hits = 0;
+	_stats.partial = 0;
 	_stats.misses = 0;
+	_stats.ra_blocks = 0;
+	_stats.ra_hits = 0;
+}
+
+int blkcache_configure_dev(int iftype, int devnum, unsigned blocks,
+			   unsigned entries)
+{
+	struct block_cache_dev *bdev;
+
+	bdev = cache_get_dev(iftype, devnum);
+	if (!bdev)
+		return -ENOMEM;
+
+	if (blocks != bdev->max_blocks_per_entry ||
+	    entries != bdev->max_entries)
+		cache_invalidate_dev(bdev);
+
+	bdev->max_blocks_per_entry = blocks;
+	bdev->max_entries = entries;
+	bdev->configured = true;
+	cache_resize_hash();
+
+	return 0;
 }
 
 void blkcache_stats(struct block_cache_stats *stats)
 {
 	memcpy(stats, &_stats, sizeof(*stats));
 	_stats.hits = 0;
+	_stats.partial = 0;
 	_stats.misses = 0;
+	_stats.ra_blocks = 0;
+	_stats.ra_hits = 0;
+}
+
+int blkcache_dev_stats(int index, struct block_cache_dev_stats *stats)
+{
+	struct block_cache_dev *bdev;
+
+	list_for_each_entry(bdev, &block_cache_devs, lh) {
+		if (index--)
+			continue;
+		stats->iftype = bdev->iftype;
+		stats->devnum = bdev->devnum;
+		stats->blocks = bdev->blocks;
+		stats->max_blocks_per_entry = bdev->max_blocks_per_entry;
+		stats->max_entries = bdev->max_entries;
+		stats->configured = bdev->configured;
+		return 0;
+	}
+
+	return -ENOENT;
 }
 
 void blkcache_free(void)
 {
+	struct block_cache_dev *bdev;
+
+	list_for_each_entry(bdev, &block_cache_devs, lh)
+		bdev->configured = false;
 	blkcache_invalidate(-1, 0);
 }
@@ -53,9 +53,43 @@ static int dm_mmc_send_cmd(struct udevice *dev, struct mmc_cmd *cmd,
 
 int mmc_send_cmd(struct mmc *mmc, struct mmc_cmd *cmd, struct mmc_data *data)
 {
+#if CONFIG_IS_ENABLED(BLK_ASYNC)
+	/* The bus is busy until the block request in progress is complete */
+	if (mmc->req)
+		blk_wait(mmc->req);
+#endif
+
 	return dm_mmc_send_cmd(mmc->dev, cmd, data);
 }
 
+#if CONFIG_IS_ENABLED(BLK_ASYNC)
+int mmc_send_cmd_async(struct mmc *mmc, struct mmc_cmd *cmd,
+		       struct mmc_data *data)
+{
+	struct dm_mmc_ops *ops = mmc_get_ops(mmc->dev);
+	int ret;
+
+	if (!ops->send_cmd_async)
+		return -ENOSYS;
+
+	mmmc_trace_before_send(mmc, cmd);
+	ret = ops->send_cmd_async(mmc->dev, cmd, data);
+	mmmc_trace_after_send(mmc, cmd, ret);
+
+	return ret;
+}
+
+int mmc_poll_data(struct mmc *mmc, struct mmc_data *data)
+{
+	struct dm_mmc_ops *ops = mmc_get_ops(mmc->dev);
+
+	if (!ops->poll_data)
+		return -ENOSYS;
+
+	return ops->poll_data(mmc->dev, data);
+}
+#endif
+
 static int dm_mmc_set_ios(struct udevice *dev)
 {
 	struct dm_mmc_ops *ops = mmc_get_ops(dev);
@@ -525,6 +559,10 @@ static const struct blk_ops mmc_blk_ops = {
 	.erase	= mmc_berase,
 #endif
 	.select_hwpart	= mmc_select_hwpart,
+#if CONFIG_IS_ENABLED(BLK_ASYNC)
+	.submit	= mmc_bsubmit,
+	.poll	= mmc_bpoll,
+#endif
 };
 
 U_BOOT_DRIVER(mmc_blk) = {
@@ -419,33 +419,66 @@ int mmc_send_stop_transmission(struct mmc *mmc, bool write)
 	return mmc_send_cmd(mmc, &cmd, NULL);
 }
 
-static int mmc_read_blocks(struct mmc *mmc, void *dst, lbaint_t start,
-			   lbaint_t blkcnt)
+bool mmc_use_cmd23(struct mmc *mmc, lbaint_t blkcnt)
+{
+	/* The block count is a 16-bit field */
+	if (blkcnt < 2 || blkcnt > 0xffff)
+		return false;
+	if (!(mmc->host_caps & MMC_CAP_CMD23) || mmc_host_is_spi(mmc))
+		return false;
+	if (IS_SD(mmc))
+		return mmc->scr[0] & SD_CMD23_SUPPORT;
+
+	return mmc->version >= MMC_VERSION_3;
+}
+
+int mmc_set_block_count(struct mmc *mmc, lbaint_t blkcnt)
 {
 	struct mmc_cmd cmd;
-	struct mmc_data data;
 
+	cmd.cmdidx = MMC_CMD_SET_BLOCK_COUNT;
+	cmd.cmdarg = blkcnt;
+	cmd.resp_type = MMC_RSP_R1;
+
+	return mmc_send_cmd(mmc, &cmd, NULL);
+}
+
+static void mmc_setup_read(struct mmc *mmc, struct mmc_cmd *cmd,
+			   struct mmc_data *data, void *dst, lbaint_t start,
+			   lbaint_t blkcnt)
+{
 	if (blkcnt > 1)
-		cmd.cmdidx = MMC_CMD_READ_MULTIPLE_BLOCK;
+		cmd->cmdidx = MMC_CMD_READ_MULTIPLE_BLOCK;
 	else
-		cmd.cmdidx = MMC_CMD_READ_SINGLE_BLOCK;
+		cmd->cmdidx = MMC_CMD_READ_SINGLE_BLOCK;
 
 	if (mmc->high_capacity)
-		cmd.cmdarg = start;
+		cmd->cmdarg = start;
 	else
-		cmd.cmdarg = start * mmc->read_bl_len;
+		cmd->cmdarg = start * mmc->read_bl_len;
 
-	cmd.resp_type = MMC_RSP_R1;
+	cmd->resp_type = MMC_RSP_R1;
 
-	data.dest = dst;
-	data.blocks = blkcnt;
-	data.blocksize = mmc->read_bl_len;
-	data.flags = MMC_DATA_READ;
+	data->dest = dst;
+	data->blocks = blkcnt;
+	data->blocksize = mmc->read_bl_len;
+	data->flags = MMC_DATA_READ;
+}
+
+static int mmc_read_blocks(struct mmc *mmc, void *dst, lbaint_t start,
+			   lbaint_t blkcnt)
+{
+	bool cmd23 = mmc_use_cmd23(mmc, blkcnt);
+	struct mmc_cmd cmd;
+	struct mmc_data data;
 
+	mmc_setup_read(mmc, &cmd, &data, dst, start, blkcnt);
+	if (cmd23 && mmc_set_block_count(mmc, blkcnt))
+		return 0;
 	if (mmc_send_cmd(mmc, &cmd, &data))
 		return 0;
 
-	if (blkcnt > 1) {
+	if (blkcnt > 1 && !cmd23) {
 		if (mmc_send_stop_transmission(mmc, false)) {
 #if !defined(CONFIG_SPL_BUILD) || defined(CONFIG_SPL_LIBCOMMON_SUPPORT)
 			pr_err("mmc fail to send stop cmd\n");
@@ -467,6 +500,36 @@ static int mmc_get_b_max(struct mmc *mmc, void *dst, lbaint_t blkcnt)
 }
 #endif
 
+/* Select the hardware partition and block length for a read */
+static int mmc_prepare_read(struct mmc *mmc, struct blk_desc *block_dev,
+			    lbaint_t start, lbaint_t blkcnt)
+{
+	int err;
+
+	if (CONFIG_IS_ENABLED(MMC_TINY))
+		err = mmc_switch_part(mmc, block_dev->hwpart);
+	else
+		err = blk_dselect_hwpart(block_dev, block_dev->hwpart);
+
+	if (err < 0)
+		return err;
+
+	if ((start + blkcnt) > block_dev->lba) {
+#if !defined(CONFIG_SPL_BUILD) || defined(CONFIG_SPL_LIBCOMMON_SUPPORT)
+		pr_err("MMC: block number 0x" LBAF " exceeds max(0x" LBAF ")\n",
+		       start + blkcnt, block_dev->lba);
+#endif
+		return -EINVAL;
+	}
+
+	if (mmc_set_blocklen(mmc, mmc->read_bl_len)) {
+		pr_debug("%s: Failed to set blocklen\n", __func__);
+		return -EIO;
+	}
+
+	return 0;
+}
+
 #if CONFIG_IS_ENABLED(BLK)
 ulong mmc_bread(struct udevice *dev, lbaint_t start, lbaint_t blkcnt, void *dst)
 #else
@@ -478,7 +541,6 @@ ulong mmc_bread(struct blk_desc *block_dev, lbaint_t start, lbaint_t blkcnt,
 	struct blk_desc *block_dev = dev_get_uclass_plat(dev);
 #endif
 	int dev_num = block_dev->devnum;
-	int err;
 	lbaint_t cur, blocks_todo = blkcnt;
 	uint b_max;
 
@@ -489,26 +551,8 @@ ulong mmc_bread(struct blk_desc *block_dev, lbaint_t start, lbaint_t blkcnt,
 	if (!mmc)
 		return 0;
 
-	if (CONFIG_IS_ENABLED(MMC_TINY))
-		err = mmc_switch_part(mmc, block_dev->hwpart);
-	else
-		err = blk_dselect_hwpart(block_dev, block_dev->hwpart);
-
-	if (err < 0)
-		return 0;
-
-	if ((start + blkcnt) > block_dev->lba) {
-#if !defined(CONFIG_SPL_BUILD) || defined(CONFIG_SPL_LIBCOMMON_SUPPORT)
-		pr_err("MMC: block number 0x" LBAF " exceeds max(0x" LBAF ")\n",
-		       start + blkcnt, block_dev->lba);
-#endif
+	if (mmc_prepare_read(mmc, block_dev, start, blkcnt))
 		return 0;
-	}
-
-	if (mmc_set_blocklen(mmc, mmc->read_bl_len)) {
-		pr_debug("%s: Failed to set blocklen\n", __func__);
-		return 0;
-	}
 
 	b_max = mmc_get_b_max(mmc, dst, blkcnt);
 
@@ -526,6 +570,91 @@ ulong mmc_bread(struct blk_desc *block_dev, lbaint_t start, lbaint_t blkcnt,
 	return blkcnt;
 }
 
+#if CONFIG_IS_ENABLED(BLK_ASYNC)
+/*
+ * Start the next read of @req, from block @req->done. The caller sets
+ * mmc->req afterwards, since until then commands can be sent as usual.
+ */
+static int mmc_read_next(struct mmc *mmc, struct blk_req *req)
+{
+	void *dst = req->buffer + req->done * mmc->read_bl_len;
+	lbaint_t blkcnt = req->blkcnt - req->done;
+	struct mmc_cmd cmd;
+	int err;
+
+	blkcnt = min_t(lbaint_t, blkcnt, mmc_get_b_max(mmc, dst, blkcnt));
+	mmc_setup_read(mmc, &cmd, &mmc->req_data, dst, req->start + req->done,
+		       blkcnt);
+	if (mmc_use_cmd23(mmc, blkcnt)) {
+		err = mmc_set_block_count(mmc, blkcnt);
+		if (err)
+			return err;
+	}
+
+	return mmc_send_cmd_async(mmc, &cmd, &mmc->req_data);
+}
+
+int mmc_bsubmit(struct udevice *dev, struct blk_req *req)
+{
+	struct blk_desc *block_dev = dev_get_uclass_plat(dev);
+	struct mmc *mmc;
+	int err;
+
+	/* Writes end with the card busy, which needs waiting for */
+	if (req->write || !req->blkcnt)
+		return -ENOSYS;
+
+	mmc = find_mmc_device(block_dev->devnum);
+	if (!mmc)
+		return -ENODEV;
+	if (mmc->req)
+		return -EBUSY;
+
+	err = mmc_prepare_read(mmc, block_dev, req->start, req->blkcnt);
+	if (err)
+		return err;
+
+	err = mmc_read_next(mmc, req);
+	if (!err)
+		mmc->req = req;
+
+	return err;
+}
+
+int mmc_bpoll(struct udevice *dev, struct blk_req *req)
+{
+	struct blk_desc *block_dev = dev_get_uclass_plat(dev);
+	struct mmc *mmc = find_mmc_device(block_dev->devnum);
+	uint blocks = mmc->req_data.blocks;
+	int err;
+
+	err = mmc_poll_data(mmc, &mmc->req_data);
+	if (err == -EAGAIN)
+		return err;
+
+	/* Let the commands below through mmc_send_cmd() */
+	mmc->req = NULL;
+	if (!err && blocks > 1 && !mmc_use_cmd23(mmc, blocks) &&
+	    mmc_send_stop_transmission(mmc, false))
+		err = -EIO;
+	if (!err) {
+		req->done += blocks;
+		if (req->done < req->blkcnt) {
+			err = mmc_read_next(mmc, req);
+			if (!err) {
+				mmc->req = req;
+				return -EAGAIN;
+			}
+		}
+	}
+	if (err)
+		pr_debug("%s: Failed to read blocks\n", __func__);
+	blk_req_complete(req, req->done ? req->done : err);
+
+	return 0;
+}
+#endif
+
 static int mmc_go_idle(struct mmc *mmc)
 {
 	struct mmc_cmd cmd;
@@ -17,6 +17,28 @@ int mmc_poll_for_busy(struct mmc *mmc, int timeout);
 
 int mmc_set_blocklen(struct mmc *mmc, int len);
 
+/**
+ * mmc_use_cmd23() - check whether to bound a transfer with CMD23
+ *
+ * A multiple-block transfer announced with SET_BLOCK_COUNT (CMD23) ends by
+ * itself, so it needs no STOP_TRANSMISSION (CMD12) afterwards.
+ *
+ * @mmc:	MMC device
+ * @blkcnt:	number of blocks in the transfer
+ * Return: true if both the host and the card support CMD23 and the
+ * transfer has more than one block, but not too many for CMD23
+ */
+bool mmc_use_cmd23(struct mmc *mmc, lbaint_t blkcnt);
+
+/**
+ * mmc_set_block_count() - send SET_BLOCK_COUNT (CMD23)
+ *
+ * @mmc:	MMC device
+ * @blkcnt:	number of blocks in the next transfer
+ * Return: 0 if OK, -ve on error
+ */
+int mmc_set_block_count(struct mmc *mmc, lbaint_t blkcnt);
+
 #if CONFIG_IS_ENABLED(BLK)
 ulong mmc_bread(struct udevice *dev, lbaint_t start, lbaint_t blkcnt,
 		void *dst);
@@ -25,6 +47,31 @@ ulong mmc_bread(struct blk_desc *block_dev, lbaint_t start, lbaint_t blkcnt,
 		void *dst);
 #endif
 
+#if CONFIG_IS_ENABLED(BLK_ASYNC)
+int mmc_bsubmit(struct udevice *dev, struct blk_req *req);
+int mmc_bpoll(struct udevice *dev, struct blk_req *req);
+
+/**
+ * mmc_send_cmd_async() - send a command and start its data transfer
+ *
+ * @mmc:	MMC device
+ * @cmd:	command to send
+ * @data:	data to receive
+ * Return: 0 if OK, -ENOSYS if the host cannot do this, other -ve on error
+ */
+int mmc_send_cmd_async(struct mmc *mmc, struct mmc_cmd *cmd,
+		       struct mmc_data *data);
+
+/**
+ * mmc_poll_data() - check a transfer started by mmc_send_cmd_async()
+ *
+ * @mmc:	MMC device
+ * @data:	data passed to mmc_send_cmd_async()
+ * Return: 0 if complete, -EAGAIN if still in progress, other -ve on error
+ */
+int mmc_poll_data(struct mmc *mmc, struct mmc_data *data);
+#endif
+
 #if CONFIG_IS_ENABLED(MMC_WRITE)
 
 #if CONFIG_IS_ENABLED(BLK)
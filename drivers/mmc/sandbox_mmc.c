@@ -31,6 +31,8 @@ struct sandbox_mmc_priv {
 	char *buf;
 	int csize;	/* CSIZE value to report */
 	int size;
+	struct mmc_cmd async_cmd; /* command started by send_cmd_async() */
+	uint cmd_count[64];	/* number of times each command was sent */
 };
 
 /**
@@ -45,6 +47,7 @@ static int sandbox_mmc_send_cmd(struct udevice *dev, struct mmc_cmd *cmd,
 	struct sandbox_mmc_priv *priv = dev_get_priv(dev);
 	static ulong erase_start, erase_end;
 
+	priv->cmd_count[cmd->cmdidx % ARRAY_SIZE(priv->cmd_count)]++;
 	switch (cmd->cmdidx) {
 	case MMC_CMD_ALL_SEND_CID:
 		memset(cmd->response, '\0', sizeof(cmd->response));
@@ -89,6 +92,7 @@ static int sandbox_mmc_send_cmd(struct udevice *dev, struct mmc_cmd *cmd,
 		       data->blocks * data->blocksize);
 		break;
 	case MMC_CMD_STOP_TRANSMISSION:
+	case MMC_CMD_SET_BLOCK_COUNT:
 		break;
 	case SD_CMD_ERASE_WR_BLK_START:
 		erase_start = cmd->cmdarg;
@@ -118,7 +122,8 @@ static int sandbox_mmc_send_cmd(struct udevice *dev, struct mmc_cmd *cmd,
 	case SD_CMD_APP_SEND_SCR: {
 		u32 *scr = (u32 *)data->dest;
 
-		scr[0] = cpu_to_be32(2 << 24 | 1 << 15);  /* SD version 3 */
+		/* SD version 3, with CMD23 */
+		scr[0] = cpu_to_be32(2 << 24 | 1 << 15 | SD_CMD23_SUPPORT);
 		break;
 	}
 	default:
@@ -129,6 +134,34 @@ static int sandbox_mmc_send_cmd(struct udevice *dev, struct mmc_cmd *cmd,
 	return 0;
 }
 
+#if CONFIG_IS_ENABLED(BLK_ASYNC)
+/* Like a DMA engine, this leaves the data until later */
+static int sandbox_mmc_send_cmd_async(struct udevice *dev,
+				      struct mmc_cmd *cmd,
+				      struct mmc_data *data)
+{
+	struct sandbox_mmc_priv *priv = dev_get_priv(dev);
+
+	priv->async_cmd = *cmd;
+
+	return 0;
+}
+
+static int sandbox_mmc_poll_data(struct udevice *dev, struct mmc_data *data)
+{
+	struct sandbox_mmc_priv *priv = dev_get_priv(dev);
+
+	return sandbox_mmc_send_cmd(dev, &priv->async_cmd, data);
+}
+#endif
+
+uint sandbox_mmc_get_cmd_count(struct udevice *dev, uint cmdidx)
+{
+	struct sandbox_mmc_priv *priv = dev_get_priv(dev);
+
+	return priv->cmd_count[cmdidx % ARRAY_SIZE(priv->cmd_count)];
+}
+
 static int sandbox_mmc_set_ios(struct udevice *dev)
 {
 	return 0;
@@ -141,6 +174,10 @@ static int sandbox_mmc_get_cd(struct udevice *dev)
 
 static const struct dm_mmc_ops sandbox_mmc_ops = {
 	.send_cmd = sandbox_mmc_send_cmd,
+#if CONFIG_IS_ENABLED(BLK_ASYNC)
+	.send_cmd_async = sandbox_mmc_send_cmd_async,
+	.poll_data = sandbox_mmc_poll_data,
+#endif
 	.set_ios = sandbox_mmc_set_ios,
 	.get_cd = sandbox_mmc_get_cd,
 };
@@ -213,7 +250,8 @@ static int sandbox_mmc_bind(struct udevice *dev)
 	struct mmc_config *cfg = &plat->cfg;
 
 	cfg->name = dev->name;
-	cfg->host_caps = MMC_MODE_HS_52MHz | MMC_MODE_HS | MMC_MODE_8BIT;
+	cfg->host_caps = MMC_MODE_HS_52MHz | MMC_MODE_HS | MMC_MODE_8BIT |
+			 MMC_CAP_CMD23;
 	cfg->voltages = MMC_VDD_165_195 | MMC_VDD_32_33 | MMC_VDD_33_34;
 	cfg->f_min = 1000000;
 	cfg->f_max = 52000000;
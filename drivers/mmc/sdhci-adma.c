@@ -27,6 +27,46 @@ static void sdhci_adma_desc(struct sdhci_adma_desc *desc,
 #endif
 }
 
+/**
+ * sdhci_adma_add_segment() - Add descriptors for a DMA segment
+ *
+ * @desc:	Next descriptor to fill in
+ * @addr:	DMA address of the segment
+ * @len:	Length of the segment in bytes, which must not be 0
+ *
+ * Segments longer than a descriptor can describe take several descriptors.
+ *
+ * Return: the descriptor after the last one filled in
+ */
+struct sdhci_adma_desc *sdhci_adma_add_segment(struct sdhci_adma_desc *desc,
+					       dma_addr_t addr, uint len)
+{
+	while (len > ADMA_MAX_LEN) {
+		sdhci_adma_desc(desc++, addr, ADMA_MAX_LEN, false);
+		addr += ADMA_MAX_LEN;
+		len -= ADMA_MAX_LEN;
+	}
+	sdhci_adma_desc(desc++, addr, len, false);
+
+	return desc;
+}
+
+/**
+ * sdhci_adma_finish_table() - Mark the end of the ADMA table and flush it
+ *
+ * @table:	Pointer to the ADMA table
+ * @end:	Descriptor after the last one filled in
+ */
+void sdhci_adma_finish_table(struct sdhci_adma_desc *table,
+			     struct sdhci_adma_desc *end)
+{
+	end[-1].attr |= ADMA_DESC_ATTR_END;
+
+	flush_cache((dma_addr_t)table,
+		    ROUND((end - table) * sizeof(struct sdhci_adma_desc),
+			  ARCH_DMA_MINALIGN));
+}
+
 /**
  * sdhci_prepare_adma_table() - Populate the ADMA table
  *
@@ -43,22 +83,9 @@ void sdhci_prepare_adma_table(struct sdhci_adma_desc *table,
 			      struct mmc_data *data, dma_addr_t addr)
 {
 	uint trans_bytes = data->blocksize * data->blocks;
-	uint desc_count = DIV_ROUND_UP(trans_bytes, ADMA_MAX_LEN);
-	struct sdhci_adma_desc *desc = table;
-	int i = desc_count;
 
-	while (--i) {
-		sdhci_adma_desc(desc, addr, ADMA_MAX_LEN, false);
-		addr += ADMA_MAX_LEN;
-		trans_bytes -= ADMA_MAX_LEN;
-		desc++;
-	}
-
-	sdhci_adma_desc(desc, addr, trans_bytes, true);
-
-	flush_cache((dma_addr_t)table,
-		    ROUND(desc_count * sizeof(struct sdhci_adma_desc),
-			  ARCH_DMA_MINALIGN));
+	sdhci_adma_finish_table(table, sdhci_adma_add_segment(table, addr,
+							      trans_bytes));
 }
 
 /**
@@ -71,6 +71,56 @@ static void sdhci_transfer_pio(struct sdhci_host *host, struct mmc_data *data)
 	}
 }
 
+#if CONFIG_IS_ENABLED(MMC_SDHCI_ADMA)
+/*
+ * Set up the ADMA table for a transfer of @data to or from @buf. The
+ * controller copes with any 32-bit aligned address, but cache maintenance
+ * works on whole cache lines. So a part of a cache line at either end of
+ * @buf is transferred through host->adma_bounce, and the rest goes straight
+ * to @buf. This avoids copying the whole buffer to an aligned one.
+ */
+static void sdhci_prepare_adma(struct sdhci_host *host, struct mmc_data *data,
+			       void *buf, uint trans_bytes)
+{
+	enum dma_data_direction dir = mmc_get_dma_dir(data);
+	struct sdhci_adma_desc *desc = host->adma_desc_table;
+	void *bounce = host->adma_bounce;
+	dma_addr_t bounce_addr = 0;
+	uint head, tail;
+
+	head = min_t(ulong, trans_bytes,
+		     ALIGN((ulong)buf, ARCH_DMA_MINALIGN) - (ulong)buf);
+	tail = 0;
+	if (head < trans_bytes)
+		tail = ((ulong)buf + trans_bytes) & (ARCH_DMA_MINALIGN - 1);
+	host->adma_head = head;
+	host->adma_tail = tail;
+
+	if (head || tail) {
+		if (dir == DMA_TO_DEVICE) {
+			memcpy(bounce, buf, head);
+			memcpy(bounce + ARCH_DMA_MINALIGN,
+			       buf + trans_bytes - tail, tail);
+		}
+		bounce_addr = dma_map_single(bounce, 2 * ARCH_DMA_MINALIGN,
+					     dir);
+	}
+	if (head)
+		desc = sdhci_adma_add_segment(desc, bounce_addr, head);
+
+	host->start_addr = dma_map_single(buf + head,
+					  trans_bytes - head - tail, dir);
+	if (trans_bytes > head + tail)
+		desc = sdhci_adma_add_segment(desc, host->start_addr,
+					      trans_bytes - head - tail);
+	if (tail)
+		desc = sdhci_adma_add_segment(desc,
+					      bounce_addr + ARCH_DMA_MINALIGN,
+					      tail);
+	sdhci_adma_finish_table(host->adma_desc_table, desc);
+}
+#endif
+
 #if (CONFIG_IS_ENABLED(MMC_SDHCI_SDMA) || CONFIG_IS_ENABLED(MMC_SDHCI_ADMA))
 static void sdhci_prepare_dma(struct sdhci_host *host, struct mmc_data *data,
 			      int *is_aligned, int trans_bytes)
@@ -102,17 +152,15 @@ static void sdhci_prepare_dma(struct sdhci_host *host, struct mmc_data *data,
 		buf = host->align_buffer;
 	}
 
-	host->start_addr = dma_map_single(buf, trans_bytes,
-					  mmc_get_dma_dir(data));
-
 	if (host->flags & USE_SDMA) {
+		host->start_addr = dma_map_single(buf, trans_bytes,
+						  mmc_get_dma_dir(data));
 		dma_addr = dev_phys_to_bus(mmc_to_dev(host->mmc), host->start_addr);
 		sdhci_writel(host, dma_addr, SDHCI_DMA_ADDRESS);
 	}
 #if CONFIG_IS_ENABLED(MMC_SDHCI_ADMA)
 	else if (host->flags & (USE_ADMA | USE_ADMA64)) {
-		sdhci_prepare_adma_table(host->adma_desc_table, data,
-					 host->start_addr);
+		sdhci_prepare_adma(host, data, buf, trans_bytes);
 
 		sdhci_writel(host, lower_32_bits(host->adma_addr),
 			     SDHCI_ADMA_ADDRESS);
@@ -122,10 +170,41 @@ static void sdhci_prepare_dma(struct sdhci_host *host, struct mmc_data *data,
 	}
 #endif
 }
+
+/* Make the data of a DMA transfer available to the CPU */
+static void sdhci_finish_dma(struct sdhci_host *host, struct mmc_data *data)
+{
+	enum dma_data_direction dir = mmc_get_dma_dir(data);
+	uint trans_bytes = data->blocks * data->blocksize;
+
+	if (!(host->flags & USE_DMA))
+		return;
+#if CONFIG_IS_ENABLED(MMC_SDHCI_ADMA)
+	if (host->flags & (USE_ADMA | USE_ADMA64)) {
+		uint head = host->adma_head, tail = host->adma_tail;
+		void *bounce = host->adma_bounce;
+
+		dma_unmap_single(host->start_addr, trans_bytes - head - tail,
+				 dir);
+		if ((head || tail) && dir == DMA_FROM_DEVICE) {
+			dma_unmap_single((ulong)bounce, 2 * ARCH_DMA_MINALIGN,
+					 dir);
+			memcpy(data->dest, bounce, head);
+			memcpy(data->dest + trans_bytes - tail,
+			       bounce + ARCH_DMA_MINALIGN, tail);
+		}
+		return;
+	}
+#endif
+	dma_unmap_single(host->start_addr, trans_bytes, dir);
+}
 #else
 static void sdhci_prepare_dma(struct sdhci_host *host, struct mmc_data *data,
 			      int *is_aligned, int trans_bytes)
 {}
+
+static void sdhci_finish_dma(struct sdhci_host *host, struct mmc_data *data)
+{}
 #endif
 static int sdhci_transfer_data(struct sdhci_host *host, struct mmc_data *data)
 {
@@ -178,10 +257,7 @@ static int sdhci_transfer_data(struct sdhci_host *host, struct mmc_data *data)
 		}
 	} while (!(stat & SDHCI_INT_DATA_END));
 
-#if (CONFIG_IS_ENABLED(MMC_SDHCI_SDMA) || CONFIG_IS_ENABLED(MMC_SDHCI_ADMA))
-	dma_unmap_single(host->start_addr, data->blocks * data->blocksize,
-			 mmc_get_dma_dir(data));
-#endif
+	sdhci_finish_dma(host, data);
 
 	return 0;
 }
@@ -196,18 +272,42 @@ static int sdhci_transfer_data(struct sdhci_host *host, struct mmc_data *data)
 #define SDHCI_CMD_MAX_TIMEOUT			3200
 #define SDHCI_CMD_DEFAULT_TIMEOUT		100
 #define SDHCI_READ_STATUS_TIMEOUT		1000
+/* Timeout for a data transfer in ms, as in sdhci_transfer_data() */
+#define SDHCI_DATA_TIMEOUT			10000
 
-#ifdef CONFIG_DM_MMC
-static int sdhci_send_command(struct udevice *dev, struct mmc_cmd *cmd,
-			      struct mmc_data *data)
+/* Finish a command, once its data has been transferred or it has failed */
+static int sdhci_end_command(struct sdhci_host *host, struct mmc_data *data,
+			     int ret, int is_aligned, int trans_bytes)
 {
-	struct mmc *mmc = mmc_get_mmc_dev(dev);
+	unsigned int stat;
 
-#else
-static int sdhci_send_command(struct mmc *mmc, struct mmc_cmd *cmd,
-			      struct mmc_data *data)
+	if (host->quirks & SDHCI_QUIRK_WAIT_SEND_CMD)
+		udelay(1000);
+
+	stat = sdhci_readl(host, SDHCI_INT_STATUS);
+	sdhci_writel(host, SDHCI_INT_ALL_MASK, SDHCI_INT_STATUS);
+	if (!ret) {
+		if ((host->quirks & SDHCI_QUIRK_32BIT_DMA_ADDR) &&
+				!is_aligned && (data->flags == MMC_DATA_READ))
+			memcpy(data->dest, host->align_buffer, trans_bytes);
+		return 0;
+	}
+
+	sdhci_reset(host, SDHCI_RESET_CMD);
+	sdhci_reset(host, SDHCI_RESET_DATA);
+	if (stat & SDHCI_INT_TIMEOUT)
+		return -ETIMEDOUT;
+	else
+		return -ECOMM;
+}
+
+/*
+ * Send a command and, unless @async is true, transfer its data. With @async
+ * the data transfer is left running, to be checked by sdhci_poll_data().
+ */
+static int sdhci_start_command(struct mmc *mmc, struct mmc_cmd *cmd,
+			       struct mmc_data *data, bool async)
 {
-#endif
 	struct sdhci_host *host = mmc->priv;
 	unsigned int stat = 0;
 	int ret = 0;
@@ -328,28 +428,71 @@ static int sdhci_send_command(struct mmc *mmc, struct mmc_cmd *cmd,
 	} else
 		ret = -1;
 
-	if (!ret && data)
+	if (!ret && data) {
+		if (async) {
+			host->data_start = get_timer(0);
+			return 0;
+		}
 		ret = sdhci_transfer_data(host, data);
+	}
 
-	if (host->quirks & SDHCI_QUIRK_WAIT_SEND_CMD)
-		udelay(1000);
+	return sdhci_end_command(host, data, ret, is_aligned, trans_bytes);
+}
+
+#ifdef CONFIG_DM_MMC
+static int sdhci_send_command(struct udevice *dev, struct mmc_cmd *cmd,
+			      struct mmc_data *data)
+{
+	return sdhci_start_command(mmc_get_mmc_dev(dev), cmd, data, false);
+}
+
+#if CONFIG_IS_ENABLED(BLK_ASYNC) && CONFIG_IS_ENABLED(MMC_SDHCI_ADMA)
+static int sdhci_send_command_async(struct udevice *dev, struct mmc_cmd *cmd,
+				    struct mmc_data *data)
+{
+	struct mmc *mmc = mmc_get_mmc_dev(dev);
+	struct sdhci_host *host = mmc->priv;
+
+	/* Only ADMA gets through the whole transfer without help */
+	if (!(host->flags & (USE_ADMA | USE_ADMA64)))
+		return -ENOSYS;
+
+	return sdhci_start_command(mmc, cmd, data, true);
+}
+
+static int sdhci_poll_data(struct udevice *dev, struct mmc_data *data)
+{
+	struct mmc *mmc = mmc_get_mmc_dev(dev);
+	struct sdhci_host *host = mmc->priv;
+	unsigned int stat;
+	int ret;
 
 	stat = sdhci_readl(host, SDHCI_INT_STATUS);
-	sdhci_writel(host, SDHCI_INT_ALL_MASK, SDHCI_INT_STATUS);
-	if (!ret) {
-		if ((host->quirks & SDHCI_QUIRK_32BIT_DMA_ADDR) &&
-				!is_aligned && (data->flags == MMC_DATA_READ))
-			memcpy(data->dest, host->align_buffer, trans_bytes);
-		return 0;
+	if (stat & SDHCI_INT_ERROR) {
+		pr_debug("%s: Error detected in status(0x%X)!\n",
+			 __func__, stat);
+		ret = -EIO;
+	} else if (stat & SDHCI_INT_DATA_END) {
+		sdhci_finish_dma(host, data);
+		ret = 0;
+	} else if (get_timer(host->data_start) >= SDHCI_DATA_TIMEOUT) {
+		printf("%s: Transfer data timeout\n", __func__);
+		ret = -ETIMEDOUT;
+	} else {
+		return -EAGAIN;
 	}
 
-	sdhci_reset(host, SDHCI_RESET_CMD);
-	sdhci_reset(host, SDHCI_RESET_DATA);
-	if (stat & SDHCI_INT_TIMEOUT)
-		return -ETIMEDOUT;
-	else
-		return -ECOMM;
+	/* ADMA never uses the aligned buffer */
+	return sdhci_end_command(host, data, ret, 1, 0);
 }
+#endif
+#else
+static int sdhci_send_command(struct mmc *mmc, struct mmc_cmd *cmd,
+			      struct mmc_data *data)
+{
+	return sdhci_start_command(mmc, cmd, data, false);
+}
+#endif
 
 #if defined(CONFIG_DM_MMC) && defined(MMC_SUPPORTS_TUNING)
 static int sdhci_execute_tuning(struct udevice *dev, uint opcode)
@@ -855,6 +998,10 @@ const struct dm_mmc_ops sdhci_ops = {
 #if CONFIG_IS_ENABLED(MMC_HS400_ES_SUPPORT)
 	.set_enhanced_strobe = sdhci_set_enhanced_strobe,
 #endif
+#if CONFIG_IS_ENABLED(BLK_ASYNC) && CONFIG_IS_ENABLED(MMC_SDHCI_ADMA)
+	.send_cmd_async	= sdhci_send_command_async,
+	.poll_data	= sdhci_poll_data,
+#endif
 };
 #else
 static const struct mmc_ops sdhci_ops = {
@@ -899,6 +1046,9 @@ int sdhci_setup_cfg(struct mmc_config *cfg, struct sdhci_host *host,
 	}
 	host->adma_desc_table = sdhci_adma_init();
 	host->adma_addr = (dma_addr_t)host->adma_desc_table;
+	host->adma_bounce = memalign(ARCH_DMA_MINALIGN, 2 * ARCH_DMA_MINALIGN);
+	if (!host->adma_desc_table || !host->adma_bounce)
+		return -ENOMEM;
 
 #ifdef CONFIG_DMA_ADDR_T_64BIT
 	host->flags |= USE_ADMA64;
@@ -1016,6 +1166,15 @@ int sdhci_setup_cfg(struct mmc_config *cfg, struct sdhci_host *host,
 	if (host->host_caps)
 		cfg->host_caps |= host->host_caps;
 
+	/*
+	 * CMD23 is sent as an ordinary command, but older controllers and
+	 * some newer ones mishandle the transfer which follows it. Those
+	 * stop multi-block transfers with CMD12, as other hosts do.
+	 */
+	if (SDHCI_GET_VERSION(host) >= SDHCI_SPEC_300 &&
+	    !(host->quirks & SDHCI_QUIRK_NO_CMD23))
+		cfg->host_caps |= MMC_CAP_CMD23;
+
 	cfg->b_max = CONFIG_SYS_MMC_MAX_BLK_COUNT;
 
 	return 0;
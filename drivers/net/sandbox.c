@@ -387,6 +387,71 @@ static int sb_eth_free_pkt(struct udevice *dev, uchar *packet, int length)
 	return 0;
 }
 
+static int sb_eth_rx_split(struct udevice *dev, int hdr_len)
+{
+	struct eth_sandbox_priv *priv = dev_get_priv(dev);
+	int i;
+
+	/* The device starts out with its own buffers, like real hardware */
+	priv->split_hdr_len = hdr_len;
+	priv->split_posted = hdr_len ? SANDBOX_ETH_SPLIT_BUFS : 0;
+	for (i = 0; i < priv->split_posted; i++)
+		priv->split_bufs[i] = NULL;
+
+	return SANDBOX_ETH_SPLIT_BUFS;
+}
+
+static int sb_eth_rx_post(struct udevice *dev, void *buf, int len)
+{
+	struct eth_sandbox_priv *priv = dev_get_priv(dev);
+
+	if (priv->split_posted >= SANDBOX_ETH_SPLIT_BUFS)
+		return -ENOSPC;
+
+	priv->split_bufs[priv->split_posted] = buf;
+	priv->split_lens[priv->split_posted] = len;
+	++priv->split_posted;
+
+	return 0;
+}
+
+static int sb_eth_recv_split(struct udevice *dev, int flags, uchar **hdrp,
+			     uchar **datap)
+{
+	struct eth_sandbox_priv *priv = dev_get_priv(dev);
+	int hdr_len = priv->split_hdr_len;
+	uchar *buf;
+	int len;
+	int i;
+
+	len = sb_eth_recv(dev, flags, hdrp);
+	if (len <= 0)
+		return len;
+
+	/* Like real hardware, drop the frame if there is nowhere to put it */
+	if (!priv->split_posted) {
+		sb_eth_free_pkt(dev, *hdrp, len);
+		return -EAGAIN;
+	}
+
+	/* The driver's own buffer is the rest of the receive buffer */
+	buf = priv->split_bufs[0];
+	if (!buf)
+		buf = *hdrp + hdr_len;
+	else if (len > hdr_len)
+		memcpy(buf, *hdrp + hdr_len,
+		       min(len - hdr_len, priv->split_lens[0]));
+	*datap = buf;
+
+	--priv->split_posted;
+	for (i = 0; i < priv->split_posted; i++) {
+		priv->split_bufs[i] = priv->split_bufs[i + 1];
+		priv->split_lens[i] = priv->split_lens[i + 1];
+	}
+
+	return len;
+}
+
 static void sb_eth_stop(struct udevice *dev)
 {
 	debug("eth_sandbox: Stop\n");
@@ -408,6 +473,9 @@ static const struct eth_ops sb_eth_ops = {
 	.send			= sb_eth_send,
 	.recv			= sb_eth_recv,
 	.free_pkt		= sb_eth_free_pkt,
+	.rx_split		= sb_eth_rx_split,
+	.rx_post		= sb_eth_rx_post,
+	.recv_split		= sb_eth_recv_split,
 	.stop			= sb_eth_stop,
 	.write_hwaddr		= sb_eth_write_hwaddr,
 };
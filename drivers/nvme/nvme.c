@@ -18,7 +18,7 @@
 #include <linux/compat.h>
 #include "nvme.h"
 
-#define NVME_Q_DEPTH		2
+#define NVME_Q_DEPTH		CONFIG_NVME_QUEUE_DEPTH
 #define NVME_AQ_DEPTH		2
 #define NVME_SQ_SIZE(depth)	(depth * sizeof(struct nvme_command))
 #define NVME_CQ_SIZE(depth)	(depth * sizeof(struct nvme_completion))
@@ -26,7 +26,6 @@
 				      ARCH_DMA_MINALIGN)
 #define ADMIN_TIMEOUT		60
 #define IO_TIMEOUT		30
-#define MAX_PRP_POOL		512
 
 static int nvme_wait_csts(struct nvme_dev *dev, u32 mask, u32 val)
 {
@@ -45,8 +44,8 @@ static int nvme_wait_csts(struct nvme_dev *dev, u32 mask, u32 val)
 	return -ETIME;
 }
 
-static int nvme_setup_prps(struct nvme_dev *dev, u64 *prp2,
-			   int total_len, u64 dma_addr)
+static int nvme_setup_prps(struct nvme_dev *dev, struct nvme_io_slot *slot,
+			   u64 *prp2, int total_len, u64 dma_addr)
 {
 	u32 page_size = dev->page_size;
 	int offset = dma_addr & (page_size - 1);
@@ -74,37 +73,39 @@ static int nvme_setup_prps(struct nvme_dev *dev, u64 *prp2,
 	nprps = DIV_ROUND_UP(length, page_size);
 	num_pages = DIV_ROUND_UP(nprps - 1, prps_per_page - 1);
 
-	if (nprps > dev->prp_entry_num) {
-		free(dev->prp_pool);
+	if (nprps > slot->prp_entry_num) {
+		free(slot->prp_pool);
 		/*
 		 * Always increase in increments of pages.  It doesn't waste
 		 * much memory and reduces the number of allocations.
 		 */
-		dev->prp_pool = memalign(page_size, num_pages * page_size);
-		if (!dev->prp_pool) {
+		slot->prp_pool = memalign(page_size, num_pages * page_size);
+		if (!slot->prp_pool) {
+			slot->prp_entry_num = 0;
 			printf("Error: malloc prp_pool fail\n");
 			return -ENOMEM;
 		}
-		dev->prp_entry_num = num_pages * (prps_per_page - 1) + 1;
+		slot->prp_entry_num = num_pages * (prps_per_page - 1) + 1;
 	}
 
-	prp_pool = dev->prp_pool;
+	prp_pool = slot->prp_pool;
 	i = 0;
 	while (nprps) {
 		if ((i == (prps_per_page - 1)) && nprps > 1) {
 			*(prp_pool + i) = cpu_to_le64((ulong)prp_pool +
 					page_size);
 			i = 0;
-			prp_pool += page_size;
+			prp_pool += prps_per_page;
 		}
 		*(prp_pool + i++) = cpu_to_le64(dma_addr);
 		dma_addr += page_size;
 		nprps--;
 	}
-	*prp2 = (ulong)dev->prp_pool;
+	*prp2 = (ulong)slot->prp_pool;
 
-	flush_dcache_range((ulong)dev->prp_pool, (ulong)dev->prp_pool +
-			   num_pages * page_size);
+	/* Only the entries written need to reach memory */
+	flush_dcache_range((ulong)slot->prp_pool,
+			   ALIGN((ulong)(prp_pool + i), ARCH_DMA_MINALIGN));
 
 	return 0;
 }
@@ -159,52 +160,36 @@ static void nvme_submit_cmd(struct nvme_queue *nvmeq, struct nvme_command *cmd)
 	nvmeq->sq_tail = tail;
 }
 
-static int nvme_submit_sync_cmd(struct nvme_queue *nvmeq,
-				struct nvme_command *cmd,
-				u32 *result, unsigned timeout)
+/**
+ * nvme_poll_cmd() - check whether the next command in a queue has completed
+ *
+ * @nvmeq:	The queue the command was sent to
+ * @cmd:	The command
+ * @result:	Returns the result field of the completion, if not NULL
+ * Return: 0 if the command completed, -EAGAIN if it has not completed yet,
+ * -EIO if it failed
+ */
+static int nvme_poll_cmd(struct nvme_queue *nvmeq, struct nvme_command *cmd,
+			 u32 *result)
 {
 	struct nvme_ops *ops;
 	u16 head = nvmeq->cq_head;
 	u16 phase = nvmeq->cq_phase;
 	u16 status;
-	ulong start_time;
-	ulong timeout_us = timeout * 100000;
 
-	cmd->common.command_id = nvme_get_cmd_id();
-	nvme_submit_cmd(nvmeq, cmd);
-
-	start_time = timer_get_us();
-
-	for (;;) {
-		status = nvme_read_completion_status(nvmeq, head);
-		if ((status & 0x01) == phase)
-			break;
-		if (timeout_us > 0 && (timer_get_us() - start_time)
-		    >= timeout_us)
-			return -ETIMEDOUT;
-	}
+	status = nvme_read_completion_status(nvmeq, head);
+	if ((status & 0x01) != phase)
+		return -EAGAIN;
 
 	ops = (struct nvme_ops *)nvmeq->dev->udev->driver->ops;
 	if (ops && ops->complete_cmd)
 		ops->complete_cmd(nvmeq, cmd);
 
 	status >>= 1;
-	if (status) {
+	if (status)
 		printf("ERROR: status = %x, phase = %d, head = %d\n",
 		       status, phase, head);
-		status = 0;
-		if (++head == nvmeq->q_depth) {
-			head = 0;
-			phase = !phase;
-		}
-		writel(head, nvmeq->q_db + nvmeq->dev->db_stride);
-		nvmeq->cq_head = head;
-		nvmeq->cq_phase = phase;
-
-		return -EIO;
-	}
-
-	if (result)
+	else if (result)
 		*result = readl(&(nvmeq->cqes[head].result));
 
 	if (++head == nvmeq->q_depth) {
@@ -215,7 +200,30 @@ static int nvme_submit_sync_cmd(struct nvme_queue *nvmeq,
 	nvmeq->cq_head = head;
 	nvmeq->cq_phase = phase;
 
-	return status;
+	return status ? -EIO : 0;
+}
+
+static int nvme_submit_sync_cmd(struct nvme_queue *nvmeq,
+				struct nvme_command *cmd,
+				u32 *result, unsigned timeout)
+{
+	ulong start_time;
+	ulong timeout_us = timeout * 100000;
+	int ret;
+
+	cmd->common.command_id = nvme_get_cmd_id();
+	nvme_submit_cmd(nvmeq, cmd);
+
+	start_time = timer_get_us();
+
+	for (;;) {
+		ret = nvme_poll_cmd(nvmeq, cmd, result);
+		if (ret != -EAGAIN)
+			return ret;
+		if (timeout_us > 0 && (timer_get_us() - start_time)
+		    >= timeout_us)
+			return -ETIMEDOUT;
+	}
 }
 
 static int nvme_submit_admin_cmd(struct nvme_dev *dev, struct nvme_command *cmd,
@@ -742,65 +750,180 @@ static int nvme_blk_probe(struct udevice *udev)
 	return 0;
 }
 
+/* Set up a read or write command for @lbas blocks at @slba in @slot */
+static int nvme_blk_setup_cmd(struct nvme_ns *ns, struct nvme_io_slot *slot,
+			      bool read, u64 slba, u32 lbas, uintptr_t buffer)
+{
+	struct nvme_command *c = &slot->cmd;
+	u64 prp2;
+
+	if (nvme_setup_prps(ns->dev, slot, &prp2, lbas << ns->lba_shift,
+			    buffer))
+		return -EIO;
+
+	memset(c, '\0', sizeof(*c));
+	c->rw.opcode = read ? nvme_cmd_read : nvme_cmd_write;
+	c->rw.nsid = cpu_to_le32(ns->ns_id);
+	c->rw.slba = cpu_to_le64(slba);
+	c->rw.length = cpu_to_le16(lbas - 1);
+	c->rw.prp1 = cpu_to_le64(buffer);
+	c->rw.prp2 = cpu_to_le64(prp2);
+
+	return 0;
+}
+
+/* Get the largest number of blocks a command can transfer */
+static u32 nvme_blk_max_lbas(struct nvme_ns *ns)
+{
+	/* The length field of a command is 16 bits */
+	return min(1U << (ns->dev->max_transfer_shift - ns->lba_shift),
+		   0x10000U);
+}
+
+/*
+ * Send commands for the rest of @req while the I/O queue has room. Each
+ * command transfers as many blocks as the controller allows, so that a
+ * large transfer keeps the controller busy with up to q_depth - 1 commands.
+ */
+static int nvme_blk_send(struct udevice *udev, struct blk_req *req)
+{
+	struct nvme_ns *ns = dev_get_priv(udev);
+	struct nvme_dev *dev = ns->dev;
+	u32 max_lbas = nvme_blk_max_lbas(ns);
+	struct nvme_io_slot *slot;
+	uintptr_t buffer;
+	u32 lbas;
+	u16 id;
+	int ret;
+
+	while (dev->io_sent < dev->io_end &&
+	       dev->io_inflight < dev->q_depth - 1) {
+		for (id = 0; dev->io_slots[id].lbas; id++)
+			;
+		slot = &dev->io_slots[id];
+		lbas = min_t(lbaint_t, max_lbas, dev->io_end - dev->io_sent);
+		buffer = (uintptr_t)req->buffer +
+			 (dev->io_sent << ns->lba_shift);
+		ret = nvme_blk_setup_cmd(ns, slot, !req->write,
+					 req->start + dev->io_sent, lbas,
+					 buffer);
+		if (ret)
+			return ret;
+		slot->pos = dev->io_sent;
+		slot->lbas = lbas;
+		slot->cmd.common.command_id = cpu_to_le16(id);
+		nvme_submit_cmd(dev->queues[NVME_IO_Q], &slot->cmd);
+		dev->io_sent += slot->lbas;
+		dev->io_inflight++;
+		dev->io_start = timer_get_us();
+	}
+
+	return 0;
+}
+
+/* Start a transfer of all of @req, flushing its buffer first */
+static int nvme_blk_start(struct udevice *udev, struct blk_req *req)
+{
+	struct nvme_ns *ns = dev_get_priv(udev);
+	struct nvme_dev *dev = ns->dev;
+
+	flush_dcache_range((ulong)req->buffer, (ulong)req->buffer +
+			   (req->blkcnt << ns->lba_shift));
+	dev->io_sent = 0;
+	dev->io_end = req->blkcnt;
+
+	return nvme_blk_send(udev, req);
+}
+
+/* Get the slot of the next completed command on the I/O queue, if any */
+static struct nvme_io_slot *nvme_blk_next_done(struct nvme_dev *dev)
+{
+	struct nvme_queue *nvmeq = dev->queues[NVME_IO_Q];
+	u16 status;
+
+	status = nvme_read_completion_status(nvmeq, nvmeq->cq_head);
+	if ((status & 0x01) != nvmeq->cq_phase)
+		return NULL;
+
+	return &dev->io_slots[readw(&nvmeq->cqes[nvmeq->cq_head].command_id) %
+			      (dev->q_depth - 1)];
+}
+
+/*
+ * Collect the commands of @req which have completed and send more. The
+ * transfer is cut short at the first command which fails, but the
+ * commands after it which are already in flight are waited for.
+ *
+ * Return: -EAGAIN while commands are in flight, 0 when the transfer is over,
+ * with dev->io_end blocks done, or -ETIMEDOUT
+ */
+static int nvme_blk_run(struct udevice *udev, struct blk_req *req)
+{
+	struct nvme_ns *ns = dev_get_priv(udev);
+	struct nvme_dev *dev = ns->dev;
+	struct nvme_io_slot *slot;
+	int i, ret;
+
+	while (dev->io_inflight && (slot = nvme_blk_next_done(dev))) {
+		ret = nvme_poll_cmd(dev->queues[NVME_IO_Q], &slot->cmd, NULL);
+		/* Ignore a late completion of a command which timed out */
+		if (!slot->lbas)
+			continue;
+		if (ret)
+			dev->io_end = min(dev->io_end, slot->pos);
+		slot->lbas = 0;
+		dev->io_inflight--;
+	}
+	if (nvme_blk_send(udev, req))
+		dev->io_end = dev->io_sent;
+	if (!dev->io_inflight)
+		return 0;
+	if (timer_get_us() - dev->io_start < IO_TIMEOUT * 100000)
+		return -EAGAIN;
+
+	for (i = 0; i < dev->q_depth - 1; i++) {
+		slot = &dev->io_slots[i];
+		if (slot->lbas)
+			dev->io_end = min(dev->io_end, slot->pos);
+		slot->lbas = 0;
+	}
+	dev->io_inflight = 0;
+
+	return -ETIMEDOUT;
+}
+
 static ulong nvme_blk_rw(struct udevice *udev, lbaint_t blknr,
 			 lbaint_t blkcnt, void *buffer, bool read)
 {
 	struct nvme_ns *ns = dev_get_priv(udev);
 	struct nvme_dev *dev = ns->dev;
-	struct nvme_command c;
-	struct blk_desc *desc = dev_get_uclass_plat(udev);
-	int status;
-	u64 prp2;
-	u64 total_len = blkcnt << desc->log2blksz;
-	u64 temp_len = total_len;
-	uintptr_t temp_buffer = (uintptr_t)buffer;
-
-	u64 slba = blknr;
-	u16 lbas = 1 << (dev->max_transfer_shift - ns->lba_shift);
-	u64 total_lbas = blkcnt;
-
-	flush_dcache_range((unsigned long)buffer,
-			   (unsigned long)buffer + total_len);
-
-	c.rw.opcode = read ? nvme_cmd_read : nvme_cmd_write;
-	c.rw.flags = 0;
-	c.rw.nsid = cpu_to_le32(ns->ns_id);
-	c.rw.control = 0;
-	c.rw.dsmgmt = 0;
-	c.rw.reftag = 0;
-	c.rw.apptag = 0;
-	c.rw.appmask = 0;
-	c.rw.metadata = 0;
-
-	while (total_lbas) {
-		if (total_lbas < lbas) {
-			lbas = (u16)total_lbas;
-			total_lbas = 0;
-		} else {
-			total_lbas -= lbas;
-		}
+	struct blk_req req = {
+		.dev = udev,
+		.start = blknr,
+		.blkcnt = blkcnt,
+		.buffer = buffer,
+		.write = !read,
+	};
+	int ret;
 
-		if (nvme_setup_prps(dev, &prp2,
-				    lbas << ns->lba_shift, temp_buffer))
-			return -EIO;
-		c.rw.slba = cpu_to_le64(slba);
-		slba += lbas;
-		c.rw.length = cpu_to_le16(lbas - 1);
-		c.rw.prp1 = cpu_to_le64(temp_buffer);
-		c.rw.prp2 = cpu_to_le64(prp2);
-		status = nvme_submit_sync_cmd(dev->queues[NVME_IO_Q],
-				&c, NULL, IO_TIMEOUT);
-		if (status)
-			break;
-		temp_len -= (u32)lbas << ns->lba_shift;
-		temp_buffer += lbas << ns->lba_shift;
-	}
+#if CONFIG_IS_ENABLED(BLK_ASYNC)
+	/* The I/O queue is in use until the request completes */
+	if (dev->io_req)
+		blk_wait(dev->io_req);
+#endif
+
+	ret = nvme_blk_start(udev, &req);
+	if (ret)
+		dev->io_end = dev->io_sent;
+	do {
+		ret = nvme_blk_run(udev, &req);
+	} while (ret == -EAGAIN);
 
 	if (read)
-		invalidate_dcache_range((unsigned long)buffer,
-					(unsigned long)buffer + total_len);
+		invalidate_dcache_range((ulong)buffer, (ulong)buffer +
+					(blkcnt << ns->lba_shift));
 
-	return (total_len - temp_len) >> desc->log2blksz;
+	return dev->io_end;
 }
 
 static ulong nvme_blk_read(struct udevice *udev, lbaint_t blknr,
@@ -815,9 +938,55 @@ static ulong nvme_blk_write(struct udevice *udev, lbaint_t blknr,
 	return nvme_blk_rw(udev, blknr, blkcnt, (void *)buffer, false);
 }
 
+#if CONFIG_IS_ENABLED(BLK_ASYNC)
+static int nvme_blk_submit(struct udevice *udev, struct blk_req *req)
+{
+	struct nvme_ns *ns = dev_get_priv(udev);
+	struct nvme_dev *dev = ns->dev;
+	int ret;
+
+	/* One request at a time, though it can have many commands in flight */
+	if (dev->io_req)
+		return -EBUSY;
+
+	ret = nvme_blk_start(udev, req);
+	if (ret && !dev->io_inflight)
+		return ret;
+	if (ret)
+		dev->io_end = dev->io_sent;
+	dev->io_req = req;
+
+	return 0;
+}
+
+static int nvme_blk_poll(struct udevice *udev, struct blk_req *req)
+{
+	struct nvme_ns *ns = dev_get_priv(udev);
+	struct nvme_dev *dev = ns->dev;
+	int ret;
+
+	ret = nvme_blk_run(udev, req);
+	if (ret == -EAGAIN)
+		return ret;
+
+	dev->io_req = NULL;
+	if (!req->write)
+		invalidate_dcache_range((ulong)req->buffer, (ulong)req->buffer +
+					(req->blkcnt << ns->lba_shift));
+	req->done = dev->io_end;
+	blk_req_complete(req, req->done ? req->done : ret ? ret : -EIO);
+
+	return 0;
+}
+#endif
+
 static const struct blk_ops nvme_blk_ops = {
 	.read	= nvme_blk_read,
 	.write	= nvme_blk_write,
+#if CONFIG_IS_ENABLED(BLK_ASYNC)
+	.submit	= nvme_blk_submit,
+	.poll	= nvme_blk_poll,
+#endif
 };
 
 U_BOOT_DRIVER(nvme_blk) = {
@@ -832,6 +1001,7 @@ int nvme_init(struct udevice *udev)
 {
 	struct nvme_dev *ndev = dev_get_priv(udev);
 	struct nvme_id_ns *id;
+	struct nvme_ops *ops;
 	int ret;
 
 	ndev->udev = udev;
@@ -852,6 +1022,13 @@ int nvme_init(struct udevice *udev)
 
 	ndev->cap = nvme_readq(&ndev->bar->cap);
 	ndev->q_depth = min_t(int, NVME_CAP_MQES(ndev->cap) + 1, NVME_Q_DEPTH);
+	/*
+	 * Controller-specific submission only moves the queue on when a
+	 * command completes, so keep to one command at a time
+	 */
+	ops = (struct nvme_ops *)udev->driver->ops;
+	if (ops && ops->submit_cmd)
+		ndev->q_depth = min(ndev->q_depth, 2);
 	ndev->db_stride = 1 << NVME_CAP_STRIDE(ndev->cap);
 	ndev->dbs = ((void __iomem *)ndev->bar) + 4096;
 
@@ -861,14 +1038,13 @@ int nvme_init(struct udevice *udev)
 		goto free_queue;
 	}
 
-	/* Allocate after the page size is known */
-	ndev->prp_pool = memalign(ndev->page_size, MAX_PRP_POOL);
-	if (!ndev->prp_pool) {
+	/* PRP lists are allocated as needed, then kept for the next command */
+	ndev->io_slots = calloc(ndev->q_depth - 1, sizeof(*ndev->io_slots));
+	if (!ndev->io_slots) {
 		ret = -ENOMEM;
 		printf("Error: %s: Out of memory!\n", udev->name);
-		goto free_nvme;
+		goto free_queue;
 	}
-	ndev->prp_entry_num = MAX_PRP_POOL >> 3;
 
 	ret = nvme_setup_io_queues(ndev);
 	if (ret) {
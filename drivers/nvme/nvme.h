@@ -7,6 +7,7 @@
 #ifndef __DRIVER_NVME_H__
 #define __DRIVER_NVME_H__
 
+#include <blk.h>
 #include <asm/io.h>
 
 struct nvme_id_power_state {
@@ -594,6 +595,18 @@ enum {
 	NVME_CSTS_SHST_MASK	= 3 << 2,
 };
 
+/*
+ * A read or write command on the I/O queue. The command ID is the index of
+ * the slot, so that completions can be matched up in any order.
+ */
+struct nvme_io_slot {
+	struct nvme_command cmd;
+	u64 *prp_pool;		/* PRP list pages, kept for the next command */
+	u32 prp_entry_num;	/* number of PRP entries prp_pool can hold */
+	lbaint_t pos;		/* first block of the command in the transfer */
+	u32 lbas;		/* number of blocks, 0 if the slot is free */
+};
+
 /* Represents an NVM Express device. Each nvme_dev is a PCI function. */
 struct nvme_dev {
 	struct udevice *udev;
@@ -618,9 +631,15 @@ struct nvme_dev {
 	u32 stripe_size;
 	u32 page_size;
 	u8 vwc;
-	u64 *prp_pool;
-	u32 prp_entry_num;
 	u32 nn;
+	/* Commands which can be in flight on the I/O queue, q_depth - 1 */
+	struct nvme_io_slot *io_slots;
+	u16 io_inflight;	/* number of io_slots in use */
+	lbaint_t io_sent;	/* blocks of the transfer sent so far */
+	lbaint_t io_end;	/* blocks to transfer, cut short by an error */
+	ulong io_start;		/* time of the last command sent, in us */
+	/* Asynchronous block request on the I/O queue, if any */
+	struct blk_req *io_req;
 };
 
 /* Admin queue and a single I/O queue. */
@@ -24,6 +24,16 @@ int scsi_exec(struct udevice *dev, struct scsi_cmd *pccb)
 	return ops->exec(dev, pccb);
 }
 
+int scsi_exec_queue(struct udevice *dev, struct scsi_cmd *cmds, int count)
+{
+	struct scsi_ops *ops = scsi_get_ops(dev);
+
+	if (!ops->exec_queue)
+		return -ENOSYS;
+
+	return ops->exec_queue(dev, cmds, count);
+}
+
 int scsi_bus_reset(struct udevice *dev)
 {
 	struct scsi_ops *ops = scsi_get_ops(dev);
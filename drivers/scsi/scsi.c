@@ -23,6 +23,11 @@
 
 static struct scsi_cmd tempccb;	/* temporary scsi command buffer */
 
+/* number of read commands scsi_read() hands to the controller at once */
+#define SCSI_MAX_QUEUE	8
+
+static struct scsi_cmd queueccb[SCSI_MAX_QUEUE];
+
 DEFINE_CACHE_ALIGN_BUFFER(u8, tempbuff, 512);	/* temporary data buffer */
 
 /* almost the maximum amount of the scsi_ext command.. */
@@ -128,14 +133,11 @@ static ulong scsi_read(struct udevice *dev, lbaint_t blknr, lbaint_t blkcnt,
 	struct blk_desc *block_dev = dev_get_uclass_plat(dev);
 	struct udevice *bdev = dev->parent;
 	struct scsi_plat *uc_plat = dev_get_uclass_plat(bdev);
-	lbaint_t start, blks, max_blks;
+	lbaint_t start, blks, max_blks, blocks, done = 0;
 	uintptr_t buf_addr;
-	unsigned short smallblks = 0;
-	struct scsi_cmd *pccb = (struct scsi_cmd *)&tempccb;
+	struct scsi_cmd *pccb;
+	int count, i, ret;
 
-	/* Setup device */
-	pccb->target = block_dev->target;
-	pccb->lun = block_dev->lun;
 	buf_addr = (unsigned long)buffer;
 	start = blknr;
 	blks = blkcnt;
@@ -147,45 +149,51 @@ static ulong scsi_read(struct udevice *dev, lbaint_t blknr, lbaint_t blkcnt,
 	debug("\nscsi_read: dev %d startblk " LBAF
 	      ", blccnt " LBAF " buffer %lx\n",
 	      block_dev->devnum, start, blks, (unsigned long)buffer);
-	do {
-		pccb->pdata = (unsigned char *)buf_addr;
-		pccb->dma_dir = DMA_FROM_DEVICE;
-#ifdef CONFIG_SYS_64BIT_LBA
-		if (start > SCSI_LBA48_READ) {
-			unsigned long blocks;
-			blocks = min_t(lbaint_t, blks, max_blks);
+	while (blks) {
+		/* Split the request into commands which are sent together */
+		for (count = 0; count < SCSI_MAX_QUEUE && blks; count++) {
+			pccb = &queueccb[count];
+			pccb->target = block_dev->target;
+			pccb->lun = block_dev->lun;
+			pccb->pdata = (unsigned char *)buf_addr;
+			pccb->dma_dir = DMA_FROM_DEVICE;
+			blocks = min(blks, max_blks);
 			pccb->datalen = block_dev->blksz * blocks;
-			scsi_setup_read16(pccb, start, blocks);
+#ifdef CONFIG_SYS_64BIT_LBA
+			if (start > SCSI_LBA48_READ)
+				scsi_setup_read16(pccb, start, blocks);
+			else
+#endif
+				scsi_setup_read_ext(pccb, start, blocks);
+			debug("scsi_read_ext: startblk " LBAF
+			      ", blccnt " LBAF " buffer %lX\n",
+			      start, blocks, buf_addr);
 			start += blocks;
 			blks -= blocks;
-		} else
-#endif
-		if (blks > max_blks) {
-			pccb->datalen = block_dev->blksz * max_blks;
-			smallblks = max_blks;
-			scsi_setup_read_ext(pccb, start, smallblks);
-			start += max_blks;
-			blks -= max_blks;
-		} else {
-			pccb->datalen = block_dev->blksz * blks;
-			smallblks = (unsigned short)blks;
-			scsi_setup_read_ext(pccb, start, smallblks);
-			start += blks;
-			blks = 0;
+			buf_addr += pccb->datalen;
 		}
-		debug("scsi_read_ext: startblk " LBAF
-		      ", blccnt %x buffer %lX\n",
-		      start, smallblks, buf_addr);
-		if (scsi_exec(bdev, pccb)) {
-			scsi_print_error(pccb);
-			blkcnt -= blks;
+
+		ret = scsi_exec_queue(bdev, queueccb, count);
+		if (ret == -ENOSYS) {
+			/* The controller takes one command at a time */
+			for (i = 0; i < count; i++) {
+				ret = scsi_exec(bdev, &queueccb[i]);
+				if (ret)
+					break;
+				done += queueccb[i].datalen / block_dev->blksz;
+			}
+		} else if (!ret) {
+			for (i = 0; i < count; i++)
+				done += queueccb[i].datalen / block_dev->blksz;
+		}
+		if (ret) {
+			scsi_print_error(&queueccb[0]);
 			break;
 		}
-		buf_addr += pccb->datalen;
-	} while (blks != 0);
+	}
 	debug("scsi_read_ext: end startblk " LBAF
-	      ", blccnt %x buffer %lX\n", start, smallblks, buf_addr);
-	return blkcnt;
+	      ", blccnt " LBAF " buffer %lX\n", start, done, buf_addr);
+	return done;
 }
 
 /*******************************************************************************
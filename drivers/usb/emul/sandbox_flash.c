@@ -19,15 +19,28 @@
  * This driver emulates a flash stick using the UFI command specification and
  * the BBB (bulk/bulk/bulk) protocol. It supports only a single logical unit
  * number (LUN 0).
+ *
+ * With the "sandbox,uas" property it is a SuperSpeed SCSI device instead,
+ * which also offers the UAS (USB Attached SCSI) protocol in alternate setting
+ * 1. Its data and status pipes have streams, and it serves the commands
+ * queued with it last first, as a real device may serve them in any order.
  */
 
 enum {
 	SANDBOX_FLASH_EP_OUT		= 1,	/* endpoints */
 	SANDBOX_FLASH_EP_IN		= 2,
+	SANDBOX_FLASH_EP_CMD		= 3,	/* UAS only */
+	SANDBOX_FLASH_EP_STATUS		= 4,
 	SANDBOX_FLASH_BLOCK_LEN		= 512,
 	SANDBOX_FLASH_BUF_SIZE		= 512,
+	SANDBOX_FLASH_UAS_ALT		= 1,
+	/* Fewer than U-Boot asks for, so it must go by what it gets */
+	SANDBOX_FLASH_UAS_STREAMS	= 2,
 };
 
+/* SCSI status of a command which failed, with sense data to say why */
+#define SANDBOX_FLASH_CHECK_CONDITION	0x02
+
 enum {
 	STRINGID_MANUFACTURER = 1,
 	STRINGID_PRODUCT,
@@ -45,6 +58,8 @@ enum {
  * @fd:		File descriptor of backing file
  * @file_size:	Size of file in bytes
  * @status_buff:	Data buffer for outgoing status
+ * @alt:	Alternate setting of the interface
+ * @queued:	Number of times more than one UAS command was queued at once
  */
 struct sandbox_flash_priv {
 	struct scsi_emul_info eminfo;
@@ -52,13 +67,24 @@ struct sandbox_flash_priv {
 	u32 tag;
 	int fd;
 	struct umass_bbb_csw status;
+	int alt;
+	int queued;
 };
 
 struct sandbox_flash_plat {
 	const char *pathname;
+	bool uas;
 	struct usb_string flash_strings[STRINGID_COUNT];
 };
 
+/* Pipe usage descriptor, which says what each UAS endpoint is for */
+struct sandbox_flash_pipe_usage {
+	u8 bLength;
+	u8 bDescriptorType;
+	u8 bPipeID;
+	u8 Reserved;
+} __packed;
+
 static struct usb_device_descriptor flash_device_desc = {
 	.bLength =		sizeof(flash_device_desc),
 	.bDescriptorType =	USB_DT_DEVICE,
@@ -131,10 +157,137 @@ static void *flash_desc_list[] = {
 	NULL,
 };
 
+static struct usb_device_descriptor uas_device_desc = {
+	.bLength =		sizeof(uas_device_desc),
+	.bDescriptorType =	USB_DT_DEVICE,
+
+	.bcdUSB =		__constant_cpu_to_le16(0x0300),
+
+	.bDeviceClass =		0,
+	.bDeviceSubClass =	0,
+	.bDeviceProtocol =	0,
+
+	.idVendor =		__constant_cpu_to_le16(0x1234),
+	.idProduct =		__constant_cpu_to_le16(0x5679),
+	.iManufacturer =	STRINGID_MANUFACTURER,
+	.iProduct =		STRINGID_PRODUCT,
+	.iSerialNumber =	STRINGID_SERIAL,
+	.bNumConfigurations =	1,
+};
+
+static struct usb_config_descriptor uas_config0 = {
+	.bLength		= sizeof(uas_config0),
+	.bDescriptorType	= USB_DT_CONFIG,
+
+	/* wTotalLength is set up by usb-emul-uclass */
+	.bNumInterfaces		= 1,
+	.bConfigurationValue	= 0,
+	.iConfiguration		= 0,
+	.bmAttributes		= 1 << 7,
+	.bMaxPower		= 50,
+};
+
+static struct usb_interface_descriptor uas_interface0_bbb = {
+	.bLength		= sizeof(uas_interface0_bbb),
+	.bDescriptorType	= USB_DT_INTERFACE,
+
+	.bInterfaceNumber	= 0,
+	.bAlternateSetting	= 0,
+	.bNumEndpoints		= 2,
+	.bInterfaceClass	= USB_CLASS_MASS_STORAGE,
+	.bInterfaceSubClass	= US_SC_SCSI,
+	.bInterfaceProtocol	= US_PR_BULK,
+	.iInterface		= 0,
+};
+
+static struct usb_interface_descriptor uas_interface0_uas = {
+	.bLength		= sizeof(uas_interface0_uas),
+	.bDescriptorType	= USB_DT_INTERFACE,
+
+	.bInterfaceNumber	= 0,
+	.bAlternateSetting	= SANDBOX_FLASH_UAS_ALT,
+	.bNumEndpoints		= 4,
+	.bInterfaceClass	= USB_CLASS_MASS_STORAGE,
+	.bInterfaceSubClass	= US_SC_SCSI,
+	.bInterfaceProtocol	= US_PR_UAS,
+	.iInterface		= 0,
+};
+
+static struct usb_endpoint_descriptor uas_endpoint_cmd = {
+	.bLength		= USB_DT_ENDPOINT_SIZE,
+	.bDescriptorType	= USB_DT_ENDPOINT,
+
+	.bEndpointAddress	= SANDBOX_FLASH_EP_CMD,
+	.bmAttributes		= USB_ENDPOINT_XFER_BULK,
+	.wMaxPacketSize		= __constant_cpu_to_le16(1024),
+	.bInterval		= 0,
+};
+
+static struct usb_endpoint_descriptor uas_endpoint_status = {
+	.bLength		= USB_DT_ENDPOINT_SIZE,
+	.bDescriptorType	= USB_DT_ENDPOINT,
+
+	.bEndpointAddress	= SANDBOX_FLASH_EP_STATUS | USB_ENDPOINT_DIR_MASK,
+	.bmAttributes		= USB_ENDPOINT_XFER_BULK,
+	.wMaxPacketSize		= __constant_cpu_to_le16(1024),
+	.bInterval		= 0,
+};
+
+static struct sandbox_flash_pipe_usage uas_pipe_cmd = {
+	.bLength		= sizeof(uas_pipe_cmd),
+	.bDescriptorType	= USB_DT_PIPE_USAGE,
+	.bPipeID		= UAS_CMD_PIPE_ID,
+};
+
+static struct sandbox_flash_pipe_usage uas_pipe_status = {
+	.bLength		= sizeof(uas_pipe_status),
+	.bDescriptorType	= USB_DT_PIPE_USAGE,
+	.bPipeID		= UAS_STATUS_PIPE_ID,
+};
+
+static struct sandbox_flash_pipe_usage uas_pipe_in = {
+	.bLength		= sizeof(uas_pipe_in),
+	.bDescriptorType	= USB_DT_PIPE_USAGE,
+	.bPipeID		= UAS_DATA_IN_PIPE_ID,
+};
+
+static struct sandbox_flash_pipe_usage uas_pipe_out = {
+	.bLength		= sizeof(uas_pipe_out),
+	.bDescriptorType	= USB_DT_PIPE_USAGE,
+	.bPipeID		= UAS_DATA_OUT_PIPE_ID,
+};
+
+/* The data endpoints are shared by the two settings, as on real devices */
+static void *uas_desc_list[] = {
+	&uas_device_desc,
+	&uas_config0,
+	&uas_interface0_bbb,
+	&flash_endpoint0_out,
+	&flash_endpoint1_in,
+	&uas_interface0_uas,
+	&uas_endpoint_cmd,
+	&uas_pipe_cmd,
+	&uas_endpoint_status,
+	&uas_pipe_status,
+	&flash_endpoint1_in,
+	&uas_pipe_in,
+	&flash_endpoint0_out,
+	&uas_pipe_out,
+	NULL,
+};
+
+int sandbox_flash_get_queued(struct udevice *dev)
+{
+	struct sandbox_flash_priv *priv = dev_get_priv(dev);
+
+	return priv->queued;
+}
+
 static int sandbox_flash_control(struct udevice *dev, struct usb_device *udev,
 				 unsigned long pipe, void *buff, int len,
 				 struct devrequest *setup)
 {
+	struct sandbox_flash_plat *plat = dev_get_plat(dev);
 	struct sandbox_flash_priv *priv = dev_get_priv(dev);
 
 	if (pipe == usb_rcvctrlpipe(udev, 0)) {
@@ -149,6 +302,11 @@ static int sandbox_flash_control(struct udevice *dev, struct usb_device *udev,
 			debug("request=%x\n", setup->request);
 			break;
 		}
+	} else if (pipe == usb_sndctrlpipe(udev, 0) && plat->uas &&
+		   setup->request == USB_REQ_SET_INTERFACE &&
+		   setup->value <= SANDBOX_FLASH_UAS_ALT) {
+		priv->alt = setup->value;
+		return 0;
 	}
 	debug("pipe=%lx\n", pipe);
 
@@ -310,6 +468,175 @@ err:
 	return 0;
 }
 
+/**
+ * sandbox_flash_uas_find() - find the transfer waiting on a stream
+ *
+ * @reqs:	Transfers queued
+ * @count:	Number of transfers
+ * @ep:		Endpoint of the stream
+ * @stream:	Stream ID, which is the tag of the command
+ * Return: transfer found, or NULL if none
+ */
+static struct usb_bulk_req *sandbox_flash_uas_find(struct usb_bulk_req *reqs,
+						   int count, int ep,
+						   uint stream)
+{
+	int i;
+
+	for (i = 0; i < count; i++) {
+		if (usb_pipeendpoint(reqs[i].pipe) == ep &&
+		    reqs[i].stream == stream &&
+		    reqs[i].status == USB_ST_NOT_PROC)
+			return &reqs[i];
+	}
+
+	return NULL;
+}
+
+/**
+ * sandbox_flash_uas_data() - move the data of a UAS command
+ *
+ * @priv:	Sandbox flash private data
+ * @op:		Return value of sb_scsi_emul_command() for the command
+ * @data:	Transfer for the data
+ * Return: 0 if OK, else the sense key saying what went wrong
+ */
+static int sandbox_flash_uas_data(struct sandbox_flash_priv *priv, int op,
+				  struct usb_bulk_req *data)
+{
+	struct scsi_emul_info *info = &priv->eminfo;
+	ssize_t done;
+	int len;
+
+	if (op == SCSI_EMUL_DO_READ || op == SCSI_EMUL_DO_WRITE) {
+		len = info->buff_used;
+		if (data->length < len || priv->fd == -1 ||
+		    os_lseek(priv->fd, info->seek_block * info->block_size,
+			     OS_SEEK_SET) == (off_t)-1)
+			return SENSE_MEDIUM_ERROR;
+		if (op == SCSI_EMUL_DO_READ)
+			done = os_read(priv->fd, data->buffer, len);
+		else
+			done = os_write(priv->fd, data->buffer, len);
+		if (done != len)
+			return SENSE_MEDIUM_ERROR;
+	} else {
+		len = min(data->length, info->buff_used);
+		if (info->alloc_len && len > info->alloc_len)
+			len = info->alloc_len;
+		memcpy(data->buffer, info->buff, len);
+	}
+	data->act_len = len;
+
+	return 0;
+}
+
+/**
+ * sandbox_flash_uas_command() - carry out a queued UAS command
+ *
+ * The data and the Sense IU go on the streams named by the command's tag. A
+ * command whose Sense IU is not queued is left waiting for it.
+ *
+ * @priv:	Sandbox flash private data
+ * @udev:	USB device
+ * @reqs:	Transfers queued
+ * @count:	Number of transfers
+ * @cmd:	Transfer holding the Command IU
+ */
+static void sandbox_flash_uas_command(struct sandbox_flash_priv *priv,
+				      struct usb_device *udev,
+				      struct usb_bulk_req *reqs, int count,
+				      struct usb_bulk_req *cmd)
+{
+	struct scsi_emul_info *info = &priv->eminfo;
+	struct uas_command_iu *iu = cmd->buffer;
+	struct usb_bulk_req *data, *status;
+	struct uas_sense_iu *sense;
+	uint tag = be16_to_cpu(iu->wTag);
+	int key = 0;
+	int op;
+
+	status = sandbox_flash_uas_find(reqs, count, SANDBOX_FLASH_EP_STATUS,
+					tag);
+	if (cmd->length < UAS_CMD_IU_SIZE || iu->bIUID != UAS_IU_ID_COMMAND ||
+	    !status || status->length < UAS_SENSE_IU_SIZE)
+		return;
+	cmd->status = 0;
+	cmd->act_len = cmd->length;
+
+	info->alloc_len = 0;
+	info->transfer_len = 0;
+	op = sb_scsi_emul_command(info, (struct scsi_cmd *)iu->CDB,
+				  sizeof(iu->CDB));
+	data = sandbox_flash_uas_find(reqs, count, op == SCSI_EMUL_DO_WRITE ?
+				      SANDBOX_FLASH_EP_OUT :
+				      SANDBOX_FLASH_EP_IN, tag);
+	if (op < 0)
+		key = SENSE_ILLEGAL_REQUEST;
+	else if (data)
+		key = sandbox_flash_uas_data(priv, op, data);
+	else if (op)
+		key = SENSE_MEDIUM_ERROR;
+	/* The data of a failed command stops short, before its status */
+	if (data)
+		data->status = 0;
+	debug("%s: tag %u, cmd %x, key %x\n", __func__, tag, iu->CDB[0], key);
+
+	sense = status->buffer;
+	memset(sense, '\0', UAS_SENSE_IU_SIZE);
+	sense->bIUID = UAS_IU_ID_SENSE;
+	sense->wTag = cpu_to_be16(tag);
+	if (key) {
+		/* Fixed-format sense data */
+		sense->bStatus = SANDBOX_FLASH_CHECK_CONDITION;
+		sense->wLength = cpu_to_be16(18);
+		sense->SenseData[0] = 0x70;
+		sense->SenseData[2] = key;
+		sense->SenseData[7] = 10;
+	}
+	status->status = 0;
+	status->act_len = UAS_SENSE_IU_SIZE;
+	udev->status = 0;
+	udev->act_len = status->act_len;
+}
+
+static int sandbox_flash_bulk_queue(struct udevice *dev,
+				    struct usb_device *udev,
+				    struct usb_bulk_req *reqs, int count)
+{
+	struct sandbox_flash_priv *priv = dev_get_priv(dev);
+	int cmds = 0;
+	int i;
+
+	/* Bulk-Only Transport is served one transfer at a time */
+	if (priv->alt != SANDBOX_FLASH_UAS_ALT)
+		return -ENOSYS;
+
+	for (i = count - 1; i >= 0; i--) {
+		if (usb_pipeendpoint(reqs[i].pipe) != SANDBOX_FLASH_EP_CMD)
+			continue;
+		sandbox_flash_uas_command(priv, udev, reqs, count, &reqs[i]);
+		cmds++;
+	}
+	if (cmds > 1)
+		priv->queued++;
+
+	return 0;
+}
+
+static int sandbox_flash_alloc_streams(struct udevice *dev,
+				       struct usb_device *udev,
+				       unsigned long *pipes, int num_pipes,
+				       int num_streams)
+{
+	struct sandbox_flash_priv *priv = dev_get_priv(dev);
+
+	if (priv->alt != SANDBOX_FLASH_UAS_ALT)
+		return -EINVAL;
+
+	return min(num_streams, (int)SANDBOX_FLASH_UAS_STREAMS);
+}
+
 static int sandbox_flash_of_to_plat(struct udevice *dev)
 {
 	struct sandbox_flash_plat *plat = dev_get_plat(dev);
@@ -332,6 +659,11 @@ static int sandbox_flash_bind(struct udevice *dev)
 	fs[2].id = STRINGID_SERIAL;
 	fs[2].s = dev->name;
 
+	plat->uas = dev_read_bool(dev, "sandbox,uas");
+	if (plat->uas)
+		return usb_emul_setup_device(dev, plat->flash_strings,
+					     uas_desc_list);
+
 	return usb_emul_setup_device(dev, plat->flash_strings, flash_desc_list);
 }
 
@@ -371,6 +703,8 @@ static int sandbox_flash_remove(struct udevice *dev)
 static const struct dm_usb_ops sandbox_usb_flash_ops = {
 	.control	= sandbox_flash_control,
 	.bulk		= sandbox_flash_bulk,
+	.bulk_queue	= sandbox_flash_bulk_queue,
+	.alloc_streams	= sandbox_flash_alloc_streams,
 };
 
 static const struct udevice_id sandbox_usb_flash_ids[] = {
@@ -246,6 +246,36 @@ int usb_emul_bulk(struct udevice *emul, struct usb_device *udev,
 	return ops->bulk(emul, udev, pipe, buffer, length);
 }
 
+int usb_emul_bulk_queue(struct udevice *emul, struct usb_device *udev,
+			struct usb_bulk_req *reqs, int count)
+{
+	struct dm_usb_ops *ops = usb_get_emul_ops(emul);
+	int ret;
+
+	if (!ops->bulk_queue)
+		return -ENOSYS;
+	debug("%s: dev=%s\n", __func__, emul->name);
+	ret = device_probe(emul);
+	if (ret)
+		return ret;
+	return ops->bulk_queue(emul, udev, reqs, count);
+}
+
+int usb_emul_alloc_streams(struct udevice *emul, struct usb_device *udev,
+			   unsigned long *pipes, int num_pipes, int num_streams)
+{
+	struct dm_usb_ops *ops = usb_get_emul_ops(emul);
+	int ret;
+
+	if (!ops->alloc_streams)
+		return -ENOSYS;
+	debug("%s: dev=%s\n", __func__, emul->name);
+	ret = device_probe(emul);
+	if (ret)
+		return ret;
+	return ops->alloc_streams(emul, udev, pipes, num_pipes, num_streams);
+}
+
 int usb_emul_int(struct udevice *emul, struct usb_device *udev,
 		  unsigned long pipe, void *buffer, int length, int interval,
 		  bool nonblock)
@@ -105,6 +105,57 @@ static int sandbox_submit_bulk(struct udevice *bus, struct usb_device *udev,
 	return ret;
 }
 
+static int sandbox_submit_bulk_queue(struct udevice *bus,
+				     struct usb_device *udev,
+				     struct usb_bulk_req *reqs, int count)
+{
+	struct udevice *emul;
+	int ret;
+	int i;
+
+	/* An emulator with streams sees the whole queue, to serve them */
+	debug("%s: bus=%s\n", __func__, bus->name);
+	ret = usb_emul_find(bus, reqs[0].pipe, udev->portnr, &emul);
+	if (ret)
+		return ret;
+	ret = usb_emul_bulk_queue(emul, udev, reqs, count);
+	if (ret != -ENOSYS)
+		return ret;
+
+	for (i = 0; i < count; i++) {
+		if (reqs[i].stream)
+			return -EINVAL;
+	}
+
+	/* The emulators are synchronous, so just go through them in order */
+	for (i = 0; i < count; i++) {
+		ret = sandbox_submit_bulk(bus, udev, reqs[i].pipe,
+					  reqs[i].buffer, reqs[i].length);
+		reqs[i].status = ret < 0 ? USB_ST_CRC_ERR : 0;
+		reqs[i].act_len = udev->act_len;
+		if (ret < 0)
+			break;
+	}
+
+	return 0;
+}
+
+static int sandbox_alloc_streams(struct udevice *bus, struct usb_device *udev,
+				 unsigned long *pipes, int num_pipes,
+				 int num_streams)
+{
+	struct udevice *emul;
+	int ret;
+
+	debug("%s: bus=%s\n", __func__, bus->name);
+	ret = usb_emul_find(bus, pipes[0], udev->portnr, &emul);
+	if (ret)
+		return ret;
+
+	return usb_emul_alloc_streams(emul, udev, pipes, num_pipes,
+				      num_streams);
+}
+
 static int sandbox_submit_int(struct udevice *bus, struct usb_device *udev,
 			      unsigned long pipe, void *buffer, int length,
 			      int interval, bool nonblock)
@@ -170,6 +221,8 @@ static int sandbox_usb_probe(struct udevice *dev)
 static const struct dm_usb_ops sandbox_usb_ops = {
 	.control	= sandbox_submit_control,
 	.bulk		= sandbox_submit_bulk,
+	.bulk_queue	= sandbox_submit_bulk_queue,
+	.alloc_streams	= sandbox_alloc_streams,
 	.interrupt	= sandbox_submit_int,
 	.alloc_device	= sandbox_alloc_device,
 };
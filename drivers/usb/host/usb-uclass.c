@@ -92,6 +92,20 @@ int submit_bulk_msg(struct usb_device *udev, unsigned long pipe, void *buffer,
 	return ops->bulk(bus, udev, pipe, buffer, length);
 }
 
+int submit_bulk_queue(struct usb_device *udev, struct usb_bulk_req *reqs,
+		      int count)
+{
+	struct udevice *bus = udev->controller_dev;
+	struct dm_usb_ops *ops = usb_get_ops(bus);
+
+	if (!ops->bulk_queue)
+		return -ENOSYS;
+	if (count > USB_MAX_BULK_REQS)
+		return -E2BIG;
+
+	return ops->bulk_queue(bus, udev, reqs, count);
+}
+
 struct int_queue *create_int_queue(struct usb_device *udev,
 		unsigned long pipe, int queuesize, int elementsize,
 		void *buffer, int interval)
@@ -173,6 +187,18 @@ int usb_get_max_xfer_size(struct usb_device *udev, size_t *size)
 	return ops->get_max_xfer_size(bus, size);
 }
 
+int usb_alloc_streams(struct usb_device *udev, unsigned long *pipes,
+		      int num_pipes, int num_streams)
+{
+	struct udevice *bus = udev->controller_dev;
+	struct dm_usb_ops *ops = usb_get_ops(bus);
+
+	if (!ops->alloc_streams)
+		return -ENOSYS;
+
+	return ops->alloc_streams(bus, udev, pipes, num_pipes, num_streams);
+}
+
 int usb_stop(void)
 {
 	struct udevice *bus;
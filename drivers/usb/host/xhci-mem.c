@@ -98,6 +98,31 @@ static void xhci_ring_free(struct xhci_ctrl *ctrl, struct xhci_ring *ring)
 	free(ring);
 }
 
+/**
+ * frees the stream context array and stream rings of an endpoint
+ *
+ * @param ep	pointer to the endpoint whose streams are to be freed
+ * Return: none
+ */
+void xhci_free_stream_info(struct xhci_ctrl *ctrl, struct xhci_virt_ep *ep)
+{
+	int i;
+
+	if (!ep->stream_ctx)
+		return;
+
+	for (i = 1; i <= ep->num_streams; i++)
+		xhci_ring_free(ctrl, ep->stream_rings[i]);
+	free(ep->stream_rings);
+	xhci_dma_unmap(ctrl, ep->stream_ctx_dma,
+		       ep->num_stream_ctxs * sizeof(struct xhci_stream_ctx));
+	free(ep->stream_ctx);
+	ep->stream_ctx = NULL;
+	ep->stream_rings = NULL;
+	ep->num_stream_ctxs = 0;
+	ep->num_streams = 0;
+}
+
 /**
  * Free the scratchpad buffer array and scratchpad buffers
  *
@@ -162,9 +187,11 @@ static void xhci_free_virt_devices(struct xhci_ctrl *ctrl)
 
 		ctrl->dcbaa->dev_context_ptrs[slot_id] = 0;
 
-		for (i = 0; i < 31; ++i)
+		for (i = 0; i < 31; ++i) {
 			if (virt_dev->eps[i].ring)
 				xhci_ring_free(ctrl, virt_dev->eps[i].ring);
+			xhci_free_stream_info(ctrl, &virt_dev->eps[i]);
+		}
 
 		if (virt_dev->in_ctx)
 			xhci_free_container_ctx(ctrl, virt_dev->in_ctx);
@@ -325,6 +352,7 @@ struct xhci_ring *xhci_ring_alloc(struct xhci_ctrl *ctrl, unsigned int num_segs,
 	ring = malloc(sizeof(struct xhci_ring));
 	BUG_ON(!ring);
 
+	ring->num_segs = num_segs;
 	if (num_segs == 0)
 		return ring;
 
@@ -459,6 +487,49 @@ static struct xhci_container_ctx
 	return ctx;
 }
 
+/**
+ * Allocates a stream context array for an endpoint, with a ring for each
+ * stream. Stream 0 is reserved, so streams 1 to num_streams are set up.
+ *
+ * @param ep		pointer to the endpoint
+ * @param num_stream_ctxs	number of entries in the stream context array,
+ *			a power of two greater than num_streams
+ * @param num_streams	number of streams to allocate rings for
+ * Return: none
+ */
+void xhci_alloc_stream_info(struct xhci_ctrl *ctrl, struct xhci_virt_ep *ep,
+			    unsigned int num_stream_ctxs,
+			    unsigned int num_streams)
+{
+	struct xhci_ring *ring;
+	u64 val_64;
+	int i;
+
+	BUG_ON(num_streams >= num_stream_ctxs);
+	xhci_free_stream_info(ctrl, ep);
+
+	ep->stream_ctx = xhci_malloc(num_stream_ctxs *
+				     sizeof(struct xhci_stream_ctx));
+	ep->stream_rings = calloc(num_streams + 1, sizeof(struct xhci_ring *));
+	BUG_ON(!ep->stream_rings);
+
+	for (i = 1; i <= num_streams; i++) {
+		ring = xhci_ring_alloc(ctrl, XHCI_BULK_RING_SEGS, true);
+		ep->stream_rings[i] = ring;
+		val_64 = ring->first_seg->dma | SCT_FOR_CTX(SCT_PRI_TR) |
+			 ring->cycle_state;
+		ep->stream_ctx[i].stream_ring = cpu_to_le64(val_64);
+	}
+	xhci_flush_cache((uintptr_t)ep->stream_ctx,
+			 num_stream_ctxs * sizeof(struct xhci_stream_ctx));
+	ep->stream_ctx_dma = xhci_dma_map(ctrl, ep->stream_ctx,
+					  num_stream_ctxs *
+					  sizeof(struct xhci_stream_ctx));
+
+	ep->num_stream_ctxs = num_stream_ctxs;
+	ep->num_streams = num_streams;
+}
+
 /**
  * Allocating virtual device
  *
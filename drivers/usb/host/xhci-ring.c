@@ -288,11 +288,13 @@ static int prepare_ring(struct xhci_ctrl *ctrl, struct xhci_ring *ep_ring,
  * @param ptr		Pointer address to write in the first two fields (opt.)
  * @param slot_id	Slot ID to encode in the flags field (opt.)
  * @param ep_index	Endpoint index to encode in the flags field (opt.)
+ * @param stream_id	Stream ID to encode in the status field (opt.)
  * @param cmd		Command type to enqueue
  * Return: none
  */
-void xhci_queue_command(struct xhci_ctrl *ctrl, dma_addr_t addr, u32 slot_id,
-			u32 ep_index, trb_type cmd)
+static void queue_command(struct xhci_ctrl *ctrl, dma_addr_t addr,
+			  u32 slot_id, u32 ep_index, u32 stream_id,
+			  trb_type cmd)
 {
 	u32 fields[4];
 
@@ -300,7 +302,7 @@ void xhci_queue_command(struct xhci_ctrl *ctrl, dma_addr_t addr, u32 slot_id,
 
 	fields[0] = lower_32_bits(addr);
 	fields[1] = upper_32_bits(addr);
-	fields[2] = 0;
+	fields[2] = STREAM_ID_FOR_TRB(stream_id);
 	fields[3] = TRB_TYPE(cmd) | SLOT_ID_FOR_TRB(slot_id) |
 		    ctrl->cmd_ring->cycle_state;
 
@@ -317,6 +319,15 @@ void xhci_queue_command(struct xhci_ctrl *ctrl, dma_addr_t addr, u32 slot_id,
 	xhci_writel(&ctrl->dba->doorbell[0], DB_VALUE_HOST);
 }
 
+/**
+ * Queues a command TRB which does not refer to a stream, see queue_command()
+ */
+void xhci_queue_command(struct xhci_ctrl *ctrl, dma_addr_t addr, u32 slot_id,
+			u32 ep_index, trb_type cmd)
+{
+	queue_command(ctrl, addr, slot_id, ep_index, 0, cmd);
+}
+
 /*
  * For xHCI 1.0 host controllers, TD size is the number of max packet sized
  * packets remaining in the TD (*not* including this TRB).
@@ -375,12 +386,13 @@ static u32 xhci_td_remainder(struct xhci_ctrl *ctrl, int transferred,
  *
  * @param udev		pointer to the USB device structure
  * @param ep_index	index of the endpoint
+ * @param stream_id	stream the TRBs were queued on, or 0
  * @param start_cycle	cycle flag of the first TRB
  * @param start_trb	pionter to the first TRB
  * Return: none
  */
 static void giveback_first_trb(struct usb_device *udev, int ep_index,
-				int start_cycle,
+				unsigned int stream_id, int start_cycle,
 				struct xhci_generic_trb *start_trb)
 {
 	struct xhci_ctrl *ctrl = xhci_get_ctrl(udev);
@@ -398,7 +410,7 @@ static void giveback_first_trb(struct usb_device *udev, int ep_index,
 
 	/* Ringing EP doorbell here */
 	xhci_writel(&ctrl->dba->doorbell[udev->slot_id],
-				DB_VALUE(ep_index, 0));
+				DB_VALUE(ep_index, stream_id));
 
 	return;
 }
@@ -502,6 +514,40 @@ union xhci_trb *xhci_wait_for_event(struct xhci_ctrl *ctrl, trb_type expected)
 	return NULL;
 }
 
+/*
+ * Sets the xHC's dequeue pointer for an endpoint to our enqueue pointer,
+ * throwing away any TRBs it has not processed. For an endpoint with streams
+ * this is done for the ring of each stream.
+ */
+static void set_deq(struct usb_device *udev, int ep_index)
+{
+	struct xhci_ctrl *ctrl = xhci_get_ctrl(udev);
+	struct xhci_virt_ep *ep = &ctrl->devs[udev->slot_id]->eps[ep_index];
+	struct xhci_ring *ring;
+	union xhci_trb *event;
+	unsigned int stream_id;
+	u64 addr;
+
+	stream_id = ep->num_streams ? 1 : 0;
+	do {
+		ring = stream_id ? ep->stream_rings[stream_id] : ep->ring;
+		addr = xhci_trb_virt_to_dma(ring->enq_seg,
+			(void *)((uintptr_t)ring->enqueue | ring->cycle_state));
+		if (stream_id)
+			addr |= SCT_FOR_CTX(SCT_PRI_TR);
+		queue_command(ctrl, addr, udev->slot_id, ep_index, stream_id,
+			      TRB_SET_DEQ);
+		event = xhci_wait_for_event(ctrl, TRB_COMPLETION);
+		if (!event)
+			return;
+
+		BUG_ON(TRB_TO_SLOT_ID(le32_to_cpu(event->event_cmd.flags))
+			!= udev->slot_id || GET_COMP_CODE(le32_to_cpu(
+			event->event_cmd.status)) != COMP_SUCCESS);
+		xhci_acknowledge_event(ctrl);
+	} while (++stream_id <= ep->num_streams);
+}
+
 /*
  * Send reset endpoint command for given endpoint. This recovers from a
  * halted endpoint (e.g. due to a stall error).
@@ -509,9 +555,7 @@ union xhci_trb *xhci_wait_for_event(struct xhci_ctrl *ctrl, trb_type expected)
 static void reset_ep(struct usb_device *udev, int ep_index)
 {
 	struct xhci_ctrl *ctrl = xhci_get_ctrl(udev);
-	struct xhci_ring *ring =  ctrl->devs[udev->slot_id]->eps[ep_index].ring;
 	union xhci_trb *event;
-	u64 addr;
 	u32 field;
 
 	printf("Resetting EP %d...\n", ep_index);
@@ -524,17 +568,7 @@ static void reset_ep(struct usb_device *udev, int ep_index)
 	BUG_ON(TRB_TO_SLOT_ID(field) != udev->slot_id);
 	xhci_acknowledge_event(ctrl);
 
-	addr = xhci_trb_virt_to_dma(ring->enq_seg,
-		(void *)((uintptr_t)ring->enqueue | ring->cycle_state));
-	xhci_queue_command(ctrl, addr, udev->slot_id, ep_index, TRB_SET_DEQ);
-	event = xhci_wait_for_event(ctrl, TRB_COMPLETION);
-	if (!event)
-		return;
-
-	BUG_ON(TRB_TO_SLOT_ID(le32_to_cpu(event->event_cmd.flags))
-		!= udev->slot_id || GET_COMP_CODE(le32_to_cpu(
-		event->event_cmd.status)) != COMP_SUCCESS);
-	xhci_acknowledge_event(ctrl);
+	set_deq(udev, ep_index);
 }
 
 /*
@@ -548,11 +582,10 @@ static void reset_ep(struct usb_device *udev, int ep_index)
 static void abort_td(struct usb_device *udev, int ep_index)
 {
 	struct xhci_ctrl *ctrl = xhci_get_ctrl(udev);
-	struct xhci_ring *ring =  ctrl->devs[udev->slot_id]->eps[ep_index].ring;
+	struct xhci_virt_ep *ep = &ctrl->devs[udev->slot_id]->eps[ep_index];
 	union xhci_trb *event;
 	xhci_comp_code comp;
 	trb_type type;
-	u64 addr;
 	u32 field;
 
 	xhci_queue_command(ctrl, 0, udev->slot_id, ep_index, TRB_STOP_RING);
@@ -575,7 +608,8 @@ static void abort_td(struct usb_device *udev, int ep_index)
 			return;
 		type = TRB_FIELD_TO_TYPE(le32_to_cpu(event->event_cmd.flags));
 
-	} else {
+	} else if (!ep->num_streams) {
+		/* With streams, there may have been no TD in progress */
 		printf("abort_td: Expected a TRB_TRANSFER TRB first\n");
 	}
 
@@ -586,17 +620,7 @@ static void abort_td(struct usb_device *udev, int ep_index)
 		!= COMP_CTX_STATE));
 	xhci_acknowledge_event(ctrl);
 
-	addr = xhci_trb_virt_to_dma(ring->enq_seg,
-		(void *)((uintptr_t)ring->enqueue | ring->cycle_state));
-	xhci_queue_command(ctrl, addr, udev->slot_id, ep_index, TRB_SET_DEQ);
-	event = xhci_wait_for_event(ctrl, TRB_COMPLETION);
-	if (!event)
-		return;
-
-	BUG_ON(TRB_TO_SLOT_ID(le32_to_cpu(event->event_cmd.flags))
-		!= udev->slot_id || GET_COMP_CODE(le32_to_cpu(
-		event->event_cmd.status)) != COMP_SUCCESS);
-	xhci_acknowledge_event(ctrl);
+	set_deq(udev, ep_index);
 }
 
 static void record_transfer_result(struct usb_device *udev,
@@ -628,18 +652,71 @@ static void record_transfer_result(struct usb_device *udev,
 }
 
 /**** Bulk and Control transfer methods ****/
+
+/* A bulk TD queued by xhci_bulk_queue() */
+struct xhci_bulk_td {
+	int ep_index;
+	struct xhci_ring *ring;
+	u64 buf_64;
+	dma_addr_t last_transfer_trb_addr;
+	int available_length;
+};
+
 /**
- * Queues up the BULK Request
+ * Finds the transfer ring for a stream of an endpoint
+ *
+ * @param virt_dev	pointer to the virtual device
+ * @param ep_index	index of the endpoint
+ * @param stream_id	stream ID, or 0 for an endpoint without streams
+ * Return: the ring, or NULL if the endpoint does not have that stream
+ */
+static struct xhci_ring *xhci_bulk_ring(struct xhci_virt_device *virt_dev,
+					int ep_index, unsigned int stream_id)
+{
+	struct xhci_virt_ep *ep = &virt_dev->eps[ep_index];
+
+	if (!stream_id)
+		return ep->num_streams ? NULL : ep->ring;
+	if (stream_id > ep->num_streams)
+		return NULL;
+
+	return ep->stream_rings[stream_id];
+}
+
+/**
+ * Checks whether a TRB is on a transfer ring
+ *
+ * @param ring		pointer to the ring
+ * @param addr		DMA address of the TRB
+ * Return: true if the TRB is in one of the ring's segments
+ */
+static bool ring_has_trb(struct xhci_ring *ring, dma_addr_t addr)
+{
+	struct xhci_segment *seg = ring->first_seg;
+
+	do {
+		if (addr >= seg->dma && addr < seg->dma + SEGMENT_SIZE)
+			return true;
+		seg = seg->next;
+	} while (seg != ring->first_seg);
+
+	return false;
+}
+
+/**
+ * Queues up a BULK TD and hands it to the controller without waiting for it
  *
  * @param udev		pointer to the USB device structure
- * @param pipe		contains the DIR_IN or OUT , devnum
- * @param length	length of the buffer
- * @param buffer	buffer to be read/written based on the request
- * Return: returns 0 if successful else -1 on failure
+ * @param req		transfer to queue
+ * @param td		returns the details needed to complete the TD
+ * Return: 0 if successful else -ve on failure
  */
-int xhci_bulk_tx(struct usb_device *udev, unsigned long pipe,
-			int length, void *buffer)
+static int xhci_bulk_queue(struct usb_device *udev, struct usb_bulk_req *req,
+			   struct xhci_bulk_td *td)
 {
+	unsigned long pipe = req->pipe;
+	int length = req->length;
+	void *buffer = req->buffer;
 	int num_trbs = 0;
 	struct xhci_generic_trb *start_trb;
 	bool first_trb = false;
@@ -652,7 +729,6 @@ int xhci_bulk_tx(struct usb_device *udev, unsigned long pipe,
 	struct xhci_virt_device *virt_dev;
 	struct xhci_ep_ctx *ep_ctx;
 	struct xhci_ring *ring;		/* EP transfer ring */
-	union xhci_trb *event;
 
 	int running_total, trb_buff_len;
 	bool more_trbs_coming = true;
@@ -660,14 +736,11 @@ int xhci_bulk_tx(struct usb_device *udev, unsigned long pipe,
 	u64 addr;
 	int ret;
 	u32 trb_fields[4];
-	u64 buf_64 = xhci_dma_map(ctrl, buffer, length);
-	dma_addr_t last_transfer_trb_addr;
-	int available_length;
+	u64 buf_64;
 
 	debug("dev=%p, pipe=%lx, buffer=%p, length=%d\n",
 		udev, pipe, buffer, length);
 
-	available_length = length;
 	ep_index = usb_pipe_ep_index(pipe);
 	virt_dev = ctrl->devs[slot_id];
 
@@ -684,7 +757,10 @@ int xhci_bulk_tx(struct usb_device *udev, unsigned long pipe,
 	if ((le32_to_cpu(ep_ctx->ep_info) & EP_STATE_MASK) == EP_STATE_HALTED)
 		reset_ep(udev, ep_index);
 
-	ring = virt_dev->eps[ep_index].ring;
+	ring = xhci_bulk_ring(virt_dev, ep_index, req->stream);
+	if (!ring)
+		return -EINVAL;
+	buf_64 = xhci_dma_map(ctrl, buffer, length);
 	/*
 	 * How much data is (potentially) left before the 64KB boundary?
 	 * XHCI Spec puts restriction( TABLE 49 and 6.4.1 section of XHCI Spec)
@@ -711,13 +787,15 @@ int xhci_bulk_tx(struct usb_device *udev, unsigned long pipe,
 
 	/*
 	 * XXX: Calling routine prepare_ring() called in place of
-	 * prepare_trasfer() as there in 'Linux' since we are not
-	 * maintaining multiple TDs/transfer at the same time.
+	 * prepare_trasfer() as there in 'Linux'. The caller makes sure that
+	 * the TDs it queues at once fit in the ring.
 	 */
 	ret = prepare_ring(ctrl, ring,
 			   le32_to_cpu(ep_ctx->ep_info) & EP_STATE_MASK);
-	if (ret < 0)
+	if (ret < 0) {
+		xhci_dma_unmap(ctrl, buf_64, length);
 		return ret;
+	}
 
 	/*
 	 * Don't give the first TRB to the hardware (by toggling the cycle bit)
@@ -789,7 +867,9 @@ int xhci_bulk_tx(struct usb_device *udev, unsigned long pipe,
 		trb_fields[2] = length_field;
 		trb_fields[3] = field | TRB_TYPE(TRB_NORMAL);
 
-		last_transfer_trb_addr = queue_trb(ctrl, ring, (num_trbs > 1), trb_fields);
+		td->last_transfer_trb_addr = queue_trb(ctrl, ring,
+						       (num_trbs > 1),
+						       trb_fields);
 
 		--num_trbs;
 
@@ -800,36 +880,331 @@ int xhci_bulk_tx(struct usb_device *udev, unsigned long pipe,
 		trb_buff_len = min((length - running_total), TRB_MAX_BUFF_SIZE);
 	} while (running_total < length);
 
-	giveback_first_trb(udev, ep_index, start_cycle, start_trb);
+	giveback_first_trb(udev, ep_index, req->stream, start_cycle,
+			   start_trb);
 
-again:
-	event = xhci_wait_for_event(ctrl, TRB_TRANSFER);
-	if (!event) {
-		debug("XHCI bulk transfer timed out, aborting...\n");
-		abort_td(udev, ep_index);
-		udev->status = USB_ST_NAK_REC;  /* closest thing to a timeout */
-		udev->act_len = 0;
-		return -ETIMEDOUT;
+	td->ep_index = ep_index;
+	td->ring = ring;
+	td->buf_64 = buf_64;
+	td->available_length = length;
+
+	return 0;
+}
+
+/**
+ * Finds the queued BULK TD which a transfer event belongs to
+ *
+ * @param udev		pointer to the USB device structure
+ * @param reqs		transfers which were queued
+ * @param td		TDs which were queued
+ * @param count		number of TDs queued
+ * @param event		transfer event
+ * Return: index of the TD, or -1 if the event is not for any of them
+ */
+static int xhci_bulk_find_td(struct usb_device *udev,
+			     struct usb_bulk_req *reqs,
+			     struct xhci_bulk_td *td, int count,
+			     union xhci_trb *event)
+{
+	u32 field = le32_to_cpu(event->trans_event.flags);
+	dma_addr_t trb_addr = le64_to_cpu(event->trans_event.buffer);
+	int i;
+
+	if (TRB_TO_SLOT_ID(field) != udev->slot_id)
+		return -1;
+
+	/*
+	 * TDs on the same ring complete in the order queued. Streams of an
+	 * endpoint have separate rings, and the device picks which one to
+	 * serve next.
+	 */
+	for (i = 0; i < count; i++) {
+		if (reqs[i].status == USB_ST_NOT_PROC &&
+		    td[i].ep_index == TRB_TO_EP_INDEX(field) &&
+		    ring_has_trb(td[i].ring, trb_addr))
+			return i;
 	}
 
-	if ((uintptr_t)(le64_to_cpu(event->trans_event.buffer)) !=
-	    (uintptr_t)last_transfer_trb_addr) {
-		available_length -=
+	return -1;
+}
+
+/**
+ * Handles a transfer event for a queued BULK TD
+ *
+ * The caller acknowledges the event afterwards.
+ *
+ * @param udev		pointer to the USB device structure
+ * @param req		transfer the event is for
+ * @param td		TD the event is for
+ * @param event		transfer event
+ * Return: true if the TD is complete, false if more events are to come
+ */
+static bool xhci_bulk_td_event(struct usb_device *udev,
+			       struct usb_bulk_req *req,
+			       struct xhci_bulk_td *td, union xhci_trb *event)
+{
+	struct xhci_ctrl *ctrl = xhci_get_ctrl(udev);
+	dma_addr_t trb_addr = le64_to_cpu(event->trans_event.buffer);
+
+	if ((uintptr_t)trb_addr != (uintptr_t)td->last_transfer_trb_addr) {
+		td->available_length -=
 			(int)EVENT_TRB_LEN(le32_to_cpu(event->trans_event.transfer_len));
-		xhci_acknowledge_event(ctrl);
-		goto again;
+		return false;
 	}
 
-	field = le32_to_cpu(event->trans_event.flags);
-	BUG_ON(TRB_TO_SLOT_ID(field) != slot_id);
-	BUG_ON(TRB_TO_EP_INDEX(field) != ep_index);
+	record_transfer_result(udev, event, td->available_length);
+	xhci_inval_cache((uintptr_t)req->buffer, req->length);
+	xhci_dma_unmap(ctrl, td->buf_64, req->length);
+	req->status = udev->status;
+	req->act_len = udev->act_len;
+
+	return true;
+}
+
+/**
+ * Stops an endpoint which still has queued BULK TDs
+ *
+ * Unlike abort_td(), this expects other endpoints of the queue to go on
+ * completing TDs while the Stop Endpoint command is carried out. Their
+ * events are matched to the TDs, which are completed as usual, and only the
+ * event for the TD which was stopped is thrown away.
+ *
+ * @param udev		pointer to the USB device structure
+ * @param reqs		transfers which were queued
+ * @param td		TDs which were queued
+ * @param count		number of TDs queued
+ * @param ep_index	endpoint to stop
+ * Return: none
+ */
+static void xhci_bulk_stop_ep(struct usb_device *udev,
+			      struct usb_bulk_req *reqs,
+			      struct xhci_bulk_td *td, int count, int ep_index)
+{
+	struct xhci_ctrl *ctrl = xhci_get_ctrl(udev);
+	union xhci_trb *event;
+	xhci_comp_code comp;
+	trb_type type;
+	int i;
+
+	xhci_queue_command(ctrl, 0, udev->slot_id, ep_index, TRB_STOP_RING);
+
+	for (;;) {
+		event = xhci_wait_for_event(ctrl, TRB_NONE);
+		if (!event)
+			return;
+
+		type = TRB_FIELD_TO_TYPE(le32_to_cpu(event->event_cmd.flags));
+		if (type == TRB_COMPLETION)
+			break;
+
+		comp = GET_COMP_CODE(le32_to_cpu(event->trans_event.transfer_len));
+		i = xhci_bulk_find_td(udev, reqs, td, count, event);
+		if (type == TRB_TRANSFER && i >= 0 && comp != COMP_STOP &&
+		    comp != COMP_STOP_INVAL)
+			xhci_bulk_td_event(udev, &reqs[i], &td[i], event);
+		xhci_acknowledge_event(ctrl);
+	}
 
-	record_transfer_result(udev, event, available_length);
+	comp = GET_COMP_CODE(le32_to_cpu(event->event_cmd.status));
+	if (TRB_TO_SLOT_ID(le32_to_cpu(event->event_cmd.flags)) !=
+	    udev->slot_id || (comp != COMP_SUCCESS && comp != COMP_CTX_STATE))
+		printf("XHCI: cannot stop endpoint %d (%d)\n", ep_index, comp);
 	xhci_acknowledge_event(ctrl);
-	xhci_inval_cache((uintptr_t)buffer, length);
-	xhci_dma_unmap(ctrl, buf_64, length);
 
-	return (udev->status != USB_ST_NOT_PROC) ? 0 : -1;
+	set_deq(udev, ep_index);
+}
+
+/**
+ * Cancels the BULK TDs which are still queued
+ *
+ * Endpoints which have halted are left alone: the TDs on them are thrown
+ * away when the endpoint is reset before its next transfer.
+ *
+ * @param udev		pointer to the USB device structure
+ * @param reqs		transfers which were queued
+ * @param td		TDs which were queued
+ * @param count		number of TDs queued
+ * Return: none
+ */
+static void xhci_bulk_cancel(struct usb_device *udev,
+			     struct usb_bulk_req *reqs,
+			     struct xhci_bulk_td *td, int count)
+{
+	struct xhci_ctrl *ctrl = xhci_get_ctrl(udev);
+	struct xhci_virt_device *virt_dev = ctrl->devs[udev->slot_id];
+	struct xhci_ep_ctx *ep_ctx;
+	u32 stopped = 0;
+	int i;
+
+	/*
+	 * TDs of other endpoints may complete while one is being stopped,
+	 * so only those still queued afterwards are given up
+	 */
+	for (i = 0; i < count; i++) {
+		if (reqs[i].status != USB_ST_NOT_PROC ||
+		    stopped & BIT(td[i].ep_index))
+			continue;
+		stopped |= BIT(td[i].ep_index);
+
+		xhci_inval_cache((uintptr_t)virt_dev->out_ctx->bytes,
+				 virt_dev->out_ctx->size);
+		ep_ctx = xhci_get_ep_ctx(ctrl, virt_dev->out_ctx,
+					 td[i].ep_index);
+		if ((le32_to_cpu(ep_ctx->ep_info) & EP_STATE_MASK) !=
+		    EP_STATE_HALTED)
+			xhci_bulk_stop_ep(udev, reqs, td, count,
+					  td[i].ep_index);
+	}
+
+	for (i = 0; i < count; i++) {
+		if (reqs[i].status == USB_ST_NOT_PROC)
+			xhci_dma_unmap(ctrl, td[i].buf_64, reqs[i].length);
+	}
+}
+
+/**
+ * Checks that several BULK TDs fit in their transfer rings at once
+ *
+ * Each TD is assumed to need a TRB for each 64KB of data plus one more, in
+ * case its buffer is not aligned. Each stream of an endpoint has its own
+ * ring.
+ *
+ * @param udev		pointer to the USB device structure
+ * @param reqs		transfers to check
+ * @param count		number of transfers
+ * Return: true if they all fit, else false
+ */
+static bool xhci_bulk_fits(struct usb_device *udev, struct usb_bulk_req *reqs,
+			   int count)
+{
+	struct xhci_ctrl *ctrl = xhci_get_ctrl(udev);
+	struct xhci_virt_device *virt_dev = ctrl->devs[udev->slot_id];
+	struct xhci_ring *ring;
+	int ep_index, num_trbs;
+	int i, j;
+
+	for (i = 0; i < count; i++) {
+		ep_index = usb_pipe_ep_index(reqs[i].pipe);
+		ring = xhci_bulk_ring(virt_dev, ep_index, reqs[i].stream);
+		if (!ring)
+			return false;
+		num_trbs = 0;
+		for (j = 0; j < count; j++) {
+			if (usb_pipe_ep_index(reqs[j].pipe) != ep_index ||
+			    reqs[j].stream != reqs[i].stream)
+				continue;
+			num_trbs += DIV_ROUND_UP(reqs[j].length,
+						 TRB_MAX_BUFF_SIZE) + 1;
+		}
+		/* Each segment ends with a link TRB */
+		if (num_trbs >= ring->num_segs * (TRBS_PER_SEGMENT - 1))
+			return false;
+	}
+
+	return true;
+}
+
+/**
+ * Queues up several BULK Requests and waits for them to complete
+ *
+ * All the TDs are handed to the controller before waiting for the first one,
+ * so that it can go straight from one to the next. Processing stops at the
+ * first request which fails, and the ones after it are cancelled.
+ *
+ * @param udev		pointer to the USB device structure
+ * @param reqs		transfers to carry out, in order for each endpoint and
+ *			stream
+ * @param count		number of transfers, at most USB_MAX_BULK_REQS
+ * Return: 0 if all were queued and processed, -E2BIG if they do not fit in
+ *	the transfer rings together, else -ve on failure
+ */
+int xhci_bulk_tx_queue(struct usb_device *udev, struct usb_bulk_req *reqs,
+		       int count)
+{
+	struct xhci_bulk_td td[USB_MAX_BULK_REQS];
+	struct xhci_ctrl *ctrl = xhci_get_ctrl(udev);
+	union xhci_trb *event;
+	struct usb_bulk_req *req;
+	int pending;
+	bool done;
+	int ret = 0;
+	int i;
+
+	BUG_ON(count > USB_MAX_BULK_REQS);
+	if (count > 1 && !xhci_bulk_fits(udev, reqs, count))
+		return -E2BIG;
+	for (i = 0; i < count; i++)
+		reqs[i].status = USB_ST_NOT_PROC;
+
+	for (pending = 0; pending < count; pending++) {
+		ret = xhci_bulk_queue(udev, &reqs[pending], &td[pending]);
+		if (ret)
+			break;
+	}
+	if (ret) {
+		xhci_bulk_cancel(udev, reqs, td, pending);
+		return ret;
+	}
+
+	while (pending) {
+		event = xhci_wait_for_event(ctrl, TRB_TRANSFER);
+		if (!event) {
+			debug("XHCI bulk transfer timed out, aborting...\n");
+			xhci_bulk_cancel(udev, reqs, td, count);
+			udev->status = USB_ST_NAK_REC;  /* closest thing to a timeout */
+			udev->act_len = 0;
+			return -ETIMEDOUT;
+		}
+
+		i = xhci_bulk_find_td(udev, reqs, td, count, event);
+		if (i < 0) {
+			printf("XHCI bulk event for no queued transfer (%08x %08x %08x %08x), cancelling\n",
+			       le32_to_cpu(event->generic.field[0]),
+			       le32_to_cpu(event->generic.field[1]),
+			       le32_to_cpu(event->generic.field[2]),
+			       le32_to_cpu(event->generic.field[3]));
+			xhci_acknowledge_event(ctrl);
+			xhci_bulk_cancel(udev, reqs, td, count);
+			udev->status = USB_ST_CRC_ERR;
+			udev->act_len = 0;
+			return -EIO;
+		}
+
+		req = &reqs[i];
+		done = xhci_bulk_td_event(udev, req, &td[i], event);
+		xhci_acknowledge_event(ctrl);
+		if (!done)
+			continue;
+		pending--;
+
+		if (req->status) {
+			xhci_bulk_cancel(udev, reqs, td, count);
+			break;
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * Queues up the BULK Request
+ *
+ * @param udev		pointer to the USB device structure
+ * @param pipe		contains the DIR_IN or OUT , devnum
+ * @param length	length of the buffer
+ * @param buffer	buffer to be read/written based on the request
+ * Return: returns 0 if successful else -1 on failure
+ */
+int xhci_bulk_tx(struct usb_device *udev, unsigned long pipe,
+			int length, void *buffer)
+{
+	struct usb_bulk_req req = {
+		.pipe = pipe,
+		.buffer = buffer,
+		.length = length,
+	};
+
+	return xhci_bulk_tx_queue(udev, &req, 1);
 }
 
 /**
@@ -1003,7 +1378,7 @@ int xhci_ctrl_tx(struct usb_device *udev, unsigned long pipe,
 
 	queue_trb(ctrl, ep_ring, false, trb_fields);
 
-	giveback_first_trb(udev, ep_index, start_cycle, start_trb);
+	giveback_first_trb(udev, ep_index, 0, start_cycle, start_trb);
 
 	event = xhci_wait_for_event(ctrl, TRB_TRANSFER);
 	if (!event)
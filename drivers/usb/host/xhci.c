@@ -36,6 +36,7 @@
 #include <linux/delay.h>
 #include <linux/errno.h>
 #include <linux/iopoll.h>
+#include <linux/log2.h>
 
 static struct descriptor {
 	struct usb_hub_descriptor hub;
@@ -564,7 +565,9 @@ static int xhci_set_configuration(struct usb_device *udev)
 		ep_ctx[ep_index] = xhci_get_ep_ctx(ctrl, in_ctx, ep_index);
 
 		/* Allocate the ep rings */
-		virt_dev->eps[ep_index].ring = xhci_ring_alloc(ctrl, 1, true);
+		virt_dev->eps[ep_index].ring = xhci_ring_alloc(ctrl,
+				usb_endpoint_xfer_bulk(endpt_desc) ?
+				XHCI_BULK_RING_SEGS : 1, true);
 		if (!virt_dev->eps[ep_index].ring)
 			return -ENOMEM;
 
@@ -1300,6 +1303,24 @@ static int xhci_submit_bulk_msg(struct udevice *dev, struct usb_device *udev,
 	return _xhci_submit_bulk_msg(udev, pipe, buffer, length);
 }
 
+static int xhci_submit_bulk_queue(struct udevice *dev, struct usb_device *udev,
+				  struct usb_bulk_req *reqs, int count)
+{
+	int i;
+
+	debug("%s: dev='%s', udev=%p, count=%d\n", __func__, dev->name, udev,
+	      count);
+	for (i = 0; i < count; i++) {
+		if (usb_pipetype(reqs[i].pipe) != PIPE_BULK) {
+			printf("non-bulk pipe (type=%lu)",
+			       usb_pipetype(reqs[i].pipe));
+			return -EINVAL;
+		}
+	}
+
+	return xhci_bulk_tx_queue(udev, reqs, count);
+}
+
 static int xhci_submit_int_msg(struct udevice *dev, struct usb_device *udev,
 			       unsigned long pipe, void *buffer, int length,
 			       int interval, bool nonblock)
@@ -1381,6 +1402,119 @@ static int xhci_update_hub_device(struct udevice *dev, struct usb_device *udev)
 	return xhci_configure_endpoints(udev, false);
 }
 
+/**
+ * Finds the SuperSpeed endpoint companion descriptor for a pipe
+ *
+ * Endpoints of all the alternate settings of an interface are listed
+ * together, so the last match is taken, as xhci_set_configuration() does.
+ *
+ * @param udev	pointer to the USB device
+ * @param pipe	pipe of the endpoint
+ * Return: the descriptor, or NULL if the endpoint was not found
+ */
+static struct usb_ss_ep_comp_descriptor *
+xhci_find_ss_ep_comp(struct usb_device *udev, unsigned long pipe)
+{
+	struct usb_ss_ep_comp_descriptor *ss_ep_comp_desc = NULL;
+	struct usb_interface *ifdesc;
+	int i, j;
+
+	for (i = 0; i < udev->config.no_of_if; i++) {
+		ifdesc = &udev->config.if_desc[i];
+		for (j = 0; j < ifdesc->no_of_ep; j++) {
+			if (xhci_get_ep_index(&ifdesc->ep_desc[j]) ==
+			    usb_pipe_ep_index(pipe))
+				ss_ep_comp_desc = &ifdesc->ss_ep_comp_desc[j];
+		}
+	}
+
+	return ss_ep_comp_desc;
+}
+
+static int xhci_alloc_streams(struct udevice *dev, struct usb_device *udev,
+			      unsigned long *pipes, int num_pipes,
+			      int num_streams)
+{
+	struct xhci_ctrl *ctrl = dev_get_priv(dev);
+	struct xhci_virt_device *virt_dev = ctrl->devs[udev->slot_id];
+	struct xhci_container_ctx *in_ctx = virt_dev->in_ctx;
+	struct xhci_container_ctx *out_ctx = virt_dev->out_ctx;
+	struct usb_ss_ep_comp_descriptor *ss_ep_comp_desc;
+	struct xhci_input_control_ctx *ctrl_ctx;
+	unsigned int num_stream_ctxs;
+	struct xhci_ep_ctx *ep_ctx;
+	u32 changed_eps = 0;
+	int ep_index;
+	int i, ret;
+
+	debug("%s: dev='%s', udev=%p, num_streams=%d\n", __func__, dev->name,
+	      udev, num_streams);
+	if (udev->speed < USB_SPEED_SUPER)
+		return -EINVAL;
+
+	if (HCC_MAX_PSA(xhci_readl(&ctrl->hccr->cr_hccparams)) < 4) {
+		debug("%s: controller does not support streams\n", __func__);
+		return -ENOSYS;
+	}
+
+	/* Stream ID 0 is reserved, so the array has an extra entry */
+	num_streams = min_t(int, num_streams,
+			    HCC_MAX_PSA(xhci_readl(&ctrl->hccr->cr_hccparams)) -
+			    1);
+	for (i = 0; i < num_pipes; i++) {
+		if (usb_pipetype(pipes[i]) != PIPE_BULK)
+			return -EINVAL;
+		ss_ep_comp_desc = xhci_find_ss_ep_comp(udev, pipes[i]);
+		if (!ss_ep_comp_desc)
+			return -EINVAL;
+		num_streams = min_t(int, num_streams,
+				    (1 << (ss_ep_comp_desc->bmAttributes &
+					   0x1f)) - 1);
+	}
+	if (num_streams < 1)
+		return -EINVAL;
+
+	/* The smallest primary stream array has four entries */
+	num_stream_ctxs = max_t(unsigned int, 4,
+				roundup_pow_of_two(num_streams + 1));
+
+	ctrl_ctx = xhci_get_input_control_ctx(in_ctx);
+	ctrl_ctx->add_flags = cpu_to_le32(SLOT_FLAG);
+	ctrl_ctx->drop_flags = 0;
+
+	xhci_inval_cache((uintptr_t)out_ctx->bytes, out_ctx->size);
+	xhci_slot_copy(ctrl, in_ctx, out_ctx);
+
+	for (i = 0; i < num_pipes; i++) {
+		ep_index = usb_pipe_ep_index(pipes[i]);
+		xhci_endpoint_copy(ctrl, in_ctx, out_ctx, ep_index);
+		xhci_alloc_stream_info(ctrl, &virt_dev->eps[ep_index],
+				       num_stream_ctxs, num_streams);
+
+		ep_ctx = xhci_get_ep_ctx(ctrl, in_ctx, ep_index);
+		ep_ctx->ep_info &= cpu_to_le32(~EP_MAXPSTREAMS_MASK);
+		ep_ctx->ep_info |=
+			cpu_to_le32(EP_MAXPSTREAMS(ilog2(num_stream_ctxs) - 1) |
+				    EP_HAS_LSA);
+		ep_ctx->deq = cpu_to_le64(virt_dev->eps[ep_index].stream_ctx_dma);
+		changed_eps |= 1 << (ep_index + 1);
+	}
+
+	/* Drop and add the endpoints again, now with streams */
+	ctrl_ctx->add_flags |= cpu_to_le32(changed_eps);
+	ctrl_ctx->drop_flags = cpu_to_le32(changed_eps);
+	ret = xhci_configure_endpoints(udev, false);
+	if (ret) {
+		for (i = 0; i < num_pipes; i++) {
+			ep_index = usb_pipe_ep_index(pipes[i]);
+			xhci_free_stream_info(ctrl, &virt_dev->eps[ep_index]);
+		}
+		return ret;
+	}
+
+	return num_streams;
+}
+
 static int xhci_get_max_xfer_size(struct udevice *dev, size_t *size)
 {
 	/*
@@ -1444,6 +1578,8 @@ int xhci_deregister(struct udevice *dev)
 struct dm_usb_ops xhci_usb_ops = {
 	.control = xhci_submit_control_msg,
 	.bulk = xhci_submit_bulk_msg,
+	.bulk_queue = xhci_submit_bulk_queue,
+	.alloc_streams = xhci_alloc_streams,
 	.interrupt = xhci_submit_int_msg,
 	.alloc_device = xhci_alloc_device,
 	.update_hub_device = xhci_update_hub_device,
@@ -13,69 +13,262 @@
 #include <virtio_types.h>
 #include <virtio.h>
 #include <virtio_ring.h>
+#include <linux/sizes.h>
 #include "virtio_blk.h"
 
+/* Number of requests which can be in flight on the virtqueue */
+#define VIRTIO_BLK_NUM_SLOTS	16
+/* Largest number of data segments in a request */
+#define VIRTIO_BLK_MAX_SEGS	64
+/*
+ * Largest request, in blocks. Large transfers are split into requests of
+ * this size so that the device can work on several of them at once.
+ */
+#define VIRTIO_BLK_MAX_REQ_BLKS	2048
+
+static const u32 feature[] = {
+	VIRTIO_BLK_F_SIZE_MAX,
+	VIRTIO_BLK_F_SEG_MAX,
+};
+
+/**
+ * struct virtio_blk_slot - a request sent to the device
+ *
+ * @out_hdr:	header of the request
+ * @status:	status of the request, written by the device
+ * @pos:	first block of the request within the transfer
+ * @blkcnt:	number of blocks in the request, 0 if the slot is free
+ */
+struct virtio_blk_slot {
+	struct virtio_blk_outhdr out_hdr;
+	u8 status;
+	lbaint_t pos;
+	lbaint_t blkcnt;
+};
+
+/**
+ * struct virtio_blk_priv - private data for a virtio block device
+ *
+ * @vq:		virtqueue for the requests
+ * @slots:	requests which can be in flight
+ * @inflight:	number of @slots in use
+ * @sent:	blocks of the transfer sent so far
+ * @end:	blocks to transfer, cut short by an error
+ * @seg_size:	largest data segment the device accepts, in bytes
+ * @max_segs:	largest number of data segments in a request
+ * @req:	asynchronous request in progress, if any
+ */
 struct virtio_blk_priv {
 	struct virtqueue *vq;
+	struct virtio_blk_slot slots[VIRTIO_BLK_NUM_SLOTS];
+	uint inflight;
+	lbaint_t sent;
+	lbaint_t end;
+	u32 seg_size;
+	uint max_segs;
+	struct blk_req *req;
 };
 
-static ulong virtio_blk_do_req(struct udevice *dev, u64 sector,
-			       lbaint_t blkcnt, void *buffer, u32 type)
+/* Add a request for @blkcnt blocks to the virtqueue, in @slot */
+static int virtio_blk_add_req(struct udevice *dev,
+			      struct virtio_blk_slot *slot, u64 sector,
+			      lbaint_t blkcnt, void *buffer, u32 type)
 {
 	struct virtio_blk_priv *priv = dev_get_priv(dev);
-	unsigned int num_out = 0, num_in = 0;
-	struct virtio_sg *sgs[3];
-	u8 status;
-	int ret;
+	struct virtio_sg sg[VIRTIO_BLK_MAX_SEGS + 2];
+	struct virtio_sg *sgs[VIRTIO_BLK_MAX_SEGS + 2];
+	size_t len = blkcnt * 512;
+	uint num_out = 0, num_in = 0, n = 0;
 
-	struct virtio_blk_outhdr out_hdr = {
-		.type = cpu_to_virtio32(dev, type),
-		.sector = cpu_to_virtio64(dev, sector),
-	};
-	struct virtio_sg hdr_sg = { &out_hdr, sizeof(out_hdr) };
-	struct virtio_sg data_sg = { buffer, blkcnt * 512 };
-	struct virtio_sg status_sg = { &status, sizeof(status) };
+	slot->out_hdr.type = cpu_to_virtio32(dev, type);
+	slot->out_hdr.ioprio = 0;
+	slot->out_hdr.sector = cpu_to_virtio64(dev, sector);
+	sg[n].addr = &slot->out_hdr;
+	sg[n++].length = sizeof(slot->out_hdr);
+	num_out++;
 
-	sgs[num_out++] = &hdr_sg;
+	for (; len; n++) {
+		sg[n].addr = buffer;
+		sg[n].length = min_t(size_t, len, priv->seg_size);
+		buffer += sg[n].length;
+		len -= sg[n].length;
+		if (type & VIRTIO_BLK_T_OUT)
+			num_out++;
+		else
+			num_in++;
+	}
 
-	if (type & VIRTIO_BLK_T_OUT)
-		sgs[num_out++] = &data_sg;
-	else
-		sgs[num_out + num_in++] = &data_sg;
+	sg[n].addr = &slot->status;
+	sg[n++].length = sizeof(slot->status);
+	num_in++;
 
-	sgs[num_out + num_in++] = &status_sg;
+	while (n--)
+		sgs[n] = &sg[n];
 	log_debug("dev=%s, active=%d, priv=%p, priv->vq=%p\n", dev->name,
 		  device_active(dev), priv, priv->vq);
 
-	ret = virtqueue_add(priv->vq, sgs, num_out, num_in);
+	return virtqueue_add(priv->vq, sgs, num_out, num_in);
+}
+
+/*
+ * Add requests for the rest of @req while there is room, then tell the
+ * device about them all at once
+ */
+static int virtio_blk_send(struct udevice *dev, struct blk_req *req)
+{
+	struct virtio_blk_priv *priv = dev_get_priv(dev);
+	lbaint_t max_blks;
+	bool added = false;
+	int ret = 0;
+	uint i;
+
+	max_blks = min_t(lbaint_t, VIRTIO_BLK_MAX_REQ_BLKS,
+			 (lbaint_t)priv->seg_size * priv->max_segs / 512);
+	while (priv->sent < priv->end &&
+	       priv->inflight < VIRTIO_BLK_NUM_SLOTS) {
+		lbaint_t blkcnt = min(max_blks, priv->end - priv->sent);
+		struct virtio_blk_slot *slot;
+
+		for (i = 0; priv->slots[i].blkcnt; i++)
+			;
+		slot = &priv->slots[i];
+		ret = virtio_blk_add_req(dev, slot, req->start + priv->sent,
+					 blkcnt, req->buffer + priv->sent * 512,
+					 req->write ? VIRTIO_BLK_T_OUT :
+					 VIRTIO_BLK_T_IN);
+		if (ret)
+			break;
+		slot->pos = priv->sent;
+		slot->blkcnt = blkcnt;
+		priv->sent += blkcnt;
+		priv->inflight++;
+		added = true;
+	}
+	if (added)
+		virtqueue_kick(priv->vq);
+
+	/* A full ring only means waiting for the requests in flight */
+	if (ret == -ENOSPC && priv->inflight)
+		ret = 0;
+
+	return ret;
+}
+
+/* Start a transfer of all of @req */
+static int virtio_blk_start(struct udevice *dev, struct blk_req *req)
+{
+	struct virtio_blk_priv *priv = dev_get_priv(dev);
+	int ret;
+
+	priv->sent = 0;
+	priv->end = req->blkcnt;
+	ret = virtio_blk_send(dev, req);
 	if (ret)
-		return ret;
+		priv->end = priv->sent;
 
-	virtqueue_kick(priv->vq);
+	return ret;
+}
 
+/*
+ * Collect the requests of @req which have completed and send more. The
+ * transfer is cut short at the first request which fails.
+ *
+ * Return: -EAGAIN while requests are in flight, 0 when the transfer is
+ * over, with priv->end blocks done
+ */
+static int virtio_blk_run(struct udevice *dev, struct blk_req *req)
+{
+	struct virtio_blk_priv *priv = dev_get_priv(dev);
+	struct virtio_blk_outhdr *out_hdr;
+	struct virtio_blk_slot *slot;
+
+	while (priv->inflight &&
+	       (out_hdr = virtqueue_get_buf(priv->vq, NULL))) {
+		slot = container_of(out_hdr, struct virtio_blk_slot, out_hdr);
+		if (slot->status != VIRTIO_BLK_S_OK)
+			priv->end = min(priv->end, slot->pos);
+		slot->blkcnt = 0;
+		priv->inflight--;
+	}
+	if (virtio_blk_send(dev, req))
+		priv->end = priv->sent;
+
+	return priv->inflight ? -EAGAIN : 0;
+}
+
+static ulong virtio_blk_do_req(struct udevice *dev, u64 sector,
+			       lbaint_t blkcnt, void *buffer, bool write)
+{
+	struct virtio_blk_priv *priv = dev_get_priv(dev);
+	struct blk_req req = {
+		.dev = dev,
+		.start = sector,
+		.blkcnt = blkcnt,
+		.buffer = buffer,
+		.write = write,
+	};
+	int ret;
+
+#if CONFIG_IS_ENABLED(BLK_ASYNC)
+	/* Finish the request in progress, so its buffer is not taken */
+	if (priv->req)
+		blk_wait(priv->req);
+#endif
+
+	ret = virtio_blk_start(dev, &req);
 	log_debug("wait...");
-	while (!virtqueue_get_buf(priv->vq, NULL))
+	while (virtio_blk_run(dev, &req) == -EAGAIN)
 		;
 	log_debug("done\n");
 
-	return status == VIRTIO_BLK_S_OK ? blkcnt : -EIO;
+	return priv->end ? priv->end : ret ? ret : -EIO;
 }
 
 static ulong virtio_blk_read(struct udevice *dev, lbaint_t start,
 			     lbaint_t blkcnt, void *buffer)
 {
 	log_debug("read %s\n", dev->name);
-	return virtio_blk_do_req(dev, start, blkcnt, buffer,
-				 VIRTIO_BLK_T_IN);
+	return virtio_blk_do_req(dev, start, blkcnt, buffer, false);
 }
 
 static ulong virtio_blk_write(struct udevice *dev, lbaint_t start,
 			      lbaint_t blkcnt, const void *buffer)
 {
-	return virtio_blk_do_req(dev, start, blkcnt, (void *)buffer,
-				 VIRTIO_BLK_T_OUT);
+	return virtio_blk_do_req(dev, start, blkcnt, (void *)buffer, true);
 }
 
+#if CONFIG_IS_ENABLED(BLK_ASYNC)
+static int virtio_blk_submit(struct udevice *dev, struct blk_req *req)
+{
+	struct virtio_blk_priv *priv = dev_get_priv(dev);
+	int ret;
+
+	/* One request at a time, though it can be split into many */
+	if (priv->req)
+		return -EBUSY;
+
+	ret = virtio_blk_start(dev, req);
+	if (ret && !priv->inflight)
+		return ret;
+	priv->req = req;
+
+	return 0;
+}
+
+static int virtio_blk_poll(struct udevice *dev, struct blk_req *req)
+{
+	struct virtio_blk_priv *priv = dev_get_priv(dev);
+
+	if (virtio_blk_run(dev, req) == -EAGAIN)
+		return -EAGAIN;
+
+	priv->req = NULL;
+	blk_req_complete(req, priv->end ? priv->end : -EIO);
+
+	return 0;
+}
+#endif
+
 static int virtio_blk_bind(struct udevice *dev)
 {
 	struct virtio_dev_priv *uc_priv = dev_get_uclass_priv(dev->parent);
@@ -105,7 +298,8 @@ static int virtio_blk_bind(struct udevice *dev)
 	desc->bdev = dev;
 
 	/* Indicate what driver features we support */
-	virtio_driver_features_init(uc_priv, NULL, 0, NULL, 0);
+	virtio_driver_features_init(uc_priv, feature, ARRAY_SIZE(feature),
+				    NULL, 0);
 
 	return 0;
 }
@@ -114,6 +308,7 @@ static int virtio_blk_probe(struct udevice *dev)
 {
 	struct virtio_blk_priv *priv = dev_get_priv(dev);
 	struct blk_desc *desc = dev_get_uclass_plat(dev);
+	u32 size_max, seg_max;
 	u64 cap;
 	int ret;
 
@@ -121,6 +316,22 @@ static int virtio_blk_probe(struct udevice *dev)
 	if (ret)
 		return ret;
 
+	/* Keep to the limits of the device, if it has any */
+	priv->seg_size = SZ_1G;
+	if (!virtio_cread_feature(dev, VIRTIO_BLK_F_SIZE_MAX,
+				  struct virtio_blk_config, size_max,
+				  &size_max) && size_max >= 512)
+		priv->seg_size = ALIGN_DOWN(size_max, 512);
+	priv->max_segs = VIRTIO_BLK_MAX_SEGS;
+	if (!virtio_cread_feature(dev, VIRTIO_BLK_F_SEG_MAX,
+				  struct virtio_blk_config, seg_max,
+				  &seg_max) && seg_max)
+		priv->max_segs = min_t(uint, priv->max_segs, seg_max);
+	/* Without indirect descriptors, a request must fit in the ring */
+	if (!priv->vq->indirect)
+		priv->max_segs = min_t(uint, priv->max_segs,
+				       virtqueue_get_vring_size(priv->vq) - 2);
+
 	desc->blksz = 512;
 	desc->log2blksz = 9;
 	virtio_cread(dev, struct virtio_blk_config, capacity, &cap);
@@ -132,6 +343,10 @@ static int virtio_blk_probe(struct udevice *dev)
 static const struct blk_ops virtio_blk_ops = {
 	.read	= virtio_blk_read,
 	.write	= virtio_blk_write,
+#if CONFIG_IS_ENABLED(BLK_ASYNC)
+	.submit	= virtio_blk_submit,
+	.poll	= virtio_blk_poll,
+#endif
 };
 
 U_BOOT_DRIVER(virtio_blk) = {
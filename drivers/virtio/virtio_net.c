@@ -32,7 +32,22 @@ struct virtio_net_priv {
 
 	char rx_buff[VIRTIO_NET_NUM_RX_BUFS][VIRTIO_NET_RX_BUF_SIZE];
 	bool rx_running;
+	bool rx_refilled;
 	int net_hdr_len;
+
+	/*
+	 * With header split, each receive buffer only holds the frame
+	 * headers and is chained to the data buffer recorded here. A bit
+	 * set in split_free means the receive buffer is neither in the ring
+	 * nor being processed, one set in split_foreign that it is in the
+	 * ring with a data buffer which is not the rest of it, and one set
+	 * in split_held that the frame in it is being processed.
+	 */
+	int split_hdr_len;
+	void *split_data[VIRTIO_NET_NUM_RX_BUFS];
+	u32 split_free;
+	u32 split_foreign;
+	u32 split_held;
 };
 
 /*
@@ -126,6 +141,14 @@ static int virtio_net_free_pkt(struct udevice *dev, uchar *packet, int length)
 	void *buf = packet - priv->net_hdr_len;
 	struct virtio_sg sg = { buf, VIRTIO_NET_RX_BUF_SIZE };
 	struct virtio_sg *sgs[] = { &sg };
+	int i = (buf - (void *)priv->rx_buff) / VIRTIO_NET_RX_BUF_SIZE;
+
+	/* The buffer goes back into the ring along with the next data buffer */
+	priv->split_held &= ~BIT(i);
+	if (priv->split_hdr_len) {
+		priv->split_free |= BIT(i);
+		return 0;
+	}
 
 	/* Put the buffer back to the rx ring */
 	virtqueue_add(priv->rx_vq, sgs, 0, 1);
@@ -133,6 +156,158 @@ static int virtio_net_free_pkt(struct udevice *dev, uchar *packet, int length)
 	return 0;
 }
 
+/*
+ * Buffers given to the device can only be taken back by resetting it, after
+ * which the virtqueues have to be set up again.
+ */
+static int virtio_net_reset(struct udevice *dev)
+{
+	struct virtio_net_priv *priv = dev_get_priv(dev);
+	int ret;
+
+	ret = virtio_reset(dev);
+	if (ret)
+		return ret;
+
+	ret = virtio_del_vqs(dev);
+	if (ret)
+		return ret;
+
+	virtio_add_status(dev, VIRTIO_CONFIG_S_ACKNOWLEDGE);
+	virtio_add_status(dev, VIRTIO_CONFIG_S_DRIVER);
+	ret = virtio_finalize_features(dev);
+	if (ret)
+		return ret;
+
+	ret = virtio_find_vqs(dev, 2, priv->vqs);
+	if (ret < 0)
+		return ret;
+
+	virtio_add_status(dev, VIRTIO_CONFIG_S_DRIVER_OK);
+	priv->rx_refilled = false;
+
+	return 0;
+}
+
+/*
+ * Header split starts with the buffers which are in the ring already: the
+ * rest of a frame which lands in one of them is right behind its headers,
+ * as if the buffer had been posted by rx_post() with a NULL buf. Taking
+ * them back would mean resetting the device.
+ */
+static int virtio_net_rx_split(struct udevice *dev, int hdr_len)
+{
+	struct virtio_net_priv *priv = dev_get_priv(dev);
+	struct virtio_sg sg = { NULL, VIRTIO_NET_RX_BUF_SIZE };
+	struct virtio_sg *sgs[] = { &sg };
+	int ret;
+	int i;
+
+	if (hdr_len) {
+		/* There is no point when the device only sees bounce buffers */
+		if (priv->rx_vq->vring.bouncebufs)
+			return -ENOSYS;
+
+		priv->split_hdr_len = hdr_len;
+		priv->split_free = 0;
+		priv->split_foreign = 0;
+		for (i = 0; i < VIRTIO_NET_NUM_RX_BUFS; i++)
+			priv->split_data[i] = priv->rx_buff[i] +
+				priv->net_hdr_len + hdr_len;
+
+		/*
+		 * A buffer is posted while the frame which made room for it
+		 * is still being processed, so one is always out of the ring
+		 */
+		return VIRTIO_NET_NUM_RX_BUFS - 1;
+	}
+
+	/* Only data buffers which are not the driver's own need a reset */
+	if (priv->split_foreign) {
+		ret = virtio_net_reset(dev);
+		if (ret)
+			return ret;
+		priv->split_free = ~priv->split_held &
+			GENMASK(VIRTIO_NET_NUM_RX_BUFS - 1, 0);
+	}
+
+	/* The frame being processed goes back through free_pkt() */
+	for (i = 0; i < VIRTIO_NET_NUM_RX_BUFS; i++) {
+		if (priv->split_free & BIT(i)) {
+			sg.addr = priv->rx_buff[i];
+			virtqueue_add(priv->rx_vq, sgs, 0, 1);
+		}
+	}
+	virtqueue_kick(priv->rx_vq);
+	priv->split_hdr_len = 0;
+	priv->split_free = 0;
+	priv->split_foreign = 0;
+
+	return 0;
+}
+
+static int virtio_net_rx_post(struct udevice *dev, void *buf, int len)
+{
+	struct virtio_net_priv *priv = dev_get_priv(dev);
+	struct virtio_sg hdr_sg, data_sg;
+	struct virtio_sg *sgs[] = { &hdr_sg, &data_sg };
+	int ret;
+	int i;
+
+	if (!priv->split_free)
+		return -ENOSPC;
+
+	i = ffs(priv->split_free) - 1;
+	hdr_sg.addr = priv->rx_buff[i];
+	hdr_sg.length = priv->net_hdr_len + priv->split_hdr_len;
+
+	/* The driver's own data buffer is the rest of the receive buffer */
+	if (buf) {
+		data_sg.addr = buf;
+		data_sg.length = len;
+	} else {
+		data_sg.addr = priv->rx_buff[i] + hdr_sg.length;
+		data_sg.length = VIRTIO_NET_RX_BUF_SIZE - hdr_sg.length;
+	}
+
+	ret = virtqueue_add(priv->rx_vq, sgs, 0, 2);
+	if (ret)
+		return ret;
+
+	priv->split_data[i] = data_sg.addr;
+	priv->split_free &= ~BIT(i);
+	if (buf)
+		priv->split_foreign |= BIT(i);
+	priv->rx_refilled = true;
+
+	return 0;
+}
+
+static int virtio_net_recv_split(struct udevice *dev, int flags, uchar **hdrp,
+				 uchar **datap)
+{
+	struct virtio_net_priv *priv = dev_get_priv(dev);
+	unsigned int len;
+	void *buf;
+	int i;
+
+	if (priv->rx_refilled) {
+		virtqueue_kick(priv->rx_vq);
+		priv->rx_refilled = false;
+	}
+
+	buf = virtqueue_get_buf(priv->rx_vq, &len);
+	if (!buf)
+		return -EAGAIN;
+
+	i = (buf - (void *)priv->rx_buff) / VIRTIO_NET_RX_BUF_SIZE;
+	priv->split_foreign &= ~BIT(i);
+	priv->split_held |= BIT(i);
+	*hdrp = buf + priv->net_hdr_len;
+	*datap = priv->split_data[i];
+	return len - priv->net_hdr_len;
+}
+
 static void virtio_net_stop(struct udevice *dev)
 {
 	/*
@@ -221,6 +396,9 @@ static const struct eth_ops virtio_net_ops = {
 	.send = virtio_net_send,
 	.recv = virtio_net_recv,
 	.free_pkt = virtio_net_free_pkt,
+	.rx_split = virtio_net_rx_split,
+	.rx_post = virtio_net_rx_post,
+	.recv_split = virtio_net_recv_split,
 	.stop = virtio_net_stop,
 	.write_hwaddr = virtio_net_write_hwaddr,
 	.read_rom_hwaddr = virtio_net_read_rom_hwaddr,
@@ -85,6 +85,51 @@ static unsigned int virtqueue_attach_desc(struct virtqueue *vq, unsigned int i,
 	return desc_shadow->next;
 }
 
+/*
+ * Put a whole chain of buffers in the indirect @table and point descriptor
+ * @i at it, so that the chain only takes up one descriptor of the ring
+ */
+static unsigned int virtqueue_attach_indirect(struct virtqueue *vq,
+					      unsigned int i,
+					      struct vring_desc *table,
+					      struct virtio_sg *sgs[],
+					      unsigned int out_sgs,
+					      unsigned int in_sgs)
+{
+	struct vring_desc_shadow *desc_shadow = &vq->vring_desc_shadow[i];
+	struct vring_desc *desc = &vq->vring.desc[i];
+	unsigned int total = out_sgs + in_sgs;
+	unsigned int n;
+
+	for (n = 0; n < total; n++) {
+		u16 flags = n < total - 1 ? VRING_DESC_F_NEXT : 0;
+
+		if (n >= out_sgs)
+			flags |= VRING_DESC_F_WRITE;
+		table[n].addr = cpu_to_virtio64(vq->vdev,
+						(u64)(uintptr_t)sgs[n]->addr);
+		table[n].len = cpu_to_virtio32(vq->vdev, sgs[n]->length);
+		table[n].flags = cpu_to_virtio16(vq->vdev, flags);
+		table[n].next = cpu_to_virtio16(vq->vdev, n + 1);
+	}
+
+	/*
+	 * The shadow keeps the first buffer, since that is what
+	 * virtqueue_get_buf() returns
+	 */
+	desc_shadow->addr = (u64)(uintptr_t)sgs[0]->addr;
+	desc_shadow->len = total * sizeof(*table);
+	desc_shadow->flags = VRING_DESC_F_INDIRECT;
+	desc_shadow->indir_desc = table;
+
+	desc->addr = cpu_to_virtio64(vq->vdev, (u64)(uintptr_t)table);
+	desc->len = cpu_to_virtio32(vq->vdev, desc_shadow->len);
+	desc->flags = cpu_to_virtio16(vq->vdev, desc_shadow->flags);
+	desc->next = cpu_to_virtio16(vq->vdev, desc_shadow->next);
+
+	return desc_shadow->next;
+}
+
 static void virtqueue_detach_desc(struct virtqueue *vq, unsigned int idx)
 {
 	struct vring_desc *desc = &vq->vring.desc[idx];
@@ -101,13 +146,20 @@ static void virtqueue_detach_desc(struct virtqueue *vq, unsigned int idx)
 int virtqueue_add(struct virtqueue *vq, struct virtio_sg *sgs[],
 		  unsigned int out_sgs, unsigned int in_sgs)
 {
-	struct vring_desc *desc;
+	struct vring_desc *desc, *table = NULL;
 	unsigned int descs_used = out_sgs + in_sgs;
 	unsigned int i, n, avail, uninitialized_var(prev);
 	int head;
 
 	WARN_ON(descs_used == 0);
 
+	/* If there is no memory for a table, the chain goes in the ring */
+	if (vq->indirect && descs_used > 1) {
+		table = malloc(descs_used * sizeof(*table));
+		if (table)
+			descs_used = 1;
+	}
+
 	head = vq->free_head;
 
 	desc = vq->vring.desc;
@@ -116,6 +168,7 @@ int virtqueue_add(struct virtqueue *vq, struct virtio_sg *sgs[],
 	if (vq->num_free < descs_used) {
 		debug("Can't add buf len %i - avail = %i\n",
 		      descs_used, vq->num_free);
+		free(table);
 		/*
 		 * FIXME: for historical reasons, we force a notify here if
 		 * there are outgoing parts to the buffer.  Presumably the
@@ -126,7 +179,12 @@ int virtqueue_add(struct virtqueue *vq, struct virtio_sg *sgs[],
 		return -ENOSPC;
 	}
 
-	for (n = 0; n < descs_used; n++) {
+	if (table) {
+		prev = i;
+		i = virtqueue_attach_indirect(vq, i, table, sgs, out_sgs,
+					      in_sgs);
+	}
+	for (n = 0; !table && n < descs_used; n++) {
 		u16 flags = VRING_DESC_F_NEXT;
 
 		if (n >= out_sgs)
@@ -212,6 +270,9 @@ static void detach_buf(struct virtqueue *vq, unsigned int head)
 	/* Unmark the descriptor as the head of a chain. */
 	vq->vring_desc_shadow[head].chain_head = false;
 
+	free(vq->vring_desc_shadow[head].indir_desc);
+	vq->vring_desc_shadow[head].indir_desc = NULL;
+
 	/* Put back on free list: unmap first-level descriptors and find end */
 	i = head;
 
@@ -316,6 +377,9 @@ static struct virtqueue *__vring_new_virtqueue(unsigned int index,
 	list_add_tail(&vq->list, &uc_priv->vqs);
 
 	vq->event = virtio_has_feature(vdev, VIRTIO_RING_F_EVENT_IDX);
+	/* Indirect tables are not set up for bounce buffers */
+	vq->indirect = virtio_has_feature(vdev, VIRTIO_RING_F_INDIRECT_DESC) &&
+		       !vring.bouncebufs;
 
 	/* Tell other side not to bother us */
 	vq->avail_flags_shadow |= VRING_AVAIL_F_NO_INTERRUPT;
@@ -395,6 +459,10 @@ err_free_queue:
 
 void vring_del_virtqueue(struct virtqueue *vq)
 {
+	unsigned int i;
+
+	for (i = 0; i < vq->vring.num; i++)
+		free(vq->vring_desc_shadow[i].indir_desc);
 	virtio_free_pages(vq->vdev, vq->vring.desc,
 			  DIV_ROUND_UP(vq->vring.size, PAGE_SIZE));
 	free(vq->vring_desc_shadow);
@@ -963,6 +963,281 @@ int ext4fs_filename_unlink(char *filename)
 	return -1;
 }
 
+static inline void ext4fs_bg_set_free_blocks(struct ext2_block_group *bg,
+					     const struct ext_filesystem *fs,
+					     uint32_t free_blocks)
+{
+	bg->free_blocks = cpu_to_le16(free_blocks & 0xffff);
+	if (fs->gdsize == 64)
+		bg->free_blocks_high = cpu_to_le16(free_blocks >> 16);
+}
+
+/* Number of blocks in block group @bg_idx, the last one may be short */
+static uint32_t ext4fs_bg_num_blocks(uint32_t bg_idx)
+{
+	struct ext_filesystem *fs = get_fs();
+	uint32_t blk_per_grp = le32_to_cpu(fs->sb->blocks_per_group);
+	uint64_t total = le32_to_cpu(fs->sb->total_blocks);
+
+	if (fs->gdsize == 64)
+		total += (uint64_t)le32_to_cpu(fs->sb->total_blocks_high) << 32;
+	total -= le32_to_cpu(fs->sb->first_data_block) +
+		 (uint64_t)bg_idx * blk_per_grp;
+
+	return min_t(uint64_t, total, blk_per_grp);
+}
+
+static bool ext4fs_bg_has_super(uint32_t bg_idx)
+{
+	struct ext_filesystem *fs = get_fs();
+	uint32_t base, n;
+
+	if (bg_idx <= 1 || !(le32_to_cpu(fs->sb->feature_ro_compat) &
+			     EXT4_FEATURE_RO_COMPAT_SPARSE_SUPER))
+		return true;
+
+	/* Backups live in groups that are powers of 3, 5 and 7 */
+	for (base = 3; base <= 7; base += 2) {
+		for (n = base; n < bg_idx; n *= base)
+			;
+		if (n == bg_idx)
+			return true;
+	}
+
+	return false;
+}
+
+static void ext4fs_bmap_set(unsigned char *bmap, uint32_t bit)
+{
+	bmap[bit / 8] |= 1 << (bit % 8);
+}
+
+/*
+ * Build the block bitmap of a group still marked EXT4_BG_BLOCK_UNINIT:
+ * everything is free apart from the superblock and descriptor backups,
+ * whatever bitmaps and inode tables were placed in the group and the
+ * padding past its last block.
+ */
+static void ext4fs_init_block_bmap(uint32_t bg_idx, unsigned char *bmap)
+{
+	struct ext_filesystem *fs = get_fs();
+	uint32_t blk_per_grp = le32_to_cpu(fs->sb->blocks_per_group);
+	uint32_t nbits = ext4fs_bg_num_blocks(bg_idx);
+	uint64_t first = le32_to_cpu(fs->sb->first_data_block) +
+			 (uint64_t)bg_idx * blk_per_grp;
+	uint32_t itable_blocks = ext4fs_div_roundup(
+			le32_to_cpu(fs->sb->inodes_per_group) * fs->inodesz,
+			fs->blksz);
+	uint64_t meta[3][2], lo, hi;
+	uint32_t i, j, k;
+
+	memset(bmap, 0, fs->blksz);
+	for (i = nbits; i < fs->blksz * 8; i++)
+		ext4fs_bmap_set(bmap, i);
+
+	if (ext4fs_bg_has_super(bg_idx)) {
+		k = 1 + fs->no_blk_pergdt +
+		    le16_to_cpu(fs->sb->reserved_gdt_blocks);
+		for (i = 0; i < k && i < nbits; i++)
+			ext4fs_bmap_set(bmap, i);
+	}
+
+	for (j = 0; j < fs->no_blkgrp; j++) {
+		struct ext2_block_group *bgd =
+			ext4fs_get_group_descriptor(fs, j);
+
+		meta[0][0] = ext4fs_bg_get_block_id(bgd, fs);
+		meta[0][1] = 1;
+		meta[1][0] = ext4fs_bg_get_inode_id(bgd, fs);
+		meta[1][1] = 1;
+		meta[2][0] = ext4fs_bg_get_inode_table_id(bgd, fs);
+		meta[2][1] = itable_blocks;
+		for (i = 0; i < 3; i++) {
+			lo = max(meta[i][0], first);
+			hi = min(meta[i][0] + meta[i][1], first + nbits);
+			for (; lo < hi; lo++)
+				ext4fs_bmap_set(bmap, lo - first);
+		}
+	}
+}
+
+/**
+ * ext4fs_get_block_bmap() - get the block bitmap of a group for changing
+ *
+ * Bitmaps are only read in, and logged to the journal, when a group is
+ * first touched, and the ones that were are written back by
+ * ext4fs_update().
+ *
+ * @bg_idx:	block group
+ * Return:	bitmap, or NULL if it could not be read
+ */
+unsigned char *ext4fs_get_block_bmap(uint32_t bg_idx)
+{
+	struct ext_filesystem *fs = get_fs();
+	struct ext2_block_group *bgd;
+	unsigned char *bmap;
+	uint16_t bg_flags;
+
+	if (bg_idx >= fs->no_blkgrp)
+		return NULL;
+	if (fs->blk_bmaps[bg_idx])
+		return fs->blk_bmaps[bg_idx];
+
+	bmap = zalloc(fs->blksz);
+	if (!bmap)
+		return NULL;
+	bgd = ext4fs_get_group_descriptor(fs, bg_idx);
+	bg_flags = ext4fs_bg_get_flags(bgd);
+	if (bg_flags & EXT4_BG_BLOCK_UNINIT) {
+		ext4fs_init_block_bmap(bg_idx, bmap);
+		ext4fs_bg_set_flags(bgd, bg_flags & ~EXT4_BG_BLOCK_UNINIT);
+	} else if (!ext4fs_devread(ext4fs_bg_get_block_id(bgd, fs) *
+				   fs->sect_perblk, 0, fs->blksz,
+				   (char *)bmap) ||
+		   ext4fs_log_journal((char *)bmap, ext4fs_bg_get_block_id(bgd, fs))) {
+		free(bmap);
+		return NULL;
+	}
+	fs->blk_bmaps[bg_idx] = bmap;
+
+	return bmap;
+}
+
+/**
+ * ext4fs_get_inode_bmap() - get the inode bitmap of a group for changing
+ *
+ * @bg_idx:	block group
+ * Return:	bitmap, or NULL if it could not be read
+ */
+unsigned char *ext4fs_get_inode_bmap(uint32_t bg_idx)
+{
+	struct ext_filesystem *fs = get_fs();
+	struct ext2_block_group *bgd;
+	unsigned char *bmap;
+	uint16_t bg_flags;
+	uint32_t i;
+
+	if (bg_idx >= fs->no_blkgrp)
+		return NULL;
+	if (fs->inode_bmaps[bg_idx])
+		return fs->inode_bmaps[bg_idx];
+
+	bmap = zalloc(fs->blksz);
+	if (!bmap)
+		return NULL;
+	bgd = ext4fs_get_group_descriptor(fs, bg_idx);
+	bg_flags = ext4fs_bg_get_flags(bgd);
+	if (bg_flags & EXT4_BG_INODE_UNINIT) {
+		for (i = le32_to_cpu(fs->sb->inodes_per_group);
+		     i < fs->blksz * 8; i++)
+			ext4fs_bmap_set(bmap, i);
+		ext4fs_bg_set_flags(bgd, bg_flags & ~EXT4_BG_INODE_UNINIT);
+	} else if (!ext4fs_devread(ext4fs_bg_get_inode_id(bgd, fs) *
+				   fs->sect_perblk, 0, fs->blksz,
+				   (char *)bmap) ||
+		   ext4fs_log_journal((char *)bmap, ext4fs_bg_get_inode_id(bgd, fs))) {
+		free(bmap);
+		return NULL;
+	}
+	fs->inode_bmaps[bg_idx] = bmap;
+
+	return bmap;
+}
+
+/* Find the first bit from @bit on that is @set, or @nbits if none is */
+static uint32_t ext4fs_bmap_next(const unsigned char *bmap, uint32_t bit,
+				 uint32_t nbits, int set)
+{
+	unsigned char skip = set ? 0x00 : 0xff;
+
+	while (bit < nbits) {
+		if (!(bit % 8) && bmap[bit / 8] == skip) {
+			bit += 8;
+			continue;
+		}
+		if (!(bmap[bit / 8] & (1 << (bit % 8))) == !set)
+			return bit;
+		bit++;
+	}
+
+	return nbits;
+}
+
+/*
+ * Allocate a run of up to @want contiguous blocks, taking the first free
+ * one at or after @goal. Returns the length of the run, with its first
+ * block in @start, or 0 if there is no free block left.
+ */
+static uint32_t ext4fs_alloc_run(uint64_t goal, uint32_t want,
+				 uint64_t *start)
+{
+	struct ext_filesystem *fs = get_fs();
+	uint32_t blk_per_grp = le32_to_cpu(fs->sb->blocks_per_group);
+	uint32_t first = le32_to_cpu(fs->sb->first_data_block);
+	uint32_t bg_goal, bg_idx, bit, end, nbits, n, i;
+	struct ext2_block_group *bgd;
+	unsigned char *bmap;
+
+	if (goal < first)
+		goal = first;
+	bg_goal = (goal - first) / blk_per_grp;
+	if (bg_goal >= fs->no_blkgrp)
+		bg_goal = 0;
+
+	/* Go once round all the groups, ending where we started */
+	for (n = 0; n <= fs->no_blkgrp; n++) {
+		bg_idx = (bg_goal + n) % fs->no_blkgrp;
+		bgd = ext4fs_get_group_descriptor(fs, bg_idx);
+		if (!ext4fs_bg_get_free_blocks(bgd, fs))
+			continue;
+		bmap = ext4fs_get_block_bmap(bg_idx);
+		if (!bmap)
+			return 0;
+
+		nbits = ext4fs_bg_num_blocks(bg_idx);
+		bit = n ? 0 : (goal - first) % blk_per_grp;
+		bit = ext4fs_bmap_next(bmap, bit, nbits, 0);
+		if (bit == nbits)
+			continue;
+		end = ext4fs_bmap_next(bmap, bit, min(nbits, bit + want), 1);
+
+		for (i = bit; i < end; i++)
+			ext4fs_bmap_set(bmap, i);
+		ext4fs_bg_set_free_blocks(bgd, fs,
+				ext4fs_bg_get_free_blocks(bgd, fs) -
+				(end - bit));
+		ext4fs_sb_set_free_blocks(fs->sb,
+				ext4fs_sb_get_free_blocks(fs->sb) -
+				(end - bit));
+
+		*start = first + (uint64_t)bg_idx * blk_per_grp + bit;
+		return end - bit;
+	}
+
+	return 0;
+}
+
+/* Give back a run handed out by ext4fs_alloc_run() */
+static void ext4fs_free_run(uint64_t start, uint32_t len)
+{
+	struct ext_filesystem *fs = get_fs();
+	uint32_t blk_per_grp = le32_to_cpu(fs->sb->blocks_per_group);
+	uint32_t first = le32_to_cpu(fs->sb->first_data_block);
+	struct ext2_block_group *bgd;
+	uint32_t bg_idx, bit;
+
+	for (; len; start++, len--) {
+		bg_idx = (start - first) / blk_per_grp;
+		bit = (start - first) % blk_per_grp;
+		bgd = ext4fs_get_group_descriptor(fs, bg_idx);
+		fs->blk_bmaps[bg_idx][bit / 8] &= ~(1 << (bit % 8));
+		ext4fs_bg_set_free_blocks(bgd, fs,
+				ext4fs_bg_get_free_blocks(bgd, fs) + 1);
+		ext4fs_sb_set_free_blocks(fs->sb,
+				ext4fs_sb_get_free_blocks(fs->sb) + 1);
+	}
+}
+
 uint32_t ext4fs_get_new_blk_no(void)
 {
 	short i;
@@ -972,9 +1247,9 @@ uint32_t ext4fs_get_new_blk_no(void)
 	static int prev_bg_bitmap_index = -1;
 	unsigned int blk_per_grp = le32_to_cpu(ext4fs_root->sblock.blocks_per_group);
 	struct ext_filesystem *fs = get_fs();
+	unsigned char *bmap;
 	char *journal_buffer = zalloc(fs->blksz);
-	char *zero_buffer = zalloc(fs->blksz);
-	if (!journal_buffer || !zero_buffer)
+	if (!journal_buffer)
 		goto fail;
 
 	if (fs->first_pass_bbmap == 0) {
@@ -982,19 +1257,12 @@ uint32_t ext4fs_get_new_blk_no(void)
 			struct ext2_block_group *bgd = NULL;
 			bgd = ext4fs_get_group_descriptor(fs, i);
 			if (ext4fs_bg_get_free_blocks(bgd, fs)) {
-				uint16_t bg_flags = ext4fs_bg_get_flags(bgd);
 				uint64_t b_bitmap_blk =
 					ext4fs_bg_get_block_id(bgd, fs);
-				if (bg_flags & EXT4_BG_BLOCK_UNINIT) {
-					memcpy(fs->blk_bmaps[i], zero_buffer,
-					       fs->blksz);
-					put_ext4(b_bitmap_blk * fs->blksz,
-						 fs->blk_bmaps[i], fs->blksz);
-					bg_flags &= ~EXT4_BG_BLOCK_UNINIT;
-					ext4fs_bg_set_flags(bgd, bg_flags);
-				}
-				fs->curr_blkno =
-				    _get_new_blk_no(fs->blk_bmaps[i]);
+				bmap = ext4fs_get_block_bmap(i);
+				if (!bmap)
+					goto fail;
+				fs->curr_blkno = _get_new_blk_no(bmap);
 				if (fs->curr_blkno == -1)
 					/* block bitmap is completely filled */
 					continue;
@@ -1047,18 +1315,12 @@ restart:
 			goto restart;
 		}
 
-		uint16_t bg_flags = ext4fs_bg_get_flags(bgd);
 		uint64_t b_bitmap_blk = ext4fs_bg_get_block_id(bgd, fs);
-		if (bg_flags & EXT4_BG_BLOCK_UNINIT) {
-			memcpy(fs->blk_bmaps[bg_idx], zero_buffer, fs->blksz);
-			put_ext4(b_bitmap_blk * fs->blksz,
-				 zero_buffer, fs->blksz);
-			bg_flags &= ~EXT4_BG_BLOCK_UNINIT;
-			ext4fs_bg_set_flags(bgd, bg_flags);
-		}
+		bmap = ext4fs_get_block_bmap(bg_idx);
+		if (!bmap)
+			goto fail;
 
-		if (ext4fs_set_block_bmap(fs->curr_blkno, fs->blk_bmaps[bg_idx],
-				   bg_idx) != 0) {
+		if (ext4fs_set_block_bmap(fs->curr_blkno, bmap, bg_idx) != 0) {
 			debug("going for restart for the block no %ld %u\n",
 			      fs->curr_blkno, bg_idx);
 			fs->curr_blkno++;
@@ -1082,12 +1344,10 @@ restart:
 	}
 success:
 	free(journal_buffer);
-	free(zero_buffer);
 
 	return fs->curr_blkno;
 fail:
 	free(journal_buffer);
-	free(zero_buffer);
 
 	return -1;
 }
@@ -1100,9 +1360,9 @@ int ext4fs_get_new_inode_no(void)
 	static int prev_inode_bitmap_index = -1;
 	unsigned int inodes_per_grp = le32_to_cpu(ext4fs_root->sblock.inodes_per_group);
 	struct ext_filesystem *fs = get_fs();
+	unsigned char *bmap;
 	char *journal_buffer = zalloc(fs->blksz);
-	char *zero_buffer = zalloc(fs->blksz);
-	if (!journal_buffer || !zero_buffer)
+	if (!journal_buffer)
 		goto fail;
 	int has_gdt_chksum = le32_to_cpu(fs->sb->feature_ro_compat) &
 		EXT4_FEATURE_RO_COMPAT_GDT_CSUM ? 1 : 0;
@@ -1114,21 +1374,14 @@ int ext4fs_get_new_inode_no(void)
 			bgd = ext4fs_get_group_descriptor(fs, i);
 			free_inodes = ext4fs_bg_get_free_inodes(bgd, fs);
 			if (free_inodes) {
-				uint16_t bg_flags = ext4fs_bg_get_flags(bgd);
 				uint64_t i_bitmap_blk =
 					ext4fs_bg_get_inode_id(bgd, fs);
 				if (has_gdt_chksum)
 					bgd->bg_itable_unused = free_inodes;
-				if (bg_flags & EXT4_BG_INODE_UNINIT) {
-					put_ext4(i_bitmap_blk * fs->blksz,
-						 zero_buffer, fs->blksz);
-					bg_flags &= ~EXT4_BG_INODE_UNINIT;
-					ext4fs_bg_set_flags(bgd, bg_flags);
-					memcpy(fs->inode_bmaps[i],
-					       zero_buffer, fs->blksz);
-				}
-				fs->curr_inode_no =
-				    _get_new_inode_no(fs->inode_bmaps[i]);
+				bmap = ext4fs_get_inode_bmap(i);
+				if (!bmap)
+					goto fail;
+				fs->curr_inode_no = _get_new_inode_no(bmap);
 				if (fs->curr_inode_no == -1)
 					/* inode bitmap is completely filled */
 					continue;
@@ -1160,20 +1413,13 @@ restart:
 		ibmap_idx = fs->curr_inode_no / inodes_per_grp;
 		struct ext2_block_group *bgd =
 			ext4fs_get_group_descriptor(fs, ibmap_idx);
-		uint16_t bg_flags = ext4fs_bg_get_flags(bgd);
 		uint64_t i_bitmap_blk = ext4fs_bg_get_inode_id(bgd, fs);
 
-		if (bg_flags & EXT4_BG_INODE_UNINIT) {
-			put_ext4(i_bitmap_blk * fs->blksz,
-				 zero_buffer, fs->blksz);
-			bg_flags &= ~EXT4_BG_INODE_UNINIT;
-			ext4fs_bg_set_flags(bgd, bg_flags);
-			memcpy(fs->inode_bmaps[ibmap_idx], zero_buffer,
-				fs->blksz);
-		}
+		bmap = ext4fs_get_inode_bmap(ibmap_idx);
+		if (!bmap)
+			goto fail;
 
-		if (ext4fs_set_inode_bmap(fs->curr_inode_no,
-					  fs->inode_bmaps[ibmap_idx],
+		if (ext4fs_set_inode_bmap(fs->curr_inode_no, bmap,
 					  ibmap_idx) != 0) {
 			debug("going for restart for the block no %d %u\n",
 			      fs->curr_inode_no, ibmap_idx);
@@ -1200,12 +1446,10 @@ restart:
 
 success:
 	free(journal_buffer);
-	free(zero_buffer);
 
 	return fs->curr_inode_no;
 fail:
 	free(journal_buffer);
-	free(zero_buffer);
 
 	return -1;
 
@@ -1498,6 +1742,134 @@ fail:
 	free(ti_gp_buff_start_addr);
 }
 
+static uint64_t ext4fs_extent_start(const struct ext4_extent *ext)
+{
+	return le32_to_cpu(ext->ee_start_lo) +
+	       ((uint64_t)le16_to_cpu(ext->ee_start_hi) << 32);
+}
+
+/*
+ * Map @blocks new blocks to @file_inode as extents, allocating them a
+ * contiguous run at a time. Up to four extents fit in the inode, more go
+ * into leaf blocks indexed from it. Returns 0 on success, or -ve if the
+ * blocks did not fit into such a tree, having given them back.
+ */
+static int ext4fs_allocate_extents(struct ext2_inode *file_inode,
+				   unsigned int blocks,
+				   unsigned int *total_no_of_block)
+{
+	struct ext_filesystem *fs = get_fs();
+	struct ext4_extent_header *eh =
+		(struct ext4_extent_header *)file_inode->b.blocks.dir_blocks;
+	struct ext4_extent_idx *idx = (struct ext4_extent_idx *)(eh + 1);
+	unsigned int per_leaf = (fs->blksz - sizeof(*eh)) /
+				sizeof(struct ext4_extent);
+	unsigned int count = 0, alloced = 0, leaves, i, n;
+	struct ext4_extent *ext = NULL, *prev;
+	struct ext4_extent_header *leaf;
+	uint64_t leaf_blk[EXT4_INODE_EXTENTS];
+	uint64_t start, goal = 0;
+	uint32_t len, lblk = 0;
+	char *buf = NULL;
+	int ret = -ENOSPC;
+
+	while (lblk < blocks) {
+		len = ext4fs_alloc_run(goal, min(blocks - lblk,
+						 (unsigned int)EXT_INIT_MAX_LEN),
+				       &start);
+		if (!len) {
+			printf("no block left to assign\n");
+			goto fail;
+		}
+		goal = start + len;
+
+		prev = count ? &ext[count - 1] : NULL;
+		if (prev && ext4fs_extent_start(prev) +
+		    le16_to_cpu(prev->ee_len) == start &&
+		    le16_to_cpu(prev->ee_len) + len <= EXT_INIT_MAX_LEN) {
+			prev->ee_len = cpu_to_le16(le16_to_cpu(prev->ee_len) +
+						   len);
+		} else {
+			if (count == alloced) {
+				alloced = alloced ? alloced * 2 : 16;
+				prev = realloc(ext, alloced * sizeof(*ext));
+				if (!prev) {
+					ext4fs_free_run(start, len);
+					ret = -ENOMEM;
+					goto fail;
+				}
+				ext = prev;
+			}
+			ext[count].ee_block = cpu_to_le32(lblk);
+			ext[count].ee_len = cpu_to_le16(len);
+			ext[count].ee_start_hi = cpu_to_le16(start >> 32);
+			ext[count].ee_start_lo = cpu_to_le32(start);
+			count++;
+		}
+		lblk += len;
+	}
+
+	eh->eh_magic = cpu_to_le16(EXT4_EXT_MAGIC);
+	eh->eh_max = cpu_to_le16(EXT4_INODE_EXTENTS);
+	if (count <= EXT4_INODE_EXTENTS) {
+		eh->eh_entries = cpu_to_le16(count);
+		memcpy(eh + 1, ext, count * sizeof(*ext));
+		goto done;
+	}
+
+	leaves = DIV_ROUND_UP(count, per_leaf);
+	if (leaves > EXT4_INODE_EXTENTS) {
+		debug("%u extents do not fit, mapping blocks instead\n",
+		      count);
+		goto fail;
+	}
+	buf = zalloc(fs->blksz);
+	if (!buf) {
+		ret = -ENOMEM;
+		goto fail;
+	}
+	leaf = (struct ext4_extent_header *)buf;
+	for (i = 0; i < leaves; i++) {
+		if (!ext4fs_alloc_run(goal, 1, &start)) {
+			printf("no block left to assign\n");
+			while (i--)
+				ext4fs_free_run(leaf_blk[i], 1);
+			goto fail;
+		}
+		n = min(count - i * per_leaf, per_leaf);
+		memset(buf, '\0', fs->blksz);
+		leaf->eh_magic = cpu_to_le16(EXT4_EXT_MAGIC);
+		leaf->eh_entries = cpu_to_le16(n);
+		leaf->eh_max = cpu_to_le16(per_leaf);
+		memcpy(leaf + 1, &ext[i * per_leaf], n * sizeof(*ext));
+		put_ext4(start * fs->blksz, buf, fs->blksz);
+		leaf_blk[i] = start;
+
+		idx[i].ei_block = ext[i * per_leaf].ee_block;
+		idx[i].ei_leaf_lo = cpu_to_le32(start);
+		idx[i].ei_leaf_hi = cpu_to_le16(start >> 32);
+		idx[i].ei_unused = 0;
+	}
+	eh->eh_entries = cpu_to_le16(leaves);
+	eh->eh_depth = cpu_to_le16(1);
+	*total_no_of_block += leaves;
+done:
+	file_inode->flags = cpu_to_le32(le32_to_cpu(file_inode->flags) |
+					EXT4_EXTENTS_FL);
+	ret = 0;
+fail:
+	if (ret) {
+		for (i = 0; i < count; i++)
+			ext4fs_free_run(ext4fs_extent_start(&ext[i]),
+					le16_to_cpu(ext[i].ee_len));
+		memset(eh, '\0', sizeof(file_inode->b.blocks));
+	}
+	free(buf);
+	free(ext);
+
+	return ret;
+}
+
 void ext4fs_allocate_blocks(struct ext2_inode *file_inode,
 				unsigned int total_remaining_blocks,
 				unsigned int *total_no_of_block)
@@ -1506,6 +1878,13 @@ void ext4fs_allocate_blocks(struct ext2_inode *file_inode,
 	long int direct_blockno;
 	unsigned int no_blks_reqd = 0;
 
+	if (total_remaining_blocks &&
+	    (le32_to_cpu(get_fs()->sb->feature_incompat) &
+	     EXT4_FEATURE_INCOMPAT_EXTENTS) &&
+	    !ext4fs_allocate_extents(file_inode, total_remaining_blocks,
+				     total_no_of_block))
+		return;
+
 	/* allocation of direct blocks */
 	for (i = 0; total_remaining_blocks && i < INDIRECT_BLOCKS; i++) {
 		direct_blockno = ext4fs_get_new_blk_no();
@@ -2014,6 +2393,7 @@ long int read_allocated_block(struct ext2_inode *inode, int fileblock,
  */
 void ext4fs_reinit_global(void)
 {
+	ext4fs_free_extent_map();
 	if (ext4fs_indir1_block != NULL) {
 		free(ext4fs_indir1_block);
 		ext4fs_indir1_block = NULL;
@@ -2047,6 +2427,56 @@ void ext4fs_close(void)
 	ext4fs_reinit_global();
 }
 
+static struct ext2fs_node *ext4fs_dirent_node(struct ext2fs_node *diro,
+					      struct ext2_dirent *dirent,
+					      int *ftype)
+{
+	struct ext2fs_node *fdiro;
+	int type = FILETYPE_UNKNOWN;
+	int status;
+
+	fdiro = zalloc(sizeof(struct ext2fs_node));
+	if (!fdiro)
+		return NULL;
+
+	fdiro->data = diro->data;
+	fdiro->ino = le32_to_cpu(dirent->inode);
+
+	if (dirent->filetype != FILETYPE_UNKNOWN) {
+		fdiro->inode_read = 0;
+
+		if (dirent->filetype == FILETYPE_DIRECTORY)
+			type = FILETYPE_DIRECTORY;
+		else if (dirent->filetype == FILETYPE_SYMLINK)
+			type = FILETYPE_SYMLINK;
+		else if (dirent->filetype == FILETYPE_REG)
+			type = FILETYPE_REG;
+	} else {
+		status = ext4fs_read_inode(diro->data,
+					   le32_to_cpu(dirent->inode),
+					   &fdiro->inode);
+		if (status == 0) {
+			free(fdiro);
+			return NULL;
+		}
+		fdiro->inode_read = 1;
+
+		if ((le16_to_cpu(fdiro->inode.mode) &
+		     FILETYPE_INO_MASK) == FILETYPE_INO_DIRECTORY) {
+			type = FILETYPE_DIRECTORY;
+		} else if ((le16_to_cpu(fdiro->inode.mode) &
+			    FILETYPE_INO_MASK) == FILETYPE_INO_SYMLINK) {
+			type = FILETYPE_SYMLINK;
+		} else if ((le16_to_cpu(fdiro->inode.mode) &
+			    FILETYPE_INO_MASK) == FILETYPE_INO_REG) {
+			type = FILETYPE_REG;
+		}
+	}
+	*ftype = type;
+
+	return fdiro;
+}
+
 int ext4fs_iterate_dir(struct ext2fs_node *dir, char *name,
 				struct ext2fs_node **fnode, int *ftype)
 {
@@ -2064,6 +2494,23 @@ int ext4fs_iterate_dir(struct ext2fs_node *dir, char *name,
 		if (status == 0)
 			return 0;
 	}
+	/* Look the name up through the hash tree if there is one */
+	if (IS_ENABLED(CONFIG_EXT4_HTREE) && name && fnode && ftype &&
+	    (le32_to_cpu(diro->inode.flags) & EXT4_INDEX_FL)) {
+		struct ext2_dirent dirent;
+		struct ext2fs_node *fdiro;
+
+		status = ext4fs_dx_lookup(diro, name, &dirent);
+		if (status == -ENOENT)
+			return 0;
+		if (!status) {
+			fdiro = ext4fs_dirent_node(diro, &dirent, ftype);
+			if (!fdiro)
+				return 0;
+			*fnode = fdiro;
+			return 1;
+		}
+	}
 	/* Search the file.  */
 	while (fpos < le32_to_cpu(diro->inode.size)) {
 		struct ext2_dirent dirent;
@@ -2082,7 +2529,7 @@ int ext4fs_iterate_dir(struct ext2fs_node *dir, char *name,
 		if (dirent.namelen != 0) {
 			char filename[dirent.namelen + 1];
 			struct ext2fs_node *fdiro;
-			int type = FILETYPE_UNKNOWN;
+			int type;
 
 			status = ext4fs_read_file(diro,
 						  fpos +
@@ -2092,49 +2539,11 @@ int ext4fs_iterate_dir(struct ext2fs_node *dir, char *name,
 			if (status < 0)
 				return 0;
 
-			fdiro = zalloc(sizeof(struct ext2fs_node));
+			fdiro = ext4fs_dirent_node(diro, &dirent, &type);
 			if (!fdiro)
 				return 0;
 
-			fdiro->data = diro->data;
-			fdiro->ino = le32_to_cpu(dirent.inode);
-
 			filename[dirent.namelen] = '\0';
-
-			if (dirent.filetype != FILETYPE_UNKNOWN) {
-				fdiro->inode_read = 0;
-
-				if (dirent.filetype == FILETYPE_DIRECTORY)
-					type = FILETYPE_DIRECTORY;
-				else if (dirent.filetype == FILETYPE_SYMLINK)
-					type = FILETYPE_SYMLINK;
-				else if (dirent.filetype == FILETYPE_REG)
-					type = FILETYPE_REG;
-			} else {
-				status = ext4fs_read_inode(diro->data,
-							   le32_to_cpu
-							   (dirent.inode),
-							   &fdiro->inode);
-				if (status == 0) {
-					free(fdiro);
-					return 0;
-				}
-				fdiro->inode_read = 1;
-
-				if ((le16_to_cpu(fdiro->inode.mode) &
-				     FILETYPE_INO_MASK) ==
-				    FILETYPE_INO_DIRECTORY) {
-					type = FILETYPE_DIRECTORY;
-				} else if ((le16_to_cpu(fdiro->inode.mode)
-					    & FILETYPE_INO_MASK) ==
-					   FILETYPE_INO_SYMLINK) {
-					type = FILETYPE_SYMLINK;
-				} else if ((le16_to_cpu(fdiro->inode.mode)
-					    & FILETYPE_INO_MASK) ==
-					   FILETYPE_INO_REG) {
-					type = FILETYPE_REG;
-				}
-			}
 #ifdef DEBUG
 			printf("iterate >%s<\n", filename);
 #endif /* of DEBUG */
@@ -2346,7 +2755,11 @@ int ext4fs_open(const char *filename, loff_t *len)
 	if (ext4fs_root == NULL)
 		return -1;
 
-	ext4fs_file = NULL;
+	/* The filesystem may stay mounted, so free the last file opened */
+	if (ext4fs_file) {
+		ext4fs_free_node(ext4fs_file, &ext4fs_root->diropen);
+		ext4fs_file = NULL;
+	}
 	status = ext4fs_find_file(filename, &ext4fs_root->diropen, &fdiro,
 				  FILETYPE_REG);
 	if (status == 0)
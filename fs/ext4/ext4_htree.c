@@ -0,0 +1,453 @@
+// SPDX-License-Identifier: GPL-2.0+
+/*
+ * Read-only lookup in ext3/ext4 hash-tree (dir_index) directories.
+ *
+ * The hash functions are taken from fs/ext4/hash.c in Linux:
+ * Copyright (C) 2002 by Theodore Ts'o
+ */
+
+#include <common.h>
+#include <blk.h>
+#include <ext_common.h>
+#include <ext4fs.h>
+#include <log.h>
+#include <malloc.h>
+#include "ext4_common.h"
+
+#define DX_HASH_LEGACY			0
+#define DX_HASH_HALF_MD4		1
+#define DX_HASH_TEA			2
+#define DX_HASH_LEGACY_UNSIGNED		3
+#define DX_HASH_HALF_MD4_UNSIGNED	4
+#define DX_HASH_TEA_UNSIGNED		5
+
+#define EXT2_FLAGS_UNSIGNED_HASH	0x0002
+#define EXT4_ENCRYPT_FL			0x00000800
+#define EXT4_CASEFOLD_FL		0x40000000
+#define EXT4_HTREE_EOF_32BIT		0x7fffffff
+
+/* Index levels including the root, as allowed with the largedir feature */
+#define DX_MAX_LEVELS			3
+
+struct dx_root_info {
+	__le32 reserved_zero;
+	u8 hash_version;
+	u8 info_length;
+	u8 indirect_levels;
+	u8 unused_flags;
+};
+
+struct dx_entry {
+	__le32 hash;
+	__le32 block;
+};
+
+/* The first dx_entry of every index block holds the count and limit */
+struct dx_countlimit {
+	__le16 limit;
+	__le16 count;
+};
+
+struct dx_frame {
+	char *buf;
+	struct dx_entry *entries;
+	struct dx_entry *at;
+	unsigned int count;
+};
+
+static inline u32 rol32(u32 word, unsigned int shift)
+{
+	return (word << shift) | (word >> (32 - shift));
+}
+
+#define DELTA 0x9E3779B9
+
+static void tea_transform(u32 buf[4], const u32 in[])
+{
+	u32 sum = 0;
+	u32 b0 = buf[0], b1 = buf[1];
+	u32 a = in[0], b = in[1], c = in[2], d = in[3];
+	int n = 16;
+
+	do {
+		sum += DELTA;
+		b0 += ((b1 << 4) + a) ^ (b1 + sum) ^ ((b1 >> 5) + b);
+		b1 += ((b0 << 4) + c) ^ (b0 + sum) ^ ((b0 >> 5) + d);
+	} while (--n);
+
+	buf[0] += b0;
+	buf[1] += b1;
+}
+
+/* F, G and H are basic MD4 functions: selection, majority, parity */
+#define F(x, y, z) ((z) ^ ((x) & ((y) ^ (z))))
+#define G(x, y, z) (((x) & (y)) + (((x) ^ (y)) & (z)))
+#define H(x, y, z) ((x) ^ (y) ^ (z))
+
+#define MD4_ROUND(f, a, b, c, d, x, s)	\
+	(a += f(b, c, d) + x, a = rol32(a, s))
+#define K1 0
+#define K2 013240474631UL
+#define K3 015666365641UL
+
+static void half_md4_transform(u32 buf[4], const u32 in[8])
+{
+	u32 a = buf[0], b = buf[1], c = buf[2], d = buf[3];
+
+	/* Round 1 */
+	MD4_ROUND(F, a, b, c, d, in[0] + K1,  3);
+	MD4_ROUND(F, d, a, b, c, in[1] + K1,  7);
+	MD4_ROUND(F, c, d, a, b, in[2] + K1, 11);
+	MD4_ROUND(F, b, c, d, a, in[3] + K1, 19);
+	MD4_ROUND(F, a, b, c, d, in[4] + K1,  3);
+	MD4_ROUND(F, d, a, b, c, in[5] + K1,  7);
+	MD4_ROUND(F, c, d, a, b, in[6] + K1, 11);
+	MD4_ROUND(F, b, c, d, a, in[7] + K1, 19);
+
+	/* Round 2 */
+	MD4_ROUND(G, a, b, c, d, in[1] + K2,  3);
+	MD4_ROUND(G, d, a, b, c, in[3] + K2,  5);
+	MD4_ROUND(G, c, d, a, b, in[5] + K2,  9);
+	MD4_ROUND(G, b, c, d, a, in[7] + K2, 13);
+	MD4_ROUND(G, a, b, c, d, in[0] + K2,  3);
+	MD4_ROUND(G, d, a, b, c, in[2] + K2,  5);
+	MD4_ROUND(G, c, d, a, b, in[4] + K2,  9);
+	MD4_ROUND(G, b, c, d, a, in[6] + K2, 13);
+
+	/* Round 3 */
+	MD4_ROUND(H, a, b, c, d, in[3] + K3,  3);
+	MD4_ROUND(H, d, a, b, c, in[7] + K3,  9);
+	MD4_ROUND(H, c, d, a, b, in[2] + K3, 11);
+	MD4_ROUND(H, b, c, d, a, in[6] + K3, 15);
+	MD4_ROUND(H, a, b, c, d, in[1] + K3,  3);
+	MD4_ROUND(H, d, a, b, c, in[5] + K3,  9);
+	MD4_ROUND(H, c, d, a, b, in[0] + K3, 11);
+	MD4_ROUND(H, b, c, d, a, in[4] + K3, 15);
+
+	buf[0] += a;
+	buf[1] += b;
+	buf[2] += c;
+	buf[3] += d;
+}
+
+#undef MD4_ROUND
+#undef K1
+#undef K2
+#undef K3
+#undef F
+#undef G
+#undef H
+
+/* The old legacy hash */
+static u32 dx_hack_hash(const char *name, int len, bool is_unsigned)
+{
+	u32 hash, hash0 = 0x12a3fe2d, hash1 = 0x37abe8f9;
+	int c;
+
+	while (len--) {
+		if (is_unsigned)
+			c = (unsigned char)*name++;
+		else
+			c = (signed char)*name++;
+		hash = hash1 + (hash0 ^ (c * 7152373));
+
+		if (hash & 0x80000000)
+			hash -= 0x7fffffff;
+		hash1 = hash0;
+		hash0 = hash;
+	}
+
+	return hash0 << 1;
+}
+
+static void str2hashbuf(const char *msg, int len, u32 *buf, int num,
+			bool is_unsigned)
+{
+	u32 pad, val;
+	int i, c;
+
+	pad = (u32)len | ((u32)len << 8);
+	pad |= pad << 16;
+
+	val = pad;
+	if (len > num * 4)
+		len = num * 4;
+	for (i = 0; i < len; i++) {
+		if (is_unsigned)
+			c = (unsigned char)msg[i];
+		else
+			c = (signed char)msg[i];
+		val = c + (val << 8);
+		if ((i % 4) == 3) {
+			*buf++ = val;
+			val = pad;
+			num--;
+		}
+	}
+	if (--num >= 0)
+		*buf++ = val;
+	while (--num >= 0)
+		*buf++ = pad;
+}
+
+static u32 ext4fs_dx_hash(struct ext2_sblock *sb, int version,
+			  const char *name, int len)
+{
+	bool is_unsigned = version >= DX_HASH_LEGACY_UNSIGNED;
+	u32 buf[4], in[8];
+	u32 hash;
+	int i;
+
+	/* Initialize the default seed for the hash checksum functions */
+	buf[0] = 0x67452301;
+	buf[1] = 0xefcdab89;
+	buf[2] = 0x98badcfe;
+	buf[3] = 0x10325476;
+
+	for (i = 0; i < 4; i++) {
+		if (sb->hash_seed[i])
+			break;
+	}
+	if (i < 4) {
+		for (i = 0; i < 4; i++)
+			buf[i] = le32_to_cpu(sb->hash_seed[i]);
+	}
+
+	switch (version) {
+	case DX_HASH_LEGACY:
+	case DX_HASH_LEGACY_UNSIGNED:
+		hash = dx_hack_hash(name, len, is_unsigned);
+		break;
+	case DX_HASH_HALF_MD4:
+	case DX_HASH_HALF_MD4_UNSIGNED:
+		while (len > 0) {
+			str2hashbuf(name, len, in, 8, is_unsigned);
+			half_md4_transform(buf, in);
+			len -= 32;
+			name += 32;
+		}
+		hash = buf[1];
+		break;
+	default:
+		while (len > 0) {
+			str2hashbuf(name, len, in, 4, is_unsigned);
+			tea_transform(buf, in);
+			len -= 16;
+			name += 16;
+		}
+		hash = buf[0];
+		break;
+	}
+
+	hash &= ~1;
+	if (hash == (EXT4_HTREE_EOF_32BIT << 1))
+		hash = (EXT4_HTREE_EOF_32BIT - 1) << 1;
+
+	return hash;
+}
+
+static int ext4fs_dx_read(struct ext2fs_node *dir, u32 blk, char *buf)
+{
+	unsigned int blksz = EXT2_BLOCK_SIZE(dir->data);
+	loff_t pos = (loff_t)blk * blksz;
+	loff_t actread;
+
+	if (pos + blksz > le32_to_cpu(dir->inode.size))
+		return -EINVAL;
+	if (ext4fs_read_file(dir, pos, blksz, buf, &actread) < 0 ||
+	    actread != blksz)
+		return -EIO;
+
+	return 0;
+}
+
+static int ext4fs_dx_frame(struct dx_frame *frame, unsigned int off)
+{
+	struct dx_countlimit *cl = (struct dx_countlimit *)(frame->buf + off);
+	unsigned int limit = le16_to_cpu(cl->limit);
+	unsigned int blksz = EXT2_BLOCK_SIZE(ext4fs_root);
+
+	frame->count = le16_to_cpu(cl->count);
+	if (!frame->count || frame->count > limit ||
+	    off + limit * sizeof(struct dx_entry) > blksz)
+		return -EINVAL;
+	frame->entries = (struct dx_entry *)cl;
+	frame->at = frame->entries;
+
+	return 0;
+}
+
+/* Point the frame at the last entry whose hash is not above @hash */
+static void ext4fs_dx_search(struct dx_frame *frame, u32 hash)
+{
+	struct dx_entry *p = frame->entries + 1;
+	struct dx_entry *q = frame->entries + frame->count - 1;
+	struct dx_entry *m;
+
+	while (p <= q) {
+		m = p + (q - p) / 2;
+		if (le32_to_cpu(m->hash) > hash)
+			q = m - 1;
+		else
+			p = m + 1;
+	}
+	frame->at = p - 1;
+}
+
+static u32 ext4fs_dx_block(struct dx_frame *frame)
+{
+	return le32_to_cpu(frame->at->block) & 0x00ffffff;
+}
+
+/*
+ * Names whose hashes collide may spill into the next leaf, which is then
+ * indexed with the collision bit set. Advance @frame (and the levels
+ * below it) to that leaf, returning 1 if there is one to look in.
+ */
+static int ext4fs_dx_next(struct ext2fs_node *dir, struct dx_frame *frames,
+			  struct dx_frame *frame, u32 hash)
+{
+	struct dx_frame *p = frame;
+	int ret;
+
+	while (++p->at == p->entries + p->count) {
+		if (p == frames)
+			return 0;
+		p--;
+	}
+	if ((le32_to_cpu(p->at->hash) & ~1) != hash)
+		return 0;
+
+	while (p < frame) {
+		ret = ext4fs_dx_read(dir, ext4fs_dx_block(p), p[1].buf);
+		if (ret)
+			return ret;
+		p++;
+		ret = ext4fs_dx_frame(p, 8);
+		if (ret)
+			return ret;
+	}
+
+	return 1;
+}
+
+static int ext4fs_dx_leaf(const char *leaf, const char *name,
+			  unsigned int len, struct ext2_dirent *dirent)
+{
+	unsigned int blksz = EXT2_BLOCK_SIZE(ext4fs_root);
+	unsigned int off = 0;
+
+	while (off + sizeof(struct ext2_dirent) <= blksz) {
+		const struct ext2_dirent *de =
+			(const struct ext2_dirent *)(leaf + off);
+		unsigned int reclen = le16_to_cpu(de->direntlen);
+
+		if (reclen < sizeof(*de) || off + reclen > blksz ||
+		    sizeof(*de) + de->namelen > reclen)
+			return -EINVAL;
+
+		if (de->inode && de->namelen == len &&
+		    !memcmp(leaf + off + sizeof(*de), name, len)) {
+			memcpy(dirent, de, sizeof(*dirent));
+			return 0;
+		}
+		off += reclen;
+	}
+
+	return -ENOENT;
+}
+
+/**
+ * ext4fs_dx_lookup() - look up a name through a directory's hash tree
+ *
+ * @dir:	directory node, with EXT4_INDEX_FL set and its inode read
+ * @name:	name to look for
+ * @dirent:	returns the directory entry of @name
+ * Return:	0 if found, -ENOENT if not, other -ve value if the index
+ *		cannot be used and the directory must be scanned instead
+ */
+int ext4fs_dx_lookup(struct ext2fs_node *dir, const char *name,
+		     struct ext2_dirent *dirent)
+{
+	unsigned int blksz = EXT2_BLOCK_SIZE(dir->data);
+	struct ext2_sblock *sb = &dir->data->sblock;
+	struct dx_frame frames[DX_MAX_LEVELS];
+	struct dx_frame *frame;
+	struct dx_root_info *info;
+	unsigned int len = strlen(name);
+	unsigned int levels, i;
+	int version, ret;
+	char *bufs, *leaf;
+	u32 hash;
+
+	/*
+	 * "." and ".." are only in the root block, ahead of the index; the
+	 * linear scan finds them straight away
+	 */
+	if (!len || len > 255 || !strcmp(name, ".") || !strcmp(name, ".."))
+		return -EINVAL;
+	/* Those hash something other than the name as given */
+	if (le32_to_cpu(dir->inode.flags) &
+	    (EXT4_ENCRYPT_FL | EXT4_CASEFOLD_FL))
+		return -EINVAL;
+
+	bufs = malloc(blksz * (DX_MAX_LEVELS + 1));
+	if (!bufs)
+		return -ENOMEM;
+	for (i = 0; i < DX_MAX_LEVELS; i++)
+		frames[i].buf = bufs + i * blksz;
+	leaf = bufs + DX_MAX_LEVELS * blksz;
+
+	frame = frames;
+	ret = ext4fs_dx_read(dir, 0, frame->buf);
+	if (ret)
+		goto out;
+
+	/* The root block starts with fake "." and ".." entries */
+	info = (struct dx_root_info *)(frame->buf + 24);
+	levels = info->indirect_levels;
+	version = info->hash_version;
+	ret = -EINVAL;
+	if (info->reserved_zero || (info->unused_flags & 1) ||
+	    info->info_length < sizeof(*info) ||
+	    levels >= DX_MAX_LEVELS || version > DX_HASH_TEA)
+		goto out;
+	if (le32_to_cpu(sb->flags) & EXT2_FLAGS_UNSIGNED_HASH)
+		version += DX_HASH_LEGACY_UNSIGNED;
+	hash = ext4fs_dx_hash(sb, version, name, len);
+
+	ret = ext4fs_dx_frame(frame, 24 + info->info_length);
+	if (ret)
+		goto out;
+	for (;;) {
+		ext4fs_dx_search(frame, hash);
+		if (frame == frames + levels)
+			break;
+		ret = ext4fs_dx_read(dir, ext4fs_dx_block(frame),
+				     frame[1].buf);
+		if (ret)
+			goto out;
+		frame++;
+		ret = ext4fs_dx_frame(frame, 8);
+		if (ret)
+			goto out;
+	}
+
+	do {
+		ret = ext4fs_dx_read(dir, ext4fs_dx_block(frame), leaf);
+		if (ret)
+			goto out;
+		ret = ext4fs_dx_leaf(leaf, name, len, dirent);
+		if (ret != -ENOENT)
+			goto out;
+		ret = ext4fs_dx_next(dir, frames, frame, hash);
+	} while (ret > 0);
+	if (!ret)
+		ret = -ENOENT;
+out:
+	free(bufs);
+	if (ret && ret != -ENOENT)
+		debug("htree lookup of %s failed (%d), scanning\n", name, ret);
+
+	return ret;
+}
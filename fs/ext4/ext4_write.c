@@ -78,10 +78,12 @@ static void ext4fs_update(void)
 	put_ext4((uint64_t)(SUPERBLOCK_SIZE),
 		 (struct ext2_sblock *)fs->sb, (uint32_t)SUPERBLOCK_SIZE);
 
-	/* update block bitmaps */
+	/* update block bitmaps, only those read in can have changed */
 	for (i = 0; i < fs->no_blkgrp; i++) {
 		bgd = ext4fs_get_group_descriptor(fs, i);
 		bgd->bg_checksum = cpu_to_le16(ext4fs_checksum_update(i));
+		if (!fs->blk_bmaps[i])
+			continue;
 		uint64_t b_bitmap_blk = ext4fs_bg_get_block_id(bgd, fs);
 		put_ext4(b_bitmap_blk * fs->blksz,
 			 fs->blk_bmaps[i], fs->blksz);
@@ -89,6 +91,8 @@ static void ext4fs_update(void)
 
 	/* update inode bitmaps */
 	for (i = 0; i < fs->no_blkgrp; i++) {
+		if (!fs->inode_bmaps[i])
+			continue;
 		bgd = ext4fs_get_group_descriptor(fs, i);
 		uint64_t i_bitmap_blk = ext4fs_bg_get_inode_id(bgd, fs);
 		put_ext4(i_bitmap_blk * fs->blksz,
@@ -138,6 +142,7 @@ fail:
 
 static void delete_single_indirect_block(struct ext2_inode *inode)
 {
+	unsigned char *bmap;
 	struct ext2_block_group *bgd = NULL;
 	static int prev_bg_bmap_idx = -1;
 	uint32_t blknr;
@@ -162,7 +167,10 @@ static void delete_single_indirect_block(struct ext2_inode *inode)
 			if (!remainder)
 				bg_idx--;
 		}
-		ext4fs_reset_block_bmap(blknr, fs->blk_bmaps[bg_idx], bg_idx);
+		bmap = ext4fs_get_block_bmap(bg_idx);
+		if (!bmap)
+			goto fail;
+		ext4fs_reset_block_bmap(blknr, bmap, bg_idx);
 		/* get  block group descriptor table */
 		bgd = ext4fs_get_group_descriptor(fs, bg_idx);
 		ext4fs_bg_free_blocks_inc(bgd, fs);
@@ -186,6 +194,7 @@ fail:
 
 static void delete_double_indirect_block(struct ext2_inode *inode)
 {
+	unsigned char *bmap;
 	int i;
 	short status;
 	static int prev_bg_bmap_idx = -1;
@@ -226,8 +235,11 @@ static void delete_double_indirect_block(struct ext2_inode *inode)
 			}
 			/* get  block group descriptor table */
 			bgd = ext4fs_get_group_descriptor(fs, bg_idx);
-			ext4fs_reset_block_bmap(le32_to_cpu(*di_buffer),
-					fs->blk_bmaps[bg_idx], bg_idx);
+			bmap = ext4fs_get_block_bmap(bg_idx);
+			if (!bmap)
+				goto fail;
+			ext4fs_reset_block_bmap(le32_to_cpu(*di_buffer), bmap,
+						bg_idx);
 			di_buffer++;
 			ext4fs_bg_free_blocks_inc(bgd, fs);
 			ext4fs_sb_free_blocks_inc(fs->sb);
@@ -259,7 +271,10 @@ static void delete_double_indirect_block(struct ext2_inode *inode)
 		}
 		/* get  block group descriptor table */
 		bgd = ext4fs_get_group_descriptor(fs, bg_idx);
-		ext4fs_reset_block_bmap(blknr, fs->blk_bmaps[bg_idx], bg_idx);
+		bmap = ext4fs_get_block_bmap(bg_idx);
+		if (!bmap)
+			goto fail;
+		ext4fs_reset_block_bmap(blknr, bmap, bg_idx);
 		ext4fs_bg_free_blocks_inc(bgd, fs);
 		ext4fs_sb_free_blocks_inc(fs->sb);
 		/* journal backup */
@@ -283,6 +298,7 @@ fail:
 
 static void delete_triple_indirect_block(struct ext2_inode *inode)
 {
+	unsigned char *bmap;
 	int i, j;
 	short status;
 	static int prev_bg_bmap_idx = -1;
@@ -334,9 +350,11 @@ static void delete_triple_indirect_block(struct ext2_inode *inode)
 						bg_idx--;
 				}
 
+				bmap = ext4fs_get_block_bmap(bg_idx);
+				if (!bmap)
+					goto fail;
 				ext4fs_reset_block_bmap(le32_to_cpu(*tip_buffer),
-							fs->blk_bmaps[bg_idx],
-							bg_idx);
+							bmap, bg_idx);
 
 				tip_buffer++;
 				/* get  block group descriptor table */
@@ -375,8 +393,11 @@ static void delete_triple_indirect_block(struct ext2_inode *inode)
 				if (!remainder)
 					bg_idx--;
 			}
+			bmap = ext4fs_get_block_bmap(bg_idx);
+			if (!bmap)
+				goto fail;
 			ext4fs_reset_block_bmap(le32_to_cpu(*tigp_buffer),
-						fs->blk_bmaps[bg_idx], bg_idx);
+						bmap, bg_idx);
 
 			tigp_buffer++;
 			/* get  block group descriptor table */
@@ -410,7 +431,10 @@ static void delete_triple_indirect_block(struct ext2_inode *inode)
 			if (!remainder)
 				bg_idx--;
 		}
-		ext4fs_reset_block_bmap(blknr, fs->blk_bmaps[bg_idx], bg_idx);
+		bmap = ext4fs_get_block_bmap(bg_idx);
+		if (!bmap)
+			goto fail;
+		ext4fs_reset_block_bmap(blknr, bmap, bg_idx);
 		/* get  block group descriptor table */
 		bgd = ext4fs_get_group_descriptor(fs, bg_idx);
 		ext4fs_bg_free_blocks_inc(bgd, fs);
@@ -435,8 +459,66 @@ fail:
 	free(journal_buffer);
 }
 
+/* Release the index and leaf blocks below an extent tree node */
+static int delete_extent_index_blocks(struct ext4_extent_header *eh)
+{
+	struct ext4_extent_idx *idx = (struct ext4_extent_idx *)(eh + 1);
+	uint32_t blk_per_grp = le32_to_cpu(ext4fs_root->sblock.blocks_per_group);
+	uint32_t first = le32_to_cpu(ext4fs_root->sblock.first_data_block);
+	struct ext_filesystem *fs = get_fs();
+	struct ext2_block_group *bgd;
+	unsigned char *bmap;
+	char *buf = NULL;
+	uint64_t blknr;
+	int bg_idx, i;
+	int ret = 0;
+
+	if (le16_to_cpu(eh->eh_magic) != EXT4_EXT_MAGIC)
+		return -EINVAL;
+	if (!eh->eh_depth)
+		return 0;
+	if (le16_to_cpu(eh->eh_depth) > 1) {
+		buf = zalloc(fs->blksz);
+		if (!buf)
+			return -ENOMEM;
+	}
+
+	for (i = 0; i < le16_to_cpu(eh->eh_entries); i++) {
+		blknr = le32_to_cpu(idx[i].ei_leaf_lo) +
+			((uint64_t)le16_to_cpu(idx[i].ei_leaf_hi) << 32);
+		if (buf) {
+			if (!ext4fs_devread(blknr * fs->sect_perblk, 0,
+					    fs->blksz, buf)) {
+				ret = -EIO;
+				break;
+			}
+			ret = delete_extent_index_blocks(
+					(struct ext4_extent_header *)buf);
+			if (ret)
+				break;
+		}
+
+		debug("EXT4 index block releasing %llu\n",
+		      (unsigned long long)blknr);
+		bg_idx = (blknr - first) / blk_per_grp;
+		bmap = ext4fs_get_block_bmap(bg_idx);
+		if (!bmap) {
+			ret = -EIO;
+			break;
+		}
+		ext4fs_reset_block_bmap(blknr, bmap, bg_idx);
+		bgd = ext4fs_get_group_descriptor(fs, bg_idx);
+		ext4fs_bg_free_blocks_inc(bgd, fs);
+		ext4fs_sb_free_blocks_inc(fs->sb);
+	}
+	free(buf);
+
+	return ret;
+}
+
 static int ext4fs_delete_file(int inodeno)
 {
+	unsigned char *bmap;
 	struct ext2_inode inode;
 	short status;
 	int i;
@@ -457,9 +539,11 @@ static int ext4fs_delete_file(int inodeno)
 	struct ext2_inode *inode_buffer = NULL;
 	struct ext2_block_group *bgd = NULL;
 	struct ext_filesystem *fs = get_fs();
+	struct ext_block_cache cache;
 	char *journal_buffer = zalloc(fs->blksz);
 	if (!journal_buffer)
 		return -ENOMEM;
+	ext_cache_init(&cache);
 	status = ext4fs_read_inode(ext4fs_root, inodeno, &inode);
 	if (status == 0)
 		goto fail;
@@ -479,11 +563,12 @@ static int ext4fs_delete_file(int inodeno)
 	}
 
 	if (le32_to_cpu(inode.flags) & EXT4_EXTENTS_FL) {
-		/* FIXME delete extent index blocks, i.e. eh_depth >= 1 */
 		struct ext4_extent_header *eh =
 			(struct ext4_extent_header *)
 				inode.b.blocks.dir_blocks;
 		debug("del: dep=%d entries=%d\n", eh->eh_depth, eh->eh_entries);
+		if (delete_extent_index_blocks(eh))
+			goto fail;
 	} else {
 		delete_single_indirect_block(&inode);
 		delete_double_indirect_block(&inode);
@@ -492,7 +577,7 @@ static int ext4fs_delete_file(int inodeno)
 
 	/* release data blocks */
 	for (i = 0; i < no_blocks; i++) {
-		blknr = read_allocated_block(&inode, i, NULL);
+		blknr = read_allocated_block(&inode, i, &cache);
 		if (blknr == 0)
 			continue;
 		if (blknr < 0)
@@ -503,8 +588,10 @@ static int ext4fs_delete_file(int inodeno)
 			if (!remainder)
 				bg_idx--;
 		}
-		ext4fs_reset_block_bmap(blknr, fs->blk_bmaps[bg_idx],
-					bg_idx);
+		bmap = ext4fs_get_block_bmap(bg_idx);
+		if (!bmap)
+			goto fail;
+		ext4fs_reset_block_bmap(blknr, bmap, bg_idx);
 		debug("EXT4 Block releasing %ld: %d\n", blknr, bg_idx);
 
 		/* get  block group descriptor table */
@@ -525,6 +612,8 @@ static int ext4fs_delete_file(int inodeno)
 		}
 	}
 
+	ext_cache_fini(&cache);
+
 	/* release inode */
 	/* from the inode no to blockno */
 	inodes_per_block = fs->blksz / fs->inodesz;
@@ -563,7 +652,10 @@ static int ext4fs_delete_file(int inodeno)
 
 	/* update the respective inode bitmaps */
 	inodeno++;
-	ext4fs_reset_inode_bmap(inodeno, fs->inode_bmaps[ibmap_idx], ibmap_idx);
+	bmap = ext4fs_get_inode_bmap(ibmap_idx);
+	if (!bmap)
+		goto fail;
+	ext4fs_reset_inode_bmap(inodeno, bmap, ibmap_idx);
 	ext4fs_bg_free_inodes_inc(bgd, fs);
 	ext4fs_sb_free_inodes_inc(fs->sb);
 	/* journal backup */
@@ -589,6 +681,7 @@ static int ext4fs_delete_file(int inodeno)
 
 	return 0;
 fail:
+	ext_cache_fini(&cache);
 	free(start_block_address);
 	free(journal_buffer);
 
@@ -597,11 +690,13 @@ fail:
 
 int ext4fs_init(void)
 {
-	short status;
 	int i;
 	uint32_t real_free_blocks = 0;
 	struct ext_filesystem *fs = get_fs();
 
+	/* Files are about to change, so forget their extents */
+	ext4fs_free_extent_map();
+
 	/* populate fs */
 	fs->blksz = EXT2_BLOCK_SIZE(ext4fs_root);
 	fs->sect_perblk = fs->blksz >> fs->dev_desc->log2blksz;
@@ -630,46 +725,16 @@ int ext4fs_init(void)
 		goto fail;
 	}
 
-	/* load all the available bitmap block of the partition */
+	/*
+	 * Bitmaps are read in as groups are touched, by
+	 * ext4fs_get_block_bmap() and ext4fs_get_inode_bmap()
+	 */
 	fs->blk_bmaps = zalloc(fs->no_blkgrp * sizeof(char *));
 	if (!fs->blk_bmaps)
 		goto fail;
-	for (i = 0; i < fs->no_blkgrp; i++) {
-		fs->blk_bmaps[i] = zalloc(fs->blksz);
-		if (!fs->blk_bmaps[i])
-			goto fail;
-	}
-
-	for (i = 0; i < fs->no_blkgrp; i++) {
-		struct ext2_block_group *bgd =
-			ext4fs_get_group_descriptor(fs, i);
-		status = ext4fs_devread(ext4fs_bg_get_block_id(bgd, fs) *
-				   fs->sect_perblk, 0,
-				   fs->blksz, (char *)fs->blk_bmaps[i]);
-		if (status == 0)
-			goto fail;
-	}
-
-	/* load all the available inode bitmap of the partition */
 	fs->inode_bmaps = zalloc(fs->no_blkgrp * sizeof(unsigned char *));
 	if (!fs->inode_bmaps)
 		goto fail;
-	for (i = 0; i < fs->no_blkgrp; i++) {
-		fs->inode_bmaps[i] = zalloc(fs->blksz);
-		if (!fs->inode_bmaps[i])
-			goto fail;
-	}
-
-	for (i = 0; i < fs->no_blkgrp; i++) {
-		struct ext2_block_group *bgd =
-			ext4fs_get_group_descriptor(fs, i);
-		status = ext4fs_devread(ext4fs_bg_get_inode_id(bgd, fs) *
-					fs->sect_perblk,
-					0, fs->blksz,
-					(char *)fs->inode_bmaps[i]);
-		if (status == 0)
-			goto fail;
-	}
 
 	/*
 	 * check filesystem consistency with free blocks of file system
@@ -778,6 +843,7 @@ static int ext4fs_write_file(struct ext2_inode *file_inode,
 	int delayed_extent = 0;
 	int delayed_next = 0;
 	const char *delayed_buf = NULL;
+	struct ext_block_cache cache;
 
 	/* Adjust len so it we can't read past the end of the file. */
 	if (len > filesize)
@@ -785,13 +851,16 @@ static int ext4fs_write_file(struct ext2_inode *file_inode,
 
 	blockcnt = ((len + pos) + fs->blksz - 1) / fs->blksz;
 
+	ext_cache_init(&cache);
 	for (i = pos / fs->blksz; i < blockcnt; i++) {
 		long int blknr;
 		int blockend = fs->blksz;
 		int skipfirst = 0;
-		blknr = read_allocated_block(file_inode, i, NULL);
-		if (blknr <= 0)
+		blknr = read_allocated_block(file_inode, i, &cache);
+		if (blknr <= 0) {
+			ext_cache_fini(&cache);
 			return -1;
+		}
 
 		blknr = blknr << log2_fs_blocksize;
 
@@ -832,6 +901,7 @@ static int ext4fs_write_file(struct ext2_inode *file_inode,
 		}
 		buf += fs->blksz - skipfirst;
 	}
+	ext_cache_fini(&cache);
 	if (previous_block_number != -1) {
 		/* spill */
 		put_ext4((uint64_t) ((uint64_t)delayed_start << log2blksz),
@@ -27,8 +27,10 @@
 #include "ext4_common.h"
 #include <div64.h>
 #include <malloc.h>
+#include <memalign.h>
 #include <part.h>
 #include <uuid.h>
+#include <linux/sizes.h>
 
 int ext4fs_symlinknest;
 struct ext_filesystem ext_fs;
@@ -44,6 +46,217 @@ void ext4fs_free_node(struct ext2fs_node *node, struct ext2fs_node *currroot)
 		free(node);
 }
 
+#define EXT_MAX_DEPTH		5
+
+/**
+ * struct ext4_extent_map_ent - a run of blocks in a file
+ *
+ * @block:	first block in the file
+ * @len:	number of blocks
+ * @start:	first block on disk, 0 if the blocks are unwritten
+ */
+struct ext4_extent_map_ent {
+	uint32_t block;
+	uint32_t len;
+	uint64_t start;
+};
+
+/*
+ * Leaves of the extent tree of the last extent-mapped inode read, in file
+ * order. They are collected once, so that reading a file does not descend
+ * the tree again for every block, and kept until the filesystem is closed
+ * or written.
+ */
+static struct {
+	int ino;
+	int count;
+	int size;
+	struct ext4_extent_map_ent *ext;
+} extmap;
+
+void ext4fs_free_extent_map(void)
+{
+	free(extmap.ext);
+	memset(&extmap, '\0', sizeof(extmap));
+}
+
+static int ext4fs_extent_map_add(struct ext4_extent *extent)
+{
+	struct ext4_extent_map_ent *ent;
+	uint32_t len = le16_to_cpu(extent->ee_len);
+
+	if (extmap.count == extmap.size) {
+		int size = extmap.size ? extmap.size * 2 : 16;
+
+		ent = realloc(extmap.ext, size * sizeof(*ent));
+		if (!ent)
+			return -ENOMEM;
+		extmap.ext = ent;
+		extmap.size = size;
+	}
+
+	ent = &extmap.ext[extmap.count];
+	ent->block = le32_to_cpu(extent->ee_block);
+	if (len > EXT_INIT_MAX_LEN) {
+		/* unwritten blocks read as zeroes */
+		ent->len = len - EXT_INIT_MAX_LEN;
+		ent->start = 0;
+	} else {
+		ent->len = len;
+		ent->start = le16_to_cpu(extent->ee_start_hi);
+		ent->start = (ent->start << 32) +
+			le32_to_cpu(extent->ee_start_lo);
+	}
+
+	/* extents must be in order and must not overlap */
+	if (extmap.count && ent->block < ent[-1].block + ent[-1].len)
+		return -EINVAL;
+	extmap.count++;
+
+	return 0;
+}
+
+static int ext4fs_extent_map_walk(struct ext2_data *data,
+				  struct ext4_extent_header *eh, int size,
+				  int depth)
+{
+	int blksz = EXT2_BLOCK_SIZE(data);
+	int log2_blksz = LOG2_BLOCK_SIZE(data) - get_fs()->dev_desc->log2blksz;
+	int entries = le16_to_cpu(eh->eh_entries);
+	struct ext4_extent_idx *index;
+	char *buf;
+	int i, ret = 0;
+
+	if (le16_to_cpu(eh->eh_magic) != EXT4_EXT_MAGIC ||
+	    le16_to_cpu(eh->eh_depth) != depth ||
+	    sizeof(*eh) + entries * sizeof(*index) > size)
+		return -EINVAL;
+
+	if (!depth) {
+		struct ext4_extent *extent = (struct ext4_extent *)(eh + 1);
+
+		for (i = 0; i < entries; i++) {
+			ret = ext4fs_extent_map_add(&extent[i]);
+			if (ret)
+				return ret;
+		}
+
+		return 0;
+	}
+
+	buf = memalign(ARCH_DMA_MINALIGN, blksz);
+	if (!buf)
+		return -ENOMEM;
+
+	index = (struct ext4_extent_idx *)(eh + 1);
+	for (i = 0; i < entries; i++) {
+		unsigned long long block;
+
+		block = le16_to_cpu(index[i].ei_leaf_hi);
+		block = (block << 32) + le32_to_cpu(index[i].ei_leaf_lo);
+		if (!ext4fs_devread((lbaint_t)block << log2_blksz, 0, blksz,
+				    buf)) {
+			ret = -EIO;
+			break;
+		}
+		ret = ext4fs_extent_map_walk(data,
+					     (struct ext4_extent_header *)buf,
+					     blksz, depth - 1);
+		if (ret)
+			break;
+	}
+	free(buf);
+
+	return ret;
+}
+
+/* Set up the extent map for an extent-mapped inode */
+static int ext4fs_extent_map(struct ext2fs_node *node)
+{
+	struct ext4_extent_header *eh;
+	int ret;
+
+	if (extmap.ino && extmap.ino == node->ino)
+		return 0;
+
+	ext4fs_free_extent_map();
+	eh = (struct ext4_extent_header *)node->inode.b.blocks.dir_blocks;
+	if (le16_to_cpu(eh->eh_depth) > EXT_MAX_DEPTH)
+		return -EINVAL;
+	ret = ext4fs_extent_map_walk(node->data, eh,
+				     sizeof(node->inode.b),
+				     le16_to_cpu(eh->eh_depth));
+	if (ret) {
+		printf("invalid extent block\n");
+		ext4fs_free_extent_map();
+		return ret;
+	}
+	extmap.ino = node->ino;
+
+	return 0;
+}
+
+/*
+ * Read from an extent-mapped file, with one device read per extent straight
+ * into the buffer
+ */
+static int ext4fs_read_extents(struct ext2fs_node *node, loff_t pos,
+			       loff_t len, char *buf)
+{
+	int log2_fs_blocksize = LOG2_BLOCK_SIZE(node->data) -
+				get_fs()->dev_desc->log2blksz;
+	int blocksize = EXT2_BLOCK_SIZE(node->data);
+	loff_t end = pos + len;
+	int lo, hi;
+
+	if (ext4fs_extent_map(node))
+		return -1;
+
+	while (pos < end) {
+		uint32_t fileblock = lldiv(pos, blocksize);
+		int skip = pos - (loff_t)fileblock * blocksize;
+		struct ext4_extent_map_ent *ent;
+		loff_t n;
+
+		/* find the first extent which ends after fileblock */
+		lo = 0;
+		hi = extmap.count;
+		while (lo < hi) {
+			int mid = (lo + hi) / 2;
+
+			ent = &extmap.ext[mid];
+			if (ent->block + ent->len <= fileblock)
+				lo = mid + 1;
+			else
+				hi = mid;
+		}
+		ent = lo < extmap.count ? &extmap.ext[lo] : NULL;
+
+		if (!ent || ent->block > fileblock) {
+			/* a hole, up to the next extent */
+			n = end - pos;
+			if (ent)
+				n = min(n, (loff_t)ent->block * blocksize - pos);
+			memset(buf, '\0', n);
+		} else {
+			n = (loff_t)(ent->block + ent->len - fileblock) *
+				blocksize - skip;
+			n = min3(n, end - pos, (loff_t)SZ_1G);
+			if (!ent->start) {
+				memset(buf, '\0', n);
+			} else if (!ext4fs_devread((lbaint_t)(ent->start +
+					fileblock - ent->block) <<
+					log2_fs_blocksize, skip, n, buf)) {
+				return -1;
+			}
+		}
+		pos += n;
+		buf += n;
+	}
+
+	return 0;
+}
+
 /*
  * Taken from openmoko-kernel mailing list: By Andy green
  * Optimized read file API : collects and defers contiguous sector
@@ -80,6 +293,14 @@ int ext4fs_read_file(struct ext2fs_node *node, loff_t pos,
 		return -1;
 	}
 
+	if ((le32_to_cpu(node->inode.flags) & EXT4_EXTENTS_FL) && node->ino) {
+		ext_cache_fini(&cache);
+		if (ext4fs_read_extents(node, pos, len, buf))
+			return -1;
+		*actread = len;
+		return 0;
+	}
+
 	blockcnt = lldiv(((len + pos) + blocksize - 1), blocksize);
 
 	for (i = lldiv(pos, blocksize); i < blockcnt; i++) {
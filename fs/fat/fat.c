@@ -13,6 +13,7 @@
 #include <common.h>
 #include <blk.h>
 #include <config.h>
+#include <div64.h>
 #include <exports.h>
 #include <fat.h>
 #include <fs.h>
@@ -46,6 +47,101 @@ static void downcase(char *str, size_t len)
 static struct blk_desc *cur_dev;
 static struct disk_partition cur_part_info;
 
+/**
+ * struct fat_extent - run of contiguous clusters in a file
+ *
+ * @fclust:	index of the first cluster within the file
+ * @clust:	first cluster on the disk
+ * @len:	number of clusters
+ */
+struct fat_extent {
+	u32 fclust;
+	u32 clust;
+	u32 len;
+};
+
+/**
+ * struct fat_extmap - cluster chain of a file, as a list of extents
+ *
+ * The map is built as far as needed while reading and kept for the next
+ * read of the same file, so that reading at an offset does not follow the
+ * chain from the start again. It is dropped when the FAT is modified or the
+ * device changes.
+ *
+ * @start:	first cluster of the file, 0 if the map is unused
+ * @next:	next cluster in the chain to be mapped
+ * @mapped:	number of clusters mapped so far
+ * @count:	number of extents in @ext
+ * @size:	number of extents allocated in @ext
+ * @ext:	extents, in file order
+ */
+static struct fat_extmap {
+	u32 start;
+	u32 next;
+	u32 mapped;
+	int count;
+	int size;
+	struct fat_extent *ext;
+} extmap;
+
+static void fat_extmap_drop(void)
+{
+	free(extmap.ext);
+	memset(&extmap, '\0', sizeof(extmap));
+}
+
+#define FAT_DCACHE_BUCKETS	256
+#define FAT_DCACHE_MAX		4096
+
+/**
+ * struct fat_dcache_ent - where a name was found in a directory
+ *
+ * @next:	next entry in the same hash bucket
+ * @dir:	first cluster of the directory
+ * @clust:	cluster holding the short name entry (for the FAT12/16 root
+ *		directory, the offset in clusters from its start)
+ * @idx:	index of the short name entry in that cluster
+ * @name:	lower-case long or short name
+ */
+struct fat_dcache_ent {
+	struct fat_dcache_ent *next;
+	u32 dir;
+	u32 clust;
+	u32 idx;
+	char name[];
+};
+
+/*
+ * Names seen while scanning directories, so that looking up a path does not
+ * scan each directory from the start again. The cache lives as long as the
+ * filesystem is mounted and is dropped by anything writing to it.
+ */
+static struct fat_dcache {
+	int count;
+	struct fat_dcache_ent **bucket;
+} dcache;
+
+static void fat_dcache_drop(void)
+{
+	struct fat_dcache_ent *ent, *next;
+	int i;
+
+	if (!dcache.bucket)
+		return;
+
+	for (i = 0; i < FAT_DCACHE_BUCKETS; i++) {
+		for (ent = dcache.bucket[i]; ent; ent = next) {
+			next = ent->next;
+			free(ent);
+		}
+	}
+	free(dcache.bucket);
+	dcache.bucket = NULL;
+	dcache.count = 0;
+}
+
+static void fat_freemap_drop(void);
+
 #define DOS_BOOT_MAGIC_OFFSET	0x1fe
 #define DOS_FS_TYPE_OFFSET	0x36
 #define DOS_FS32_TYPE_OFFSET	0x52
@@ -71,6 +167,9 @@ int fat_set_blk_dev(struct blk_desc *dev_desc, struct disk_partition *info)
 
 	cur_dev = dev_desc;
 	cur_part_info = *info;
+	fat_extmap_drop();
+	fat_dcache_drop();
+	fat_freemap_drop();
 
 	/* Make sure it has a valid FAT header */
 	if (disk_read(0, 1, buffer) != 1) {
@@ -160,6 +259,10 @@ int flush_dirty_fat_buffer(fsdata *mydata)
 	(void)(mydata);
 	return 0;
 }
+
+void fat_freemap_drop(void)
+{
+}
 #endif
 
 /*
@@ -309,6 +412,88 @@ get_cluster(fsdata *mydata, __u32 clustnum, __u8 *buffer, unsigned long size)
 	return 0;
 }
 
+/**
+ * fat_extmap_get() - look up a cluster of a file in its extent map
+ *
+ * The map is extended so that it covers @want clusters from @idx, if the
+ * chain is that long.
+ *
+ * @mydata:	file system description
+ * @start:	first cluster of the file
+ * @idx:	index of the cluster within the file
+ * @want:	number of clusters the caller is going to read from @idx
+ * @clustp:	returns the cluster on the disk
+ * @runp:	returns the number of contiguous clusters from @clustp
+ * Return:	0 on success, -1 if the chain is invalid or too short
+ */
+static int fat_extmap_get(fsdata *mydata, u32 start, u32 idx, u32 want,
+			  u32 *clustp, u32 *runp)
+{
+	struct fat_extent *ext;
+	int lo, hi;
+
+	if (extmap.start != start) {
+		fat_extmap_drop();
+		extmap.start = start;
+		extmap.next = start;
+	}
+
+	while (extmap.mapped < idx + want) {
+		u32 clust = extmap.next;
+
+		/* end of the chain, or a bad entry */
+		if (CHECK_CLUST(clust, mydata->fatsize)) {
+			debug("curclust: 0x%x\n", clust);
+			break;
+		}
+
+		ext = extmap.count ? &extmap.ext[extmap.count - 1] : NULL;
+		if (ext && ext->clust + ext->len == clust) {
+			ext->len++;
+		} else {
+			if (extmap.count == extmap.size) {
+				int size = extmap.size ? extmap.size * 2 : 16;
+
+				ext = realloc(extmap.ext, size * sizeof(*ext));
+				if (!ext) {
+					fat_extmap_drop();
+					return -1;
+				}
+				extmap.ext = ext;
+				extmap.size = size;
+			}
+			ext = &extmap.ext[extmap.count++];
+			ext->fclust = extmap.mapped;
+			ext->clust = clust;
+			ext->len = 1;
+		}
+		extmap.mapped++;
+		extmap.next = get_fatent(mydata, clust);
+	}
+
+	if (idx >= extmap.mapped) {
+		printf("Invalid FAT entry\n");
+		return -1;
+	}
+
+	/* Find the extent holding idx */
+	lo = 0;
+	hi = extmap.count - 1;
+	while (lo < hi) {
+		int mid = (lo + hi + 1) / 2;
+
+		if (extmap.ext[mid].fclust <= idx)
+			lo = mid;
+		else
+			hi = mid - 1;
+	}
+	ext = &extmap.ext[lo];
+	*clustp = ext->clust + idx - ext->fclust;
+	*runp = ext->fclust + ext->len - idx;
+
+	return 0;
+}
+
 /**
  * get_contents() - read from file
  *
@@ -329,8 +514,8 @@ static int get_contents(fsdata *mydata, dir_entry *dentptr, loff_t pos,
 {
 	loff_t filesize = FAT2CPU32(dentptr->size);
 	unsigned int bytesperclust = mydata->clust_size * mydata->sect_size;
-	__u32 curclust = START(dentptr);
-	__u32 endclust, newclust;
+	__u32 start = START(dentptr);
+	__u32 idx, want, clust, run;
 	loff_t actsize;
 
 	*gotsize = 0;
@@ -346,23 +531,15 @@ static int get_contents(fsdata *mydata, dir_entry *dentptr, loff_t pos,
 
 	debug("%llu bytes\n", filesize);
 
-	actsize = bytesperclust;
-
 	/* go to cluster at pos */
-	while (actsize <= pos) {
-		curclust = get_fatent(mydata, curclust);
-		if (CHECK_CLUST(curclust, mydata->fatsize)) {
-			debug("curclust: 0x%x\n", curclust);
-			printf("Invalid FAT entry\n");
-			return -1;
-		}
-		actsize += bytesperclust;
-	}
-
-	/* actsize > pos */
-	actsize -= bytesperclust;
+	idx = lldiv(pos, bytesperclust);
+	actsize = (loff_t)idx * bytesperclust;
 	filesize -= actsize;
 	pos -= actsize;
+	want = DIV_ROUND_UP(filesize, bytesperclust);
+
+	if (fat_extmap_get(mydata, start, idx, want, &clust, &run))
+		return -1;
 
 	/* align to beginning of next cluster if any */
 	if (pos) {
@@ -375,7 +552,7 @@ static int get_contents(fsdata *mydata, dir_entry *dentptr, loff_t pos,
 			return -1;
 		}
 
-		if (get_cluster(mydata, curclust, tmp_buffer, actsize) != 0) {
+		if (get_cluster(mydata, clust, tmp_buffer, actsize) != 0) {
 			printf("Error reading cluster\n");
 			free(tmp_buffer);
 			return -1;
@@ -388,59 +565,31 @@ static int get_contents(fsdata *mydata, dir_entry *dentptr, loff_t pos,
 		if (!filesize)
 			return 0;
 		buffer += actsize;
+		idx++;
+		want--;
 
-		curclust = get_fatent(mydata, curclust);
-		if (CHECK_CLUST(curclust, mydata->fatsize)) {
-			debug("curclust: 0x%x\n", curclust);
-			printf("Invalid FAT entry\n");
+		if (fat_extmap_get(mydata, start, idx, want, &clust, &run))
 			return -1;
-		}
 	}
 
-	actsize = bytesperclust;
-	endclust = curclust;
-
-	do {
-		/* search for consecutive clusters */
-		while (actsize < filesize) {
-			newclust = get_fatent(mydata, endclust);
-			if ((newclust - 1) != endclust)
-				goto getit;
-			if (CHECK_CLUST(newclust, mydata->fatsize)) {
-				debug("curclust: 0x%x\n", newclust);
-				printf("Invalid FAT entry\n");
-				return -1;
-			}
-			endclust = newclust;
-			actsize += bytesperclust;
-		}
-
-		/* get remaining bytes */
-		actsize = filesize;
-		if (get_cluster(mydata, curclust, buffer, (int)actsize) != 0) {
+	/* read each run of contiguous clusters in one go */
+	for (;;) {
+		actsize = min(filesize, (loff_t)run * bytesperclust);
+		if (get_cluster(mydata, clust, buffer, actsize) != 0) {
 			printf("Error reading cluster\n");
 			return -1;
 		}
 		*gotsize += actsize;
-		return 0;
-getit:
-		if (get_cluster(mydata, curclust, buffer, (int)actsize) != 0) {
-			printf("Error reading cluster\n");
-			return -1;
-		}
-		*gotsize += (int)actsize;
 		filesize -= actsize;
+		if (!filesize)
+			return 0;
 		buffer += actsize;
+		idx += run;
+		want -= run;
 
-		curclust = get_fatent(mydata, endclust);
-		if (CHECK_CLUST(curclust, mydata->fatsize)) {
-			debug("curclust: 0x%x\n", curclust);
-			printf("Invalid FAT entry\n");
+		if (fat_extmap_get(mydata, start, idx, want, &clust, &run))
 			return -1;
-		}
-		actsize = bytesperclust;
-		endclust = curclust;
-	} while (1);
+	}
 }
 
 /*
@@ -1092,6 +1241,157 @@ static int fat_itr_isdir(fat_itr *itr)
 	return !!(itr->dent->attr & ATTR_DIR);
 }
 
+static uint fat_dcache_hash(u32 dir, const char *name, int len)
+{
+	uint hash = dir;
+
+	while (len--)
+		hash = hash * 31 + tolower(*name++);
+
+	return hash % FAT_DCACHE_BUCKETS;
+}
+
+static struct fat_dcache_ent *fat_dcache_find(u32 dir, const char *name,
+					      int len)
+{
+	struct fat_dcache_ent *ent;
+
+	if (!dcache.bucket)
+		return NULL;
+
+	ent = dcache.bucket[fat_dcache_hash(dir, name, len)];
+	for (; ent; ent = ent->next) {
+		if (ent->dir == dir && !strncasecmp(ent->name, name, len) &&
+		    !ent->name[len])
+			return ent;
+	}
+
+	return NULL;
+}
+
+static void fat_dcache_add(fat_itr *itr, const char *name)
+{
+	struct fat_dcache_ent *ent;
+	int len = strlen(name);
+	uint hash;
+
+	if (dcache.count >= FAT_DCACHE_MAX ||
+	    fat_dcache_find(itr->start_clust, name, len))
+		return;
+
+	if (!dcache.bucket) {
+		dcache.bucket = calloc(FAT_DCACHE_BUCKETS,
+				       sizeof(*dcache.bucket));
+		if (!dcache.bucket)
+			return;
+	}
+
+	ent = malloc(sizeof(*ent) + len + 1);
+	if (!ent)
+		return;
+	ent->dir = itr->start_clust;
+	ent->clust = itr->clust;
+	ent->idx = itr->dent - (dir_entry *)itr->block;
+	memcpy(ent->name, name, len + 1);
+	downcase(ent->name, len);
+
+	hash = fat_dcache_hash(ent->dir, name, len);
+	ent->next = dcache.bucket[hash];
+	dcache.bucket[hash] = ent;
+	dcache.count++;
+}
+
+/**
+ * fat_dcache_lookup() - find a name in the directory using the cache
+ *
+ * On success the iterator is left at the short name entry of @name, as
+ * fat_itr_next() would have left it (only the short name is set).
+ *
+ * @itr:	iterator at the start of the directory
+ * @name:	name to look up, need not be nul-terminated
+ * @len:	length of @name
+ * Return:	0 if found, -ENOENT if not in the cache, other -ve on error
+ */
+static int fat_dcache_lookup(fat_itr *itr, const char *name, int len)
+{
+	struct fat_dcache_ent *ent;
+	unsigned int nbytes;
+
+	if (!CONFIG_IS_ENABLED(FS_FAT_DIR_CACHE))
+		return -ENOENT;
+
+	ent = fat_dcache_find(itr->start_clust, name, len);
+	if (!ent)
+		return -ENOENT;
+
+	itr->next_clust = ent->clust;
+	itr->last_cluster = 0;
+	if (!fat_next_cluster(itr, &nbytes))
+		return -EIO;
+	if (ent->idx >= nbytes / sizeof(dir_entry))
+		return -EINVAL;
+	itr->dent = (dir_entry *)itr->block + ent->idx;
+	itr->remaining = nbytes / sizeof(dir_entry) - 1 - ent->idx;
+	itr->dent_start = itr->dent;
+	itr->dent_clust = itr->clust;
+	itr->dent_rem = itr->remaining;
+
+	/* The directory was changed without dropping the cache */
+	if (!itr->dent->nameext.name[0] ||
+	    itr->dent->nameext.name[0] == DELETED_FLAG ||
+	    (itr->dent->attr & ATTR_VOLUME))
+		return -EINVAL;
+
+	get_name(itr->dent, itr->s_name);
+	itr->name = itr->s_name;
+
+	return 0;
+}
+
+/**
+ * fat_itr_find() - find a name in the directory
+ *
+ * @itr:	iterator at the start of the directory, left at the entry found
+ * @name:	name to look up, need not be nul-terminated
+ * @len:	length of @name
+ * Return:	0 if found, -ENOENT if not
+ */
+static int fat_itr_find(fat_itr *itr, const char *name, int len)
+{
+	int ret;
+
+	ret = fat_dcache_lookup(itr, name, len);
+	if (!ret)
+		return 0;
+	if (ret != -ENOENT) {
+		/* Forget the cache and scan the directory */
+		fat_dcache_drop();
+		itr->next_clust = itr->start_clust;
+		itr->dent = NULL;
+		itr->remaining = 0;
+		itr->last_cluster = 0;
+	}
+
+	while (fat_itr_next(itr)) {
+		unsigned n = max(strlen(itr->name), (size_t)len);
+
+		if (CONFIG_IS_ENABLED(FS_FAT_DIR_CACHE)) {
+			fat_dcache_add(itr, itr->name);
+			if (itr->name != itr->s_name)
+				fat_dcache_add(itr, itr->s_name);
+		}
+
+		/* check both long and short name: */
+		if (!strncasecmp(name, itr->name, n))
+			return 0;
+		if (itr->name != itr->s_name &&
+		    !strncasecmp(name, itr->s_name, n))
+			return 0;
+	}
+
+	return -ENOENT;
+}
+
 /*
  * Helpers:
  */
@@ -1118,6 +1418,7 @@ static int fat_itr_isdir(fat_itr *itr)
 static int fat_itr_resolve(fat_itr *itr, const char *path, unsigned type)
 {
 	const char *next;
+	int ret;
 
 	/* chomp any extra leading slashes: */
 	while (path[0] && ISDIRDELIM(path[0]))
@@ -1158,39 +1459,26 @@ static int fat_itr_resolve(fat_itr *itr, const char *path, unsigned type)
 		}
 	}
 
-	while (fat_itr_next(itr)) {
-		int match = 0;
-		unsigned n = max(strlen(itr->name), (size_t)(next - path));
-
-		/* check both long and short name: */
-		if (!strncasecmp(path, itr->name, n))
-			match = 1;
-		else if (itr->name != itr->s_name &&
-			 !strncasecmp(path, itr->s_name, n))
-			match = 1;
-
-		if (!match)
-			continue;
+	ret = fat_itr_find(itr, path, next - path);
+	if (ret)
+		return ret;
 
-		if (fat_itr_isdir(itr)) {
-			/* recurse into directory: */
-			fat_itr_child(itr, itr);
-			return fat_itr_resolve(itr, next, type);
-		} else if (next[0]) {
-			/*
-			 * If next is not empty then we have a case
-			 * like: /path/to/realfile/nonsense
-			 */
-			debug("bad trailing path: %s\n", next);
-			return -ENOENT;
-		} else if (!(type & TYPE_FILE)) {
-			return -ENOTDIR;
-		} else {
-			return 0;
-		}
+	if (fat_itr_isdir(itr)) {
+		/* recurse into directory: */
+		fat_itr_child(itr, itr);
+		return fat_itr_resolve(itr, next, type);
+	} else if (next[0]) {
+		/*
+		 * If next is not empty then we have a case
+		 * like: /path/to/realfile/nonsense
+		 */
+		debug("bad trailing path: %s\n", next);
+		return -ENOENT;
+	} else if (!(type & TYPE_FILE)) {
+		return -ENOTDIR;
+	} else {
+		return 0;
 	}
-
-	return -ENOENT;
 }
 
 int file_fat_detectfs(void)
@@ -1422,6 +1710,9 @@ void fat_closedir(struct fs_dir_stream *dirs)
 
 void fat_close(void)
 {
+	fat_extmap_drop();
+	fat_dcache_drop();
+	fat_freemap_drop();
 }
 
 int fat_uuid(char *uuid_str)
@@ -18,6 +18,7 @@
 #include <rand.h>
 #include <asm/byteorder.h>
 #include <asm/cache.h>
+#include <linux/bitops.h>
 #include <linux/ctype.h>
 #include <linux/math64.h>
 #include "fat.c"
@@ -205,6 +206,9 @@ static int disk_write(__u32 block, __u32 nr_blocks, void *buf)
 		return -1;
 	}
 
+	/* Directories may change, so forget where names were found */
+	fat_dcache_drop();
+
 	ret = blk_dwrite(cur_dev, cur_part_info.start + block, nr_blocks, buf);
 	if (nr_blocks && ret == 0)
 		return -1;
@@ -214,13 +218,17 @@ static int disk_write(__u32 block, __u32 nr_blocks, void *buf)
 
 /*
  * Write fat buffer into block device
+ *
+ * Only the span of sectors which was modified is written, to each copy of
+ * the FAT in turn.
  */
 static int flush_dirty_fat_buffer(fsdata *mydata)
 {
-	int getsize = FATBUFBLOCKS;
-	__u32 fatlength = mydata->fatlength;
-	__u8 *bufptr = mydata->fatbuf;
-	__u32 startblock = mydata->fatbufnum * FATBUFBLOCKS;
+	__u32 first = mydata->dirty_first;
+	__u32 getsize = mydata->dirty_last - first + 1;
+	__u8 *bufptr = mydata->fatbuf + first * mydata->sect_size;
+	__u32 startblock;
+	int i;
 
 	debug("debug: evicting %d, dirty: %d\n", mydata->fatbufnum,
 	      (int)mydata->fat_dirty);
@@ -228,25 +236,15 @@ static int flush_dirty_fat_buffer(fsdata *mydata)
 	if ((!mydata->fat_dirty) || (mydata->fatbufnum == -1))
 		return 0;
 
-	/* Cap length if fatlength is not a multiple of FATBUFBLOCKS */
-	if (startblock + getsize > fatlength)
-		getsize = fatlength - startblock;
-
+	startblock = mydata->fatbufnum * FATBUFBLOCKS + first;
 	startblock += mydata->fat_sect;
 
-	/* Write FAT buf */
-	if (disk_write(startblock, getsize, bufptr) < 0) {
-		debug("error: writing FAT blocks\n");
-		return -1;
-	}
-
-	if (mydata->fats == 2) {
-		/* Update corresponding second FAT blocks */
-		startblock += mydata->fatlength;
+	for (i = 0; i < mydata->fats; i++) {
 		if (disk_write(startblock, getsize, bufptr) < 0) {
-			debug("error: writing second FAT blocks\n");
+			debug("error: writing FAT %d blocks\n", i);
 			return -1;
 		}
+		startblock += mydata->fatlength;
 	}
 	mydata->fat_dirty = 0;
 
@@ -435,12 +433,43 @@ fill_dir_slot(fat_itr *itr, const char *l_name, const char *shortname)
 	return 0;
 }
 
+/*
+ * Bitmap of the free clusters, filled in from the FAT as far as allocations
+ * have needed it. It is kept up to date by set_fatent_value() and lives as
+ * long as the filesystem is mounted, so that allocating clusters does not
+ * scan the FAT from the start each time.
+ */
+#define FAT_FREEMAP_STEP	4096
+
+static struct {
+	u32 *map;	/* bit set if the cluster is free, NULL if no memory */
+	u32 clusters;	/* number of clusters, including the reserved two */
+	u32 scanned;	/* clusters below this are in the map */
+} freemap;
+
+void fat_freemap_drop(void)
+{
+	free(freemap.map);
+	memset(&freemap, '\0', sizeof(freemap));
+}
+
+static void fat_freemap_set(u32 clust, bool is_free)
+{
+	if (!freemap.map || clust >= freemap.scanned)
+		return;
+
+	if (is_free)
+		freemap.map[clust / 32] |= BIT(clust % 32);
+	else
+		freemap.map[clust / 32] &= ~BIT(clust % 32);
+}
+
 /*
  * Set the entry at index 'entry' in a FAT (12/16/32) table.
  */
 static int set_fatent_value(fsdata *mydata, __u32 entry, __u32 entry_value)
 {
-	__u32 bufnum, offset, off16;
+	__u32 bufnum, offset, off16, first, last;
 	__u16 val1, val2;
 
 	switch (mydata->fatsize) {
@@ -461,6 +490,9 @@ static int set_fatent_value(fsdata *mydata, __u32 entry, __u32 entry_value)
 		return -1;
 	}
 
+	/* The chain of some file changes */
+	fat_extmap_drop();
+
 	/* Read a new block of FAT entries into the cache. */
 	if (bufnum != mydata->fatbufnum) {
 		int getsize = FATBUFBLOCKS;
@@ -484,8 +516,32 @@ static int set_fatent_value(fsdata *mydata, __u32 entry, __u32 entry_value)
 		mydata->fatbufnum = bufnum;
 	}
 
-	/* Mark as dirty */
+	/* Mark the sectors holding the entry as dirty */
+	switch (mydata->fatsize) {
+	case 32:
+		first = offset * 4;
+		last = first + 3;
+		break;
+	case 16:
+		first = offset * 2;
+		last = first + 1;
+		break;
+	default:
+		first = (offset * 3) / 2;
+		last = first + 1;
+		break;
+	}
+	first /= mydata->sect_size;
+	last /= mydata->sect_size;
+	if (!mydata->fat_dirty) {
+		mydata->dirty_first = first;
+		mydata->dirty_last = last;
+	} else {
+		mydata->dirty_first = min_t(__u32, mydata->dirty_first, first);
+		mydata->dirty_last = max_t(__u32, mydata->dirty_last, last);
+	}
 	mydata->fat_dirty = 1;
+	fat_freemap_set(entry, !entry_value);
 
 	/* Set the actual entry */
 	switch (mydata->fatsize) {
@@ -541,23 +597,100 @@ static int set_fatent_value(fsdata *mydata, __u32 entry, __u32 entry_value)
 	return 0;
 }
 
+/* Add clusters up to 'upto' to the free cluster bitmap */
+static void fat_freemap_scan(fsdata *mydata, __u32 upto)
+{
+	upto = min(upto, freemap.clusters);
+	while (freemap.scanned < upto) {
+		__u32 clust = freemap.scanned++;
+
+		if (!get_fatent(mydata, clust))
+			freemap.map[clust / 32] |= BIT(clust % 32);
+	}
+}
+
+static int fat_cluster_free(fsdata *mydata, __u32 clust)
+{
+	if (!freemap.map)
+		return !get_fatent(mydata, clust);
+
+	if (clust >= freemap.scanned)
+		fat_freemap_scan(mydata, clust + FAT_FREEMAP_STEP);
+
+	return freemap.map[clust / 32] & BIT(clust % 32);
+}
+
+/**
+ * fat_find_free() - find free clusters
+ *
+ * Look for the first run of 'want' free clusters from cluster 'from', or
+ * failing that the first free cluster, searching from the start of the FAT
+ * if there is none after 'from'.
+ *
+ * @mydata:	filesystem parameters
+ * @from:	cluster to start from
+ * @want:	number of contiguous clusters wanted
+ * Return:	first cluster found, 0 if the filesystem is full
+ */
+static __u32 fat_find_free(fsdata *mydata, __u32 from, __u32 want)
+{
+	__u32 clust, start = 0, len = 0, first = 0;
+
+	if (!freemap.clusters) {
+		u64 entries = (u64)mydata->fatlength * mydata->sect_size * 8;
+
+		freemap.clusters = (mydata->total_sect - mydata->data_begin) /
+				   mydata->clust_size;
+		freemap.clusters = min_t(u64, freemap.clusters,
+					 div_u64(entries, mydata->fatsize));
+		freemap.scanned = 2;
+		freemap.map = calloc(DIV_ROUND_UP(freemap.clusters, 32),
+				     sizeof(u32));
+	}
+
+	from = max_t(__u32, from, 2);
+	for (clust = from; clust < freemap.clusters; clust++) {
+		/* skip whole words with no free cluster */
+		if (freemap.map && !len && !(clust % 32) &&
+		    clust + 32 <= freemap.scanned &&
+		    !freemap.map[clust / 32]) {
+			clust += 31;
+			continue;
+		}
+		if (!fat_cluster_free(mydata, clust)) {
+			len = 0;
+			continue;
+		}
+		if (!len++)
+			start = clust;
+		if (!first)
+			first = start;
+		if (len >= want)
+			return start;
+	}
+	if (first)
+		return first;
+	if (from > 2)
+		return fat_find_free(mydata, 2, want);
+
+	return 0;
+}
+
 /*
  * Determine the next free cluster after 'entry' in a FAT (12/16/32) table
  * and link it to 'entry'. EOC marker is not set on returned entry.
+ * Return 0 if there is no free cluster left.
  */
 static __u32 determine_fatent(fsdata *mydata, __u32 entry)
 {
-	__u32 next_fat, next_entry = entry + 1;
+	__u32 next_entry;
 
-	while (1) {
-		next_fat = get_fatent(mydata, next_entry);
-		if (next_fat == 0) {
-			/* found free entry, link to entry */
-			set_fatent_value(mydata, entry, next_entry);
-			break;
-		}
-		next_entry++;
-	}
+	next_entry = fat_find_free(mydata, entry + 1, 1);
+	if (!next_entry)
+		return 0;
+
+	/* found free entry, link to entry */
+	set_fatent_value(mydata, entry, next_entry);
 	debug("FAT%d: entry: %08x, entry_value: %04x\n",
 	       mydata->fatsize, entry, next_entry);
 
@@ -800,20 +933,12 @@ get_set_cluster(fsdata *mydata, __u32 clustnum, loff_t pos, __u8 *buffer,
 }
 
 /*
- * Find the first empty cluster
+ * Find the first run of 'count' empty clusters, or the first empty cluster
+ * if there is no such run. Return 0 if there is no empty cluster.
  */
-static int find_empty_cluster(fsdata *mydata)
+static __u32 find_empty_cluster(fsdata *mydata, __u32 count)
 {
-	__u32 fat_val, entry = 3;
-
-	while (1) {
-		fat_val = get_fatent(mydata, entry);
-		if (fat_val == 0)
-			break;
-		entry++;
-	}
-
-	return entry;
+	return fat_find_free(mydata, 3, count);
 }
 
 /**
@@ -829,7 +954,9 @@ static int new_dir_table(fat_itr *itr)
 	int dir_oldclust = itr->clust;
 	unsigned int bytesperclust = mydata->clust_size * mydata->sect_size;
 
-	dir_newclust = find_empty_cluster(mydata);
+	dir_newclust = find_empty_cluster(mydata, 1);
+	if (!dir_newclust)
+		return -EIO;
 
 	/*
 	 * Flush before updating FAT to ensure valid directory structure
@@ -919,6 +1046,28 @@ static int check_overflow(fsdata *mydata, __u32 clustnum, loff_t size)
 	return 0;
 }
 
+/*
+ * Give back the clusters linked from 'first' on by a write which ran out of
+ * space, and end the file's chain at 'last' again, or leave the file without
+ * clusters if 'last' is 0. The FAT is flushed, so that it stays consistent.
+ */
+static void free_new_clusters(fsdata *mydata, dir_entry *dentptr,
+			      __u32 last, __u32 first)
+{
+	__u32 eoc = 0xfffffff;
+
+	if (mydata->fatsize == 12)
+		eoc = 0xfff;
+	else if (mydata->fatsize == 16)
+		eoc = 0xffff;
+
+	if (last)
+		set_fatent_value(mydata, last, eoc);
+	else
+		set_start_cluster(mydata, dentptr, 0);
+	clear_fatent(mydata, first);
+}
+
 /*
  * Write at most 'maxsize' bytes from 'buffer' into
  * the file associated with 'dentptr'
@@ -932,6 +1081,7 @@ set_contents(fsdata *mydata, dir_entry *dentptr, loff_t pos, __u8 *buffer,
 	unsigned int bytesperclust = mydata->clust_size * mydata->sect_size;
 	__u32 curclust = START(dentptr);
 	__u32 endclust = 0, newclust = 0;
+	__u32 lastclust = 0, firstclust;
 	u64 cur_pos, filesize;
 	loff_t offset, actsize, wsize;
 
@@ -1071,14 +1221,24 @@ set_clusters:
 
 	/* Assure that curclust is valid */
 	if (!curclust) {
-		curclust = find_empty_cluster(mydata);
+		curclust = find_empty_cluster(mydata,
+				DIV_ROUND_UP_ULL(filesize, bytesperclust));
+		if (!curclust) {
+			printf("Error: no space left: %llu\n", filesize);
+			return -1;
+		}
 		set_start_cluster(mydata, dentptr, curclust);
 	} else {
 		newclust = get_fatent(mydata, curclust);
 
 		if (IS_LAST_CLUST(newclust, mydata->fatsize)) {
 			newclust = determine_fatent(mydata, curclust);
-			set_fatent_value(mydata, curclust, newclust);
+			if (!newclust) {
+				printf("Error: no space left: %llu\n",
+				       filesize);
+				return -1;
+			}
+			lastclust = curclust;
 			curclust = newclust;
 		} else {
 			debug("error: something wrong\n");
@@ -1089,15 +1249,24 @@ set_clusters:
 	/* TODO: already partially written */
 	if (check_overflow(mydata, curclust, filesize)) {
 		printf("Error: no space left: %llu\n", filesize);
+		free_new_clusters(mydata, dentptr, lastclust, curclust);
 		return -1;
 	}
 
+	firstclust = curclust;
 	actsize = bytesperclust;
 	endclust = curclust;
 	do {
 		/* search for consecutive clusters */
 		while (actsize < filesize) {
 			newclust = determine_fatent(mydata, endclust);
+			if (!newclust) {
+				printf("Error: no space left: %llu\n",
+				       filesize);
+				free_new_clusters(mydata, dentptr, lastclust,
+						  firstclust);
+				return -1;
+			}
 
 			if ((newclust - 1) != endclust)
 				/* write to <curclust..endclust> */
@@ -1430,6 +1599,9 @@ int file_fat_write_at(const char *filename, loff_t pos, void *buffer,
 	ret = flush_dir(itr);
 
 exit:
+	/* FAT changes not flushed are lost, and the free map went with them */
+	if (mydata->fat_dirty)
+		fat_freemap_drop();
 	free(filename_copy);
 	free(mydata->fatbuf);
 	free(itr);
@@ -1621,6 +1793,9 @@ int fat_unlink(const char *filename)
 	ret = delete_dentry_long(itr);
 
 exit:
+	/* FAT changes not flushed are lost, and the free map went with them */
+	if (fsdata.fat_dirty)
+		fat_freemap_drop();
 	free(fsdata.fatbuf);
 	free(itr);
 	free(filename_copy);
@@ -1764,6 +1939,9 @@ int fat_mkdir(const char *dirname)
 	ret = flush_dir(itr);
 
 exit:
+	/* FAT changes not flushed are lost, and the free map went with them */
+	if (mydata->fat_dirty)
+		fat_freemap_drop();
 	free(dirname_copy);
 	free(mydata->fatbuf);
 	free(itr);
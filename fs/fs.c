@@ -5,6 +5,7 @@
 
 #define LOG_CATEGORY LOGC_CORE
 
+#include <bootstage.h>
 #include <command.h>
 #include <config.h>
 #include <display_options.h>
@@ -25,6 +26,7 @@
 #include <btrfs.h>
 #include <asm/global_data.h>
 #include <asm/io.h>
+#include <dm/uclass-id.h>
 #include <div64.h>
 #include <linux/math64.h>
 #include <linux/sizes.h>
@@ -418,16 +420,128 @@ const char *fs_get_type_name(void)
 	return fs_get_info(fs_type)->name;
 }
 
-int fs_set_blk_dev(const char *ifname, const char *dev_part_str, int fstype)
+#if CONFIG_IS_ENABLED(FS_MOUNT_CACHE)
+/*
+ * The filesystem drivers each keep the state of one mounted filesystem.
+ * Rather than closing it at the end of every operation, the filesystem last
+ * probed on a block device is left mounted, so that the next operation on
+ * the same partition need not probe it again. fs_invalidate() unmounts it
+ * when the device is written to or changes.
+ */
+static struct {
+	int type;		/* FS_TYPE_ANY if nothing is mounted */
+	bool stale;		/* unmount when the current operation ends */
+	enum uclass_id uclass_id;
+	int devnum;
+	int hwpart;
+	int part;
+	lbaint_t start;
+	lbaint_t size;
+	uint32_t probe_us;	/* time spent probing it */
+} fs_mount = {
+	.type = FS_TYPE_ANY,
+};
+
+static void fs_unmount(void)
+{
+	if (fs_mount.type == FS_TYPE_ANY)
+		return;
+
+	log_debug("unmount %s\n", fs_get_info(fs_mount.type)->name);
+	fs_get_info(fs_mount.type)->close();
+	fs_mount.type = FS_TYPE_ANY;
+	fs_mount.stale = false;
+}
+
+/* Record the filesystem just probed as mounted */
+static void fs_mount_add(int part, uint32_t probe_us)
+{
+	if (!fs_dev_desc)
+		return;
+
+	fs_mount.type = fs_type;
+	fs_mount.stale = false;
+	fs_mount.uclass_id = fs_dev_desc->uclass_id;
+	fs_mount.devnum = fs_dev_desc->devnum;
+	fs_mount.hwpart = fs_dev_desc->hwpart;
+	fs_mount.part = part;
+	fs_mount.start = fs_partition.start;
+	fs_mount.size = fs_partition.size;
+	fs_mount.probe_us = probe_us;
+}
+
+/* Use the mounted filesystem if it is the one on fs_dev_desc / part */
+static bool fs_mount_find(int fstype, int part)
+{
+	if (fs_mount.type == FS_TYPE_ANY || fs_mount.stale || !fs_dev_desc)
+		return false;
+	if (fstype != FS_TYPE_ANY && fstype != fs_mount.type)
+		return false;
+	if (fs_dev_desc->uclass_id != fs_mount.uclass_id ||
+	    fs_dev_desc->devnum != fs_mount.devnum ||
+	    fs_dev_desc->hwpart != fs_mount.hwpart ||
+	    part != fs_mount.part ||
+	    fs_partition.start != fs_mount.start ||
+	    fs_partition.size != fs_mount.size)
+		return false;
+
+	fs_type = fs_mount.type;
+	fs_dev_part = part;
+	bootstage_accum_time(BOOTSTAGE_ID_ACCUM_FS_PROBE_SAVED,
+			     "fs_probe_saved", fs_mount.probe_us);
+
+	return true;
+}
+
+/* Check whether fs_close() should leave the current filesystem mounted */
+static bool fs_mount_keep(void)
+{
+	if (fs_type == FS_TYPE_ANY || fs_type != fs_mount.type)
+		return false;
+	if (!fs_mount.stale)
+		return true;
+
+	/* The caller closes it */
+	fs_mount.type = FS_TYPE_ANY;
+	fs_mount.stale = false;
+
+	return false;
+}
+
+void fs_invalidate(struct blk_desc *desc)
+{
+	if (fs_mount.type == FS_TYPE_ANY)
+		return;
+	if (desc && (desc->uclass_id != fs_mount.uclass_id ||
+		     desc->devnum != fs_mount.devnum))
+		return;
+
+	/* Don't pull the filesystem from under an operation using it */
+	if (fs_type == fs_mount.type)
+		fs_mount.stale = true;
+	else
+		fs_unmount();
+}
+#else
+static inline void fs_unmount(void) {}
+static inline void fs_mount_add(int part, uint32_t probe_us) {}
+static inline bool fs_mount_find(int fstype, int part) { return false; }
+static inline bool fs_mount_keep(void) { return false; }
+#endif
+
+/* Probe fs_dev_desc / fs_partition for a filesystem of the given type */
+static int fs_probe(int fstype, int part)
 {
 	struct fstype_info *info;
-	int part, i;
+	int i;
 
-	part = part_get_info_by_dev_and_name_or_num(ifname, dev_part_str, &fs_dev_desc,
-						    &fs_partition, 1);
-	if (part < 0)
-		return -1;
+	if (fs_mount_find(fstype, part))
+		return 0;
 
+	/* Drivers only keep one filesystem, so the mounted one must go */
+	fs_unmount();
+
+	bootstage_start(BOOTSTAGE_ID_ACCUM_FS_PROBE, "fs_probe");
 	for (i = 0, info = fstypes; i < ARRAY_SIZE(fstypes); i++, info++) {
 		if (fstype != FS_TYPE_ANY && info->fstype != FS_TYPE_ANY &&
 				fstype != info->fstype)
@@ -439,18 +553,32 @@ int fs_set_blk_dev(const char *ifname, const char *dev_part_str, int fstype)
 		if (!info->probe(fs_dev_desc, &fs_partition)) {
 			fs_type = info->fstype;
 			fs_dev_part = part;
+			fs_mount_add(part,
+				     bootstage_accum(BOOTSTAGE_ID_ACCUM_FS_PROBE));
 			return 0;
 		}
 	}
+	bootstage_accum(BOOTSTAGE_ID_ACCUM_FS_PROBE);
 
 	return -1;
 }
 
+int fs_set_blk_dev(const char *ifname, const char *dev_part_str, int fstype)
+{
+	int part;
+
+	part = part_get_info_by_dev_and_name_or_num(ifname, dev_part_str, &fs_dev_desc,
+						    &fs_partition, 1);
+	if (part < 0)
+		return -1;
+
+	return fs_probe(fstype, part);
+}
+
 /* set current blk device w/ blk_desc + partition # */
 int fs_set_blk_dev_with_part(struct blk_desc *desc, int part)
 {
-	struct fstype_info *info;
-	int ret, i;
+	int ret;
 
 	if (part >= 1)
 		ret = part_get_info(desc, part, &fs_partition);
@@ -460,22 +588,15 @@ int fs_set_blk_dev_with_part(struct blk_desc *desc, int part)
 		return ret;
 	fs_dev_desc = desc;
 
-	for (i = 0, info = fstypes; i < ARRAY_SIZE(fstypes); i++, info++) {
-		if (!info->probe(fs_dev_desc, &fs_partition)) {
-			fs_type = info->fstype;
-			fs_dev_part = part;
-			return 0;
-		}
-	}
-
-	return -1;
+	return fs_probe(FS_TYPE_ANY, part);
 }
 
 void fs_close(void)
 {
 	struct fstype_info *info = fs_get_info(fs_type);
 
-	info->close();
+	if (!fs_mount_keep())
+		info->close();
 
 	fs_type = FS_TYPE_ANY;
 }
@@ -77,160 +77,436 @@ static int sqfs_count_tokens(const char *filename)
 }
 
 /*
- * Calculates how many blocks are needed for the buffer used in sqfs_disk_read.
- * The memory section (e.g. inode table) start offset and its end (i.e. the next
- * table start) must be specified. It also calculates the offset from which to
- * start reading the buffer.
+ * Reads the device blocks holding the 'len' bytes found at offset 'pos' of the
+ * filesystem. Returns the buffer they were read into, which the caller must
+ * free, and gives in 'offset' where the requested bytes start in it.
  */
-static int sqfs_calc_n_blks(__le64 start, __le64 end, u64 *offset)
+static unsigned char *sqfs_read_bytes(u64 pos, u32 len, u32 *offset)
 {
-	u64 start_, table_size;
+	unsigned char *buf;
+	u64 start, n_blks;
 
-	table_size = le64_to_cpu(end) - le64_to_cpu(start);
-	start_ = lldiv(le64_to_cpu(start), ctxt.cur_dev->blksz);
-	*offset = le64_to_cpu(start) - (start_ * ctxt.cur_dev->blksz);
+	start = lldiv(pos, ctxt.cur_dev->blksz);
+	*offset = pos - (start * ctxt.cur_dev->blksz);
+	n_blks = DIV_ROUND_UP(len + *offset, ctxt.cur_dev->blksz);
 
-	return DIV_ROUND_UP(table_size + *offset, ctxt.cur_dev->blksz);
+	buf = malloc_cache_aligned(n_blks * ctxt.cur_dev->blksz);
+	if (!buf)
+		return NULL;
+
+	if (sqfs_disk_read(start, n_blks, buf) < 0) {
+		free(buf);
+		return NULL;
+	}
+
+	return buf;
+}
+
+static void sqfs_cache_free(void)
+{
+	int i;
+
+	for (i = 0; i < SQFS_METADATA_CACHE_ENTRIES; i++)
+		free(ctxt.metadata[i].data);
+
+	for (i = 0; i < SQFS_FRAGMENT_CACHE_ENTRIES; i++)
+		free(ctxt.fragments[i].data);
+
+	memset(ctxt.metadata, 0, sizeof(ctxt.metadata));
+	memset(ctxt.fragments, 0, sizeof(ctxt.fragments));
+	ctxt.cache_clock = 0;
 }
 
 /*
- * Retrieves fragment block entry and returns true if the fragment block is
- * compressed
+ * Looks for the block at on-disk offset 'pos' in a cache of 'count' entries.
+ * On a miss, NULL is returned and 'lru' is set to the entry to replace.
  */
-static int sqfs_frag_lookup(u32 inode_fragment_index,
-			    struct squashfs_fragment_block_entry *e)
+static struct squashfs_cache_entry *
+sqfs_cache_find(struct squashfs_cache_entry *cache, int count, u64 pos,
+		struct squashfs_cache_entry **lru)
 {
-	u64 start, end, exp_tbl, n_blks, src_len, table_offset, start_block;
-	unsigned char *metadata_buffer, *metadata, *table;
-	struct squashfs_fragment_block_entry *entries;
-	struct squashfs_super_block *sblk = ctxt.sblk;
+	struct squashfs_cache_entry *ce;
+	int i;
+
+	*lru = NULL;
+	for (i = 0; i < count; i++) {
+		ce = &cache[i];
+		if (ce->pos && ce->pos == pos) {
+			ce->last_used = ++ctxt.cache_clock;
+			return ce;
+		}
+
+		if (!*lru || ce->last_used < (*lru)->last_used)
+			*lru = ce;
+	}
+
+	return NULL;
+}
+
+/*
+ * Returns the uncompressed metadata block whose header is found at offset 'pos'
+ * of the filesystem. Inode, directory and fragment tables are only ever read
+ * through here, a block at a time: recently used blocks come from the metadata
+ * cache, others are read from the device into the least recently used entry.
+ */
+static struct squashfs_cache_entry *sqfs_get_metadata_block(u64 pos)
+{
+	struct squashfs_cache_entry *mb, *lru;
 	unsigned long dest_len;
-	int block, offset, ret;
+	unsigned char *buf;
+	u32 offset, size;
 	u16 header;
+	int ret;
 
-	metadata_buffer = NULL;
-	entries = NULL;
-	table = NULL;
+	mb = sqfs_cache_find(ctxt.metadata, SQFS_METADATA_CACHE_ENTRIES, pos,
+			     &lru);
+	if (mb)
+		return mb;
 
-	if (inode_fragment_index >= get_unaligned_le32(&sblk->fragments))
-		return -EINVAL;
+	/* Every metadata block starts with a 16-bit header */
+	buf = sqfs_read_bytes(pos, SQFS_HEADER_SIZE, &offset);
+	if (!buf)
+		return NULL;
+
+	header = get_unaligned_le16(buf + offset);
+	free(buf);
 
-	start = get_unaligned_le64(&sblk->fragment_table_start);
-	end = get_unaligned_le64(&sblk->id_table_start);
-	exp_tbl = get_unaligned_le64(&sblk->export_table_start);
+	size = SQFS_METADATA_SIZE(header);
+	if (!size || size > SQFS_METADATA_BLOCK_SIZE) {
+		printf("Invalid metadata block size: %d bytes.\n", size);
+		return NULL;
+	}
 
-	if (exp_tbl > start && exp_tbl < end)
-		end = exp_tbl;
+	if (!lru->data) {
+		lru->data = malloc(SQFS_METADATA_BLOCK_SIZE);
+		if (!lru->data)
+			return NULL;
+	}
 
-	n_blks = sqfs_calc_n_blks(sblk->fragment_table_start,
-				  cpu_to_le64(end), &table_offset);
+	lru->pos = 0;
+	lru->last_used = 0;
 
-	start /= ctxt.cur_dev->blksz;
+	buf = sqfs_read_bytes(pos + SQFS_HEADER_SIZE, size, &offset);
+	if (!buf)
+		return NULL;
 
-	/* Allocate a proper sized buffer to store the fragment index table */
-	table = malloc_cache_aligned(n_blks * ctxt.cur_dev->blksz);
-	if (!table) {
-		ret = -ENOMEM;
-		goto out;
+	if (SQFS_COMPRESSED_METADATA(header)) {
+		dest_len = SQFS_METADATA_BLOCK_SIZE;
+		ret = sqfs_decompress(&ctxt, lru->data, &dest_len, buf + offset,
+				      size);
+		if (ret) {
+			free(buf);
+			return NULL;
+		}
+
+		lru->len = dest_len;
+	} else {
+		memcpy(lru->data, buf + offset, size);
+		lru->len = size;
 	}
 
-	if (sqfs_disk_read(start, n_blks, table) < 0) {
-		ret = -EINVAL;
-		goto out;
+	free(buf);
+
+	lru->pos = pos;
+	lru->next = pos + SQFS_HEADER_SIZE + size;
+	lru->last_used = ++ctxt.cache_clock;
+
+	return lru;
+}
+
+/*
+ * Copies 'len' bytes found at 'ref' in a metadata table into 'dest', going on
+ * to the following metadata blocks as needed, and moves 'ref' past them.
+ */
+static int sqfs_read_metadata(struct squashfs_metadata_ref *ref, void *dest,
+			      size_t len)
+{
+	struct squashfs_cache_entry *mb;
+	size_t n;
+
+	while (len) {
+		mb = sqfs_get_metadata_block(ref->block);
+		/* An empty block would never let 'ref' reach its data */
+		if (!mb || !mb->len)
+			return -EINVAL;
+
+		if (ref->offset >= mb->len) {
+			ref->offset -= mb->len;
+			ref->block = mb->next;
+			continue;
+		}
+
+		n = min_t(size_t, len, mb->len - ref->offset);
+		memcpy(dest, mb->data + ref->offset, n);
+		ref->offset += n;
+		dest += n;
+		len -= n;
 	}
 
-	block = SQFS_FRAGMENT_INDEX(inode_fragment_index);
-	offset = SQFS_FRAGMENT_INDEX_OFFSET(inode_fragment_index);
+	return 0;
+}
+
+/*
+ * Inodes and directory listings are referred to by the offset of the metadata
+ * block holding them from the start of their table, shifted left by 16, plus
+ * their offset into the uncompressed block. This turns such a reference into a
+ * position that sqfs_read_metadata() can read from.
+ */
+static void sqfs_metadata_pos(u64 table_start, u64 ref,
+			      struct squashfs_metadata_ref *pos)
+{
+	pos->block = table_start + (ref >> 16);
+	pos->offset = ref & 0xFFFF;
+}
+
+/*
+ * Reads the inode that 'ref' refers to in the inode table into a buffer
+ * allocated for it, which the caller must free.
+ */
+static int sqfs_read_inode(u64 ref, void **inode)
+{
+	struct squashfs_super_block *sblk = ctxt.sblk;
+	/* No inode type has a larger fixed part than the extended file */
+	unsigned char fixed[sizeof(struct squashfs_lreg_inode)];
+	struct squashfs_base_inode *base = (void *)fixed;
+	struct squashfs_metadata_ref pos;
+	int fixed_size, size, ret;
+
+	*inode = NULL;
+
+	sqfs_metadata_pos(get_unaligned_le64(&sblk->inode_table_start), ref,
+			  &pos);
+
+	memset(fixed, 0, sizeof(fixed));
+	ret = sqfs_read_metadata(&pos, base, sizeof(*base));
+	if (ret)
+		return ret;
 
 	/*
-	 * Get the start offset of the metadata block that contains the right
-	 * fragment block entry
+	 * With every field but the base ones still zeroed, sqfs_inode_size()
+	 * gives the size of the fixed part of the inode.
 	 */
-	start_block = get_unaligned_le64(table + table_offset + block *
-					 sizeof(u64));
+	fixed_size = sqfs_inode_size(base, get_unaligned_le32(&sblk->block_size));
+	if (fixed_size < 0)
+		return fixed_size;
 
-	start = start_block / ctxt.cur_dev->blksz;
-	n_blks = sqfs_calc_n_blks(cpu_to_le64(start_block),
-				  sblk->fragment_table_start, &table_offset);
+	ret = sqfs_read_metadata(&pos, fixed + sizeof(*base),
+				 fixed_size - sizeof(*base));
+	if (ret)
+		return ret;
 
-	metadata_buffer = malloc_cache_aligned(n_blks * ctxt.cur_dev->blksz);
-	if (!metadata_buffer) {
-		ret = -ENOMEM;
-		goto out;
-	}
+	/* The directory index of extended directories is not used */
+	if (get_unaligned_le16(&base->inode_type) == SQFS_LDIR_TYPE)
+		size = fixed_size;
+	else
+		size = sqfs_inode_size(base,
+				       get_unaligned_le32(&sblk->block_size));
+	if (size < 0)
+		return size;
 
-	if (sqfs_disk_read(start, n_blks, metadata_buffer) < 0) {
-		ret = -EINVAL;
-		goto out;
+	*inode = malloc(size);
+	if (!*inode)
+		return -ENOMEM;
+
+	memcpy(*inode, fixed, fixed_size);
+	ret = sqfs_read_metadata(&pos, *inode + fixed_size, size - fixed_size);
+	if (ret) {
+		free(*inode);
+		*inode = NULL;
 	}
 
-	/* Every metadata block starts with a 16-bit header */
-	header = get_unaligned_le16(metadata_buffer + table_offset);
-	metadata = metadata_buffer + table_offset + SQFS_HEADER_SIZE;
+	return ret;
+}
 
-	if (!metadata || !header) {
-		ret = -ENOMEM;
-		goto out;
-	}
+/*
+ * Retrieves fragment block entry and returns true if the fragment block is
+ * compressed
+ */
+static int sqfs_frag_lookup(u32 inode_fragment_index,
+			    struct squashfs_fragment_block_entry *e)
+{
+	struct squashfs_super_block *sblk = ctxt.sblk;
+	struct squashfs_metadata_ref ref;
+	unsigned char *table;
+	u32 table_offset;
+	u64 start;
+	int ret;
 
-	entries = malloc(SQFS_METADATA_BLOCK_SIZE);
-	if (!entries) {
-		ret = -ENOMEM;
-		goto out;
+	if (inode_fragment_index >= get_unaligned_le32(&sblk->fragments))
+		return -EINVAL;
+
+	/*
+	 * The fragment table is a list of the positions of the metadata blocks
+	 * holding the fragment block entries, SQFS_MAX_ENTRIES per block. Only
+	 * the position of the block holding the right entry is read.
+	 */
+	start = get_unaligned_le64(&sblk->fragment_table_start) +
+		SQFS_FRAGMENT_INDEX(inode_fragment_index) * sizeof(u64);
+	table = sqfs_read_bytes(start, sizeof(u64), &table_offset);
+	if (!table)
+		return -EINVAL;
+
+	ref.block = get_unaligned_le64(table + table_offset);
+	ref.offset = SQFS_FRAGMENT_INDEX_OFFSET(inode_fragment_index) *
+		sizeof(*e);
+	free(table);
+
+	ret = sqfs_read_metadata(&ref, e, sizeof(*e));
+	if (ret)
+		return -EINVAL;
+
+	return SQFS_COMPRESSED_BLOCK(e->size);
+}
+
+/*
+ * Returns the uncompressed fragment block that the fragment block entry 'e'
+ * describes. Files sharing a fragment block, typically many small ones, get
+ * it from the fragment cache rather than reading and decompressing it again.
+ */
+static struct squashfs_cache_entry *
+sqfs_get_fragment_block(struct squashfs_fragment_block_entry *e)
+{
+	u32 block_size = get_unaligned_le32(&ctxt.sblk->block_size);
+	u32 offset, size = SQFS_BLOCK_SIZE(e->size);
+	struct squashfs_cache_entry *fb, *lru;
+	unsigned long dest_len;
+	unsigned char *buf;
+	int ret;
+
+	fb = sqfs_cache_find(ctxt.fragments, SQFS_FRAGMENT_CACHE_ENTRIES,
+			     e->start, &lru);
+	if (fb)
+		return fb;
+
+	if (!size || size > block_size)
+		return NULL;
+
+	if (!lru->data) {
+		lru->data = malloc(block_size);
+		if (!lru->data)
+			return NULL;
 	}
 
-	if (SQFS_COMPRESSED_METADATA(header)) {
-		src_len = SQFS_METADATA_SIZE(header);
-		dest_len = SQFS_METADATA_BLOCK_SIZE;
-		ret = sqfs_decompress(&ctxt, entries, &dest_len, metadata,
-				      src_len);
+	lru->pos = 0;
+	lru->last_used = 0;
+
+	buf = sqfs_read_bytes(e->start, size, &offset);
+	if (!buf)
+		return NULL;
+
+	if (SQFS_COMPRESSED_BLOCK(e->size)) {
+		dest_len = block_size;
+		ret = sqfs_decompress(&ctxt, lru->data, &dest_len, buf + offset,
+				      size);
 		if (ret) {
-			ret = -EINVAL;
-			goto out;
+			free(buf);
+			return NULL;
 		}
+
+		lru->len = dest_len;
 	} else {
-		memcpy(entries, metadata, SQFS_METADATA_SIZE(header));
+		memcpy(lru->data, buf + offset, size);
+		lru->len = size;
 	}
 
-	*e = entries[offset];
-	ret = SQFS_COMPRESSED_BLOCK(e->size);
+	free(buf);
 
-out:
-	free(entries);
-	free(metadata_buffer);
-	free(table);
+	lru->pos = e->start;
+	lru->last_used = ++ctxt.cache_clock;
 
-	return ret;
+	return lru;
 }
 
 /*
  * The entry name is a flexible array member, and we don't know its size before
  * actually reading the entry. So we need a first copy to retrieve this size so
- * we can finally copy the whole struct.
+ * we can finally copy the whole struct. 'ref' is moved past the entry.
  */
-static int sqfs_read_entry(struct squashfs_directory_entry **dest, void *src)
+static int sqfs_read_entry(struct squashfs_directory_entry **dest,
+			   struct squashfs_metadata_ref *ref)
 {
-	struct squashfs_directory_entry *tmp;
+	struct squashfs_directory_entry tmp;
+	int ret;
 	u16 sz;
 
-	tmp = src;
-	sz = get_unaligned_le16(src + sizeof(*tmp) - sizeof(u16));
+	ret = sqfs_read_metadata(ref, &tmp, sizeof(tmp));
+	if (ret)
+		return ret;
+
+	sz = get_unaligned_le16(&tmp.name_size);
 	/*
-	 * 'src' points to the begin of a directory entry, and 'sz' gets its
-	 * 'name_size' member's value. name_size is actually the string
-	 * length - 1, so adding 2 compensates this difference and adds space
-	 * for the trailling null byte.
+	 * 'sz' is the entry's 'name_size' member's value. name_size is
+	 * actually the string length - 1, so adding 2 compensates this
+	 * difference and adds space for the trailling null byte.
 	 */
-	*dest = malloc(sizeof(*tmp) + sz + 2);
+	*dest = malloc(sizeof(tmp) + sz + 2);
 	if (!*dest)
 		return -ENOMEM;
 
-	memcpy(*dest, src, sizeof(*tmp) + sz + 1);
+	memcpy(*dest, &tmp, sizeof(tmp));
+	ret = sqfs_read_metadata(ref, (*dest)->name, sz + 1);
+	if (ret) {
+		free(*dest);
+		*dest = NULL;
+		return ret;
+	}
+
 	(*dest)->name[sz + 1] = '\0';
 
 	return 0;
 }
 
+/* Returns the reference to the inode of the current entry of 'dirs' */
+static u64 sqfs_entry_inode(struct squashfs_dir_stream *dirs)
+{
+	return ((u64)dirs->dir_header->start << 16) | dirs->entry->offset;
+}
+
+/*
+ * Points the directory stream at the start of the listing of the directory
+ * inode 'dir_i', keeps a copy of the inode and reads the first header.
+ */
+static int sqfs_dir_open(struct squashfs_dir_stream *dirs, void *dir_i)
+{
+	struct squashfs_super_block *sblk = ctxt.sblk;
+	struct squashfs_ldir_inode *ldir = dir_i;
+	struct squashfs_dir_inode *dir = dir_i;
+	u64 ref;
+	int ret;
+
+	ret = sqfs_dir_offset(dir_i, &ref);
+	if (ret)
+		return ret;
+
+	sqfs_metadata_pos(get_unaligned_le64(&sblk->directory_table_start),
+			  ref, &dirs->table);
+
+	if (get_unaligned_le16(&dir->inode_type) == SQFS_DIR_TYPE) {
+		memcpy(&dirs->i_dir, dir, sizeof(*dir));
+		dirs->size = get_unaligned_le16(&dir->file_size);
+	} else {
+		memcpy(&dirs->i_ldir, ldir, sizeof(*ldir));
+		dirs->size = get_unaligned_le32(&ldir->file_size);
+	}
+
+	dirs->entry_count = 0;
+	if (dirs->size <= SQFS_DIR_HEADER_SIZE) {
+		dirs->size = 0;
+		return 0;
+	}
+
+	/* Setup directory header */
+	ret = sqfs_read_metadata(&dirs->table, dirs->dir_header,
+				 SQFS_DIR_HEADER_SIZE);
+	if (ret)
+		return ret;
+
+	dirs->entry_count = dirs->dir_header->count + 1;
+	dirs->size -= SQFS_DIR_HEADER_SIZE;
+
+	return 0;
+}
+
 static int sqfs_get_tokens_length(char **tokens, int count)
 {
 	int length = 0, i;
@@ -444,468 +720,286 @@ static char *sqfs_resolve_symlink(struct squashfs_symlink_inode *sym,
 }
 
 /*
- * m_list contains each metadata block's position, and m_count is the number of
- * elements of m_list. Those metadata blocks come from the compressed directory
- * table.
+ * Reads the next entry of a directory. Regular files only get their size
+ * filled in when 'fetch_size' is set, as it takes reading their inode.
  */
-static int sqfs_search_dir(struct squashfs_dir_stream *dirs, char **token_list,
-			   int token_count, u32 *m_list, int m_count)
+static int sqfs_next_dirent(struct squashfs_dir_stream *dirs,
+			    struct fs_dirent **dentp, bool fetch_size)
 {
-	struct squashfs_super_block *sblk = ctxt.sblk;
-	char *path, *target, **sym_tokens, *res, *rem;
-	int j, ret = 0, new_inode_number, offset;
-	struct squashfs_symlink_inode *sym;
-	struct squashfs_ldir_inode *ldir;
-	struct squashfs_dir_inode *dir;
-	struct fs_dir_stream *dirsp;
+	struct squashfs_lreg_inode *lreg;
+	struct squashfs_base_inode *base;
+	struct squashfs_reg_inode *reg;
+	int offset = 0, ret;
 	struct fs_dirent *dent;
-	unsigned char *table;
-
-	res = NULL;
-	rem = NULL;
-	path = NULL;
-	target = NULL;
-	sym_tokens = NULL;
-
-	dirsp = (struct fs_dir_stream *)dirs;
-
-	/* Start by root inode */
-	table = sqfs_find_inode(dirs->inode_table, le32_to_cpu(sblk->inodes),
-				sblk->inodes, sblk->block_size);
-
-	dir = (struct squashfs_dir_inode *)table;
-	ldir = (struct squashfs_ldir_inode *)table;
-
-	/* get directory offset in directory table */
-	offset = sqfs_dir_offset(table, m_list, m_count);
-	dirs->table = &dirs->dir_table[offset];
-
-	/* Setup directory header */
-	dirs->dir_header = malloc(SQFS_DIR_HEADER_SIZE);
-	if (!dirs->dir_header)
-		return -ENOMEM;
-
-	memcpy(dirs->dir_header, dirs->table, SQFS_DIR_HEADER_SIZE);
-
-	/* Initialize squashfs_dir_stream members */
-	dirs->table += SQFS_DIR_HEADER_SIZE;
-	dirs->size = get_unaligned_le16(&dir->file_size) - SQFS_DIR_HEADER_SIZE;
-	dirs->entry_count = dirs->dir_header->count + 1;
+	void *ipos;
+	u16 name_size;
 
-	/* No path given -> root directory */
-	if (!strcmp(token_list[0], "/")) {
-		dirs->table = &dirs->dir_table[offset];
-		memcpy(&dirs->i_dir, dir, sizeof(*dir));
-		return 0;
+	if (!dirs->size) {
+		*dentp = NULL;
+		return -SQFS_STOP_READDIR;
 	}
 
-	for (j = 0; j < token_count; j++) {
-		if (!sqfs_is_dir(get_unaligned_le16(&dir->inode_type))) {
-			printf("** Cannot find directory. **\n");
-			ret = -EINVAL;
-			goto out;
-		}
-
-		while (!sqfs_readdir(dirsp, &dent)) {
-			ret = strcmp(dent->name, token_list[j]);
-			if (!ret)
-				break;
-			free(dirs->entry);
-			dirs->entry = NULL;
-		}
+	dent = &dirs->dentp;
 
-		if (ret) {
-			printf("** Cannot find directory. **\n");
-			ret = -EINVAL;
-			goto out;
+	if (!dirs->entry_count) {
+		if (dirs->size <= SQFS_DIR_HEADER_SIZE + SQFS_EMPTY_FILE_SIZE) {
+			*dentp = NULL;
+			dirs->size = 0;
+			return -SQFS_STOP_READDIR;
 		}
 
-		/* Redefine inode as the found token */
-		new_inode_number = dirs->entry->inode_offset +
-			dirs->dir_header->inode_number;
-
-		/* Get reference to inode in the inode table */
-		table = sqfs_find_inode(dirs->inode_table, new_inode_number,
-					sblk->inodes, sblk->block_size);
-		dir = (struct squashfs_dir_inode *)table;
+		/* Read follow-up (emitted) dir. header */
+		ret = sqfs_read_metadata(&dirs->table, dirs->dir_header,
+					 SQFS_DIR_HEADER_SIZE);
+		if (ret)
+			return -SQFS_STOP_READDIR;
 
-		/* Check for symbolic link and inode type sanity */
-		if (get_unaligned_le16(&dir->inode_type) == SQFS_SYMLINK_TYPE) {
-			sym = (struct squashfs_symlink_inode *)table;
-			/* Get first j + 1 tokens */
-			path = sqfs_concat_tokens(token_list, j + 1);
-			if (!path) {
-				ret = -ENOMEM;
-				goto out;
-			}
-			/* Resolve for these tokens */
-			target = sqfs_resolve_symlink(sym, path);
-			if (!target) {
-				ret = -ENOMEM;
-				goto out;
-			}
-			/* Join remaining tokens */
-			rem = sqfs_concat_tokens(token_list + j + 1, token_count -
-						 j - 1);
-			if (!rem) {
-				ret = -ENOMEM;
-				goto out;
-			}
-			/* Concatenate remaining tokens and symlink's target */
-			res = malloc(strlen(rem) + strlen(target) + 1);
-			if (!res) {
-				ret = -ENOMEM;
-				goto out;
-			}
-			strcpy(res, target);
-			res[strlen(target)] = '/';
-			strcpy(res + strlen(target) + 1, rem);
-			token_count = sqfs_count_tokens(res);
+		dirs->entry_count = dirs->dir_header->count + 1;
+		dirs->size -= SQFS_DIR_HEADER_SIZE;
+	}
 
-			if (token_count < 0) {
-				ret = -EINVAL;
-				goto out;
-			}
+	free(dirs->entry);
+	ret = sqfs_read_entry(&dirs->entry, &dirs->table);
+	if (ret)
+		return -SQFS_STOP_READDIR;
 
-			sym_tokens = malloc(token_count * sizeof(char *));
-			if (!sym_tokens) {
-				ret = -EINVAL;
-				goto out;
-			}
+	/* Set entry type and size */
+	switch (dirs->entry->type) {
+	case SQFS_DIR_TYPE:
+	case SQFS_LDIR_TYPE:
+		dent->type = FS_DT_DIR;
+		break;
+	case SQFS_REG_TYPE:
+	case SQFS_LREG_TYPE:
+		if (fetch_size) {
+			ret = sqfs_read_inode(sqfs_entry_inode(dirs), &ipos);
+			if (ret)
+				return -SQFS_STOP_READDIR;
 
-			/* Fill tokens list */
-			ret = sqfs_tokenize(sym_tokens, token_count, res);
-			if (ret) {
-				ret = -EINVAL;
-				goto out;
+			base = (struct squashfs_base_inode *)ipos;
+			/*
+			 * Entries do not differentiate extended from regular
+			 * types, so it needs to be verified manually.
+			 */
+			if (get_unaligned_le16(&base->inode_type) ==
+			    SQFS_LREG_TYPE) {
+				lreg = (struct squashfs_lreg_inode *)ipos;
+				dent->size = get_unaligned_le64(&lreg->file_size);
+			} else {
+				reg = (struct squashfs_reg_inode *)ipos;
+				dent->size = get_unaligned_le32(&reg->file_size);
 			}
-			free(dirs->entry);
-			dirs->entry = NULL;
 
-			ret = sqfs_search_dir(dirs, sym_tokens, token_count,
-					      m_list, m_count);
-			goto out;
-		} else if (!sqfs_is_dir(get_unaligned_le16(&dir->inode_type))) {
-			printf("** Cannot find directory. **\n");
-			free(dirs->entry);
-			dirs->entry = NULL;
-			ret = -EINVAL;
-			goto out;
+			free(ipos);
 		}
 
-		/* Check if it is an extended dir. */
-		if (get_unaligned_le16(&dir->inode_type) == SQFS_LDIR_TYPE)
-			ldir = (struct squashfs_ldir_inode *)table;
-
-		/* Get dir. offset into the directory table */
-		offset = sqfs_dir_offset(table, m_list, m_count);
-		dirs->table = &dirs->dir_table[offset];
-
-		/* Copy directory header */
-		memcpy(dirs->dir_header, &dirs->dir_table[offset],
-		       SQFS_DIR_HEADER_SIZE);
-
-		/* Check for empty directory */
-		if (sqfs_is_empty_dir(table)) {
-			printf("Empty directory.\n");
-			free(dirs->entry);
-			dirs->entry = NULL;
-			ret = SQFS_EMPTY_DIR;
-			goto out;
-		}
-
-		dirs->table += SQFS_DIR_HEADER_SIZE;
-		dirs->size = get_unaligned_le16(&dir->file_size);
-		dirs->entry_count = dirs->dir_header->count + 1;
-		dirs->size -= SQFS_DIR_HEADER_SIZE;
-		free(dirs->entry);
-		dirs->entry = NULL;
+		dent->type = FS_DT_REG;
+		break;
+	case SQFS_BLKDEV_TYPE:
+	case SQFS_CHRDEV_TYPE:
+	case SQFS_LBLKDEV_TYPE:
+	case SQFS_LCHRDEV_TYPE:
+	case SQFS_FIFO_TYPE:
+	case SQFS_SOCKET_TYPE:
+	case SQFS_LFIFO_TYPE:
+	case SQFS_LSOCKET_TYPE:
+		dent->type = SQFS_MISC_ENTRY_TYPE;
+		break;
+	case SQFS_SYMLINK_TYPE:
+	case SQFS_LSYMLINK_TYPE:
+		dent->type = FS_DT_LNK;
+		break;
+	default:
+		return -SQFS_STOP_READDIR;
 	}
 
-	offset = sqfs_dir_offset(table, m_list, m_count);
-	dirs->table = &dirs->dir_table[offset];
-
-	if (get_unaligned_le16(&dir->inode_type) == SQFS_DIR_TYPE)
-		memcpy(&dirs->i_dir, dir, sizeof(*dir));
-	else
-		memcpy(&dirs->i_ldir, ldir, sizeof(*ldir));
+	/* Set entry name (capped at FS_DIRENT_NAME_LEN which is a U-Boot limitation) */
+	name_size = min_t(u16, dirs->entry->name_size + 1, FS_DIRENT_NAME_LEN - 1);
+	strncpy(dent->name, dirs->entry->name, name_size);
+	dent->name[name_size] = '\0';
 
-out:
-	free(res);
-	free(rem);
-	free(path);
-	free(target);
-	free(sym_tokens);
-	return ret;
-}
+	offset = dirs->entry->name_size + 1 + SQFS_ENTRY_BASE_LENGTH;
+	dirs->entry_count--;
 
-/*
- * Inode and directory tables are stored as a series of metadata blocks, and
- * given the compressed size of this table, we can calculate how much metadata
- * blocks are needed to store the result of the decompression, since a
- * decompressed metadata block should have a size of 8KiB.
- */
-static int sqfs_count_metablks(void *table, u32 offset, int table_size)
-{
-	int count = 0, cur_size = 0, ret;
-	u32 data_size;
-	bool comp;
+	/* Decrement size to be read */
+	if (dirs->size > offset)
+		dirs->size -= offset;
+	else
+		dirs->size = 0;
 
-	do {
-		ret = sqfs_read_metablock(table, offset + cur_size, &comp,
-					  &data_size);
-		if (ret)
-			return -EINVAL;
-		cur_size += data_size + SQFS_HEADER_SIZE;
-		count++;
-	} while (cur_size < table_size);
+	*dentp = dent;
 
-	return count;
+	return 0;
 }
 
-/*
- * Storing the metadata blocks header's positions will be useful while looking
- * for an entry in the directory table, using the reference (index and offset)
- * given by its inode.
- */
-static int sqfs_get_metablk_pos(u32 *pos_list, void *table, u32 offset,
-				int metablks_count)
+int sqfs_readdir(struct fs_dir_stream *fs_dirs, struct fs_dirent **dentp)
 {
-	u32 data_size, cur_size = 0;
-	int j, ret = 0;
-	bool comp;
-
-	if (!metablks_count)
-		return -EINVAL;
-
-	for (j = 0; j < metablks_count; j++) {
-		ret = sqfs_read_metablock(table, offset + cur_size, &comp,
-					  &data_size);
-		if (ret)
-			return -EINVAL;
-
-		cur_size += data_size + SQFS_HEADER_SIZE;
-		pos_list[j] = cur_size;
-	}
-
-	return ret;
+	return sqfs_next_dirent((struct squashfs_dir_stream *)fs_dirs, dentp,
+				true);
 }
 
-static int sqfs_read_inode_table(unsigned char **inode_table)
+static int sqfs_search_dir(struct squashfs_dir_stream *dirs, char **token_list,
+			   int token_count)
 {
 	struct squashfs_super_block *sblk = ctxt.sblk;
-	u64 start, n_blks, table_offset, table_size;
-	int j, ret = 0, metablks_count;
-	unsigned char *src_table, *itb;
-	u32 src_len, dest_offset = 0;
-	unsigned long dest_len = 0;
-	bool compressed;
-
-	table_size = get_unaligned_le64(&sblk->directory_table_start) -
-		get_unaligned_le64(&sblk->inode_table_start);
-	start = get_unaligned_le64(&sblk->inode_table_start) /
-		ctxt.cur_dev->blksz;
-	n_blks = sqfs_calc_n_blks(sblk->inode_table_start,
-				  sblk->directory_table_start, &table_offset);
-
-	/* Allocate a proper sized buffer (itb) to store the inode table */
-	itb = malloc_cache_aligned(n_blks * ctxt.cur_dev->blksz);
-	if (!itb)
-		return -ENOMEM;
-
-	if (sqfs_disk_read(start, n_blks, itb) < 0) {
-		ret = -EINVAL;
-		goto free_itb;
-	}
-
-	/* Parse inode table (metadata block) header */
-	ret = sqfs_read_metablock(itb, table_offset, &compressed, &src_len);
-	if (ret) {
-		ret = -EINVAL;
-		goto free_itb;
-	}
-
-	/* Calculate size to store the whole decompressed table */
-	metablks_count = sqfs_count_metablks(itb, table_offset, table_size);
-	if (metablks_count < 1) {
-		ret = -EINVAL;
-		goto free_itb;
-	}
-
-	*inode_table = kcalloc(metablks_count, SQFS_METADATA_BLOCK_SIZE,
-			       GFP_KERNEL);
-	if (!*inode_table) {
-		ret = -ENOMEM;
-		printf("Error: failed to allocate squashfs inode_table of size %i, increasing CONFIG_SYS_MALLOC_LEN could help\n",
-		       metablks_count * SQFS_METADATA_BLOCK_SIZE);
-		goto free_itb;
-	}
-
-	src_table = itb + table_offset + SQFS_HEADER_SIZE;
+	char *path, *target, **sym_tokens, *res, *rem;
+	struct squashfs_symlink_inode *sym;
+	struct squashfs_dir_inode *dir;
+	struct fs_dirent *dent;
+	void *table = NULL;
+	int j, ret = 0;
 
-	/* Extract compressed Inode table */
-	for (j = 0; j < metablks_count; j++) {
-		sqfs_read_metablock(itb, table_offset, &compressed, &src_len);
-		if (compressed) {
-			dest_len = SQFS_METADATA_BLOCK_SIZE;
-			ret = sqfs_decompress(&ctxt, *inode_table +
-					      dest_offset, &dest_len,
-					      src_table, src_len);
-			if (ret) {
-				free(*inode_table);
-				*inode_table = NULL;
-				goto free_itb;
-			}
+	res = NULL;
+	rem = NULL;
+	path = NULL;
+	target = NULL;
+	sym_tokens = NULL;
 
-			dest_offset += dest_len;
-		} else {
-			memcpy(*inode_table + (j * SQFS_METADATA_BLOCK_SIZE),
-			       src_table, src_len);
-		}
+	/* Start by root inode */
+	ret = sqfs_read_inode(get_unaligned_le64(&sblk->root_inode), &table);
+	if (ret)
+		return ret;
 
-		/*
-		 * Offsets to the decompression destination, to the metadata
-		 * buffer 'itb' and to the decompression source, respectively.
-		 */
+	dir = (struct squashfs_dir_inode *)table;
 
-		table_offset += src_len + SQFS_HEADER_SIZE;
-		src_table += src_len + SQFS_HEADER_SIZE;
-	}
+	/* Point the stream at the root directory's listing */
+	ret = sqfs_dir_open(dirs, table);
+	if (ret)
+		goto out;
 
-free_itb:
-	free(itb);
+	/* No path given -> root directory */
+	if (!strcmp(token_list[0], "/"))
+		goto out;
 
-	return ret;
-}
+	for (j = 0; j < token_count; j++) {
+		if (!sqfs_is_dir(get_unaligned_le16(&dir->inode_type))) {
+			printf("** Cannot find directory. **\n");
+			ret = -EINVAL;
+			goto out;
+		}
 
-static int sqfs_read_directory_table(unsigned char **dir_table, u32 **pos_list)
-{
-	u64 start, n_blks, table_offset, table_size;
-	struct squashfs_super_block *sblk = ctxt.sblk;
-	int j, ret = 0, metablks_count = -1;
-	unsigned char *src_table, *dtb;
-	u32 src_len, dest_offset = 0;
-	unsigned long dest_len = 0;
-	bool compressed;
-
-	*dir_table = NULL;
-	*pos_list = NULL;
-	/* DIRECTORY TABLE */
-	table_size = get_unaligned_le64(&sblk->fragment_table_start) -
-		get_unaligned_le64(&sblk->directory_table_start);
-	start = get_unaligned_le64(&sblk->directory_table_start) /
-		ctxt.cur_dev->blksz;
-	n_blks = sqfs_calc_n_blks(sblk->directory_table_start,
-				  sblk->fragment_table_start, &table_offset);
-
-	/* Allocate a proper sized buffer (dtb) to store the directory table */
-	dtb = malloc_cache_aligned(n_blks * ctxt.cur_dev->blksz);
-	if (!dtb)
-		return -ENOMEM;
+		while (!sqfs_next_dirent(dirs, &dent, false)) {
+			ret = strcmp(dent->name, token_list[j]);
+			if (!ret)
+				break;
+			free(dirs->entry);
+			dirs->entry = NULL;
+		}
 
-	if (sqfs_disk_read(start, n_blks, dtb) < 0)
-		goto out;
+		if (ret) {
+			printf("** Cannot find directory. **\n");
+			ret = -EINVAL;
+			goto out;
+		}
 
-	/* Parse directory table (metadata block) header */
-	ret = sqfs_read_metablock(dtb, table_offset, &compressed, &src_len);
-	if (ret)
-		goto out;
+		/* Redefine inode as the found token */
+		free(table);
+		ret = sqfs_read_inode(sqfs_entry_inode(dirs), &table);
+		free(dirs->entry);
+		dirs->entry = NULL;
+		if (ret)
+			goto out;
 
-	/* Calculate total size to store the whole decompressed table */
-	metablks_count = sqfs_count_metablks(dtb, table_offset, table_size);
-	if (metablks_count < 1)
-		goto out;
+		dir = (struct squashfs_dir_inode *)table;
 
-	*dir_table = malloc(metablks_count * SQFS_METADATA_BLOCK_SIZE);
-	if (!*dir_table)
-		goto out;
+		/* Check for symbolic link and inode type sanity */
+		if (get_unaligned_le16(&dir->inode_type) == SQFS_SYMLINK_TYPE) {
+			sym = (struct squashfs_symlink_inode *)table;
+			/* Get first j + 1 tokens */
+			path = sqfs_concat_tokens(token_list, j + 1);
+			if (!path) {
+				ret = -ENOMEM;
+				goto out;
+			}
+			/* Resolve for these tokens */
+			target = sqfs_resolve_symlink(sym, path);
+			if (!target) {
+				ret = -ENOMEM;
+				goto out;
+			}
+			/* Join remaining tokens */
+			rem = sqfs_concat_tokens(token_list + j + 1, token_count -
+						 j - 1);
+			if (!rem) {
+				ret = -ENOMEM;
+				goto out;
+			}
+			/* Concatenate remaining tokens and symlink's target */
+			res = malloc(strlen(rem) + strlen(target) + 1);
+			if (!res) {
+				ret = -ENOMEM;
+				goto out;
+			}
+			strcpy(res, target);
+			res[strlen(target)] = '/';
+			strcpy(res + strlen(target) + 1, rem);
+			token_count = sqfs_count_tokens(res);
 
-	*pos_list = malloc(metablks_count * sizeof(u32));
-	if (!*pos_list)
-		goto out;
+			if (token_count < 0) {
+				ret = -EINVAL;
+				goto out;
+			}
 
-	ret = sqfs_get_metablk_pos(*pos_list, dtb, table_offset,
-				   metablks_count);
-	if (ret) {
-		metablks_count = -1;
-		goto out;
-	}
+			sym_tokens = malloc(token_count * sizeof(char *));
+			if (!sym_tokens) {
+				ret = -EINVAL;
+				goto out;
+			}
 
-	src_table = dtb + table_offset + SQFS_HEADER_SIZE;
-
-	/* Extract compressed Directory table */
-	dest_offset = 0;
-	for (j = 0; j < metablks_count; j++) {
-		sqfs_read_metablock(dtb, table_offset, &compressed, &src_len);
-		if (compressed) {
-			dest_len = SQFS_METADATA_BLOCK_SIZE;
-			ret = sqfs_decompress(&ctxt, *dir_table +
-					      (j * SQFS_METADATA_BLOCK_SIZE),
-					      &dest_len, src_table, src_len);
+			/* Fill tokens list */
+			ret = sqfs_tokenize(sym_tokens, token_count, res);
 			if (ret) {
-				metablks_count = -1;
+				ret = -EINVAL;
 				goto out;
 			}
 
-			if (dest_len < SQFS_METADATA_BLOCK_SIZE) {
-				dest_offset += dest_len;
-				break;
-			}
+			ret = sqfs_search_dir(dirs, sym_tokens, token_count);
+			goto out;
+		} else if (!sqfs_is_dir(get_unaligned_le16(&dir->inode_type))) {
+			printf("** Cannot find directory. **\n");
+			ret = -EINVAL;
+			goto out;
+		}
 
-			dest_offset += dest_len;
-		} else {
-			memcpy(*dir_table + (j * SQFS_METADATA_BLOCK_SIZE),
-			       src_table, src_len);
+		/* Check for empty directory */
+		if (sqfs_is_empty_dir(table)) {
+			printf("Empty directory.\n");
+			ret = SQFS_EMPTY_DIR;
+			goto out;
 		}
 
-		/*
-		 * Offsets to the decompression destination, to the metadata
-		 * buffer 'dtb' and to the decompression source, respectively.
-		 */
-		table_offset += src_len + SQFS_HEADER_SIZE;
-		src_table += src_len + SQFS_HEADER_SIZE;
+		/* Point the stream at the directory's listing */
+		ret = sqfs_dir_open(dirs, table);
+		if (ret)
+			goto out;
 	}
 
 out:
-	if (metablks_count < 1) {
-		free(*dir_table);
-		free(*pos_list);
-		*dir_table = NULL;
-		*pos_list = NULL;
-	}
-	free(dtb);
-
-	return metablks_count;
+	free(table);
+	free(res);
+	free(rem);
+	free(path);
+	free(target);
+	free(sym_tokens);
+	return ret;
 }
 
 int sqfs_opendir(const char *filename, struct fs_dir_stream **dirsp)
 {
-	unsigned char *inode_table = NULL, *dir_table = NULL;
-	int j, token_count = 0, ret = 0, metablks_count;
+	int j, token_count = 0, ret = 0;
 	struct squashfs_dir_stream *dirs;
 	char **token_list = NULL, *path = NULL;
-	u32 *pos_list = NULL;
 
 	dirs = calloc(1, sizeof(*dirs));
 	if (!dirs)
 		return -EINVAL;
 
 	/* these should be set to NULL to prevent dangling pointers */
-	dirs->dir_header = NULL;
 	dirs->entry = NULL;
-	dirs->table = NULL;
-	dirs->inode_table = NULL;
-	dirs->dir_table = NULL;
 
-	ret = sqfs_read_inode_table(&inode_table);
-	if (ret) {
-		ret = -EINVAL;
-		goto out;
-	}
-
-	metablks_count = sqfs_read_directory_table(&dir_table, &pos_list);
-	if (metablks_count < 1) {
-		ret = -EINVAL;
+	dirs->dir_header = malloc(SQFS_DIR_HEADER_SIZE);
+	if (!dirs->dir_header) {
+		ret = -ENOMEM;
 		goto out;
 	}
 
@@ -932,162 +1026,30 @@ int sqfs_opendir(const char *filename, struct fs_dir_stream **dirsp)
 	ret = sqfs_tokenize(token_list, token_count, path);
 	if (ret)
 		goto out;
+
 	/*
-	 * ldir's (extended directory) size is greater than dir, so it works as
-	 * a general solution for the malloc size, since 'i' is a union.
+	 * Only the metadata blocks holding the inodes and directory listings
+	 * along the path are read, through the metadata cache.
 	 */
-	dirs->inode_table = inode_table;
-	dirs->dir_table = dir_table;
-	ret = sqfs_search_dir(dirs, token_list, token_count, pos_list,
-			      metablks_count);
+	ret = sqfs_search_dir(dirs, token_list, token_count);
 	if (ret)
 		goto out;
 
-	if (le16_to_cpu(dirs->i_dir.inode_type) == SQFS_DIR_TYPE)
-		dirs->size = le16_to_cpu(dirs->i_dir.file_size);
-	else
-		dirs->size = le32_to_cpu(dirs->i_ldir.file_size);
-
-	/* Setup directory header */
-	memcpy(dirs->dir_header, dirs->table, SQFS_DIR_HEADER_SIZE);
-	dirs->entry_count = dirs->dir_header->count + 1;
-	dirs->size -= SQFS_DIR_HEADER_SIZE;
-
-	/* Setup entry */
-	dirs->entry = NULL;
-	dirs->table += SQFS_DIR_HEADER_SIZE;
-
 	*dirsp = (struct fs_dir_stream *)dirs;
 
 out:
 	for (j = 0; j < token_count; j++)
 		free(token_list[j]);
 	free(token_list);
-	free(pos_list);
 	free(path);
 	if (ret) {
-		free(inode_table);
+		free(dirs->dir_header);
 		free(dirs);
 	}
 
 	return ret;
 }
 
-int sqfs_readdir(struct fs_dir_stream *fs_dirs, struct fs_dirent **dentp)
-{
-	struct squashfs_super_block *sblk = ctxt.sblk;
-	struct squashfs_dir_stream *dirs;
-	struct squashfs_lreg_inode *lreg;
-	struct squashfs_base_inode *base;
-	struct squashfs_reg_inode *reg;
-	int i_number, offset = 0, ret;
-	struct fs_dirent *dent;
-	unsigned char *ipos;
-	u16 name_size;
-
-	dirs = (struct squashfs_dir_stream *)fs_dirs;
-	if (!dirs->size) {
-		*dentp = NULL;
-		return -SQFS_STOP_READDIR;
-	}
-
-	dent = &dirs->dentp;
-
-	if (!dirs->entry_count) {
-		if (dirs->size > SQFS_DIR_HEADER_SIZE) {
-			dirs->size -= SQFS_DIR_HEADER_SIZE;
-		} else {
-			*dentp = NULL;
-			dirs->size = 0;
-			return -SQFS_STOP_READDIR;
-		}
-
-		if (dirs->size > SQFS_EMPTY_FILE_SIZE) {
-			/* Read follow-up (emitted) dir. header */
-			memcpy(dirs->dir_header, dirs->table,
-			       SQFS_DIR_HEADER_SIZE);
-			dirs->entry_count = dirs->dir_header->count + 1;
-			ret = sqfs_read_entry(&dirs->entry, dirs->table +
-					      SQFS_DIR_HEADER_SIZE);
-			if (ret)
-				return -SQFS_STOP_READDIR;
-
-			dirs->table += SQFS_DIR_HEADER_SIZE;
-		}
-	} else {
-		ret = sqfs_read_entry(&dirs->entry, dirs->table);
-		if (ret)
-			return -SQFS_STOP_READDIR;
-	}
-
-	i_number = dirs->dir_header->inode_number + dirs->entry->inode_offset;
-	ipos = sqfs_find_inode(dirs->inode_table, i_number, sblk->inodes,
-			       sblk->block_size);
-
-	base = (struct squashfs_base_inode *)ipos;
-
-	/* Set entry type and size */
-	switch (dirs->entry->type) {
-	case SQFS_DIR_TYPE:
-	case SQFS_LDIR_TYPE:
-		dent->type = FS_DT_DIR;
-		break;
-	case SQFS_REG_TYPE:
-	case SQFS_LREG_TYPE:
-		/*
-		 * Entries do not differentiate extended from regular types, so
-		 * it needs to be verified manually.
-		 */
-		if (get_unaligned_le16(&base->inode_type) == SQFS_LREG_TYPE) {
-			lreg = (struct squashfs_lreg_inode *)ipos;
-			dent->size = get_unaligned_le64(&lreg->file_size);
-		} else {
-			reg = (struct squashfs_reg_inode *)ipos;
-			dent->size = get_unaligned_le32(&reg->file_size);
-		}
-
-		dent->type = FS_DT_REG;
-		break;
-	case SQFS_BLKDEV_TYPE:
-	case SQFS_CHRDEV_TYPE:
-	case SQFS_LBLKDEV_TYPE:
-	case SQFS_LCHRDEV_TYPE:
-	case SQFS_FIFO_TYPE:
-	case SQFS_SOCKET_TYPE:
-	case SQFS_LFIFO_TYPE:
-	case SQFS_LSOCKET_TYPE:
-		dent->type = SQFS_MISC_ENTRY_TYPE;
-		break;
-	case SQFS_SYMLINK_TYPE:
-	case SQFS_LSYMLINK_TYPE:
-		dent->type = FS_DT_LNK;
-		break;
-	default:
-		return -SQFS_STOP_READDIR;
-	}
-
-	/* Set entry name (capped at FS_DIRENT_NAME_LEN which is a U-Boot limitation) */
-	name_size = min_t(u16, dirs->entry->name_size + 1, FS_DIRENT_NAME_LEN - 1);
-	strncpy(dent->name, dirs->entry->name, name_size);
-	dent->name[name_size] = '\0';
-
-	offset = dirs->entry->name_size + 1 + SQFS_ENTRY_BASE_LENGTH;
-	dirs->entry_count--;
-
-	/* Decrement size to be read */
-	if (dirs->size > offset)
-		dirs->size -= offset;
-	else
-		dirs->size = 0;
-
-	/* Keep a reference to the current entry before incrementing it */
-	dirs->table += offset;
-
-	*dentp = dent;
-
-	return 0;
-}
-
 int sqfs_probe(struct blk_desc *fs_dev_desc, struct disk_partition *fs_partition)
 {
 	struct squashfs_super_block *sblk;
@@ -1095,6 +1057,7 @@ int sqfs_probe(struct blk_desc *fs_dev_desc, struct disk_partition *fs_partition
 
 	ctxt.cur_dev = fs_dev_desc;
 	ctxt.cur_part_info = *fs_partition;
+	sqfs_cache_free();
 
 	ret = sqfs_read_sblk(&sblk);
 	if (ret)
@@ -1320,11 +1283,14 @@ static int sqfs_get_lregfile_info(struct squashfs_lreg_inode *lreg,
 int sqfs_read(const char *filename, void *buf, loff_t offset, loff_t len,
 	      loff_t *actread)
 {
-	char *dir = NULL, *fragment_block, *datablock = NULL;
-	char *fragment = NULL, *file = NULL, *resolved, *data;
+	char *dir = NULL, *datablock = NULL, *data_buffer = NULL;
+	char *file = NULL, *resolved, *data;
 	u64 start, n_blks, table_size, data_offset, table_offset, sparse_size;
-	int ret, j, i_number, datablk_count = 0;
 	struct squashfs_super_block *sblk = ctxt.sblk;
+	int ret, j, datablk_count = 0;
+	struct squashfs_cache_entry *frag_block;
+	u64 file_size;
+	u32 block_size;
 	struct squashfs_fragment_block_entry frag_entry;
 	struct squashfs_file_info finfo = {0};
 	struct squashfs_symlink_inode *symlink;
@@ -1333,9 +1299,9 @@ int sqfs_read(const char *filename, void *buf, loff_t offset, loff_t len,
 	struct squashfs_lreg_inode *lreg;
 	struct squashfs_base_inode *base;
 	struct squashfs_reg_inode *reg;
+	unsigned char *ipos = NULL;
 	unsigned long dest_len;
 	struct fs_dirent *dent;
-	unsigned char *ipos;
 
 	*actread = 0;
 
@@ -1348,8 +1314,8 @@ int sqfs_read(const char *filename, void *buf, loff_t offset, loff_t len,
 	}
 
 	/*
-	 * sqfs_opendir will uncompress inode and directory tables, and will
-	 * return a pointer to the directory that contains the requested file.
+	 * sqfs_opendir will return a pointer to the directory that contains
+	 * the requested file.
 	 */
 	sqfs_split_path(&file, &dir, filename);
 	ret = sqfs_opendir(dir, &dirsp);
@@ -1360,7 +1326,7 @@ int sqfs_read(const char *filename, void *buf, loff_t offset, loff_t len,
 	dirs = (struct squashfs_dir_stream *)dirsp;
 
 	/* For now, only regular files are able to be loaded */
-	while (!sqfs_readdir(dirsp, &dent)) {
+	while (!sqfs_next_dirent(dirs, &dent, false)) {
 		ret = strcmp(dent->name, file);
 		if (!ret)
 			break;
@@ -1376,9 +1342,9 @@ int sqfs_read(const char *filename, void *buf, loff_t offset, loff_t len,
 		goto out;
 	}
 
-	i_number = dirs->dir_header->inode_number + dirs->entry->inode_offset;
-	ipos = sqfs_find_inode(dirs->inode_table, i_number, sblk->inodes,
-			       sblk->block_size);
+	ret = sqfs_read_inode(sqfs_entry_inode(dirs), (void **)&ipos);
+	if (ret)
+		goto out;
 
 	base = (struct squashfs_base_inode *)ipos;
 	switch (get_unaligned_le16(&base->inode_type)) {
@@ -1429,6 +1395,7 @@ int sqfs_read(const char *filename, void *buf, loff_t offset, loff_t len,
 	}
 
 	/* If the user specifies a length, check its sanity */
+	file_size = finfo.size;
 	if (len) {
 		if (len > finfo.size) {
 			ret = -EINVAL;
@@ -1440,38 +1407,45 @@ int sqfs_read(const char *filename, void *buf, loff_t offset, loff_t len,
 		len = finfo.size;
 	}
 
+	block_size = get_unaligned_le32(&sblk->block_size);
 	if (datablk_count) {
 		data_offset = finfo.start;
-		datablock = malloc(get_unaligned_le32(&sblk->block_size));
+		datablock = malloc(block_size);
 		if (!datablock) {
 			ret = -ENOMEM;
 			goto out;
 		}
+
+		/*
+		 * Large enough for any data block, wherever it starts within a
+		 * device block.
+		 */
+		n_blks = DIV_ROUND_UP(block_size + ctxt.cur_dev->blksz - 1,
+				      ctxt.cur_dev->blksz);
+		data_buffer = malloc_cache_aligned(n_blks * ctxt.cur_dev->blksz);
+		if (!data_buffer) {
+			ret = -ENOMEM;
+			goto out;
+		}
 	}
 
 	for (j = 0; j < datablk_count; j++) {
-		char *data_buffer;
-
 		start = lldiv(data_offset, ctxt.cur_dev->blksz);
 		table_size = SQFS_BLOCK_SIZE(finfo.blk_sizes[j]);
 		table_offset = data_offset - (start * ctxt.cur_dev->blksz);
 		n_blks = DIV_ROUND_UP(table_size + table_offset,
 				      ctxt.cur_dev->blksz);
 
+		if (table_size > block_size) {
+			printf("Error: invalid data block size.\n");
+			ret = -EINVAL;
+			goto out;
+		}
+
 		/* Don't load any data for sparse blocks */
 		if (finfo.blk_sizes[j] == 0) {
-			n_blks = 0;
-			table_offset = 0;
-			data_buffer = NULL;
 			data = NULL;
 		} else {
-			data_buffer = malloc_cache_aligned(n_blks * ctxt.cur_dev->blksz);
-
-			if (!data_buffer) {
-				ret = -ENOMEM;
-				goto out;
-			}
-
 			ret = sqfs_disk_read(start, n_blks, data_buffer);
 			if (ret < 0) {
 				/*
@@ -1489,21 +1463,37 @@ int sqfs_read(const char *filename, void *buf, loff_t offset, loff_t len,
 		/* Load the data */
 		if (finfo.blk_sizes[j] == 0) {
 			/* This is a sparse block */
-			sparse_size = get_unaligned_le32(&sblk->block_size);
+			sparse_size = block_size;
 			if ((*actread + sparse_size) > len)
 				sparse_size = len - *actread;
 			memset(buf + *actread, 0, sparse_size);
 			*actread += sparse_size;
 		} else if (SQFS_COMPRESSED_BLOCK(finfo.blk_sizes[j])) {
-			dest_len = get_unaligned_le32(&sblk->block_size);
-			ret = sqfs_decompress(&ctxt, datablock, &dest_len,
-					      data, table_size);
-			if (ret)
-				goto out;
+			/*
+			 * A block that fits in what is left of the caller's
+			 * buffer is decompressed straight into it. Only a block
+			 * cut short by 'len' goes through 'datablock'.
+			 */
+			dest_len = min_t(u64, block_size, file_size - *actread);
+			if (*actread + dest_len <= len) {
+				ret = sqfs_decompress(&ctxt, buf + *actread,
+						      &dest_len, data,
+						      table_size);
+				if (ret)
+					goto out;
+			} else {
+				dest_len = block_size;
+				ret = sqfs_decompress(&ctxt, datablock,
+						      &dest_len, data,
+						      table_size);
+				if (ret)
+					goto out;
+
+				if ((*actread + dest_len) > len)
+					dest_len = len - *actread;
+				memcpy(buf + *actread, datablock, dest_len);
+			}
 
-			if ((*actread + dest_len) > len)
-				dest_len = len - *actread;
-			memcpy(buf + *actread, datablock, dest_len);
 			*actread += dest_len;
 		} else {
 			if ((*actread + table_size) > len)
@@ -1513,7 +1503,6 @@ int sqfs_read(const char *filename, void *buf, loff_t offset, loff_t len,
 		}
 
 		data_offset += table_size;
-		free(data_buffer);
 		if (*actread >= len)
 			break;
 	}
@@ -1526,53 +1515,26 @@ int sqfs_read(const char *filename, void *buf, loff_t offset, loff_t len,
 		goto out;
 	}
 
-	start = lldiv(frag_entry.start, ctxt.cur_dev->blksz);
-	table_size = SQFS_BLOCK_SIZE(frag_entry.size);
-	table_offset = frag_entry.start - (start * ctxt.cur_dev->blksz);
-	n_blks = DIV_ROUND_UP(table_size + table_offset, ctxt.cur_dev->blksz);
-
-	fragment = malloc_cache_aligned(n_blks * ctxt.cur_dev->blksz);
-
-	if (!fragment) {
-		ret = -ENOMEM;
+	frag_block = sqfs_get_fragment_block(&frag_entry);
+	if (!frag_block) {
+		ret = -EINVAL;
 		goto out;
 	}
 
-	ret = sqfs_disk_read(start, n_blks, fragment);
-	if (ret < 0)
+	if (finfo.offset + finfo.size - *actread > frag_block->len) {
+		printf("Error: invalid fragment offset.\n");
+		ret = -EINVAL;
 		goto out;
-
-	/* File compressed and fragmented */
-	if (finfo.frag && finfo.comp) {
-		dest_len = get_unaligned_le32(&sblk->block_size);
-		fragment_block = malloc(dest_len);
-		if (!fragment_block) {
-			ret = -ENOMEM;
-			goto out;
-		}
-
-		ret = sqfs_decompress(&ctxt, fragment_block, &dest_len,
-				      (void *)fragment  + table_offset,
-				      frag_entry.size);
-		if (ret) {
-			free(fragment_block);
-			goto out;
-		}
-
-		memcpy(buf + *actread, &fragment_block[finfo.offset], finfo.size - *actread);
-		*actread = finfo.size;
-
-		free(fragment_block);
-
-	} else if (finfo.frag && !finfo.comp) {
-		fragment_block = (void *)fragment + table_offset;
-
-		memcpy(buf + *actread, &fragment_block[finfo.offset], finfo.size - *actread);
-		*actread = finfo.size;
 	}
 
+	memcpy(buf + *actread, frag_block->data + finfo.offset,
+	       finfo.size - *actread);
+	*actread = finfo.size;
+	ret = 0;
+
 out:
-	free(fragment);
+	free(ipos);
+	free(data_buffer);
 	free(datablock);
 	free(file);
 	free(dir);
@@ -1584,7 +1546,6 @@ out:
 
 int sqfs_size(const char *filename, loff_t *size)
 {
-	struct squashfs_super_block *sblk = ctxt.sblk;
 	struct squashfs_symlink_inode *symlink;
 	struct fs_dir_stream *dirsp = NULL;
 	struct squashfs_base_inode *base;
@@ -1592,14 +1553,14 @@ int sqfs_size(const char *filename, loff_t *size)
 	struct squashfs_lreg_inode *lreg;
 	struct squashfs_reg_inode *reg;
 	char *dir, *file, *resolved;
+	unsigned char *ipos = NULL;
 	struct fs_dirent *dent;
-	unsigned char *ipos;
-	int ret, i_number;
+	int ret;
 
 	sqfs_split_path(&file, &dir, filename);
 	/*
-	 * sqfs_opendir will uncompress inode and directory tables, and will
-	 * return a pointer to the directory that contains the requested file.
+	 * sqfs_opendir will return a pointer to the directory that contains
+	 * the requested file.
 	 */
 	ret = sqfs_opendir(dir, &dirsp);
 	if (ret) {
@@ -1609,7 +1570,7 @@ int sqfs_size(const char *filename, loff_t *size)
 
 	dirs = (struct squashfs_dir_stream *)dirsp;
 
-	while (!sqfs_readdir(dirsp, &dent)) {
+	while (!sqfs_next_dirent(dirs, &dent, false)) {
 		ret = strcmp(dent->name, file);
 		if (!ret)
 			break;
@@ -1624,11 +1585,13 @@ int sqfs_size(const char *filename, loff_t *size)
 		goto free_strings;
 	}
 
-	i_number = dirs->dir_header->inode_number + dirs->entry->inode_offset;
-	ipos = sqfs_find_inode(dirs->inode_table, i_number, sblk->inodes,
-			       sblk->block_size);
+	ret = sqfs_read_inode(sqfs_entry_inode(dirs), (void **)&ipos);
 	free(dirs->entry);
 	dirs->entry = NULL;
+	if (ret) {
+		*size = 0;
+		goto free_strings;
+	}
 
 	base = (struct squashfs_base_inode *)ipos;
 	switch (get_unaligned_le16(&base->inode_type)) {
@@ -1663,6 +1626,7 @@ int sqfs_size(const char *filename, loff_t *size)
 	}
 
 free_strings:
+	free(ipos);
 	free(dir);
 	free(file);
 
@@ -1681,8 +1645,8 @@ int sqfs_exists(const char *filename)
 
 	sqfs_split_path(&file, &dir, filename);
 	/*
-	 * sqfs_opendir will uncompress inode and directory tables, and will
-	 * return a pointer to the directory that contains the requested file.
+	 * sqfs_opendir will return a pointer to the directory that contains
+	 * the requested file.
 	 */
 	ret = sqfs_opendir(dir, &dirsp);
 	if (ret) {
@@ -1692,7 +1656,7 @@ int sqfs_exists(const char *filename)
 
 	dirs = (struct squashfs_dir_stream *)dirsp;
 
-	while (!sqfs_readdir(dirsp, &dent)) {
+	while (!sqfs_next_dirent(dirs, &dent, false)) {
 		ret = strcmp(dent->name, file);
 		if (!ret)
 			break;
@@ -1711,6 +1675,7 @@ free_strings:
 
 void sqfs_close(void)
 {
+	sqfs_cache_free();
 	sqfs_decompressor_cleanup(&ctxt);
 	free(ctxt.sblk);
 	ctxt.sblk = NULL;
@@ -1725,8 +1690,7 @@ void sqfs_closedir(struct fs_dir_stream *dirs)
 		return;
 
 	sqfs_dirs = (struct squashfs_dir_stream *)dirs;
-	free(sqfs_dirs->inode_table);
-	free(sqfs_dirs->dir_table);
+	free(sqfs_dirs->entry);
 	free(sqfs_dirs->dir_header);
 	free(sqfs_dirs);
 }
@@ -105,20 +105,27 @@ static void zlib_decompression_status(int ret)
 
 #if IS_ENABLED(CONFIG_ZSTD)
 static int sqfs_zstd_decompress(struct squashfs_ctxt *ctxt, void *dest,
-				unsigned long dest_len, void *source, u32 src_len)
+				unsigned long *dest_len, void *source,
+				u32 src_len)
 {
 	ZSTD_DCtx *ctx;
 	size_t wsize;
-	int ret;
+	size_t ret;
 
 	wsize = zstd_dctx_workspace_bound();
 
 	ctx = zstd_init_dctx(ctxt->zstd_workspace, wsize);
 	if (!ctx)
 		return -EINVAL;
-	ret = zstd_decompress_dctx(ctx, dest, dest_len, source, src_len);
+	ret = zstd_decompress_dctx(ctx, dest, *dest_len, source, src_len);
+	if (zstd_is_error(ret)) {
+		printf("ZSTD Error code: %d\n", zstd_get_error_code(ret));
+		return -EINVAL;
+	}
 
-	return zstd_is_error(ret);
+	*dest_len = ret;
+
+	return 0;
 }
 #endif /* CONFIG_ZSTD */
 
@@ -138,6 +145,7 @@ int sqfs_decompress(struct squashfs_ctxt *ctxt, void *dest,
 			return -EINVAL;
 		}
 
+		*dest_len = lzo_dest_len;
 		break;
 	}
 #endif
@@ -159,16 +167,15 @@ int sqfs_decompress(struct squashfs_ctxt *ctxt, void *dest,
 			return -EINVAL;
 		}
 
+		*dest_len = ret;
 		ret = 0;
 		break;
 #endif
 #if IS_ENABLED(CONFIG_ZSTD)
 	case SQFS_COMP_ZSTD:
-		ret = sqfs_zstd_decompress(ctxt, dest, *dest_len, source, src_len);
-		if (ret) {
-			printf("ZSTD Error code: %d\n", zstd_get_error_code(ret));
-			return -EINVAL;
-		}
+		ret = sqfs_zstd_decompress(ctxt, dest, dest_len, source, src_len);
+		if (ret)
+			return ret;
 
 		break;
 #endif
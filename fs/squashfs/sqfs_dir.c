@@ -22,18 +22,17 @@ bool sqfs_is_dir(u16 type)
 
 /*
  * Receives a pointer (void *) to a position in the inode table containing the
- * directory's inode. Returns directory inode offset into the directory table.
- * m_list contains each metadata block's position, and m_count is the number of
- * elements of m_list. Those metadata blocks come from the compressed directory
- * table.
+ * directory's inode. Gives, in 'ref', the position of the directory's listing
+ * in the directory table: the offset of its first metadata block from the
+ * start of the table, shifted left by 16, plus the offset into that block.
  */
-int sqfs_dir_offset(void *dir_i, u32 *m_list, int m_count)
+int sqfs_dir_offset(void *dir_i, u64 *ref)
 {
 	struct squashfs_base_inode *base = dir_i;
 	struct squashfs_ldir_inode *ldir;
 	struct squashfs_dir_inode *dir;
 	u32 start_block;
-	int j, offset;
+	u16 offset;
 
 	switch (get_unaligned_le16(&base->inode_type)) {
 	case SQFS_DIR_TYPE:
@@ -51,20 +50,14 @@ int sqfs_dir_offset(void *dir_i, u32 *m_list, int m_count)
 		return -EINVAL;
 	}
 
-	if (offset < 0)
+	if (offset >= SQFS_METADATA_BLOCK_SIZE) {
+		printf("Error: invalid inode reference to directory table.\n");
 		return -EINVAL;
-
-	for (j = 0; j < m_count; j++) {
-		if (m_list[j] == start_block)
-			return (++j * SQFS_METADATA_BLOCK_SIZE) + offset;
 	}
 
-	if (start_block == 0)
-		return offset;
-
-	printf("Error: invalid inode reference to directory table.\n");
+	*ref = ((u64)start_block << 16) | offset;
 
-	return -EINVAL;
+	return 0;
 }
 
 bool sqfs_is_empty_dir(void *dir_i)
@@ -18,6 +18,10 @@
 #define SQFS_DIR_INDEX_BASE_LENGTH 12
 /* size of metadata (inode and directory) blocks */
 #define SQFS_METADATA_BLOCK_SIZE 8192
+/* Number of uncompressed metadata blocks kept in the metadata cache */
+#define SQFS_METADATA_CACHE_ENTRIES 8
+/* Number of uncompressed fragment blocks kept in the fragment cache */
+#define SQFS_FRAGMENT_CACHE_ENTRIES 4
 /* Max. number of fragment entries in a metadata block is 512 */
 #define SQFS_MAX_ENTRIES 512
 /* Metadata blocks start by a 2-byte length header */
@@ -71,6 +75,30 @@ struct squashfs_super_block {
 	__le64 export_table_start;
 };
 
+/*
+ * An uncompressed metadata or fragment block, as kept in the metadata and
+ * fragment caches. 'pos' is the on-disk offset of the block (of its header for
+ * metadata blocks), 0 for an unused entry. For metadata blocks, 'next' is the
+ * offset of the block following it in the same table.
+ */
+struct squashfs_cache_entry {
+	u64 pos;
+	u64 next;
+	u32 len;
+	/* Value of the cache clock at the last use, for LRU replacement */
+	u32 last_used;
+	unsigned char *data;
+};
+
+/*
+ * Position in a metadata table: 'block' is the on-disk offset of a metadata
+ * block's header and 'offset' an offset into its uncompressed contents.
+ */
+struct squashfs_metadata_ref {
+	u64 block;
+	u32 offset;
+};
+
 struct squashfs_ctxt {
 	struct disk_partition cur_part_info;
 	struct blk_desc *cur_dev;
@@ -78,6 +106,10 @@ struct squashfs_ctxt {
 #if IS_ENABLED(CONFIG_ZSTD)
 	void *zstd_workspace;
 #endif
+	/* Both caches live from sqfs_probe() to sqfs_close() */
+	struct squashfs_cache_entry metadata[SQFS_METADATA_CACHE_ENTRIES];
+	struct squashfs_cache_entry fragments[SQFS_FRAGMENT_CACHE_ENTRIES];
+	u32 cache_clock;
 };
 
 struct squashfs_directory_index {
@@ -262,20 +294,14 @@ struct squashfs_dir_stream {
 	struct squashfs_directory_header *dir_header;
 	struct squashfs_directory_entry *entry;
 	/*
-	 * 'table' points to a position into the directory table. Both 'table'
-	 * and 'inode' are defined for the first time in sqfs_opendir().
-	 * 'table's value changes in sqfs_readdir().
+	 * 'table' is the position of the next header or entry in the
+	 * directory table. Both 'table' and 'inode' are defined for the first
+	 * time in sqfs_opendir(). 'table' moves forward in sqfs_readdir().
 	 */
-	unsigned char *table;
+	struct squashfs_metadata_ref table;
 	union squashfs_inode i;
 	struct squashfs_dir_inode i_dir;
 	struct squashfs_ldir_inode i_ldir;
-	/*
-	 * References to the tables' beginnings. They are assigned in
-	 * sqfs_opendir() and freed in sqfs_closedir().
-	 */
-	unsigned char *inode_table;
-	unsigned char *dir_table;
 };
 
 struct squashfs_file_info {
@@ -293,13 +319,9 @@ struct squashfs_file_info {
 	bool comp;
 };
 
-void *sqfs_find_inode(void *inode_table, int inode_number, __le32 inode_count,
-		      __le32 block_size);
-
-int sqfs_dir_offset(void *dir_i, u32 *m_list, int m_count);
+int sqfs_inode_size(struct squashfs_base_inode *inode, u32 blk_size);
 
-int sqfs_read_metablock(unsigned char *file_mapping, int offset,
-			bool *compressed, u32 *data_size);
+int sqfs_dir_offset(void *dir_i, u64 *ref);
 
 bool sqfs_is_empty_dir(void *dir_i);
 
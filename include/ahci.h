@@ -19,6 +19,8 @@
 #define AHCI_CMD_TBL_SZ		AHCI_CMD_TBL_HDR + (AHCI_MAX_SG * 16)
 #define AHCI_PORT_PRIV_DMA_SZ	(AHCI_CMD_SLOT_SZ * AHCI_MAX_CMD_SLOT + \
 				AHCI_CMD_TBL_SZ	+ AHCI_RX_FIS_SZ)
+#define AHCI_NCQ_MAX_SG		8 /* enough for 65535 sectors */
+#define AHCI_NCQ_TBL_SZ		(AHCI_CMD_TBL_HDR + (AHCI_NCQ_MAX_SG * 16))
 #define AHCI_CMD_ATAPI		(1 << 5)
 #define AHCI_CMD_WRITE		(1 << 6)
 #define AHCI_CMD_PREFETCH	(1 << 7)
@@ -139,6 +141,8 @@ struct ahci_ioports {
 	struct ahci_sg		*cmd_tbl_sg;
 	ulong	cmd_tbl;
 	u32	rx_fis;
+	ulong	ncq_tbl;	/* command tables for queued commands */
+	u32	ncq_depth;	/* 0 if NCQ is not used */
 };
 
 /**
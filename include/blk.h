@@ -111,18 +111,26 @@ struct blk_desc {
 /**
  * blkcache_read() - attempt to read a set of blocks from cache
  *
+ * Blocks are cached individually, so some of the blocks may be cached when
+ * others are not. The cached blocks at the start and at the end of the range
+ * are copied to @buffer, leaving a single run of blocks in the middle to be
+ * read from the device.
+ *
  * @param iftype - uclass_id_x for type of device
  * @param dev - device index of particular type
  * @param start - starting block number
  * @param blkcnt - number of blocks to read
  * @param blksz - size in bytes of each block
  * @param buffer - buffer to contain cached data
+ * @param tailp - returns the number of blocks copied at the end of the range,
+ *	if not all of them were cached
  *
- * Return: - 1 if block returned from cache, 0 otherwise.
+ * Return: - number of blocks copied at the start of the range, @blkcnt if
+ * all blocks were returned from cache
  */
 int blkcache_read(int iftype, int dev,
 		  lbaint_t start, lbaint_t blkcnt,
-		  unsigned long blksz, void *buffer);
+		  unsigned long blksz, void *buffer, lbaint_t *tailp);
 
 /**
  * blkcache_fill() - make data read from a block device available
@@ -140,6 +148,41 @@ void blkcache_fill(int iftype, int dev,
 		   lbaint_t start, lbaint_t blkcnt,
 		   unsigned long blksz, void const *buffer);
 
+/**
+ * blkcache_readahead() - work out what to read ahead after a read
+ *
+ * This tracks whether the device is read sequentially. If so, it asks for
+ * the blocks following the read to be read ahead, with a window which grows
+ * each time the reads catch up with it, up to CONFIG_BLOCK_CACHE_READAHEAD
+ * blocks or half of the cache of the device.
+ *
+ * @iftype - uclass_id_x for type of device
+ * @dev - device index of particular type
+ * @start - starting block number of the read
+ * @blkcnt - number of blocks read
+ * @startp - returns the first block to read ahead
+ * Return: number of blocks to read ahead, 0 if none
+ */
+lbaint_t blkcache_readahead(int iftype, int dev, lbaint_t start,
+			    lbaint_t blkcnt, lbaint_t *startp);
+
+/**
+ * blkcache_fill_readahead() - add blocks read ahead to the block cache
+ *
+ * Unlike blkcache_fill(), this does not limit the number of blocks, and the
+ * blocks are counted as used by the readahead statistics once they are read.
+ *
+ * @iftype - uclass_id_x for type of device
+ * @dev - device index of particular type
+ * @start - starting block number
+ * @blkcnt - number of blocks available
+ * @blksz - size in bytes of each block
+ * @buffer - buffer containing data to cache
+ */
+void blkcache_fill_readahead(int iftype, int dev, lbaint_t start,
+			     lbaint_t blkcnt, unsigned long blksz,
+			     void const *buffer);
+
 /**
  * blkcache_invalidate() - discard the cache for a set of blocks
  * because of a write or device (re)initialization.
@@ -152,20 +195,51 @@ void blkcache_invalidate(int iftype, int dev);
 /**
  * blkcache_configure() - configure block cache
  *
+ * This sets the size of the cache of every device, including devices which
+ * were configured with blkcache_configure_dev() before.
+ *
  * @param blocks - maximum blocks per entry
- * @param entries - maximum entries in cache
+ * @param entries - maximum entries in the cache of each device
  */
 void blkcache_configure(unsigned blocks, unsigned entries);
 
+/**
+ * blkcache_configure_dev() - configure the block cache of one device
+ *
+ * @iftype - UCLASS_ID_ for type of device
+ * @dev - device index of particular type
+ * @blocks - maximum blocks per entry, i.e. the largest read which is cached
+ * @entries - maximum entries in the cache of the device, each of @blocks
+ *	blocks
+ * Return: 0 if OK, -ENOMEM if out of memory
+ */
+int blkcache_configure_dev(int iftype, int dev, unsigned blocks,
+			   unsigned entries);
+
 /*
  * statistics of the block cache
  */
 struct block_cache_stats {
 	unsigned hits;
+	unsigned partial; /* reads partly returned from cache */
 	unsigned misses;
-	unsigned entries; /* current entry count */
+	unsigned entries; /* current block count, for all devices */
 	unsigned max_blocks_per_entry;
 	unsigned max_entries;
+	unsigned ra_blocks; /* blocks read ahead */
+	unsigned ra_hits; /* blocks read ahead which were then read */
+};
+
+/*
+ * state of the block cache of one device
+ */
+struct block_cache_dev_stats {
+	int iftype;
+	int devnum;
+	unsigned blocks; /* current block count */
+	unsigned max_blocks_per_entry;
+	unsigned max_entries;
+	bool configured; /* set with blkcache_configure_dev() */
 };
 
 /**
@@ -175,6 +249,15 @@ struct block_cache_stats {
  */
 void blkcache_stats(struct block_cache_stats *stats);
 
+/**
+ * blkcache_dev_stats() - return the state of the cache of a device
+ *
+ * @index - index of the device in the cache, starting from 0
+ * @stats - state is copied here
+ * Return: 0 if OK, -ENOENT if there is no device with that index
+ */
+int blkcache_dev_stats(int index, struct block_cache_dev_stats *stats);
+
 /** blkcache_free() - free all memory allocated to the block cache */
 void blkcache_free(void);
 
@@ -182,8 +265,10 @@ void blkcache_free(void);
 
 static inline int blkcache_read(int iftype, int dev,
 				lbaint_t start, lbaint_t blkcnt,
-				unsigned long blksz, void *buffer)
+				unsigned long blksz, void *buffer,
+				lbaint_t *tailp)
 {
+	*tailp = 0;
 	return 0;
 }
 
@@ -191,6 +276,18 @@ static inline void blkcache_fill(int iftype, int dev,
 				 lbaint_t start, lbaint_t blkcnt,
 				 unsigned long blksz, void const *buffer) {}
 
+static inline lbaint_t blkcache_readahead(int iftype, int dev,
+					  lbaint_t start, lbaint_t blkcnt,
+					  lbaint_t *startp)
+{
+	return 0;
+}
+
+static inline void blkcache_fill_readahead(int iftype, int dev,
+					   lbaint_t start, lbaint_t blkcnt,
+					   unsigned long blksz,
+					   void const *buffer) {}
+
 static inline void blkcache_invalidate(int iftype, int dev) {}
 
 static inline void blkcache_free(void) {}
@@ -200,6 +297,49 @@ static inline void blkcache_free(void) {}
 #if CONFIG_IS_ENABLED(BLK)
 struct udevice;
 
+/**
+ * enum blk_req_state - progress of an asynchronous block request
+ *
+ * @BLK_REQ_IDLE:	not submitted, or rejected by blk_submit()
+ * @BLK_REQ_PENDING:	submitted and not complete yet
+ * @BLK_REQ_DONE:	complete, with the outcome in &struct blk_req.result
+ */
+enum blk_req_state {
+	BLK_REQ_IDLE,
+	BLK_REQ_PENDING,
+	BLK_REQ_DONE,
+};
+
+/**
+ * struct blk_req - an asynchronous block request
+ *
+ * The caller fills in @start, @blkcnt, @buffer and @write, then passes the
+ * request to blk_submit(). The request and the buffer must be left alone
+ * until blk_poll() or blk_wait() reports that the request is complete.
+ *
+ * @dev:	Block device, set by blk_submit()
+ * @start:	First block to transfer
+ * @blkcnt:	Number of blocks to transfer
+ * @buffer:	Data to write, or place to put the data read
+ * @write:	true to write to the device, false to read from it
+ * @state:	Progress of the request
+ * @result:	Number of blocks transferred, which may be less than @blkcnt,
+ *		or -ve error, once the request is complete
+ * @done:	Number of blocks transferred so far, for use by the driver
+ * @priv:	For use by the driver while the request is pending
+ */
+struct blk_req {
+	struct udevice *dev;
+	lbaint_t start;
+	lbaint_t blkcnt;
+	void *buffer;
+	bool write;
+	enum blk_req_state state;
+	long result;
+	lbaint_t done;
+	void *priv;
+};
+
 /* Operations on block devices */
 struct blk_ops {
 	/**
@@ -259,6 +399,38 @@ struct blk_ops {
 	 */
 	int (*select_hwpart)(struct udevice *dev, int hwpart);
 
+	/**
+	 * submit() - start an asynchronous transfer
+	 *
+	 * This is optional. Without it, requests are completed synchronously
+	 * with read() and write(). It is only used with BLK_ASYNC.
+	 *
+	 * The driver starts the transfer and returns without waiting for
+	 * it, or completes the request at once with blk_req_complete(). A
+	 * driver must finish any pending request itself before it handles
+	 * read(), write() or erase().
+	 *
+	 * @dev:	Block device for the request
+	 * @req:	Request to start
+	 * @return 0 if OK, -EBUSY if the device cannot take another request
+	 * until one completes, -ENOSYS if this request must be completed
+	 * synchronously, other -ve on error
+	 */
+	int (*submit)(struct udevice *dev, struct blk_req *req);
+
+	/**
+	 * poll() - check a request started by submit()
+	 *
+	 * This must not wait for the transfer. When it is complete, or has
+	 * failed or timed out, the driver calls blk_req_complete(). It may
+	 * complete other pending requests at the same time.
+	 *
+	 * @dev:	Block device for the request
+	 * @req:	Request to check
+	 * @return 0 if the request is complete, -EAGAIN if not
+	 */
+	int (*poll)(struct udevice *dev, struct blk_req *req);
+
 #if IS_ENABLED(CONFIG_BOUNCE_BUFFER)
 	/**
 	 * buffer_aligned() - test memory alignment of block operation buffer
@@ -328,6 +500,52 @@ long blk_write(struct udevice *dev, lbaint_t start, lbaint_t blkcnt,
  */
 long blk_erase(struct udevice *dev, lbaint_t start, lbaint_t blkcnt);
 
+/**
+ * blk_submit() - Start an asynchronous read or write
+ *
+ * The transfer described by @req is started and this returns without
+ * waiting for it, if the driver supports that. Otherwise the request is
+ * complete when this returns. Reads which can be served from the block
+ * cache are also completed at once.
+ *
+ * @dev: Device to read from or write to
+ * @req: Request to submit, see &struct blk_req
+ * Return: 0 if OK, -EBUSY if the device is busy with other requests, so one
+ * of those must be completed first, other -ve on error
+ */
+int blk_submit(struct udevice *dev, struct blk_req *req);
+
+/**
+ * blk_poll() - Check whether an asynchronous request is complete
+ *
+ * This does not wait, so the caller can do other work between calls.
+ *
+ * @req: Request passed to blk_submit()
+ * Return: 0 if complete, with the outcome in @req->result, -EAGAIN if it is
+ * still in progress, -EINVAL if it was not submitted
+ */
+int blk_poll(struct blk_req *req);
+
+/**
+ * blk_wait() - Wait for an asynchronous request to complete
+ *
+ * @req: Request passed to blk_submit()
+ * Return: number of blocks transferred (which may be less than the number
+ * requested), or -ve on error
+ */
+long blk_wait(struct blk_req *req);
+
+/**
+ * blk_req_complete() - Mark an asynchronous request as complete
+ *
+ * This is called by drivers when a transfer started by their submit()
+ * method is complete.
+ *
+ * @req: Request which is complete
+ * @result: Number of blocks transferred, or -ve on error
+ */
+void blk_req_complete(struct blk_req *req, long result);
+
 /**
  * blk_find_device() - Find a block device
  *
@@ -539,22 +757,33 @@ int blk_get_desc(enum uclass_id uclass_id, int devnum, struct blk_desc **descp);
 static inline ulong blk_dread(struct blk_desc *block_dev, lbaint_t start,
 			      lbaint_t blkcnt, void *buffer)
 {
+	lbaint_t head, tail, count;
 	ulong blks_read;
-	if (blkcache_read(block_dev->uclass_id, block_dev->devnum,
-			  start, blkcnt, block_dev->blksz, buffer))
+
+	head = blkcache_read(block_dev->uclass_id, block_dev->devnum,
+			     start, blkcnt, block_dev->blksz, buffer, &tail);
+	if (head == blkcnt)
 		return blkcnt;
 
 	/*
 	 * We could check if block_read is NULL and return -ENOSYS. But this
 	 * bloats the code slightly (cause some board to fail to build), and
 	 * it would be an error to try an operation that does not exist.
+	 *
+	 * Only read what the cache could not supply.
 	 */
-	blks_read = block_dev->block_read(block_dev, start, blkcnt, buffer);
-	if (blks_read == blkcnt)
-		blkcache_fill(block_dev->uclass_id, block_dev->devnum,
-			      start, blkcnt, block_dev->blksz, buffer);
-
-	return blks_read;
+	count = blkcnt - head - tail;
+	buffer += head * block_dev->blksz;
+	blks_read = block_dev->block_read(block_dev, start + head, count,
+					  buffer);
+	if (blks_read != count)
+		/* Pass errors, which read as huge counts, through unchanged */
+		return blks_read > count ? blks_read : head + blks_read;
+
+	blkcache_fill(block_dev->uclass_id, block_dev->devnum,
+		      start + head, count, block_dev->blksz, buffer);
+
+	return blkcnt;
 }
 
 static inline ulong blk_dwrite(struct blk_desc *block_dev, lbaint_t start,
@@ -213,6 +213,8 @@ enum bootstage_id {
 	BOOTSTAGE_ID_ACCUM_FSP_M,
 	BOOTSTAGE_ID_ACCUM_FSP_S,
 	BOOTSTAGE_ID_ACCUM_MMAP_SPI,
+	BOOTSTAGE_ID_ACCUM_FS_PROBE,
+	BOOTSTAGE_ID_ACCUM_FS_PROBE_SAVED,
 
 	/* a few spare for the user, from here */
 	BOOTSTAGE_ID_USER,
@@ -335,6 +337,20 @@ uint32_t bootstage_start(enum bootstage_id id, const char *name);
  */
 uint32_t bootstage_accum(enum bootstage_id id);
 
+/**
+ * Add a given amount of time to a bootstage accumulator
+ *
+ * This is for activities which are not timed directly, for example the time
+ * saved by skipping work which would otherwise have been done.
+ *
+ * @param id		Bootstage id to record this time against
+ * @param name		Textual name to display for this id in the report
+ * @param duration	Time to add in microseconds
+ * Return: total time accumulated against this id
+ */
+uint32_t bootstage_accum_time(enum bootstage_id id, const char *name,
+			      uint32_t duration);
+
 /* Print a report about boot time */
 void bootstage_report(void);
 
@@ -434,6 +450,13 @@ static inline uint32_t bootstage_accum(enum bootstage_id id)
 	return 0;
 }
 
+static inline uint32_t bootstage_accum_time(enum bootstage_id id,
+					    const char *name,
+					    uint32_t duration)
+{
+	return 0;
+}
+
 static inline int bootstage_stash(void *base, int size)
 {
 	return 0;	/* Pretend to succeed */
@@ -34,6 +34,7 @@ struct disk_partition;
 #define EXT4_TOPDIR_FL		0x00020000 /* Top of directory hierarchies*/
 #define EXT4_EXTENTS_FL		0x00080000 /* Inode uses extents */
 #define EXT4_EXT_MAGIC			0xf30a
+#define EXT4_FEATURE_RO_COMPAT_SPARSE_SUPER	0x0001
 #define EXT4_FEATURE_RO_COMPAT_GDT_CSUM	0x0010
 #define EXT4_FEATURE_RO_COMPAT_METADATA_CSUM 0x0400
 #define EXT4_FEATURE_INCOMPAT_EXTENTS	0x0040
@@ -61,6 +62,11 @@ struct ext4_extent {
 	__le32	ee_start_lo;	/* low 32 bits of physical block */
 };
 
+/* Extents longer than this are unwritten, see the Linux ext4 driver */
+#define EXT_INIT_MAX_LEN	(1 << 15)
+/* Extents, or index entries, that fit in the inode after the header */
+#define EXT4_INODE_EXTENTS	4
+
 /*
  * This is index on-disk structure.
  * It's used at all the levels except the bottom.
@@ -25,7 +25,10 @@ struct disk_partition;
 #define DIRENTSPERCLUST	((mydata->clust_size * mydata->sect_size) / \
 			 sizeof(dir_entry))
 
-#define FATBUFBLOCKS	6
+#define FATBUFBLOCKS	CONFIG_VAL(FS_FAT_FATBUF_BLOCKS)
+#if FATBUFBLOCKS % 3
+#error "FS_FAT_FATBUF_BLOCKS must be a multiple of 3 for FAT12"
+#endif
 #define FATBUFSIZE	(mydata->sect_size * FATBUFBLOCKS)
 #define FAT12BUFSIZE	((FATBUFSIZE*2)/3)
 #define FAT16BUFSIZE	(FATBUFSIZE/2)
@@ -167,6 +170,8 @@ typedef struct {
 	__u32	fatlength;	/* Length of FAT in sectors */
 	__u16	fat_sect;	/* Starting sector of the FAT */
 	__u8	fat_dirty;      /* Set if fatbuf has been modified */
+	__u16	dirty_first;	/* First modified sector in fatbuf */
+	__u16	dirty_last;	/* Last modified sector in fatbuf */
 	__u32	rootdir_sect;	/* Start sector of root directory */
 	__u16	sect_size;	/* Size of sectors in bytes */
 	__u16	clust_size;	/* Size of clusters in sectors */
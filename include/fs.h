@@ -87,9 +87,27 @@ int fs_set_blk_dev_with_part(struct blk_desc *desc, int part);
  * Many file functions implicitly call fs_close(), e.g. fs_closedir(),
  * fs_exist(), fs_ln(), fs_ls(), fs_mkdir(), fs_read(), fs_size(), fs_write(),
  * fs_unlink().
+ *
+ * With CONFIG_FS_MOUNT_CACHE the filesystem is left mounted, so that the
+ * next operation on the same partition can use it without probing again.
  */
 void fs_close(void);
 
+/**
+ * fs_invalidate() - Unmount a filesystem kept mounted on a device
+ *
+ * This must be called when a block device is written or its media may have
+ * changed behind the filesystem drivers' back. If an operation is using the
+ * filesystem, it is unmounted when that operation ends.
+ *
+ * @desc: block device which changed, or NULL for any device
+ */
+#if CONFIG_IS_ENABLED(FS_MOUNT_CACHE)
+void fs_invalidate(struct blk_desc *desc);
+#else
+static inline void fs_invalidate(struct blk_desc *desc) {}
+#endif
+
 /**
  * fs_get_type() - Get type of current filesystem
  *
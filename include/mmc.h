@@ -74,6 +74,7 @@ struct bd_info;
 #define MMC_CAP_NONREMOVABLE	BIT(14)
 #define MMC_CAP_NEEDS_POLL	BIT(15)
 #define MMC_CAP_CD_ACTIVE_HIGH  BIT(16)
+#define MMC_CAP_CMD23		BIT(17)	/* host can bound transfers with CMD23 */
 
 #define MMC_MODE_8BIT		BIT(30)
 #define MMC_MODE_4BIT		BIT(29)
@@ -82,6 +83,7 @@ struct bd_info;
 
 
 #define SD_DATA_4BIT	0x00040000
+#define SD_CMD23_SUPPORT	0x00000002
 
 #define IS_SD(x)	((x)->version & SD_VERSION_SD)
 #define IS_MMC(x)	((x)->version & MMC_VERSION_MMC)
@@ -461,6 +463,35 @@ struct dm_mmc_ops {
 	int (*send_cmd)(struct udevice *dev, struct mmc_cmd *cmd,
 			struct mmc_data *data);
 
+#if CONFIG_IS_ENABLED(BLK_ASYNC)
+	/**
+	 * send_cmd_async() - Send a command and start its data transfer
+	 *
+	 * This is optional. It is used for block reads, so that the CPU can
+	 * get on with something else while the data is transferred. It
+	 * returns once the command has been sent, without waiting for the
+	 * data, which is then checked with poll_data().
+	 *
+	 * @dev:	Device to receive the command
+	 * @cmd:	Command to send
+	 * @data:	Data to receive
+	 * @return 0 if OK, -ENOSYS if the transfer cannot be done this way,
+	 * other -ve on error
+	 */
+	int (*send_cmd_async)(struct udevice *dev, struct mmc_cmd *cmd,
+			      struct mmc_data *data);
+
+	/**
+	 * poll_data() - Check the data transfer started by send_cmd_async()
+	 *
+	 * @dev:	Device which is transferring
+	 * @data:	Data passed to send_cmd_async()
+	 * @return 0 if the transfer is complete, -EAGAIN if it is still in
+	 * progress, other -ve on error
+	 */
+	int (*poll_data)(struct udevice *dev, struct mmc_data *data);
+#endif
+
 	/**
 	 * set_ios() - Set the I/O speed/width for an MMC device
 	 *
@@ -739,6 +770,10 @@ struct mmc {
 	u8 hs400_tuning;
 
 	enum bus_mode user_speed_mode; /* input speed mode from user */
+#if CONFIG_IS_ENABLED(BLK_ASYNC)
+	struct blk_req *req;	/* asynchronous block request in progress */
+	struct mmc_data req_data; /* its data transfer in progress */
+#endif
 };
 
 #if CONFIG_IS_ENABLED(DM_MMC)
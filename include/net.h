@@ -107,6 +107,19 @@ typedef void rxhand_f(uchar *pkt, unsigned dport,
 typedef void rxhand_icmp_f(unsigned type, unsigned code, unsigned dport,
 		struct in_addr sip, unsigned sport, uchar *pkt, unsigned len);
 
+/**
+ * typedef rxsplit_f - Handle a frame received with header split
+ *
+ * @hdr: Start of the frame, up to the header length passed to
+ *	 eth_rx_split_start()
+ * @data: Rest of the frame, in a buffer given to eth_rx_split_post() or in
+ *	  one of the driver's own buffers
+ * @len: Length of the whole frame
+ * Return: true if the frame was dealt with, false to pass it on to
+ *	   net_process_received_packet() in one piece
+ */
+typedef bool rxsplit_f(uchar *hdr, uchar *data, int len);
+
 /*
  *	A timeout handler.  Called after time interval has expired.
  */
@@ -156,6 +169,25 @@ enum eth_recv_flags {
  * free_pkt: Give the driver an opportunity to manage its packet buffer memory
  *	     when the network stack is finished processing it. This will only be
  *	     called when no error was returned from recv - optional
+ * rx_split: Start receiving with header split when hdr_len is not 0: the
+ *	     first hdr_len bytes of each frame go into a buffer owned by the
+ *	     driver and the rest into a data buffer. The buffers the hardware
+ *	     has already are kept, as if given to rx_post() with a NULL buf,
+ *	     and each one used is replaced by the next buffer given to
+ *	     rx_post(). The hardware may write to that at any time until
+ *	     header split is stopped again with a hdr_len of 0, which must
+ *	     take back every buffer given to rx_post() and not used yet.
+ *	     Return the number of buffers the hardware is to be kept supplied
+ *	     with, or an error - optional
+ * rx_post: Queue a buffer of len bytes for the data part of a frame, or one
+ *	    of the driver's own buffers if buf is NULL. Buffers are filled in
+ *	    the order they were posted - optional, needed by rx_split
+ * recv_split: Used instead of recv while header split is on, setting hdrp to
+ *	       the header buffer and datap to the posted buffer that was used
+ *	       with it, even if the frame did not reach it. Return the length
+ *	       of the whole frame. free_pkt() is called with the header buffer,
+ *	       even if header split was stopped meanwhile - optional, needed
+ *	       by rx_split
  * stop: Stop the hardware from looking for packets - may be called even if
  *	 state == PASSIVE
  * mcast: Join or leave a multicast group (for TFTP) - optional
@@ -178,6 +210,10 @@ struct eth_ops {
 	int (*send)(struct udevice *dev, void *packet, int length);
 	int (*recv)(struct udevice *dev, int flags, uchar **packetp);
 	int (*free_pkt)(struct udevice *dev, uchar *packet, int length);
+	int (*rx_split)(struct udevice *dev, int hdr_len);
+	int (*rx_post)(struct udevice *dev, void *buf, int len);
+	int (*recv_split)(struct udevice *dev, int flags, uchar **hdrp,
+			  uchar **datap);
 	void (*stop)(struct udevice *dev);
 	int (*mcast)(struct udevice *dev, const u8 *enetaddr, int join);
 	int (*write_hwaddr)(struct udevice *dev);
@@ -254,6 +290,49 @@ extern void (*push_packet)(void *packet, int length);
 #endif
 int eth_rx(void);			/* Check for received packets */
 void eth_halt(void);			/* stop SCC */
+
+/**
+ * eth_rx_split_start() - Receive frames with header split
+ *
+ * From now on, the first @hdr_len bytes of each frame received by the
+ * current device are kept apart from the rest, which goes into buffers
+ * given with eth_rx_split_post(). @handler is called for every frame
+ * received this way. Header split stays on until eth_rx_split_stop() or
+ * eth_halt() is called.
+ *
+ * The device starts out with its own buffers, and uses each buffer posted
+ * after the ones it has. Posting one buffer for every frame received keeps
+ * it supplied, with the buffer posted for a frame used the number of
+ * frames returned here later.
+ *
+ * @hdr_len: Length of the frame headers
+ * @handler: Function to handle frames received with header split
+ * Return: number of buffers the device holds, -ENOSYS if the device does
+ *	   not support header split, or other -ve on error
+ */
+int eth_rx_split_start(int hdr_len, rxsplit_f *handler);
+
+/**
+ * eth_rx_split_post() - Give the device a buffer for received data
+ *
+ * The buffer must not be touched until it comes back through the handler
+ * given to eth_rx_split_start(), or until header split is stopped.
+ *
+ * @buf: Buffer to post, or NULL to post one of the driver's own buffers
+ * @len: Length of @buf, ignored if @buf is NULL. The headers and the
+ *	 buffer together may not be larger than PKTSIZE.
+ * Return: 0 if OK, -ENOSPC if the device holds all the buffers it can,
+ *	   other -ve on error
+ */
+int eth_rx_split_post(void *buf, int len);
+
+/**
+ * eth_rx_split_stop() - Stop receiving frames with header split
+ *
+ * This takes back every buffer posted with eth_rx_split_post() which was
+ * not used yet.
+ */
+void eth_rx_split_stop(void);
 const char *eth_get_name(void);		/* get name of current device */
 int eth_mcast_join(struct in_addr mcast_addr, int join);
 
@@ -5,6 +5,8 @@
  * Copyright 2017 Duncan Hare, All rights reserved.
  */
 
+#include <linux/log2.h>
+
 #define TCP_ACTIVITY 127		/* Number of packets received   */
 					/* before console progress mark */
 /**
@@ -68,9 +70,6 @@ struct ip_tcp_hdr {
  * TCP header options, Seq, MSS, and SACK
  */
 
-#define TCP_SACK 32			/* Number of packets analyzed   */
-					/* on leading edge of stream    */
-
 #define TCP_O_END	0x00		/* End of option list		*/
 #define TCP_1_NOP	0x01		/* Single padding NOP		*/
 #define TCP_O_NOP	0x01010101	/* NOPs pad to 32 bit boundary	*/
@@ -86,7 +85,11 @@ struct ip_tcp_hdr {
 #define TCP_OPT_LEN_8	0x08
 #define TCP_OPT_LEN_A	0x0a		/* Timestamp Length		*/
 #define TCP_MSS		1460		/* Max segment size		*/
-#define TCP_SCALE	0x01		/* Scale			*/
+#define TCP_RCV_WND	(CONFIG_PROT_TCP_RCV_WINDOW * 1024)
+					/* Receive window in bytes	*/
+#define TCP_SCALE	(TCP_RCV_WND > 0xffff ?	\
+			 ilog2(TCP_RCV_WND >> 16) + 1 : 0)
+					/* Scale to fit it in 16 bits	*/
 
 /**
  * struct tcp_mss - TCP option structure for MSS (Max segment size)
@@ -143,6 +146,7 @@ struct sack_edges {
  */
 
 #define TCP_SACK_HILLS	4
+#define TCP_SACK_BLOCKS	(TCP_SACK_HILLS - 1)	/* room left by timestamps */
 
 /**
  * struct tcp_sack_v - TCP option structure for SACK
@@ -13,9 +13,11 @@ enum wget_state {
 	WGET_CONNECTING,
 	WGET_CONNECTED,
 	WGET_TRANSFERRING,
-	WGET_TRANSFERRED
+	WGET_TRANSFERRED,
+	WGET_IDLE,		/* transfer done, connection kept open */
 };
 
 #define DEBUG_WGET		0	/* Set to 1 for debug messages */
 #define WGET_RETRY_COUNT	30
+#define WGET_RESUME_COUNT	5	/* Range requests after stalls */
 #define WGET_TIMEOUT		2000UL
@@ -288,6 +288,21 @@ struct scsi_ops {
 	 */
 	int (*exec)(struct udevice *dev, struct scsi_cmd *cmd);
 
+	/**
+	 * exec_queue() - execute several read/write commands together
+	 *
+	 * The controller may keep all the commands outstanding at once and
+	 * complete them in any order. If any command fails, the others may
+	 * or may not have completed.
+	 *
+	 * @dev:	SCSI bus
+	 * @cmds:	Commands to execute
+	 * @count:	Number of commands in @cmds
+	 * @return 0 if OK, -ve on error
+	 */
+	int (*exec_queue)(struct udevice *dev, struct scsi_cmd *cmds,
+			  int count);
+
 	/**
 	 * bus_reset() - reset the bus
 	 *
@@ -328,6 +343,17 @@ extern struct scsi_ops scsi_ops;
  */
 int scsi_exec(struct udevice *dev, struct scsi_cmd *cmd);
 
+/**
+ * scsi_exec_queue() - execute several read/write commands together
+ *
+ * @dev:	SCSI bus
+ * @cmds:	Commands to execute
+ * @count:	Number of commands in @cmds
+ * Return: 0 if OK, -ENOSYS if the controller cannot queue commands (use
+ * scsi_exec() for each), other -ve on error
+ */
+int scsi_exec_queue(struct udevice *dev, struct scsi_cmd *cmds, int count);
+
 /**
  * scsi_bus_reset() - reset the bus
  *
@@ -252,6 +252,8 @@
 #define SDHCI_QUIRK_SUPPORT_SINGLE	(1 << 10)
 /* Capability register bit-63 indicates HS400 support */
 #define SDHCI_QUIRK_CAPS_BIT63_FOR_HS400	BIT(11)
+/* Multi-block transfers must not be bounded with CMD23 */
+#define SDHCI_QUIRK_NO_CMD23		BIT(12)
 
 /* to make gcc happy */
 struct sdhci_host;
@@ -299,8 +301,9 @@ struct sdhci_ops {
 #else
 #define ADMA_DESC_LEN	8
 #endif
-#define ADMA_TABLE_NO_ENTRIES (CONFIG_SYS_MMC_MAX_BLK_COUNT * \
-			       MMC_MAX_BLOCK_LEN) / ADMA_MAX_LEN
+/* Enough for the largest transfer, plus an unaligned head and tail */
+#define ADMA_TABLE_NO_ENTRIES (DIV_ROUND_UP(CONFIG_SYS_MMC_MAX_BLK_COUNT * \
+					    MMC_MAX_BLOCK_LEN, ADMA_MAX_LEN) + 2)
 
 #define ADMA_TABLE_SZ (ADMA_TABLE_NO_ENTRIES * ADMA_DESC_LEN)
 
@@ -347,6 +350,7 @@ struct sdhci_host {
 	void *align_buffer;
 	bool force_align_buffer;
 	dma_addr_t start_addr;
+	ulong data_start;	/* time an asynchronous transfer started */
 	int flags;
 #define USE_SDMA	(0x1 << 0)
 #define USE_ADMA	(0x1 << 1)
@@ -355,6 +359,10 @@ struct sdhci_host {
 	dma_addr_t adma_addr;
 #if CONFIG_IS_ENABLED(MMC_SDHCI_ADMA)
 	struct sdhci_adma_desc *adma_desc_table;
+	/* Two cache lines for the unaligned head and tail of a transfer */
+	void *adma_bounce;
+	uint adma_head;		/* bytes of the transfer in the first line */
+	uint adma_tail;		/* bytes of the transfer in the second line */
 #endif
 };
 
@@ -529,5 +537,9 @@ extern const struct dm_mmc_ops sdhci_ops;
 struct sdhci_adma_desc *sdhci_adma_init(void);
 void sdhci_prepare_adma_table(struct sdhci_adma_desc *table,
 			      struct mmc_data *data, dma_addr_t addr);
+struct sdhci_adma_desc *sdhci_adma_add_segment(struct sdhci_adma_desc *desc,
+					       dma_addr_t addr, uint len);
+void sdhci_adma_finish_table(struct sdhci_adma_desc *table,
+			     struct sdhci_adma_desc *end);
 
 #endif /* __SDHCI_HW_H */
@@ -183,6 +183,30 @@ int usb_reset_root_port(struct usb_device *dev);
 #define usb_reset_root_port(dev)
 #endif
 
+/**
+ * struct usb_bulk_req - A bulk transfer queued together with others
+ *
+ * @pipe:	Pipe to use, as for submit_bulk_msg()
+ * @buffer:	Buffer to send or receive. This should be DMA-aligned
+ * @length:	Number of bytes to send or receive
+ * @act_len:	Number of bytes actually transferred, set on completion
+ * @status:	USB_ST_... status, 0 once the transfer has completed without
+ *		error, or USB_ST_NOT_PROC if it was not carried out
+ * @stream:	Stream ID to use, from usb_alloc_streams(), or 0 if the
+ *		endpoint has no streams
+ */
+struct usb_bulk_req {
+	unsigned long pipe;
+	void *buffer;
+	int length;
+	int act_len;
+	unsigned long status;
+	unsigned int stream;
+};
+
+/* Largest number of transfers which can be queued together */
+#define USB_MAX_BULK_REQS	12
+
 int submit_bulk_msg(struct usb_device *dev, unsigned long pipe,
 			void *buffer, int transfer_len);
 int submit_control_msg(struct usb_device *dev, unsigned long pipe, void *buffer,
@@ -278,6 +302,8 @@ int usb_control_msg(struct usb_device *dev, unsigned int pipe,
 			void *data, unsigned short size, int timeout);
 int usb_bulk_msg(struct usb_device *dev, unsigned int pipe,
 			void *data, int len, int *actual_length, int timeout);
+int usb_bulk_msgs(struct usb_device *dev, struct usb_bulk_req *reqs,
+		  int count, int timeout);
 int usb_int_msg(struct usb_device *dev, unsigned long pipe,
 		void *buffer, int transfer_len, int interval, bool nonblock);
 int usb_lock_async(struct usb_device *dev, int lock);
@@ -717,6 +743,40 @@ struct dm_usb_ops {
 	 */
 	int (*bulk)(struct udevice *bus, struct usb_device *udev,
 		    unsigned long pipe, void *buffer, int length);
+	/**
+	 * bulk_queue() - Send several bulk messages at once
+	 *
+	 * Queue all of @reqs with the controller before waiting for any of
+	 * them, so that the device can go from one transfer to the next
+	 * without waiting for U-Boot. Transfers on the same endpoint are
+	 * carried out in order. Processing stops at the first transfer which
+	 * fails: the ones still queued are cancelled and keep a status of
+	 * USB_ST_NOT_PROC. @udev's status and act_len are set as for the last
+	 * transfer processed.
+	 *
+	 * @reqs: Transfers to carry out
+	 * @count: Number of transfers, at most USB_MAX_BULK_REQS
+	 * @return 0 if OK, -ve on error
+	 */
+	int (*bulk_queue)(struct udevice *bus, struct usb_device *udev,
+			  struct usb_bulk_req *reqs, int count);
+	/**
+	 * alloc_streams() - Set up bulk endpoints to use streams
+	 *
+	 * Each endpoint gets the same number of streams, with IDs starting
+	 * at 1. Transfers on them are then sent with bulk_queue(), giving
+	 * the stream ID of each. The device may serve the streams of an
+	 * endpoint in any order.
+	 *
+	 * @pipes: Bulk pipes of the endpoints
+	 * @num_pipes: Number of pipes
+	 * @num_streams: Number of streams wanted on each endpoint
+	 * @return number of streams allocated, which may be fewer than
+	 *	wanted, or -ve on error
+	 */
+	int (*alloc_streams)(struct udevice *bus, struct usb_device *udev,
+			     unsigned long *pipes, int num_pipes,
+			     int num_streams);
 	/**
 	 * interrupt() - Send an interrupt message
 	 *
@@ -1002,6 +1062,37 @@ int usb_update_hub_device(struct usb_device *dev);
  */
 int usb_get_max_xfer_size(struct usb_device *dev, size_t *size);
 
+/**
+ * submit_bulk_queue() - Queue several bulk transfers with the controller
+ *
+ * See bulk_queue() in struct dm_usb_ops. Use usb_bulk_msgs() instead, which
+ * falls back to one transfer at a time when the controller cannot do this.
+ *
+ * @dev:		USB device
+ * @reqs:		Transfers to carry out
+ * @count:		Number of transfers, at most USB_MAX_BULK_REQS
+ * Return: 0 if OK, -ENOSYS if not supported by the controller, other -ve
+ *	on error
+ */
+int submit_bulk_queue(struct usb_device *dev, struct usb_bulk_req *reqs,
+		      int count);
+
+/**
+ * usb_alloc_streams() - Set up bulk endpoints to use streams
+ *
+ * See alloc_streams() in struct dm_usb_ops. This is only possible with
+ * SuperSpeed devices.
+ *
+ * @dev:		USB device
+ * @pipes:		Bulk pipes of the endpoints
+ * @num_pipes:		Number of pipes
+ * @num_streams:	Number of streams wanted on each endpoint
+ * Return: number of streams allocated, -ENOSYS if not supported by the
+ *	controller, other -ve on error
+ */
+int usb_alloc_streams(struct usb_device *dev, unsigned long *pipes,
+		      int num_pipes, int num_streams);
+
 /**
  * usb_emul_setup_device() - Set up a new USB device emulation
  *
@@ -1042,6 +1133,37 @@ int usb_emul_control(struct udevice *emul, struct usb_device *udev,
 int usb_emul_bulk(struct udevice *emul, struct usb_device *udev,
 		  unsigned long pipe, void *buffer, int length);
 
+/**
+ * usb_emul_bulk_queue() - Send several bulk packets to an emulator at once
+ *
+ * See bulk_queue() in struct dm_usb_ops
+ *
+ * @emul:	Emulator device
+ * @udev:	USB device (which the emulator is causing to appear)
+ * @reqs:	Transfers to carry out
+ * @count:	Number of transfers
+ * Return: 0 if OK, -ENOSYS if the emulator cannot queue transfers, other
+ *	-ve on error
+ */
+int usb_emul_bulk_queue(struct udevice *emul, struct usb_device *udev,
+			struct usb_bulk_req *reqs, int count);
+
+/**
+ * usb_emul_alloc_streams() - Set up streams on an emulator's bulk endpoints
+ *
+ * See alloc_streams() in struct dm_usb_ops
+ *
+ * @emul:	Emulator device
+ * @udev:	USB device (which the emulator is causing to appear)
+ * @pipes:	Bulk pipes of the endpoints
+ * @num_pipes:	Number of pipes
+ * @num_streams: Number of streams wanted on each endpoint
+ * Return: number of streams allocated, -ENOSYS if the emulator has none,
+ *	other -ve on error
+ */
+int usb_emul_alloc_streams(struct udevice *emul, struct usb_device *udev,
+			   unsigned long *pipes, int num_pipes, int num_streams);
+
 /**
  * usb_emul_int() - Send an interrupt packet to an emulator
  *
@@ -669,6 +669,27 @@ struct xhci_ep_ctx {
 #define EP_BPKTS(p)	(((p) & 0x7f) << 0)
 #define EP_BBM(p)	(((p) & 0x1) << 11)
 
+/**
+ * struct xhci_stream_ctx
+ * @stream_ring:	64-bit stream ring address, cycle state, and stream
+ *			type
+ *
+ * Stream Context - section 6.2.4. An endpoint with streams has an array of
+ * these in place of its transfer ring, one for each stream ID.
+ */
+struct xhci_stream_ctx {
+	__le64	stream_ring;
+	/* offset 0x08 - 0x0f reserved for HC internal use */
+	__le32	reserved[2];
+};
+
+/* Stream Context Types (section 6.4.1) - bits 3:1 of stream ctx deq ptr */
+#define SCT_FOR_CTX(p)		(((p) & 0x7) << 1)
+/* Secondary stream array type, dequeue pointer is to a transfer ring */
+#define SCT_SEC_TR		0
+/* Primary stream array type, dequeue pointer is to a transfer ring */
+#define SCT_PRI_TR		1
+
 /**
  * struct xhci_input_control_context
  * Input control context; see section 6.2.5.
@@ -995,6 +1016,11 @@ typedef enum {
  * Change this if you change TRBS_PER_SEGMENT!
  */
 #define SEGMENT_SHIFT		10
+/*
+ * Bulk endpoint rings get several segments, so that more than one maximum
+ * size TD can be queued on them at once
+ */
+#define XHCI_BULK_RING_SEGS	5
 /* TRB buffer pointers can't cross 64KB boundaries */
 #define TRB_MAX_BUFF_SHIFT	16
 #define TRB_MAX_BUFF_SIZE	(1 << TRB_MAX_BUFF_SHIFT)
@@ -1070,6 +1096,12 @@ struct xhci_virt_ep {
 #define EP_HAS_STREAMS		(1 << 4)
 /* Transitioning the endpoint to not using streams, don't enqueue URBs */
 #define EP_GETTING_NO_STREAMS	(1 << 5)
+	/* Stream context array and a ring for each stream, if any */
+	struct xhci_stream_ctx		*stream_ctx;
+	dma_addr_t			stream_ctx_dma;
+	struct xhci_ring		**stream_rings;
+	unsigned int			num_stream_ctxs;
+	unsigned int			num_streams;
 };
 
 #define CTX_SIZE(_hcc) (HCC_64BYTE_CONTEXT(_hcc) ? 64 : 32)
@@ -1261,6 +1293,8 @@ void xhci_acknowledge_event(struct xhci_ctrl *ctrl);
 union xhci_trb *xhci_wait_for_event(struct xhci_ctrl *ctrl, trb_type expected);
 int xhci_bulk_tx(struct usb_device *udev, unsigned long pipe,
 		 int length, void *buffer);
+int xhci_bulk_tx_queue(struct usb_device *udev, struct usb_bulk_req *reqs,
+		       int count);
 int xhci_ctrl_tx(struct usb_device *udev, unsigned long pipe,
 		 struct devrequest *req, int length, void *buffer);
 int xhci_check_maxpacket(struct usb_device *udev);
@@ -1270,6 +1304,10 @@ void xhci_cleanup(struct xhci_ctrl *ctrl);
 struct xhci_ring *xhci_ring_alloc(struct xhci_ctrl *ctrl, unsigned int num_segs,
 				  bool link_trbs);
 int xhci_alloc_virt_device(struct xhci_ctrl *ctrl, unsigned int slot_id);
+void xhci_alloc_stream_info(struct xhci_ctrl *ctrl, struct xhci_virt_ep *ep,
+			    unsigned int num_stream_ctxs,
+			    unsigned int num_streams);
+void xhci_free_stream_info(struct xhci_ctrl *ctrl, struct xhci_virt_ep *ep);
 int xhci_mem_init(struct xhci_ctrl *ctrl, struct xhci_hccr *hccr,
 		  struct xhci_hcor *hcor);
 
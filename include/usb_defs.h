@@ -45,6 +45,7 @@
 #define US_PR_CB               1		/* Control/Bulk w/o interrupt */
 #define US_PR_CBI              0		/* Control/Bulk/Interrupt */
 #define US_PR_BULK             0x50		/* bulk only */
+#define US_PR_UAS              0x62		/* USB Attached SCSI */
 
 /* USB types */
 #define USB_TYPE_STANDARD   (0x00 << 5)
@@ -394,4 +395,50 @@ struct umass_bbb_csw {
 #define US_BBB_RESET		0xff
 #define US_BBB_GET_MAX_LUN	0xfe
 
+/*
+ * USB Attached SCSI
+ */
+
+/* bPipeID of the pipe usage descriptor which follows each endpoint */
+#define UAS_CMD_PIPE_ID		1
+#define UAS_STATUS_PIPE_ID	2
+#define UAS_DATA_IN_PIPE_ID	3
+#define UAS_DATA_OUT_PIPE_ID	4
+
+/* Information Unit IDs */
+#define UAS_IU_ID_COMMAND	0x01
+#define UAS_IU_ID_SENSE		0x03
+#define UAS_IU_ID_RESPONSE	0x04
+#define UAS_IU_ID_TASK_MGMT	0x05
+#define UAS_IU_ID_READ_READY	0x06
+#define UAS_IU_ID_WRITE_READY	0x07
+
+/* Command IU, sent on the command pipe */
+struct uas_command_iu {
+	__u8		bIUID;
+	__u8		bReserved;
+	__be16		wTag;
+	__u8		bPrioAttr;
+	__u8		bReserved2;
+	__u8		bLength;	/* Additional CDB length, in dwords */
+	__u8		bReserved3;
+	__u8		bLUN[8];
+	__u8		CDB[16];
+};
+#define UAS_CMD_IU_SIZE		32
+
+/* Sense IU, received on the status pipe when a command completes */
+struct uas_sense_iu {
+	__u8		bIUID;
+	__u8		bReserved;
+	__be16		wTag;
+	__be16		wStatusQualifier;
+	__u8		bStatus;
+	__u8		bReserved2[7];
+	__be16		wLength;
+#	define UAS_SENSE_LEN	96
+	__u8		SenseData[UAS_SENSE_LEN];
+};
+#define UAS_SENSE_IU_SIZE	(16 + UAS_SENSE_LEN)
+
 #endif /*_USB_DEFS_H_ */
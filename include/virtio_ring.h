@@ -63,6 +63,8 @@ struct vring_desc_shadow {
 	u16 next;
 	/* Metadata about the descriptor. */
 	bool chain_head;
+	/* Indirect table this descriptor points to, if any */
+	struct vring_desc *indir_desc;
 };
 
 struct vring_avail {
@@ -103,6 +105,8 @@ struct vring {
  * @vring: actual memory layout for this queue
  * @vring_desc_shadow: guest-only copy of descriptors
  * @event: host publishes avail event idx
+ * @indirect: chains of buffers are put in an indirect table, so each one
+ *	uses a single descriptor of the ring
  * @free_head: head of free buffer list
  * @num_added: number we've added since last sync
  * @last_used_idx: last used index we've seen
@@ -117,6 +121,7 @@ struct virtqueue {
 	struct vring vring;
 	struct vring_desc_shadow *vring_desc_shadow;
 	bool event;
+	bool indirect;
 	unsigned int free_head;
 	unsigned int num_added;
 	u16 last_used_idx;
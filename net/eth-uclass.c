@@ -28,10 +28,17 @@ DECLARE_GLOBAL_DATA_PTR;
  * struct eth_device_priv - private structure for each Ethernet device
  *
  * @state: The state of the Ethernet MAC driver (defined by enum eth_state_t)
+ * @running: true if the driver has been started and not stopped since
+ * @split_handler: handler for frames received with header split, or NULL if
+ *	header split is off
+ * @split_hdr_len: number of bytes at the start of each frame which are kept
+ *	apart from the data when header split is on
  */
 struct eth_device_priv {
 	enum eth_state_t state;
 	bool running;
+	rxsplit_f *split_handler;
+	int split_hdr_len;
 };
 
 /**
@@ -49,6 +56,9 @@ struct eth_uclass_priv {
 /* eth_errno - This stores the most recent failure code from DM functions */
 static int eth_errno;
 
+/* Used to put a frame received with header split back together */
+static uchar eth_rx_split_buf[PKTSIZE_ALIGN];
+
 /* board-specific Ethernet Interface initializations. */
 __weak int board_interface_eth_init(struct udevice *dev,
 				    phy_interface_t interface_type)
@@ -360,6 +370,10 @@ void eth_halt(void)
 	if (!priv || !priv->running)
 		return;
 
+	if (priv->split_handler) {
+		eth_get_ops(current)->rx_split(current, 0);
+		priv->split_handler = NULL;
+	}
 	eth_get_ops(current)->stop(current);
 	priv->state = ETH_STATE_PASSIVE;
 	priv->running = false;
@@ -400,8 +414,127 @@ int eth_send(void *packet, int length)
 	return ret;
 }
 
+/**
+ * eth_rx_split() - receive packets while header split is on
+ *
+ * Each frame goes to the header split handler first. Frames which it does
+ * not deal with are copied into one piece and processed as usual.
+ *
+ * @dev: Ethernet device
+ * Return: length of the last frame received, or -ve on error
+ */
+static int eth_rx_split(struct udevice *dev)
+{
+	struct eth_device_priv *priv = dev_get_uclass_priv(dev);
+	const struct eth_ops *ops = eth_get_ops(dev);
+	int hdr_len = priv->split_hdr_len;
+	int flags = ETH_RECV_CHECK_DEVICE;
+	uchar *hdr, *data;
+	int ret;
+	int i;
+
+	for (i = 0; i < ETH_PACKETS_BATCH_RECV; i++) {
+		ret = ops->recv_split(dev, flags, &hdr, &data);
+		flags = 0;
+		if (ret <= 0)
+			break;
+
+		if (!priv->split_handler(hdr, data, ret)) {
+			/* eth_rx_split_post() keeps frames within PKTSIZE */
+			if (ret > PKTSIZE) {
+				log_warning("%s: %d-byte frame too long, dropped\n",
+					    dev->name, ret);
+			} else {
+				memcpy(eth_rx_split_buf, hdr, min(ret, hdr_len));
+				if (ret > hdr_len)
+					memcpy(eth_rx_split_buf + hdr_len, data,
+					       ret - hdr_len);
+				net_process_received_packet(eth_rx_split_buf,
+							    ret);
+			}
+		}
+
+		/* The frame is given back even if header split was stopped */
+		if (ops->free_pkt)
+			ops->free_pkt(dev, hdr, ret);
+		if (!priv->running || !priv->split_handler)
+			break;
+	}
+
+	return ret;
+}
+
+int eth_rx_split_start(int hdr_len, rxsplit_f *handler)
+{
+	struct udevice *current;
+	struct eth_device_priv *priv;
+	const struct eth_ops *ops;
+	int ret;
+
+	current = eth_get_dev();
+	if (!current)
+		return -ENODEV;
+
+	if (!eth_is_active(current))
+		return -EINVAL;
+
+	ops = eth_get_ops(current);
+	if (!ops->rx_split || !ops->rx_post || !ops->recv_split)
+		return -ENOSYS;
+
+	priv = dev_get_uclass_priv(current);
+	if (priv->split_handler)
+		return -EBUSY;
+
+	ret = ops->rx_split(current, hdr_len);
+	if (ret < 0)
+		return ret;
+	priv->split_handler = handler;
+	priv->split_hdr_len = hdr_len;
+
+	return ret;
+}
+
+int eth_rx_split_post(void *buf, int len)
+{
+	struct udevice *current;
+	struct eth_device_priv *priv;
+
+	current = eth_get_dev();
+	if (!current)
+		return -ENODEV;
+
+	priv = dev_get_uclass_priv(current);
+	if (!priv->split_handler)
+		return -EINVAL;
+
+	/* The whole frame must fit in one packet buffer if it is not handled */
+	if (buf && len > PKTSIZE - priv->split_hdr_len)
+		return -EINVAL;
+
+	return eth_get_ops(current)->rx_post(current, buf, len);
+}
+
+void eth_rx_split_stop(void)
+{
+	struct udevice *current;
+	struct eth_device_priv *priv;
+
+	current = eth_get_dev();
+	if (!current)
+		return;
+
+	priv = dev_get_uclass_priv(current);
+	if (!priv->split_handler)
+		return;
+
+	eth_get_ops(current)->rx_split(current, 0);
+	priv->split_handler = NULL;
+}
+
 int eth_rx(void)
 {
+	struct eth_device_priv *priv;
 	struct udevice *current;
 	uchar *packet;
 	int flags;
@@ -415,6 +548,17 @@ int eth_rx(void)
 	if (!eth_is_active(current))
 		return -EINVAL;
 
+	priv = dev_get_uclass_priv(current);
+	if (priv->split_handler) {
+		ret = eth_rx_split(current);
+		if (ret == -EAGAIN)
+			ret = 0;
+		if (ret < 0)
+			debug("%s: recv_split() returned error %d\n", __func__,
+			      ret);
+		return ret;
+	}
+
 	/* Process up to 32 packets at one time */
 	flags = ETH_RECV_CHECK_DEVICE;
 	for (i = 0; i < ETH_PACKETS_BATCH_RECV; i++) {
@@ -424,7 +568,8 @@ int eth_rx(void)
 			net_process_received_packet(packet, ret);
 		if (ret >= 0 && eth_get_ops(current)->free_pkt)
 			eth_get_ops(current)->free_pkt(current, packet, ret);
-		if (ret <= 0)
+		/* A handler may have turned on header split */
+		if (ret <= 0 || priv->split_handler)
 			break;
 	}
 	if (ret == -EAGAIN)
@@ -53,10 +53,29 @@
 
 static int fs_mounted;
 static unsigned long rpc_id;
-static int nfs_offset = -1;
-static int nfs_len;
+static unsigned int nfs_offset;
 static const ulong nfs_timeout = CONFIG_NFS_TIMEOUT;
 
+/*
+ * READ requests in flight. A slot is free when its length is 0. The offset is
+ * where the next request starts, the file size is unknown until the first
+ * reply arrives, and only one request is sent until then.
+ */
+struct nfs_read {
+	unsigned long id;	/* transaction ID of the last request sent */
+	unsigned int offset;	/* file offset of the data requested */
+	unsigned int len;	/* number of bytes requested */
+};
+
+#define NFS_SIZE_UNKNOWN	UINT_MAX
+
+static struct nfs_read nfs_reads[CONFIG_NFS_READ_WINDOW];
+static int nfs_reads_pending;
+static unsigned int nfs_read_size = NFS_READ_SIZE;
+static unsigned int nfs_file_size;
+static unsigned int nfs_received;
+static unsigned int nfs_hashes;
+
 static char dirfh[NFS_FHSIZE];	/* NFSv2 / NFSv3 file handle of directory */
 static char filefh[NFS3_FHSIZE]; /* NFSv2 / NFSv3 file handle */
 static unsigned int filefh3_length;	/* (variable) length of filefh when NFSv3 */
@@ -75,6 +94,7 @@ static int nfs_state;
 #define STATE_LOOKUP_REQ		5
 #define STATE_READ_REQ			6
 #define STATE_READLINK_REQ		7
+#define STATE_FSINFO_REQ		8
 
 static char *nfs_filename;
 static char *nfs_path;
@@ -425,6 +445,110 @@ static void nfs_read_req(int offset, int readlen)
 	rpc_req(PROG_NFS, NFS_READ, data, len);
 }
 
+/* (Re)send a READ request, which gets a new transaction ID */
+static void nfs_read_send(struct nfs_read *rd)
+{
+	nfs_read_req(rd->offset, rd->len);
+	rd->id = rpc_id;
+}
+
+/* Keep as many READ requests in flight as the window allows */
+static void nfs_read_fill(void)
+{
+	struct nfs_read *rd;
+
+	for (rd = nfs_reads; rd < nfs_reads + ARRAY_SIZE(nfs_reads); rd++) {
+		if (rd->len)
+			continue;
+		if (nfs_file_size == NFS_SIZE_UNKNOWN ? nfs_reads_pending :
+		    nfs_offset >= nfs_file_size)
+			break;
+
+		rd->offset = nfs_offset;
+		rd->len = nfs_read_size;
+		if (nfs_file_size != NFS_SIZE_UNKNOWN)
+			rd->len = min(rd->len, nfs_file_size - rd->offset);
+		nfs_offset += rd->len;
+		nfs_reads_pending++;
+		nfs_read_send(rd);
+	}
+}
+
+/* Start reading the file from the beginning */
+static void nfs_read_start(void)
+{
+	memset(nfs_reads, '\0', sizeof(nfs_reads));
+	nfs_reads_pending = 0;
+	nfs_offset = 0;
+	nfs_file_size = NFS_SIZE_UNKNOWN;
+	nfs_received = 0;
+	nfs_hashes = 0;
+	nfs_read_fill();
+}
+
+/*
+ * Account for a READ reply of @rlen bytes. A short read asks for the rest of
+ * the data, an empty one marks the end of the file.
+ */
+static void nfs_read_done(struct nfs_read *rd, int rlen)
+{
+	nfs_received += rlen;
+	while (nfs_hashes * (NFS_READ_SIZE / 2) * 10 < nfs_received) {
+		if (nfs_hashes && !(nfs_hashes % HASHES_PER_LINE))
+			puts("\n\t ");
+		putc('#');
+		nfs_hashes++;
+	}
+
+	if (rlen && rlen < rd->len &&
+	    rd->offset + rlen < nfs_file_size) {
+		rd->offset += rlen;
+		rd->len -= rlen;
+		nfs_read_send(rd);
+		return;
+	}
+
+	if (!rlen)
+		nfs_file_size = min(nfs_file_size, rd->offset);
+	rd->len = 0;
+	nfs_reads_pending--;
+	nfs_read_fill();
+}
+
+/**************************************************************************
+NFS_FSINFO - Ask an NFSv3 server for its preferred transfer sizes
+**************************************************************************/
+static void nfs3_fsinfo_req(void)
+{
+	uint32_t data[1024];
+	uint32_t *p;
+	int len;
+
+	p = &(data[0]);
+	p = rpc_add_credentials(p);
+
+	*p++ = htonl(filefh3_length);
+	memcpy(p, filefh, filefh3_length);
+	p += (filefh3_length / 4);
+
+	len = (uint32_t *)p - (uint32_t *)&(data[0]);
+
+	rpc_req(PROG_NFS, NFS3PROC_FSINFO, data, len);
+}
+
+/* Largest read size whose reply fits into the IP reassembly buffer */
+static unsigned int nfs3_read_size_max(void)
+{
+	unsigned int size = NFS_READ_SIZE;
+
+#ifdef CONFIG_IP_DEFRAG
+	size = NFS3_READ_SIZE;
+	while (size > NFS_READ_SIZE && NFS3_READ_HDR + size > CONFIG_NET_MAXDEFRAG)
+		size /= 2;
+#endif
+	return size;
+}
+
 /**************************************************************************
 RPC request dispatcher
 **************************************************************************/
@@ -454,9 +578,19 @@ static void nfs_send(void)
 	case STATE_LOOKUP_REQ:
 		nfs_lookup_req(nfs_filename);
 		break;
-	case STATE_READ_REQ:
-		nfs_read_req(nfs_offset, nfs_len);
+	case STATE_FSINFO_REQ:
+		nfs3_fsinfo_req();
+		break;
+	case STATE_READ_REQ: {
+		struct nfs_read *rd;
+
+		for (rd = nfs_reads; rd < nfs_reads + ARRAY_SIZE(nfs_reads);
+		     rd++) {
+			if (rd->len)
+				nfs_read_send(rd);
+		}
 		break;
+	}
 	case STATE_READLINK_REQ:
 		nfs_readlink_req();
 		break;
@@ -704,21 +838,70 @@ static int nfs_readlink_reply(uchar *pkt, unsigned len)
 	return 0;
 }
 
-static int nfs_read_reply(uchar *pkt, unsigned len)
+static int nfs3_fsinfo_reply(uchar *pkt, unsigned len)
 {
 	struct rpc_t rpc_pkt;
-	int rlen;
-	uchar *data_ptr;
+	unsigned int rtmax;
+	int nfsv3_data_offset;
 
 	debug("%s\n", __func__);
 
-	memcpy(&rpc_pkt.u.data[0], pkt, sizeof(rpc_pkt.u.reply));
+	memcpy(&rpc_pkt.u.data[0], pkt, len);
 
 	if (ntohl(rpc_pkt.u.reply.id) > rpc_id)
 		return -NFS_RPC_ERR;
 	else if (ntohl(rpc_pkt.u.reply.id) < rpc_id)
 		return -NFS_RPC_DROP;
 
+	if (rpc_pkt.u.reply.rstatus  ||
+	    rpc_pkt.u.reply.verifier ||
+	    rpc_pkt.u.reply.astatus  ||
+	    rpc_pkt.u.reply.data[0])
+		return -1;
+
+	nfsv3_data_offset = nfs3_get_attributes_offset(rpc_pkt.u.reply.data);
+	if (((uchar *)&(rpc_pkt.u.reply.data[2 + nfsv3_data_offset]) -
+	     (uchar *)(&rpc_pkt)) > len)
+		return -1;
+
+	/* rtmax, followed by rtpref and rtmult */
+	rtmax = ntohl(rpc_pkt.u.reply.data[1 + nfsv3_data_offset]);
+	nfs_read_size = nfs3_read_size_max();
+	while (nfs_read_size > NFS_READ_SIZE && nfs_read_size > rtmax)
+		nfs_read_size /= 2;
+	debug("NFSv3 rtmax %u, reading %u bytes at a time\n", rtmax,
+	      nfs_read_size);
+
+	return 0;
+}
+
+static int nfs_read_reply(uchar *pkt, unsigned len, struct nfs_read **rdp)
+{
+	struct rpc_t rpc_pkt;
+	struct nfs_read *rd;
+	unsigned int size = NFS_SIZE_UNKNOWN;
+	unsigned long id;
+	int rlen;
+	uchar *data_ptr;
+
+	debug("%s\n", __func__);
+
+	/* Only the headers are copied, the data is stored from the packet */
+	memcpy(&rpc_pkt.u.data[0], pkt,
+	       min_t(unsigned int, len, sizeof(rpc_pkt.u.reply)));
+
+	id = ntohl(rpc_pkt.u.reply.id);
+	if (id > rpc_id)
+		return -NFS_RPC_ERR;
+	for (rd = nfs_reads; rd < nfs_reads + ARRAY_SIZE(nfs_reads); rd++) {
+		if (rd->len && rd->id == id)
+			break;
+	}
+	/* A reply to a request which was sent again, or already answered */
+	if (rd == nfs_reads + ARRAY_SIZE(nfs_reads))
+		return -NFS_RPC_DROP;
+	*rdp = rd;
+
 	if (rpc_pkt.u.reply.rstatus  ||
 	    rpc_pkt.u.reply.verifier ||
 	    rpc_pkt.u.reply.astatus  ||
@@ -730,19 +913,17 @@ static int nfs_read_reply(uchar *pkt, unsigned len)
 		return -ntohl(rpc_pkt.u.reply.data[0]);
 	}
 
-	if ((nfs_offset != 0) && !((nfs_offset) %
-			(NFS_READ_SIZE / 2 * 10 * HASHES_PER_LINE)))
-		puts("\n\t ");
-	if (!(nfs_offset % ((NFS_READ_SIZE / 2) * 10)))
-		putc('#');
-
 	if (choosen_nfs_version != NFS_V3) {
+		size = ntohl(rpc_pkt.u.reply.data[6]);
 		rlen = ntohl(rpc_pkt.u.reply.data[18]);
 		data_ptr = (uchar *)&(rpc_pkt.u.reply.data[19]);
 	} else {  /* NFS_V3 */
 		int nfsv3_data_offset =
 			nfs3_get_attributes_offset(rpc_pkt.u.reply.data);
 
+		/* size is 64 bits, after type, mode, nlink, uid and gid */
+		if (rpc_pkt.u.reply.data[1] && !rpc_pkt.u.reply.data[7])
+			size = ntohl(rpc_pkt.u.reply.data[8]);
 		/* count value */
 		rlen = ntohl(rpc_pkt.u.reply.data[1 + nfsv3_data_offset]);
 		/* Skip unused values :
@@ -753,11 +934,16 @@ static int nfs_read_reply(uchar *pkt, unsigned len)
 			&(rpc_pkt.u.reply.data[4 + nfsv3_data_offset]);
 	}
 
-	if (((uchar *)&(rpc_pkt.u.reply.data[0]) - (uchar *)(&rpc_pkt) + rlen) > len)
-			return -9999;
+	if (rlen < 0 || rlen > rd->len ||
+	    (data_ptr - (uchar *)(&rpc_pkt) + rlen) > len)
+		return -9999;
 
-	if (store_block(data_ptr, nfs_offset, rlen))
-			return -9999;
+	if (store_block(pkt + (data_ptr - (uchar *)&rpc_pkt), rd->offset, rlen))
+		return -9999;
+
+	/* Now that the size is known, more requests can be sent at once */
+	if (nfs_file_size == NFS_SIZE_UNKNOWN && size != NFS_SIZE_UNKNOWN)
+		nfs_file_size = size;
 
 	return rlen;
 }
@@ -782,12 +968,14 @@ static void nfs_timeout_handler(void)
 static void nfs_handler(uchar *pkt, unsigned dest, struct in_addr sip,
 			unsigned src, unsigned len)
 {
+	struct nfs_read *rd;
 	int rlen;
 	int reply;
 
 	debug("%s\n", __func__);
 
-	if (len > sizeof(struct rpc_t))
+	/* Read replies may be larger, the data is not copied to a struct rpc_t */
+	if (len > sizeof(struct rpc_t) && nfs_state != STATE_READ_REQ)
 		return;
 
 	if (dest != nfs_our_port)
@@ -856,14 +1044,28 @@ static void nfs_handler(uchar *pkt, unsigned dest, struct in_addr sip,
 			/* And retry with another supported version */
 			nfs_state = STATE_PRCLOOKUP_PROG_MOUNT_REQ;
 			nfs_send();
+		} else if (choosen_nfs_version == NFS_V3 &&
+			   nfs3_read_size_max() > NFS_READ_SIZE) {
+			nfs_state = STATE_FSINFO_REQ;
+			nfs_send();
 		} else {
 			nfs_state = STATE_READ_REQ;
-			nfs_offset = 0;
-			nfs_len = NFS_READ_SIZE;
-			nfs_send();
+			nfs_read_size = NFS_READ_SIZE;
+			nfs_read_start();
 		}
 		break;
 
+	case STATE_FSINFO_REQ:
+		reply = nfs3_fsinfo_reply(pkt, len);
+		if (reply == -NFS_RPC_DROP)
+			break;
+		/* Stay with the safe size if the server does not tell */
+		if (reply)
+			nfs_read_size = NFS_READ_SIZE;
+		nfs_state = STATE_READ_REQ;
+		nfs_read_start();
+		break;
+
 	case STATE_READLINK_REQ:
 		reply = nfs_readlink_reply(pkt, len);
 		if (reply == -NFS_RPC_DROP) {
@@ -883,22 +1085,24 @@ static void nfs_handler(uchar *pkt, unsigned dest, struct in_addr sip,
 		break;
 
 	case STATE_READ_REQ:
-		rlen = nfs_read_reply(pkt, len);
+		rlen = nfs_read_reply(pkt, len, &rd);
 		if (rlen == -NFS_RPC_DROP)
 			break;
 		net_set_timeout_handler(nfs_timeout, nfs_timeout_handler);
-		if (rlen > 0) {
-			nfs_offset += rlen;
+		if (rlen >= 0) {
+			nfs_read_done(rd, rlen);
+			/* The file is complete once every request is answered */
+			if (nfs_reads_pending)
+				break;
+			nfs_download_state = NETLOOP_SUCCESS;
+			nfs_state = STATE_UMOUNT_REQ;
 			nfs_send();
 		} else if ((rlen == -NFSERR_ISDIR) || (rlen == -NFSERR_INVAL)) {
 			/* symbolic link */
 			nfs_state = STATE_READLINK_REQ;
 			nfs_send();
 		} else {
-			if (!rlen)
-				nfs_download_state = NETLOOP_SUCCESS;
-			if (rlen < 0)
-				debug("NFS READ error (%d)\n", rlen);
+			debug("NFS READ error (%d)\n", rlen);
 			nfs_state = STATE_UMOUNT_REQ;
 			nfs_send();
 		}
@@ -25,6 +25,7 @@
 #define NFS_READ        6
 
 #define NFS3PROC_LOOKUP 3
+#define NFS3PROC_FSINFO 19
 
 #define NFS_FHSIZE      32
 #define NFS3_FHSIZE     64
@@ -42,6 +43,12 @@
  * case, most NFS servers are optimized for a power of 2.
  */
 #define NFS_READ_SIZE	1024	/* biggest power of two that fits Ether frame */
+/*
+ * NFSv3 allows larger reads when the server agrees.  The reply, including the
+ * RPC header and the file attributes, must fit into the IP reassembly buffer.
+ */
+#define NFS3_READ_SIZE	32768
+#define NFS3_READ_HDR	(IP_UDP_HDR_SIZE + (6 + NFS_MAX_ATTRS) * sizeof(uint32_t))
 #define NFS_MAX_ATTRS	26
 
 /* Values for Accept State flag on RPC answers (See: rfc1831) */
@@ -39,20 +39,32 @@ static u32 tcp_ack_edge;
 
 static int tcp_activity_count;
 
+/* Options the server sent in its SYN */
+static bool tcp_sack_ok;
+static bool tcp_wscale_ok;
+
 /*
- * Search for TCP_SACK and review the comments before the code section
- * TCP_SACK is the number of packets at the front of the stream
+ * Reassembly queue
+ *
+ * Data is stored by the application at its offset in the stream as it
+ * arrives, so only the sequence numbers need to be kept here. tcp_ooo holds
+ * the ranges received beyond the first hole, sorted and not touching each
+ * other. When the hole is filled, tcp_ack_edge moves over them.
  */
+static struct sack_edges tcp_ooo[CONFIG_PROT_TCP_REASM_RANGES];
+static int tcp_ooo_cnt;
+static u32 tcp_ooo_recent;		/* start of last segment queued */
 
-enum pkt_state {PKT, NOPKT};
-struct sack_r {
-	struct sack_edges se;
-	enum pkt_state st;
-};
+/* Sequence number comparisons which survive wrap around */
+static inline bool tcp_seq_before(u32 a, u32 b)
+{
+	return (s32)(a - b) < 0;
+}
 
-static struct sack_r edge_a[TCP_SACK];
-static unsigned int sack_idx;
-static unsigned int prev_len;
+static inline bool tcp_seq_after(u32 a, u32 b)
+{
+	return (s32)(a - b) > 0;
+}
 
 /*
  * TCP lengths are stored as a rounded up number of 32 bit words.
@@ -212,6 +224,8 @@ void net_set_syn_options(union tcp_build_pkt *b)
 {
 	if (IS_ENABLED(CONFIG_PROT_TCP_SACK))
 		tcp_lost.len = 0;
+	tcp_sack_ok = false;
+	tcp_wscale_ok = false;
 
 	b->ip.hdr.tcp_hlen = 0xa0;
 
@@ -318,7 +332,17 @@ int tcp_set_tcp_header(uchar *pkt, int dport, int sport, int payload_len,
 	pkt_len	= pkt_hdr_len + payload_len;
 	tcp_len	= pkt_len - IP_HDR_SIZE;
 
-	tcp_ack_edge = tcp_ack_num;
+	/*
+	 * Once the connection is up, the acknowledgment is what this layer
+	 * has received without holes, whatever the application asked for:
+	 * acknowledging the end of a segment which arrived out of order
+	 * would tell the server that the data in the hole had arrived.
+	 */
+	if (current_tcp_state == TCP_ESTABLISHED &&
+	    !(action & (TCP_SYN | TCP_RST)))
+		tcp_ack_num = tcp_ack_edge;
+	else
+		tcp_ack_edge = tcp_ack_num;
 	/* TCP Header */
 	b->ip.hdr.tcp_ack = htonl(tcp_ack_edge);
 	b->ip.hdr.tcp_src = htons(sport);
@@ -340,7 +364,10 @@ int tcp_set_tcp_header(uchar *pkt, int dport, int sport, int payload_len,
 	 * it is, then the u-boot tftp or nfs kernel netboot should be
 	 * considered.
 	 */
-	b->ip.hdr.tcp_win = htons(PKTBUFSRX * TCP_MSS >> TCP_SCALE);
+	if ((b->ip.hdr.tcp_flags & TCP_SYN) || !tcp_wscale_ok)
+		b->ip.hdr.tcp_win = htons(min(TCP_RCV_WND, 0xffff));
+	else
+		b->ip.hdr.tcp_win = htons(TCP_RCV_WND >> TCP_SCALE);
 
 	b->ip.hdr.tcp_xsum = 0;
 	b->ip.hdr.tcp_ugr = 0;
@@ -355,111 +382,111 @@ int tcp_set_tcp_header(uchar *pkt, int dport, int sport, int payload_len,
 }
 
 /**
- * tcp_hole() - Selective Acknowledgment (Essential for fast stream transfer)
- * @tcp_seq_num: TCP sequence start number
- * @len: the length of sequence numbers
+ * tcp_sack_fill() - build the SACK option from the reassembly queue
+ *
+ * The first block is the one holding the segment received last, the
+ * others follow in stream order, as RFC 2018 asks.
  */
-void tcp_hole(u32 tcp_seq_num, u32 len)
+static void tcp_sack_fill(void)
 {
-	u32 idx_sack, sack_in;
-	u32 sack_end = TCP_SACK - 1;
-	u32 hill = 0;
-	enum pkt_state expect = PKT;
-	u32 seq = tcp_seq_num - tcp_seq_init;
-	u32 hol_l = tcp_ack_edge - tcp_seq_init;
-	u32 hol_r = 0;
-
-	/* Place new seq number in correct place in receive array */
-	if (prev_len == 0)
-		prev_len = len;
-
-	idx_sack = sack_idx + ((tcp_seq_num - tcp_ack_edge) / prev_len);
-	if (idx_sack < TCP_SACK) {
-		edge_a[idx_sack].se.l = tcp_seq_num;
-		edge_a[idx_sack].se.r = tcp_seq_num + len;
-		edge_a[idx_sack].st = PKT;
+	int i, hill = 0;
 
-		/*
-		 * The fin (last) packet is not the same length as data
-		 * packets, and if it's length is recorded and used for
-		 *  array index calculation, calculation breaks.
-		 */
-		if (prev_len < len)
-			prev_len = len;
-	}
-
-	debug_cond(DEBUG_DEV_PKT,
-		   "TCP 1 seq %d, edg %d, len %d, sack_idx %d, sack_end %d\n",
-		    seq, hol_l, len, sack_idx, sack_end);
+	tcp_lost.len = TCP_OPT_LEN_2;
+	if (!tcp_sack_ok)
+		return;
 
-	/* Right edge of contiguous stream, is the left edge of first hill */
-	hol_l = tcp_seq_num - tcp_seq_init;
-	hol_r = hol_l + len;
+	for (i = 0; i < tcp_ooo_cnt; i++) {
+		if (!tcp_seq_before(tcp_ooo_recent, tcp_ooo[i].l) &&
+		    tcp_seq_before(tcp_ooo_recent, tcp_ooo[i].r)) {
+			tcp_lost.hill[hill++] = tcp_ooo[i];
+			break;
+		}
+	}
+	for (i = 0; i < tcp_ooo_cnt && hill < TCP_SACK_BLOCKS; i++) {
+		if (hill && tcp_ooo[i].l == tcp_lost.hill[0].l)
+			continue;
+		tcp_lost.hill[hill++] = tcp_ooo[i];
+	}
+	tcp_lost.len += hill * TCP_OPT_LEN_8;
+}
 
-	if (IS_ENABLED(CONFIG_PROT_TCP_SACK))
-		tcp_lost.len = TCP_OPT_LEN_2;
+/**
+ * tcp_ooo_insert() - record a segment received beyond a hole
+ * @l: first sequence number of the segment
+ * @r: sequence number following the segment
+ */
+static void tcp_ooo_insert(u32 l, u32 r)
+{
+	int i, j;
+
+	/* Skip the ranges which end before this one starts */
+	for (i = 0; i < tcp_ooo_cnt && tcp_seq_before(tcp_ooo[i].r, l); i++)
+		;
+
+	/* Merge with the ranges it overlaps or touches */
+	for (j = i; j < tcp_ooo_cnt && !tcp_seq_after(tcp_ooo[j].l, r); j++) {
+		if (tcp_seq_before(tcp_ooo[j].l, l))
+			l = tcp_ooo[j].l;
+		if (tcp_seq_after(tcp_ooo[j].r, r))
+			r = tcp_ooo[j].r;
+	}
 
-	debug_cond(DEBUG_DEV_PKT,
-		   "TCP 1 in %d, seq %d, pkt_l %d, pkt_r %d, sack_idx %d, sack_end %d\n",
-		   idx_sack, seq, hol_l, hol_r, sack_idx, sack_end);
-
-	for (sack_in = sack_idx; sack_in < sack_end && hill < TCP_SACK_HILLS;
-	     sack_in++)  {
-		switch (expect) {
-		case NOPKT:
-			switch (edge_a[sack_in].st) {
-			case NOPKT:
-				debug_cond(DEBUG_INT_STATE, "N");
-				break;
-			case PKT:
-				debug_cond(DEBUG_INT_STATE, "n");
-				if (IS_ENABLED(CONFIG_PROT_TCP_SACK)) {
-					tcp_lost.hill[hill].l =
-						edge_a[sack_in].se.l;
-					tcp_lost.hill[hill].r =
-						edge_a[sack_in].se.r;
-				}
-				expect = PKT;
-				break;
-			}
-			break;
-		case PKT:
-			switch (edge_a[sack_in].st) {
-			case NOPKT:
-				debug_cond(DEBUG_INT_STATE, "p");
-				if (sack_in > sack_idx &&
-				    hill < TCP_SACK_HILLS) {
-					hill++;
-					if (IS_ENABLED(CONFIG_PROT_TCP_SACK))
-						tcp_lost.len += TCP_OPT_LEN_8;
-				}
-				expect = NOPKT;
-				break;
-			case PKT:
-				debug_cond(DEBUG_INT_STATE, "P");
-
-				if (tcp_ack_edge == edge_a[sack_in].se.l) {
-					tcp_ack_edge = edge_a[sack_in].se.r;
-					edge_a[sack_in].st = NOPKT;
-					sack_idx++;
-				} else {
-					if (IS_ENABLED(CONFIG_PROT_TCP_SACK) &&
-					    hill < TCP_SACK_HILLS)
-						tcp_lost.hill[hill].r =
-							edge_a[sack_in].se.r;
-				if (IS_ENABLED(CONFIG_PROT_TCP_SACK) &&
-				    sack_in == sack_end - 1)
-					tcp_lost.hill[hill].r =
-						edge_a[sack_in].se.r;
-				}
-				break;
+	if (i == j) {
+		if (tcp_ooo_cnt == CONFIG_PROT_TCP_REASM_RANGES) {
+			/* Full: keep the ranges closest to the hole */
+			if (i == tcp_ooo_cnt) {
+				debug_cond(DEBUG_DEV_PKT,
+					   "TCP reassembly full, drop %u\n", l);
+				return;
 			}
-			break;
+			tcp_ooo_cnt--;
+		}
+		memmove(&tcp_ooo[i + 1], &tcp_ooo[i],
+			(tcp_ooo_cnt - i) * sizeof(*tcp_ooo));
+		tcp_ooo_cnt++;
+	} else if (j > i + 1) {
+		memmove(&tcp_ooo[i + 1], &tcp_ooo[j],
+			(tcp_ooo_cnt - j) * sizeof(*tcp_ooo));
+		tcp_ooo_cnt -= j - i - 1;
+	}
+	tcp_ooo[i].l = l;
+	tcp_ooo[i].r = r;
+}
+
+/**
+ * tcp_hole() - Selective Acknowledgment (Essential for fast stream transfer)
+ * @tcp_seq_num: TCP sequence start number
+ * @len: the length of sequence numbers
+ *
+ * Move the acknowledgment edge over a segment which fills the hole at the
+ * front of the stream, together with any ranges queued behind it, or queue
+ * the segment if it lies beyond the hole.
+ */
+void tcp_hole(u32 tcp_seq_num, u32 len)
+{
+	u32 r = tcp_seq_num + len;
+
+	debug_cond(DEBUG_DEV_PKT, "TCP seq %u, len %u, edge %u, ranges %d\n",
+		   tcp_seq_num - tcp_seq_init, len, tcp_ack_edge - tcp_seq_init,
+		   tcp_ooo_cnt);
+
+	if (tcp_seq_after(tcp_seq_num, tcp_ack_edge)) {
+		tcp_ooo_insert(tcp_seq_num, r);
+		tcp_ooo_recent = tcp_seq_num;
+	} else if (tcp_seq_after(r, tcp_ack_edge)) {
+		tcp_ack_edge = r;
+		while (tcp_ooo_cnt &&
+		       !tcp_seq_after(tcp_ooo[0].l, tcp_ack_edge)) {
+			if (tcp_seq_after(tcp_ooo[0].r, tcp_ack_edge))
+				tcp_ack_edge = tcp_ooo[0].r;
+			tcp_ooo_cnt--;
+			memmove(&tcp_ooo[0], &tcp_ooo[1],
+				tcp_ooo_cnt * sizeof(*tcp_ooo));
 		}
 	}
-	debug_cond(DEBUG_INT_STATE, "\n");
-	if (!IS_ENABLED(CONFIG_PROT_TCP_SACK) || tcp_lost.len <= TCP_OPT_LEN_2)
-		sack_idx = 0;
+
+	if (IS_ENABLED(CONFIG_PROT_TCP_SACK))
+		tcp_sack_fill();
 }
 
 /**
@@ -476,27 +503,33 @@ void tcp_parse_options(uchar *o, int o_len)
 	 * NOPs are options with a zero length, and thus are special.
 	 * All other options have length fields.
 	 */
-	for (p = o; p < (o + o_len); p = p + p[1]) {
-		if (!p[1])
-			return; /* Finished processing options */
+	while (p < o + o_len) {
+		if (p[0] == TCP_O_END)
+			return;
+		if (p[0] == TCP_1_NOP) {
+			p++;
+			continue;
+		}
+		if (p + 1 >= o + o_len || p[1] < TCP_OPT_LEN_2 ||
+		    p + p[1] > o + o_len)
+			return; /* Malformed option */
 
 		switch (p[0]) {
-		case TCP_O_END:
-			return;
-		case TCP_O_MSS:
 		case TCP_O_SCL:
+			/* Only valid in the SYN which answers ours */
+			if (current_tcp_state == TCP_SYN_SENT)
+				tcp_wscale_ok = true;
+			break;
 		case TCP_P_SACK:
-		case TCP_V_SACK:
+			if (current_tcp_state == TCP_SYN_SENT)
+				tcp_sack_ok = true;
 			break;
 		case TCP_O_TS:
 			tsopt = (struct tcp_t_opt *)p;
 			rmt_timestamp = tsopt->t_snd;
-			return;
+			break;
 		}
-
-		/* Process optional NOPs */
-		if (p[0] == TCP_O_NOP)
-			p++;
+		p += p[1];
 	}
 }
 
@@ -508,7 +541,6 @@ static u8 tcp_state_machine(u8 tcp_flags, u32 tcp_seq_num, int payload_len)
 	u8 tcp_push = tcp_flags & TCP_PUSH;
 	u8 tcp_ack = tcp_flags & TCP_ACK;
 	u8 action = TCP_DATA;
-	int i;
 
 	/*
 	 * tcp_flags are examined to determine TX action in a given state
@@ -551,13 +583,8 @@ static u8 tcp_state_machine(u8 tcp_flags, u32 tcp_seq_num, int payload_len)
 			action |= TCP_ACK;
 			tcp_seq_init = tcp_seq_num;
 			tcp_ack_edge = tcp_seq_num + 1;
-			sack_idx = 0;
-			edge_a[sack_idx].se.l = tcp_ack_edge;
-			edge_a[sack_idx].se.r = tcp_ack_edge;
-			prev_len = 0;
+			tcp_ooo_cnt = 0;
 			current_tcp_state = TCP_ESTABLISHED;
-			for (i = 0; i < TCP_SACK; i++)
-				edge_a[i].st = NOPKT;
 
 			if (tcp_syn && tcp_ack)
 				action |= TCP_PUSH;
@@ -572,9 +599,12 @@ static u8 tcp_state_machine(u8 tcp_flags, u32 tcp_seq_num, int payload_len)
 			tcp_fin = TCP_DATA;  /* cause standalone FIN */
 		}
 
-		if ((tcp_fin) &&
-		    (!IS_ENABLED(CONFIG_PROT_TCP_SACK) ||
-		     tcp_lost.len <= TCP_OPT_LEN_2)) {
+		/*
+		 * Only take the FIN once everything before it has arrived,
+		 * otherwise data still in flight would be cut off.
+		 */
+		if (tcp_fin && !tcp_ooo_cnt &&
+		    tcp_seq_num + payload_len == tcp_ack_edge) {
 			action = action | TCP_FIN | TCP_PUSH | TCP_ACK;
 			current_tcp_state = TCP_CLOSE_WAIT;
 		} else if (tcp_ack) {
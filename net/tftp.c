@@ -16,6 +16,7 @@
 #include <mapmem.h>
 #include <net.h>
 #include <net6.h>
+#include <time.h>
 #include <asm/global_data.h>
 #include <net/tftp.h>
 #include "bootp.h"
@@ -153,6 +154,364 @@ static unsigned short tftp_block_size = TFTP_BLOCK_SIZE;
 static unsigned short tftp_block_size_option = CONFIG_TFTP_BLOCKSIZE;
 static unsigned short tftp_window_size_option = TFTP_WINDOWSIZE;
 
+#ifdef CONFIG_TFTP_WINDOW_ADAPTIVE
+/*
+ * Blocks stored ahead of a missing one, kept as a ring: slot
+ * (tftp_ooo_head + n) stands for block tftp_cur_block + 1 + n.
+ */
+#define TFTP_OOO_BLOCKS		256
+static uchar	tftp_ooo_map[TFTP_OOO_BLOCKS];
+static uint	tftp_ooo_head;
+/* The short, final block has been stored ahead of the others */
+static bool	tftp_ooo_final_valid;
+static ushort	tftp_ooo_final;
+/* Blocks per round trip the link seems to sustain */
+static ushort	tftp_cwnd;
+/* A block went missing in the current window */
+static bool	tftp_cwnd_loss;
+/* The ack ending the current window is being held back */
+static bool	tftp_ack_paced;
+/* Time the last window ack went out, 0 if no RTT sample pending */
+static ulong	tftp_ack_time_us;
+/* Window size to request next time, 0 to use tftp_window_size_option */
+static ushort	tftp_window_size_learned;
+/* The window size requested for the current transfer */
+static ushort	tftp_window_size_request;
+
+static struct {
+	ulong	blocks;		/* data blocks stored */
+	ulong	acks;		/* acks sent for data */
+	ulong	retransmits;	/* acks resent after a loss or timeout */
+	ulong	timeouts;
+	ulong	ooo_blocks;	/* blocks stored ahead of a missing one */
+	ulong	dup_blocks;	/* blocks received more than once */
+	ulong	srtt_us;	/* smoothed round-trip time */
+	ulong	min_rtt_us;
+	ulong	last_rtt_us;
+	ushort	min_cwnd;
+	ushort	max_cwnd;
+} tftp_stats;
+#endif
+
+#ifdef CONFIG_TFTP_ZERO_COPY
+/* Frame headers in front of the data of a TFTP data packet */
+#define TFTP_SPLIT_HDR_LEN	(ETHER_HDR_SIZE + IP_UDP_HDR_SIZE + 4)
+/* Block size which fills a whole Ethernet frame with a 1500-byte MTU */
+#define TFTP_SPLIT_BLOCKSIZE	(1500 - IP_UDP_HDR_SIZE - 4)
+/* Most blocks of the load buffer posted to the Ethernet device at once */
+#define TFTP_SPLIT_BUFS		32
+/* Blocks held back while their place in the load buffer is still posted */
+#define TFTP_SPLIT_HOLD		4
+/* Marks a free entry in tftp_split_posted[] */
+#define TFTP_SPLIT_FREE		(~0UL)
+
+/* Number of buffers kept posted to the device, 0 if header split is off */
+static int	tftp_split_depth;
+/* Offsets of the blocks posted to the device and not yet received into */
+static ulong	tftp_split_posted[TFTP_SPLIT_BUFS];
+/* Data of the packet being handled, if it came in with header split */
+static uchar	*tftp_split_data;
+/* Number of blocks which arrived straight at their place */
+static ulong	tftp_split_in_place;
+
+static struct {
+	ulong	offset;
+	uint	len;		/* 0 if the entry is free */
+	uchar	data[TFTP_SPLIT_BLOCKSIZE];
+} tftp_split_hold_buf[TFTP_SPLIT_HOLD];
+
+static bool tftp_split_busy(ulong offset)
+{
+	int i;
+
+	for (i = 0; i < tftp_split_depth; i++) {
+		if (tftp_split_posted[i] == offset)
+			return true;
+	}
+
+	return false;
+}
+
+/**
+ * tftp_split_hold() - Hold back a block if its place is still posted
+ *
+ * The device may still write a frame into that place, so the block is
+ * copied there only once the posted buffer comes back.
+ *
+ * @offset:	Offset of the block in the load buffer
+ * @src:	Block data
+ * @len:	Length of block data
+ * Return: true if the block was held back, false if it can be stored now
+ */
+static bool tftp_split_hold(ulong offset, uchar *src, unsigned int len)
+{
+	int i, free = -1;
+
+	if (!tftp_split_busy(offset))
+		return false;
+
+	for (i = 0; i < TFTP_SPLIT_HOLD; i++) {
+		if (tftp_split_hold_buf[i].len &&
+		    tftp_split_hold_buf[i].offset == offset)
+			break;
+		if (!tftp_split_hold_buf[i].len && free < 0)
+			free = i;
+	}
+	if (i == TFTP_SPLIT_HOLD)
+		i = free;
+
+	/* tftp_split_rx() makes sure there is room for the block */
+	tftp_split_hold_buf[i].offset = offset;
+	tftp_split_hold_buf[i].len = len;
+	memcpy(tftp_split_hold_buf[i].data, src, len);
+
+	return true;
+}
+
+/* Store the blocks held back whose place is no longer posted */
+static void tftp_split_flush(void)
+{
+	void *ptr;
+	int i;
+
+	for (i = 0; i < TFTP_SPLIT_HOLD; i++) {
+		if (!tftp_split_hold_buf[i].len ||
+		    tftp_split_busy(tftp_split_hold_buf[i].offset))
+			continue;
+
+		ptr = map_sysmem(tftp_load_addr + tftp_split_hold_buf[i].offset,
+				 tftp_split_hold_buf[i].len);
+		memcpy(ptr, tftp_split_hold_buf[i].data,
+		       tftp_split_hold_buf[i].len);
+		unmap_sysmem(ptr);
+		tftp_split_hold_buf[i].len = 0;
+	}
+}
+
+static bool tftp_split_hold_full(void)
+{
+	int i;
+
+	for (i = 0; i < TFTP_SPLIT_HOLD; i++) {
+		if (!tftp_split_hold_buf[i].len)
+			return false;
+	}
+
+	return true;
+}
+
+/* Check whether a block was already stored */
+static bool tftp_split_stored(ulong offset)
+{
+	ulong next = tftp_cur_block * tftp_block_size + tftp_block_wrap_offset;
+
+	if (offset < next)
+		return true;
+#ifdef CONFIG_TFTP_WINDOW_ADAPTIVE
+	offset = (offset - next) / tftp_block_size;
+	if (offset < TFTP_OOO_BLOCKS &&
+	    tftp_ooo_map[(tftp_ooo_head + offset) % TFTP_OOO_BLOCKS])
+		return true;
+#endif
+
+	return false;
+}
+
+/**
+ * tftp_split_post() - Post the place of a block to the Ethernet device
+ *
+ * Only whole blocks inside the file which are neither stored nor posted
+ * already are posted. One of the driver's own buffers is posted instead of
+ * anything else, so that the device always has the same number of buffers.
+ *
+ * @offset:	Offset of the block in the load buffer
+ */
+static void tftp_split_post(ulong offset)
+{
+	ulong len = tftp_block_size;
+	void *buf = NULL;
+	int i;
+
+	if (offset + len <= tftp_tsize && !tftp_split_stored(offset) &&
+	    !tftp_split_busy(offset)) {
+#ifdef CONFIG_LMB
+		if (!tftp_load_size || offset + len <= tftp_load_size)
+#endif
+			buf = map_sysmem(tftp_load_addr + offset, len);
+	}
+	if (buf) {
+		for (i = 0; tftp_split_posted[i] != TFTP_SPLIT_FREE; i++)
+			;
+		tftp_split_posted[i] = offset;
+		if (!eth_rx_split_post(buf, len))
+			return;
+		tftp_split_posted[i] = TFTP_SPLIT_FREE;
+	}
+	eth_rx_split_post(NULL, 0);
+}
+
+/* Take back a posted buffer which the device filled */
+static void tftp_split_done(uchar *data)
+{
+	int i;
+
+	for (i = 0; i < tftp_split_depth; i++) {
+		if (tftp_split_posted[i] != TFTP_SPLIT_FREE &&
+		    map_sysmem(tftp_load_addr + tftp_split_posted[i], 0) == data) {
+			tftp_split_posted[i] = TFTP_SPLIT_FREE;
+			return;
+		}
+	}
+}
+
+static void tftp_handler(uchar *pkt, unsigned dest, struct in_addr sip,
+			 unsigned src, unsigned len);
+
+/**
+ * tftp_split_rx() - Handle a frame received with header split
+ *
+ * Data packets of the transfer are handled here, without copying the data
+ * if it went straight to its place in the load buffer. The place of the
+ * block one posting depth ahead is posted in return, which lines the
+ * device's buffers up with the blocks again after a loss. The first blocks
+ * come in on the device's own buffers and are copied as usual.
+ *
+ * @hdr:	Frame headers
+ * @data:	Rest of the frame
+ * @len:	Length of the frame
+ * Return: true if the frame was handled
+ */
+static bool tftp_split_rx(uchar *hdr, uchar *data, int len)
+{
+	struct ethernet_hdr *et = (struct ethernet_hdr *)hdr;
+	struct ip_udp_hdr *ip = (struct ip_udp_hdr *)(hdr + ETHER_HDR_SIZE);
+	__be16 *s = (__be16 *)(hdr + ETHER_HDR_SIZE + IP_UDP_HDR_SIZE);
+	ulong offset = TFTP_SPLIT_FREE;
+	unsigned int udp_len;
+	ushort ahead;
+	long index;
+
+	/* The previous frame is done with, so its buffer can be written */
+	tftp_split_flush();
+	tftp_split_done(data);
+
+	udp_len = ntohs(ip->udp_len);
+	if (len < TFTP_SPLIT_HDR_LEN || et->et_protlen != htons(PROT_IP) ||
+	    ip->ip_hl_v != 0x45 || ip->ip_p != IPPROTO_UDP ||
+	    (ntohs(ip->ip_off) & (IP_OFFS | IP_FLAGS_MFRAG)) ||
+	    !ip_checksum_ok(ip, IP_HDR_SIZE) ||
+	    net_read_ip(&ip->ip_dst).s_addr != net_ip.s_addr ||
+	    udp_len < UDP_HDR_SIZE + 4 ||
+	    udp_len > len - ETHER_HDR_SIZE - IP_HDR_SIZE ||
+	    ntohs(ip->udp_dst) != tftp_our_port ||
+	    ntohs(ip->udp_src) != tftp_remote_port ||
+	    ntohs(s[0]) != TFTP_DATA) {
+		eth_rx_split_post(NULL, 0);
+		return false;
+	}
+
+	/* Work out where the block goes, even if it was stored already */
+	ahead = ntohs(s[1]) - (ushort)(tftp_cur_block + 1);
+	index = tftp_cur_block + tftp_block_wrap * TFTP_SEQUENCE_SIZE + ahead;
+	if (ahead >= TFTP_SEQUENCE_SIZE / 2)
+		index -= TFTP_SEQUENCE_SIZE;
+	if (index >= 0) {
+		offset = index * tftp_block_size;
+
+		/* Drop the block if it can neither be stored nor held back */
+		if (ahead < TFTP_SEQUENCE_SIZE / 2 && tftp_split_busy(offset) &&
+		    tftp_split_hold_full()) {
+			tftp_split_post(offset + tftp_split_depth *
+					tftp_block_size);
+			return true;
+		}
+		if (map_sysmem(tftp_load_addr + offset, 0) == data)
+			tftp_split_in_place++;
+	}
+
+	tftp_split_data = data;
+	tftp_handler((uchar *)s, ntohs(ip->udp_dst), net_read_ip(&ip->ip_src),
+		     ntohs(ip->udp_src), udp_len - UDP_HDR_SIZE);
+	tftp_split_data = NULL;
+
+	/* The transfer may have ended, which stops header split */
+	if (tftp_split_depth) {
+		if (offset != TFTP_SPLIT_FREE)
+			tftp_split_post(offset + tftp_split_depth *
+					tftp_block_size);
+		else
+			eth_rx_split_post(NULL, 0);
+	}
+
+	return true;
+}
+
+/* Receive the data packets of a transfer straight into the load buffer */
+static void tftp_split_start(void)
+{
+	int ret;
+	int i;
+
+	if (tftp_split_depth || tftp_put_active || !tftp_tsize ||
+	    tftp_block_size != TFTP_SPLIT_BLOCKSIZE)
+		return;
+
+	ret = eth_rx_split_start(TFTP_SPLIT_HDR_LEN, tftp_split_rx);
+	if (ret <= 0)
+		return;
+
+	/*
+	 * The device's own buffers take the first blocks. After that, each
+	 * block lands in the place posted when the one ret blocks before it
+	 * came in, so all of those places have to be kept track of.
+	 */
+	if (ret > TFTP_SPLIT_BUFS) {
+		eth_rx_split_stop();
+		return;
+	}
+	tftp_split_depth = ret;
+	for (i = 0; i < TFTP_SPLIT_BUFS; i++)
+		tftp_split_posted[i] = TFTP_SPLIT_FREE;
+	for (i = 0; i < TFTP_SPLIT_HOLD; i++)
+		tftp_split_hold_buf[i].len = 0;
+	tftp_split_in_place = 0;
+}
+
+/* Take back all posted buffers and store the blocks still held back */
+static void tftp_split_stop(void)
+{
+	int i;
+
+	if (!tftp_split_depth)
+		return;
+
+	eth_rx_split_stop();
+	for (i = 0; i < tftp_split_depth; i++)
+		tftp_split_posted[i] = TFTP_SPLIT_FREE;
+	tftp_split_flush();
+	tftp_split_depth = 0;
+}
+
+static uchar *tftp_block_data(uchar *pkt)
+{
+	return tftp_split_data ? tftp_split_data : pkt + 2;
+}
+#else
+static inline bool tftp_split_hold(ulong offset, uchar *src,
+				   unsigned int len)
+{
+	return false;
+}
+
+static inline void tftp_split_start(void) {}
+static inline void tftp_split_stop(void) {}
+
+static inline uchar *tftp_block_data(uchar *pkt)
+{
+	return pkt + 2;
+}
+#endif
+
 static inline int store_block(int block, uchar *src, unsigned int len)
 {
 	ulong offset = block * tftp_block_size + tftp_block_wrap_offset -
@@ -175,7 +534,9 @@ static inline int store_block(int block, uchar *src, unsigned int len)
 	}
 #endif
 	ptr = map_sysmem(store_addr, len);
-	memcpy(ptr, src, len);
+	/* Nothing to copy if the block was received in place */
+	if (ptr != src && !tftp_split_hold(offset, src, len))
+		memcpy(ptr, src, len);
 	unmap_sysmem(ptr);
 
 	if (net_boot_file_size < newsize)
@@ -193,6 +554,17 @@ static void new_transfer(void)
 #ifdef CONFIG_CMD_TFTPPUT
 	tftp_put_final_block_sent = 0;
 #endif
+#ifdef CONFIG_TFTP_WINDOW_ADAPTIVE
+	memset(tftp_ooo_map, 0, sizeof(tftp_ooo_map));
+	tftp_ooo_head = 0;
+	tftp_ooo_final_valid = false;
+	tftp_cwnd = tftp_windowsize;
+	tftp_cwnd_loss = false;
+	tftp_ack_paced = false;
+	tftp_ack_time_us = 0;
+	tftp_stats.min_cwnd = tftp_cwnd;
+	tftp_stats.max_cwnd = tftp_cwnd;
+#endif
 }
 
 #ifdef CONFIG_CMD_TFTPPUT
@@ -283,9 +655,226 @@ static void update_block_number(void)
 	show_block_marker();
 }
 
+#ifdef CONFIG_TFTP_WINDOW_ADAPTIVE
+/* Record that an ack for the current block is going out */
+static void tftp_window_ack(bool retransmit)
+{
+	tftp_stats.acks++;
+	if (retransmit) {
+		tftp_stats.retransmits++;
+		tftp_ack_time_us = 0;
+		/* This ack also ends a window that was being held back */
+		if (tftp_ack_paced) {
+			tftp_ack_paced = false;
+			net_set_timeout_handler(timeout_ms,
+						tftp_timeout_handler);
+		}
+		return;
+	}
+
+	/*
+	 * Grow the window by one block after each clean window, unless the
+	 * round-trip time has doubled, which points at queues building up
+	 * somewhere on the path.
+	 */
+	if (!tftp_cwnd_loss && tftp_cwnd < tftp_windowsize &&
+	    tftp_stats.last_rtt_us <= 2 * tftp_stats.min_rtt_us)
+		tftp_cwnd++;
+	tftp_cwnd_loss = false;
+	tftp_stats.max_cwnd = max(tftp_stats.max_cwnd, tftp_cwnd);
+
+	/* The server waits for this ack, so it gives a round-trip time */
+	tftp_ack_time_us = timer_get_us();
+}
+
+/* Send the ack which was held back to pace the server */
+static void tftp_paced_ack_handler(void)
+{
+	tftp_ack_paced = false;
+	net_set_timeout_handler(timeout_ms, tftp_timeout_handler);
+	tftp_window_ack(false);
+	tftp_send();
+}
+
+/**
+ * tftp_window_send_ack() - Ack the end of a window
+ *
+ * The server always sends the whole negotiated window, and takes an ack in
+ * the middle of it for a loss, so the window is never cut short. To send
+ * only tftp_cwnd blocks per round trip, the ack is held back instead, long
+ * enough to stretch the window to the time it would take at that rate. The
+ * pause is kept well below the server's timeout.
+ */
+static void tftp_window_send_ack(void)
+{
+	ulong delay = 0;
+
+	if (tftp_cwnd < tftp_windowsize && tftp_stats.srtt_us) {
+		delay = DIV_ROUND_UP(tftp_stats.srtt_us *
+				     (tftp_windowsize - tftp_cwnd),
+				     tftp_cwnd * 1000UL);
+		delay = min(delay, timeout_ms / 2);
+	}
+	if (delay) {
+		tftp_ack_paced = true;
+		net_set_timeout_handler(delay, tftp_paced_ack_handler);
+		return;
+	}
+
+	tftp_window_ack(false);
+	tftp_send();
+}
+
+/* A data block arrived in order: take an RTT sample if one is pending */
+static void tftp_window_rtt_sample(void)
+{
+	ulong rtt;
+
+	tftp_stats.blocks++;
+	if (!tftp_ack_time_us)
+		return;
+
+	rtt = timer_get_us() - tftp_ack_time_us;
+	tftp_ack_time_us = 0;
+	tftp_stats.last_rtt_us = rtt;
+	if (!tftp_stats.min_rtt_us || rtt < tftp_stats.min_rtt_us)
+		tftp_stats.min_rtt_us = rtt;
+	if (tftp_stats.srtt_us)
+		tftp_stats.srtt_us = (7 * tftp_stats.srtt_us + rtt) / 8;
+	else
+		tftp_stats.srtt_us = rtt;
+}
+
+/* Halve the window, at most once per window */
+static void tftp_window_loss(void)
+{
+	if (tftp_cwnd_loss)
+		return;
+	tftp_cwnd_loss = true;
+	tftp_cwnd = max(tftp_cwnd / 2, 1);
+	tftp_stats.min_cwnd = min(tftp_stats.min_cwnd, tftp_cwnd);
+}
+
+/* The server went quiet: shrink the window and restart it from here */
+static void tftp_window_timeout(void)
+{
+	tftp_stats.timeouts++;
+	tftp_window_loss();
+	tftp_window_ack(true);
+	tftp_next_ack = (ushort)(tftp_cur_block + tftp_windowsize);
+}
+
+/* Move the ring of early blocks on, after tftp_cur_block moved on */
+static void tftp_ooo_slide(void)
+{
+	tftp_ooo_map[tftp_ooo_head] = 0;
+	tftp_ooo_head = (tftp_ooo_head + 1) % TFTP_OOO_BLOCKS;
+}
+
+/**
+ * tftp_window_gap() - Handle a block which arrived ahead of the next one
+ *
+ * The block is stored straight away if it falls inside the window, so that
+ * only the missing blocks need to be sent again.
+ *
+ * @block:	Block number received
+ * @src:	Block data
+ * @len:	Length of block data
+ */
+static void tftp_window_gap(ushort block, uchar *src, unsigned int len)
+{
+	ushort ahead = block - (ushort)(tftp_cur_block + 1);
+	uint slot;
+
+	tftp_window_loss();
+	if (tftp_state != STATE_DATA || ahead >= TFTP_OOO_BLOCKS ||
+	    ahead >= tftp_windowsize)
+		return;
+
+	slot = (tftp_ooo_head + ahead) % TFTP_OOO_BLOCKS;
+	if (tftp_ooo_map[slot]) {
+		tftp_stats.dup_blocks++;
+		return;
+	}
+	if (store_block(tftp_cur_block + 1 + ahead, src, len))
+		return;
+
+	tftp_ooo_map[slot] = 1;
+	tftp_stats.ooo_blocks++;
+	tftp_stats.blocks++;
+	if (len < tftp_block_size) {
+		tftp_ooo_final_valid = true;
+		tftp_ooo_final = block;
+	}
+}
+
+/**
+ * tftp_window_advance() - Skip blocks stored ahead of the one just received
+ *
+ * Return: number of blocks skipped, or -1 if the final block was reached
+ */
+static int tftp_window_advance(void)
+{
+	int skipped = 0;
+
+	tftp_ooo_slide();
+	while (tftp_ooo_map[tftp_ooo_head]) {
+		tftp_prev_block = tftp_cur_block;
+		tftp_cur_block = (tftp_cur_block + 1) % TFTP_SEQUENCE_SIZE;
+		update_block_number();
+		tftp_ooo_slide();
+		skipped++;
+		if (tftp_ooo_final_valid && tftp_cur_block == tftp_ooo_final)
+			return -1;
+	}
+
+	return skipped;
+}
+
+/* Remember what the link sustained, and show how the transfer went */
+static void tftp_window_complete(void)
+{
+	ulong avg = tftp_stats.acks ? tftp_stats.blocks / tftp_stats.acks : 0;
+
+	/*
+	 * Ask for the window size that worked this time on the next
+	 * transfer, or for the configured one if there was no loss at all
+	 */
+	if (tftp_stats.min_cwnd < tftp_windowsize)
+		tftp_window_size_learned = tftp_cwnd;
+	else
+		tftp_window_size_learned = 0;
+
+	printf("\n\t Window %u (%u-%u, avg %lu), RTT %lu us",
+	       tftp_windowsize, tftp_stats.min_cwnd, tftp_stats.max_cwnd,
+	       avg, tftp_stats.srtt_us);
+	printf("\n\t %lu retransmits, %lu timeouts, %lu out of order, %lu duplicates",
+	       tftp_stats.retransmits, tftp_stats.timeouts,
+	       tftp_stats.ooo_blocks, tftp_stats.dup_blocks);
+}
+#else
+static inline void tftp_window_ack(bool retransmit) {}
+static inline void tftp_window_send_ack(void)
+{
+	tftp_send();
+}
+
+static inline void tftp_window_rtt_sample(void) {}
+static inline void tftp_window_timeout(void) {}
+static inline void tftp_window_gap(ushort block, uchar *src,
+				   unsigned int len) {}
+static inline int tftp_window_advance(void)
+{
+	return 0;
+}
+
+static inline void tftp_window_complete(void) {}
+#endif
+
 /* The TFTP get or put is complete */
 static void tftp_complete(void)
 {
+	tftp_split_stop();
 #ifdef CONFIG_TFTP_TSIZE
 	/* Print hash marks for the last packet received */
 	while (tftp_tsize && tftp_tsize_num_hash < 49) {
@@ -301,6 +890,13 @@ static void tftp_complete(void)
 		print_size(net_boot_file_size /
 			time_start * 1000, "/s");
 	}
+	if (!tftp_put_active)
+		tftp_window_complete();
+#ifdef CONFIG_TFTP_ZERO_COPY
+	if (tftp_split_in_place)
+		printf("\n\t %lu blocks received in place",
+		       tftp_split_in_place);
+#endif
 	puts("\ndone\n");
 	if (!tftp_put_active)
 		efi_set_bootdev("Net", "", tftp_filename,
@@ -360,9 +956,15 @@ static void tftp_send(void)
 		 * Implemented only for tftp get.
 		 * Don't bother sending if it's 1
 		 */
+#ifdef CONFIG_TFTP_WINDOW_ADAPTIVE
+		if (tftp_state == STATE_SEND_RRQ && tftp_window_size_request > 1)
+			pkt += sprintf((char *)pkt, "windowsize%c%d%c",
+					0, tftp_window_size_request, 0);
+#else
 		if (tftp_state == STATE_SEND_RRQ && tftp_window_size_option > 1)
 			pkt += sprintf((char *)pkt, "windowsize%c%d%c",
 					0, tftp_window_size_option, 0);
+#endif
 		len = pkt - xp;
 		break;
 
@@ -579,6 +1181,8 @@ static void tftp_handler(uchar *pkt, unsigned dest, struct in_addr sip,
 			tftp_cur_block++;
 		}
 #endif
+		if (tftp_state == STATE_OACK)
+			tftp_split_start();
 		tftp_send(); /* Send ACK or first data block */
 		break;
 	case TFTP_DATA:
@@ -598,6 +1202,11 @@ static void tftp_handler(uchar *pkt, unsigned dest, struct in_addr sip,
 			 */
 			if ((ushort)(tftp_cur_block + 1) - (short)(ntohs(*(__be16 *)pkt)) > 0)
 				break;
+
+			/* Keep the block if it fits in the window */
+			tftp_window_gap(ntohs(*(__be16 *)pkt),
+					tftp_block_data(pkt), len);
+
 			/*
 			 * If one packet is dropped most likely
 			 * all other buffers in the window
@@ -605,6 +1214,7 @@ static void tftp_handler(uchar *pkt, unsigned dest, struct in_addr sip,
 			 * This just overwellms the server, let's just send one.
 			 */
 			if (tftp_last_nack != tftp_cur_block) {
+				tftp_window_ack(true);
 				tftp_send();
 				tftp_last_nack = tftp_cur_block;
 				tftp_next_ack = (ushort)(tftp_cur_block +
@@ -648,25 +1258,37 @@ static void tftp_handler(uchar *pkt, unsigned dest, struct in_addr sip,
 		timeout_count_max = tftp_timeout_count_max;
 		net_set_timeout_handler(timeout_ms, tftp_timeout_handler);
 
-		if (store_block(tftp_cur_block, pkt + 2, len)) {
+		if (store_block(tftp_cur_block, tftp_block_data(pkt), len)) {
 			eth_halt();
 			net_set_state(NETLOOP_FAIL);
 			break;
 		}
 
+		tftp_window_rtt_sample();
+
 		if (len < tftp_block_size) {
 			tftp_send();
 			tftp_complete();
 			break;
 		}
 
+		/* Skip over blocks which already arrived out of order */
+		i = tftp_window_advance();
+		if (i < 0) {
+			tftp_send();
+			tftp_complete();
+			break;
+		}
+
 		/*
 		 *	Acknowledge the block just received, which will prompt
-		 *	the remote for the next one.
+		 *	the remote for the next one. Skipping over stored blocks
+		 *	may have taken us past the end of the window.
 		 */
-		if (tftp_cur_block == tftp_next_ack) {
-			tftp_send();
-			tftp_next_ack += tftp_windowsize;
+		if ((short)((ushort)tftp_cur_block - tftp_next_ack) >= 0) {
+			tftp_next_ack = (ushort)(tftp_cur_block +
+						 tftp_windowsize);
+			tftp_window_send_ack();
 		}
 		break;
 
@@ -703,6 +1325,8 @@ static void tftp_timeout_handler(void)
 	} else {
 		puts("T ");
 		net_set_timeout_handler(timeout_ms, tftp_timeout_handler);
+		if (tftp_state == STATE_DATA && !tftp_put_active)
+			tftp_window_timeout();
 		if (tftp_state != STATE_RECV_WRQ)
 			tftp_send();
 	}
@@ -813,6 +1437,14 @@ void tftp_start(enum proto_t protocol)
 
 	sanitize_tftp_block_size_option(protocol);
 
+#ifdef CONFIG_TFTP_WINDOW_ADAPTIVE
+	tftp_window_size_request = tftp_window_size_option;
+	if (tftp_window_size_learned &&
+	    tftp_window_size_learned < tftp_window_size_option)
+		tftp_window_size_request = tftp_window_size_learned;
+	memset(&tftp_stats, 0, sizeof(tftp_stats));
+#endif
+
 	debug("TFTP blocksize = %i, TFTP windowsize = %d timeout = %ld ms\n",
 	      tftp_block_size_option, tftp_window_size_option, timeout_ms);
 
@@ -952,6 +1584,12 @@ void tftp_start(enum proto_t protocol)
 	tftp_tsize = 0;
 	tftp_tsize_num_hash = 0;
 #endif
+#ifdef CONFIG_TFTP_ZERO_COPY
+	/* Anything held back belongs to a transfer which did not finish */
+	eth_rx_split_stop();
+	tftp_split_depth = 0;
+	tftp_split_in_place = 0;
+#endif
 
 	tftp_send();
 }
@@ -22,11 +22,18 @@ DECLARE_GLOBAL_DATA_PTR;
 /* The default, change with environment variable 'httpdstp' */
 #define SERVER_PORT		80
 
+#define HTTP_OK			200
+#define HTTP_PARTIAL_CONTENT	206
+
 static const char bootfile1[] = "GET ";
-static const char bootfile3[] = " HTTP/1.0\r\n\r\n";
+static const char bootfile3[] = " HTTP/1.1\r\n";
 static const char http_eom[] = "\r\n\r\n";
-static const char http_ok[] = "200";
+static const char http_10[] = "HTTP/1.0";
 static const char content_len[] = "Content-Length";
+static const char content_range[] = "Content-Range";
+static const char accept_ranges[] = "Accept-Ranges";
+static const char connection[] = "Connection";
+static const char transfer_enc[] = "Transfer-Encoding";
 static const char linefeed[] = "\r\n";
 static struct in_addr web_server_ip;
 static int our_port;
@@ -66,6 +73,33 @@ static int retry_len;			/* TCP retry length */
 
 static ulong wget_load_size;
 
+/*
+ * Persistent connection and resume state.
+ *
+ * With HTTP/1.1 the server keeps the connection open after the response,
+ * so the end of the body is found from Content-Length rather than from the
+ * server closing the connection. The connection is then left idle, and the
+ * next wget to the same server sends its request on it instead of opening a
+ * new one.
+ *
+ * If the transfer stalls, it is resumed with a Range request from the first
+ * byte which has not been received, rather than started again from zero.
+ */
+static bool wget_keep_alive;		/* server keeps the connection open */
+static bool wget_accept_ranges;		/* server supports byte ranges */
+static ulong wget_range_start;		/* offset of the requested range */
+static ulong wget_rcv_edge;		/* bytes received without a gap */
+static int wget_resume_count;
+static struct in_addr wget_idle_ip;	/* server of the idle connection */
+static unsigned int wget_idle_port;
+static unsigned int wget_idle_seq;	/* our next sequence number */
+static unsigned int wget_idle_ack;	/* server's next sequence number */
+static bool wget_reused;		/* request sent on the idle connection */
+static unsigned int wget_req_seq;	/* sequence numbers of the request */
+static unsigned int wget_req_ack;
+
+static void wget_timeout_handler(void);
+
 /**
  * wget_init_max_size() - initialize maximum load size
  *
@@ -95,10 +129,14 @@ static int wget_init_load_size(void)
  */
 static inline int store_block(uchar *src, unsigned int offset, unsigned int len)
 {
-	ulong store_addr = image_load_addr + offset;
-	ulong newsize = offset + len;
+	ulong store_addr, newsize;
 	uchar *ptr;
 
+	/* A resumed transfer carries on where the last one stopped */
+	offset += wget_range_start;
+	store_addr = image_load_addr + offset;
+	newsize = offset + len;
+
 	if (IS_ENABLED(CONFIG_LMB)) {
 		ulong end_addr = image_load_addr + wget_load_size;
 
@@ -120,9 +158,96 @@ static inline int store_block(uchar *src, unsigned int offset, unsigned int len)
 	if (net_boot_file_size < (offset + len))
 		net_boot_file_size = newsize;
 
+	if (offset <= wget_rcv_edge && newsize > wget_rcv_edge)
+		wget_rcv_edge = newsize;
+
 	return 0;
 }
 
+/**
+ * wget_find_header() - find a header field in an HTTP response
+ * @hdr: response header, nul-terminated
+ * @hlen: length of the response header
+ * @name: field name, matched without regard to case
+ *
+ * Return: pointer to the field value, or NULL if not present
+ */
+static char *wget_find_header(char *hdr, int hlen, const char *name)
+{
+	int nlen = strlen(name);
+	char *pos = hdr;
+
+	while ((pos = strstr(pos, linefeed)) && pos < hdr + hlen) {
+		pos += sizeof(linefeed) - 1;
+		if (!strncasecmp(pos, name, nlen) && pos[nlen] == ':') {
+			pos += nlen + 1;
+			while (*pos == ' ')
+				pos++;
+			return pos;
+		}
+	}
+
+	return NULL;
+}
+
+/**
+ * wget_send_request() - send the HTTP GET request
+ * @tcp_seq_num: our sequence number
+ * @tcp_ack_num: sequence number to acknowledge
+ */
+static void wget_send_request(unsigned int tcp_seq_num,
+			      unsigned int tcp_ack_num)
+{
+	unsigned int server_port;
+	uchar *ptr, *offset;
+
+	server_port = env_get_ulong("httpdstp", 10, SERVER_PORT) & 0xffff;
+
+	ptr = net_tx_packet + net_eth_hdr_size() +
+		IP_TCP_HDR_SIZE + TCP_TSOPT_SIZE + 2;
+	offset = ptr;
+
+	memcpy(offset, &bootfile1, strlen(bootfile1));
+	offset += strlen(bootfile1);
+
+	memcpy(offset, image_url, strlen(image_url));
+	offset += strlen(image_url);
+
+	memcpy(offset, &bootfile3, strlen(bootfile3));
+	offset += strlen(bootfile3);
+
+	offset += sprintf((char *)offset, "Host: %pI4\r\n", &web_server_ip);
+	if (wget_range_start)
+		offset += sprintf((char *)offset, "Range: bytes=%lu-\r\n",
+				  wget_range_start);
+	offset += sprintf((char *)offset, "%s", linefeed);
+
+	net_send_tcp_packet((offset - ptr), server_port, our_port,
+			    TCP_PUSH, tcp_seq_num, tcp_ack_num);
+
+	wget_req_seq = tcp_seq_num;
+	wget_req_ack = tcp_ack_num;
+	pkt_q_idx = 0;
+	packets = 0;
+	current_wget_state = WGET_CONNECTED;
+}
+
+#define RANDOM_PORT_START 1024
+#define RANDOM_PORT_RANGE 0x4000
+
+/**
+ * random_port() - make port a little random (1024-17407)
+ *
+ * Return: random port number from 1024 to 17407
+ *
+ * This keeps the math somewhat trivial to compute, and seems to work with
+ * all supported protocols/clients/servers
+ */
+static unsigned int random_port(void)
+{
+	return RANDOM_PORT_START + (get_timer(0) % RANDOM_PORT_RANGE);
+}
+
 /**
  * wget_send_stored() - wget response dispatcher
  *
@@ -138,7 +263,6 @@ static void wget_send_stored(void)
 	unsigned int tcp_ack_num = retry_tcp_seq_num + (len == 0 ? 1 : len);
 	unsigned int tcp_seq_num = retry_tcp_ack_num;
 	unsigned int server_port;
-	uchar *ptr, *offset;
 
 	server_port = env_get_ulong("httpdstp", 10, SERVER_PORT) & 0xffff;
 
@@ -151,29 +275,14 @@ static void wget_send_stored(void)
 		packets = 0;
 		break;
 	case WGET_CONNECTING:
-		pkt_q_idx = 0;
 		net_send_tcp_packet(0, server_port, our_port, action,
 				    tcp_seq_num, tcp_ack_num);
-
-		ptr = net_tx_packet + net_eth_hdr_size() +
-			IP_TCP_HDR_SIZE + TCP_TSOPT_SIZE + 2;
-		offset = ptr;
-
-		memcpy(offset, &bootfile1, strlen(bootfile1));
-		offset += strlen(bootfile1);
-
-		memcpy(offset, image_url, strlen(image_url));
-		offset += strlen(image_url);
-
-		memcpy(offset, &bootfile3, strlen(bootfile3));
-		offset += strlen(bootfile3);
-		net_send_tcp_packet((offset - ptr), server_port, our_port,
-				    TCP_PUSH, tcp_seq_num, tcp_ack_num);
-		current_wget_state = WGET_CONNECTED;
+		wget_send_request(tcp_seq_num, tcp_ack_num);
 		break;
 	case WGET_CONNECTED:
 	case WGET_TRANSFERRING:
 	case WGET_TRANSFERRED:
+	case WGET_IDLE:
 		net_send_tcp_packet(0, server_port, our_port, action,
 				    tcp_seq_num, tcp_ack_num);
 		break;
@@ -206,12 +315,82 @@ void wget_success(u8 action, unsigned int tcp_seq_num,
 	wget_send(action, tcp_seq_num, tcp_ack_num, len);
 }
 
+/**
+ * wget_body_done() - check whether the whole response body has arrived
+ *
+ * Return: true if the body length is known and all of it was received
+ */
+static bool wget_body_done(void)
+{
+	return content_length != -1 &&
+	       wget_rcv_edge >= wget_range_start + content_length;
+}
+
+/**
+ * wget_done_keep_alive() - finish a transfer and keep the connection open
+ * @tcp_seq_num: sequence number of the last segment received
+ * @tcp_ack_num: acknowledgment number of the last segment received
+ * @action: TCP action
+ * @len: length of the last segment received
+ */
+static void wget_done_keep_alive(unsigned int tcp_seq_num,
+				 unsigned int tcp_ack_num, u8 action, int len)
+{
+	wget_success(action, tcp_seq_num, tcp_ack_num, len, packets);
+
+	wget_idle_ip = web_server_ip;
+	wget_idle_port = env_get_ulong("httpdstp", 10, SERVER_PORT) & 0xffff;
+	wget_idle_seq = tcp_ack_num;
+	wget_idle_ack = initial_data_seq_num + content_length;
+	current_wget_state = WGET_IDLE;
+
+	net_set_timeout_handler(0, NULL);
+	net_set_state(NETLOOP_SUCCESS);
+}
+
+/**
+ * wget_connect() - open a new connection to the server
+ */
+static void wget_connect(void)
+{
+	tcp_set_tcp_state(TCP_CLOSED);
+	current_wget_state = WGET_CLOSED;
+	wget_reused = false;
+	our_port = random_port();
+	wget_send(TCP_SYN, 0, 0, 0);
+}
+
+/**
+ * wget_resume() - restart a stalled transfer where it stopped
+ *
+ * Return: true if the transfer is being resumed
+ */
+static bool wget_resume(void)
+{
+	if (current_wget_state != WGET_TRANSFERRING || !wget_accept_ranges ||
+	    wget_rcv_edge <= wget_range_start ||
+	    wget_resume_count >= WGET_RESUME_COUNT)
+		return false;
+
+	printf("\nResuming at 0x%lx\n", wget_rcv_edge);
+	wget_resume_count++;
+	wget_timeout_count = 0;
+	wget_send(TCP_RST, retry_tcp_seq_num, retry_tcp_ack_num, retry_len);
+	wget_range_start = wget_rcv_edge;
+	net_set_timeout_handler(wget_timeout, wget_timeout_handler);
+	wget_connect();
+
+	return true;
+}
+
 /*
  * Interfaces of U-BOOT
  */
 static void wget_timeout_handler(void)
 {
 	if (++wget_timeout_count > WGET_RETRY_COUNT) {
+		if (wget_resume())
+			return;
 		puts("\nRetry count exceeded; starting again\n");
 		wget_send(TCP_RST, 0, 0, 0);
 		net_start_again();
@@ -220,7 +399,11 @@ static void wget_timeout_handler(void)
 		net_set_timeout_handler(wget_timeout +
 					WGET_TIMEOUT * wget_timeout_count,
 					wget_timeout_handler);
-		wget_send_stored();
+		/* No response yet: the request itself may have been lost */
+		if (current_wget_state == WGET_CONNECTED)
+			wget_send_request(wget_req_seq, wget_req_ack);
+		else
+			wget_send_stored();
 	}
 }
 
@@ -233,6 +416,7 @@ static void wget_connected(uchar *pkt, unsigned int tcp_seq_num,
 	uchar *pkt_in_q;
 	char *pos;
 	int hlen, i;
+	ulong status;
 	uchar *ptr1;
 
 	pkt[len] = '\0';
@@ -241,6 +425,13 @@ static void wget_connected(uchar *pkt, unsigned int tcp_seq_num,
 	if (!pos) {
 		debug_cond(DEBUG_WGET,
 			   "wget: Connected, data before Header %p\n", pkt);
+		if (pkt_q_idx >= PKTQ_SZ) {
+			printf("wget: Fatal error, queue overrun!\n");
+			net_set_state(NETLOOP_FAIL);
+
+			return;
+		}
+
 		pkt_in_q = (void *)image_load_addr + PKT_QUEUE_OFFSET +
 			(pkt_q_idx * PKT_QUEUE_PACKET_SIZE);
 
@@ -252,13 +443,6 @@ static void wget_connected(uchar *pkt, unsigned int tcp_seq_num,
 		pkt_q[pkt_q_idx].tcp_seq_num = tcp_seq_num;
 		pkt_q[pkt_q_idx].len = len;
 		pkt_q_idx++;
-
-		if (pkt_q_idx >= PKTQ_SZ) {
-			printf("wget: Fatal error, queue overrun!\n");
-			net_set_state(NETLOOP_FAIL);
-
-			return;
-		}
 	} else {
 		debug_cond(DEBUG_WGET, "wget: Connected HTTP Header %p\n", pkt);
 		/* sizeof(http_eom) - 1 is the string length of (http_eom) */
@@ -272,66 +456,118 @@ static void wget_connected(uchar *pkt, unsigned int tcp_seq_num,
 
 		current_wget_state = WGET_TRANSFERRING;
 
-		if (strstr((char *)pkt, http_ok) == 0) {
+		status = 0;
+		pos = strchr((char *)pkt, ' ');
+		if (pos && pos < (char *)pkt + i)
+			status = simple_strtoul(pos + 1, NULL, 10);
+
+		if (status == HTTP_PARTIAL_CONTENT && wget_range_start) {
+			pos = wget_find_header((char *)pkt, hlen, content_range);
+			if (!pos || strncmp(pos, "bytes ", 6) ||
+			    simple_strtoul(pos + 6, NULL, 10) != wget_range_start) {
+				wget_loop_state = NETLOOP_FAIL;
+				wget_fail("wget: bad Content-Range\n",
+					  tcp_seq_num, tcp_ack_num, action);
+				net_set_state(NETLOOP_FAIL);
+				return;
+			}
+		} else if (status == HTTP_OK) {
+			/* The server may have sent the whole file after all */
+			wget_range_start = 0;
+			wget_rcv_edge = 0;
+		} else {
 			debug_cond(DEBUG_WGET,
 				   "wget: Connected Bad Xfer\n");
 			initial_data_seq_num = tcp_seq_num + hlen;
 			wget_loop_state = NETLOOP_FAIL;
 			wget_send(action, tcp_seq_num, tcp_ack_num, len);
+			return;
+		}
+
+		debug_cond(DEBUG_WGET,
+			   "wget: Connctd pkt %p  hlen %x\n",
+			   pkt, hlen);
+		initial_data_seq_num = tcp_seq_num + hlen;
+
+		pos = wget_find_header((char *)pkt, hlen, content_len);
+		if (!pos) {
+			content_length = -1;
 		} else {
+			strict_strtoul(pos, 10, &content_length);
 			debug_cond(DEBUG_WGET,
-				   "wget: Connctd pkt %p  hlen %x\n",
-				   pkt, hlen);
-			initial_data_seq_num = tcp_seq_num + hlen;
-
-			pos = strstr((char *)pkt, content_len);
-			if (!pos) {
-				content_length = -1;
-			} else {
-				pos += sizeof(content_len) + 2;
-				strict_strtoul(pos, 10, &content_length);
-				debug_cond(DEBUG_WGET,
-					   "wget: Connected Len %lu\n",
-					   content_length);
-			}
+				   "wget: Connected Len %lu\n",
+				   content_length);
+		}
 
-			net_boot_file_size = 0;
+		pos = wget_find_header((char *)pkt, hlen, transfer_enc);
+		if (pos && strncasecmp(pos, "identity", 8)) {
+			wget_loop_state = NETLOOP_FAIL;
+			wget_fail("wget: transfer encoding not supported\n",
+				  tcp_seq_num, tcp_ack_num, action);
+			net_set_state(NETLOOP_FAIL);
+			return;
+		}
 
-			if (len > hlen) {
-				if (store_block(pkt + hlen, 0, len - hlen) != 0) {
-					wget_loop_state = NETLOOP_FAIL;
-					wget_fail("wget: store error\n", tcp_seq_num, tcp_ack_num, action);
-					net_set_state(NETLOOP_FAIL);
-					return;
-				}
+		/*
+		 * HTTP/1.1 connections stay open unless the server says
+		 * otherwise, HTTP/1.0 ones are closed unless it asks
+		 */
+		pos = wget_find_header((char *)pkt, hlen, connection);
+		if (!strncmp((char *)pkt, http_10, strlen(http_10)))
+			wget_keep_alive = pos && !strncasecmp(pos, "keep-alive", 10);
+		else
+			wget_keep_alive = !pos || strncasecmp(pos, "close", 5);
+		if (content_length == -1)
+			wget_keep_alive = false;
+
+		pos = wget_find_header((char *)pkt, hlen, accept_ranges);
+		if (pos && !strncasecmp(pos, "bytes", 5))
+			wget_accept_ranges = true;
+		else if (!wget_range_start)
+			wget_accept_ranges = false;
+
+		net_boot_file_size = wget_range_start;
+
+		if (len > hlen) {
+			if (store_block(pkt + hlen, 0, len - hlen) != 0) {
+				wget_loop_state = NETLOOP_FAIL;
+				wget_fail("wget: store error\n", tcp_seq_num, tcp_ack_num, action);
+				net_set_state(NETLOOP_FAIL);
+				return;
 			}
+		}
 
+		debug_cond(DEBUG_WGET,
+			   "wget: Connected Pkt %p hlen %x\n",
+			   pkt, hlen);
+
+		for (i = 0; i < pkt_q_idx; i++) {
+			int err;
+
+			ptr1 = map_sysmem(
+				(phys_addr_t)(pkt_q[i].pkt),
+				pkt_q[i].len);
+			err = store_block(ptr1,
+				  pkt_q[i].tcp_seq_num -
+				  initial_data_seq_num,
+				  pkt_q[i].len);
+			unmap_sysmem(ptr1);
 			debug_cond(DEBUG_WGET,
-				   "wget: Connected Pkt %p hlen %x\n",
-				   pkt, hlen);
-
-			for (i = 0; i < pkt_q_idx; i++) {
-				int err;
-
-				ptr1 = map_sysmem(
-					(phys_addr_t)(pkt_q[i].pkt),
-					pkt_q[i].len);
-				err = store_block(ptr1,
-					  pkt_q[i].tcp_seq_num -
-					  initial_data_seq_num,
-					  pkt_q[i].len);
-				unmap_sysmem(ptr1);
-				debug_cond(DEBUG_WGET,
-					   "wget: Connctd pkt Q %p len %x\n",
-					   pkt_q[i].pkt, pkt_q[i].len);
-				if (err) {
-					wget_loop_state = NETLOOP_FAIL;
-					wget_fail("wget: store error\n", tcp_seq_num, tcp_ack_num, action);
-					net_set_state(NETLOOP_FAIL);
-					return;
-				}
+				   "wget: Connctd pkt Q %p len %x\n",
+				   pkt_q[i].pkt, pkt_q[i].len);
+			if (err) {
+				wget_loop_state = NETLOOP_FAIL;
+				wget_fail("wget: store error\n", tcp_seq_num, tcp_ack_num, action);
+				net_set_state(NETLOOP_FAIL);
+				return;
 			}
 		}
+
+		if (wget_keep_alive && wget_body_done()) {
+			wget_done_keep_alive(tcp_seq_num, tcp_ack_num, action,
+					     len);
+			return;
+		}
 	}
 	wget_send(action, tcp_seq_num, tcp_ack_num, len);
 }
@@ -384,7 +620,11 @@ static void wget_handler(uchar *pkt, u16 dport,
 	case WGET_CONNECTED:
 		debug_cond(DEBUG_WGET, "wget: Connected seq=%u, len=%x\n",
 			   tcp_seq_num, len);
-		if (!len) {
+		if (!len && wget_reused && wget_tcp_state != TCP_ESTABLISHED) {
+			/* The server closed the idle connection meanwhile */
+			debug_cond(DEBUG_WGET, "wget: idle connection lost\n");
+			wget_connect();
+		} else if (!len) {
 			wget_fail("Image not found, no data returned\n",
 				  tcp_seq_num, tcp_ack_num, action);
 		} else {
@@ -417,9 +657,14 @@ static void wget_handler(uchar *pkt, u16 dport,
 			net_set_state(NETLOOP_FAIL);
 			break;
 		case TCP_ESTABLISHED:
+			wget_loop_state = NETLOOP_SUCCESS;
+			if (wget_keep_alive && wget_body_done()) {
+				wget_done_keep_alive(tcp_seq_num, tcp_ack_num,
+						     TCP_ACK, len);
+				break;
+			}
 			wget_send(TCP_ACK, tcp_seq_num, tcp_ack_num,
 				  len);
-			wget_loop_state = NETLOOP_SUCCESS;
 			break;
 		case TCP_CLOSE_WAIT:     /* End of transfer */
 			current_wget_state = WGET_TRANSFERRED;
@@ -432,25 +677,11 @@ static void wget_handler(uchar *pkt, u16 dport,
 		printf("Packets received %d, Transfer Successful\n", packets);
 		net_set_state(wget_loop_state);
 		break;
+	case WGET_IDLE:
+		break;
 	}
 }
 
-#define RANDOM_PORT_START 1024
-#define RANDOM_PORT_RANGE 0x4000
-
-/**
- * random_port() - make port a little random (1024-17407)
- *
- * Return: random port number from 1024 to 17407
- *
- * This keeps the math somewhat trivial to compute, and seems to work with
- * all supported protocols/clients/servers
- */
-static unsigned int random_port(void)
-{
-	return RANDOM_PORT_START + (get_timer(0) % RANDOM_PORT_RANGE);
-}
-
 #define BLOCKSIZE 512
 
 void wget_start(void)
@@ -505,9 +736,10 @@ void wget_start(void)
 	tcp_set_tcp_handler(wget_handler);
 
 	wget_timeout_count = 0;
-	current_wget_state = WGET_CLOSED;
-
-	our_port = random_port();
+	wget_resume_count = 0;
+	wget_range_start = 0;
+	wget_rcv_edge = 0;
+	content_length = -1;
 
 	/*
 	 * Zero out server ether to force arp resolution in case
@@ -517,7 +749,19 @@ void wget_start(void)
 
 	memset(net_server_ethaddr, 0, 6);
 
-	wget_send(TCP_SYN, 0, 0, 0);
+	/* Send the request on the connection left open by the last one */
+	if (current_wget_state == WGET_IDLE &&
+	    tcp_get_tcp_state() == TCP_ESTABLISHED &&
+	    wget_idle_ip.s_addr == web_server_ip.s_addr &&
+	    wget_idle_port == (env_get_ulong("httpdstp", 10, SERVER_PORT) &
+			       0xffff)) {
+		debug_cond(DEBUG_WGET, "wget: reusing connection\n");
+		wget_reused = true;
+		wget_send_request(wget_idle_seq, wget_idle_ack);
+		return;
+	}
+
+	wget_connect();
 }
 
 #if (IS_ENABLED(CONFIG_CMD_DNS))
@@ -0,0 +1,262 @@
+// SPDX-License-Identifier: GPL-2.0+
+/*
+ * Tests for tftpboot against a fake server which loses and reorders blocks
+ */
+
+#include <common.h>
+#include <command.h>
+#include <dm.h>
+#include <env.h>
+#include <mapmem.h>
+#include <net.h>
+#include <asm/eth.h>
+#include <test/lib.h>
+#include <test/test.h>
+#include <test/ut.h>
+
+/* Well known TFTP port # */
+#define TFTP_PORT	69
+/* Port the fake server answers from */
+#define TFTP_TID	21313
+
+/*
+ *	TFTP operations.
+ */
+#define TFTP_RRQ	1
+#define TFTP_DATA	3
+#define TFTP_ACK	4
+#define TFTP_OACK	6
+
+/* default TFTP block size */
+#define TFTP_BLOCK_SIZE	512
+
+/**
+ * struct sb_tftp - State of the fake TFTP server
+ *
+ * @data: File being served
+ * @size: Size of the file
+ * @blksize: Block size to accept, 0 to leave the default of 512
+ * @windowsize: Window size to accept
+ * @drop: Block to leave out the first time it is sent, 0 for none
+ * @swap: Block to send after the following one, 0 for none. The ack the
+ *	client sends on seeing the gap is lost.
+ * @window_end: Last block of the window sent last
+ * @acks: Number of acks received
+ * @short_acks: Number of acks which did not end the window sent last
+ */
+static struct sb_tftp {
+	const uchar *data;
+	int size;
+	int blksize;
+	int windowsize;
+	int drop;
+	int swap;
+	int window_end;
+	int acks;
+	int short_acks;
+} sb_tftp;
+
+/* Queue a TFTP packet from the server in answer to the client's packet */
+static void sb_tftp_send(struct udevice *dev, void *packet, const void *tftp,
+			 int len)
+{
+	struct eth_sandbox_priv *priv = dev_get_priv(dev);
+	struct ethernet_hdr *eth = packet;
+	struct ip_udp_hdr *ip = packet + ETHER_HDR_SIZE;
+	struct ethernet_hdr *eth_recv;
+	struct ip_udp_hdr *ipr;
+
+	/* Anything which does not fit in the receive buffers is lost */
+	if (priv->recv_packets >= PKTBUFSRX)
+		return;
+
+	eth_recv = (void *)priv->recv_packet_buffer[priv->recv_packets];
+	memcpy(eth_recv->et_dest, eth->et_src, ARP_HLEN);
+	memcpy(eth_recv->et_src, priv->fake_host_hwaddr, ARP_HLEN);
+	eth_recv->et_protlen = htons(PROT_IP);
+
+	ipr = (void *)eth_recv + ETHER_HDR_SIZE;
+	ipr->ip_hl_v = 0x45;
+	ipr->ip_tos = 0;
+	ipr->ip_len = htons(IP_UDP_HDR_SIZE + len);
+	ipr->ip_id = 0;
+	ipr->ip_off = htons(IP_FLAGS_DFRAG);
+	ipr->ip_ttl = 255;
+	ipr->ip_p = IPPROTO_UDP;
+	ipr->ip_sum = 0;
+	net_copy_ip(&ipr->ip_dst, &ip->ip_src);
+	net_copy_ip(&ipr->ip_src, &ip->ip_dst);
+	ipr->ip_sum = compute_ip_checksum(ipr, IP_HDR_SIZE);
+
+	ipr->udp_src = htons(TFTP_TID);
+	ipr->udp_dst = ip->udp_src;
+	ipr->udp_len = htons(UDP_HDR_SIZE + len);
+	ipr->udp_xsum = 0;
+	memcpy((void *)ipr + IP_UDP_HDR_SIZE, tftp, len);
+
+	priv->recv_packet_length[priv->recv_packets] =
+		ETHER_HDR_SIZE + IP_UDP_HDR_SIZE + len;
+	++priv->recv_packets;
+}
+
+/* Answer a read request with the options the server accepts */
+static void sb_tftp_oack(struct udevice *dev, void *packet)
+{
+	char buf[80];
+	int len = 2;
+
+	*(__be16 *)buf = htons(TFTP_OACK);
+	len += sprintf(buf + len, "tsize%c%d", 0, sb_tftp.size) + 1;
+	if (sb_tftp.blksize)
+		len += sprintf(buf + len, "blksize%c%d", 0,
+			       sb_tftp.blksize) + 1;
+	len += sprintf(buf + len, "windowsize%c%d", 0,
+		       sb_tftp.windowsize) + 1;
+
+	sb_tftp.window_end = 0;
+	sb_tftp_send(dev, packet, buf, len);
+}
+
+/* Send a data block */
+static void sb_tftp_data(struct udevice *dev, void *packet, int block)
+{
+	int blksize = sb_tftp.blksize ?: TFTP_BLOCK_SIZE;
+	int offset = (block - 1) * blksize;
+	uchar buf[4 + 1468];
+	int len;
+
+	len = min(sb_tftp.size - offset, blksize);
+	*(__be16 *)buf = htons(TFTP_DATA);
+	*(__be16 *)(buf + 2) = htons(block);
+	memcpy(buf + 4, sb_tftp.data + offset, len);
+	sb_tftp_send(dev, packet, buf, 4 + len);
+}
+
+/* Answer an ack with the next window, as an RFC 7440 server does */
+static void sb_tftp_ack(struct udevice *dev, void *packet, int block)
+{
+	int blksize = sb_tftp.blksize ?: TFTP_BLOCK_SIZE;
+	int last = sb_tftp.size / blksize + 1;
+	int end, i;
+
+	sb_tftp.acks++;
+	if (block != sb_tftp.window_end) {
+		sb_tftp.short_acks++;
+		/* The block it asks for is on its way already */
+		if (block + 1 == sb_tftp.swap) {
+			sb_tftp.swap = 0;
+			return;
+		}
+	}
+	if (block >= last)
+		return;
+
+	end = min(block + sb_tftp.windowsize, last);
+	for (i = block + 1; i <= end; i++) {
+		if (i == sb_tftp.drop) {
+			sb_tftp.drop = 0;
+		} else if (i == sb_tftp.swap && i < end) {
+			sb_tftp_data(dev, packet, i + 1);
+			sb_tftp_data(dev, packet, i);
+			i++;
+		} else {
+			sb_tftp_data(dev, packet, i);
+		}
+	}
+	sb_tftp.window_end = end;
+}
+
+static int sb_tftp_handler(struct udevice *dev, void *packet,
+			   unsigned int len)
+{
+	struct ethernet_hdr *eth = packet;
+	struct ip_udp_hdr *ip = packet + ETHER_HDR_SIZE;
+	__be16 *s = (void *)ip + IP_UDP_HDR_SIZE;
+
+	if (ntohs(eth->et_protlen) == PROT_ARP)
+		return sandbox_eth_arp_req_to_reply(dev, packet, len);
+	if (ntohs(eth->et_protlen) != PROT_IP || ip->ip_p != IPPROTO_UDP)
+		return 0;
+
+	if (ntohs(ip->udp_dst) == TFTP_PORT && ntohs(s[0]) == TFTP_RRQ)
+		sb_tftp_oack(dev, packet);
+	else if (ntohs(ip->udp_dst) == TFTP_TID && ntohs(s[0]) == TFTP_ACK)
+		sb_tftp_ack(dev, packet, ntohs(s[1]));
+
+	return 0;
+}
+
+/* Serve a file to tftpboot, and check that it arrived intact */
+static int sb_tftp_run(struct unit_test_state *uts, uchar *data, int size)
+{
+	int i;
+
+	for (i = 0; i < size; i++)
+		data[i] = i * 7 + (i >> 9);
+	sb_tftp.data = data;
+	sb_tftp.size = size;
+
+	sandbox_eth_set_tx_handler(0, sb_tftp_handler);
+	env_set("ethact", "eth@10002000");
+	env_set("ethrotate", "no");
+	env_set("loadaddr", "0x20000");
+	env_set_ulong("tftpwindowsize", sb_tftp.windowsize);
+	ut_assertok(console_record_reset_enable());
+	ut_assertok(run_command("tftpboot ${loadaddr} 1.1.2.2:file", 0));
+	sandbox_eth_set_tx_handler(0, NULL);
+	env_set("tftpwindowsize", NULL);
+
+	ut_asserteq(size, env_get_hex("filesize", 0));
+	ut_asserteq_mem(data, map_sysmem(0x20000, size), size);
+
+	return 0;
+}
+
+static int net_test_tftp_window(struct unit_test_state *uts)
+{
+	static uchar data[19 * TFTP_BLOCK_SIZE + 100];
+
+	if (!IS_ENABLED(CONFIG_TFTP_WINDOW_ADAPTIVE))
+		return -EAGAIN;
+
+	memset(&sb_tftp, 0, sizeof(sb_tftp));
+	sb_tftp.windowsize = 3;
+	sb_tftp.drop = 5;
+	sb_tftp.swap = 11;
+	ut_assertok(sb_tftp_run(uts, data, sizeof(data)));
+
+	/* Only the two gaps may be acked before the end of a window */
+	ut_asserteq(2, sb_tftp.short_acks);
+	ut_assert_skip_to_line("\t 2 retransmits, 0 timeouts, 2 out of order, 0 duplicates");
+
+	return 0;
+}
+
+LIB_TEST(net_test_tftp_window, 0);
+
+static int net_test_tftp_split(struct unit_test_state *uts)
+{
+	static uchar data[30 * 1468 + 100];
+
+	if (!IS_ENABLED(CONFIG_TFTP_ZERO_COPY) ||
+	    !IS_ENABLED(CONFIG_TFTP_WINDOW_ADAPTIVE))
+		return -EAGAIN;
+
+	memset(&sb_tftp, 0, sizeof(sb_tftp));
+	sb_tftp.blksize = 1468;
+	sb_tftp.windowsize = 3;
+	sb_tftp.swap = 13;
+	ut_assertok(sb_tftp_run(uts, data, sizeof(data)));
+
+	/*
+	 * The first blocks go into the device's own buffers and the final one
+	 * is short. The two swapped blocks land in each other's place, and so
+	 * do the two which come in on the places posted in return for them.
+	 */
+	ut_assert_skip_to_line("\t 1 retransmits, 0 timeouts, 1 out of order, 0 duplicates");
+	ut_assert_nextline("\t 18 blocks received in place");
+
+	return 0;
+}
+
+LIB_TEST(net_test_tftp_split, 0);
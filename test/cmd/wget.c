@@ -13,9 +13,11 @@
 #include <fdtdec.h>
 #include <log.h>
 #include <malloc.h>
+#include <mapmem.h>
 #include <net.h>
 #include <net/tcp.h>
 #include <net/wget.h>
+#include <time.h>
 #include <asm/eth.h>
 #include <dm/test.h>
 #include <dm/device-internal.h>
@@ -191,6 +193,7 @@ static int net_test_wget(struct unit_test_state *uts)
 	env_set("ethact", "eth@10002000");
 	env_set("ethrotate", "no");
 	env_set("loadaddr", "0x20000");
+	tcp_set_tcp_state(TCP_CLOSED);
 	ut_assertok(run_command("wget ${loadaddr} 1.1.2.2:/index.html", 0));
 
 	sandbox_eth_set_tx_handler(0, NULL);
@@ -204,3 +207,276 @@ static int net_test_wget(struct unit_test_state *uts)
 }
 
 LIB_TEST(net_test_wget, 0);
+
+/* Acknowledgments sent by the client while the body arrives */
+static u32 ooo_acks[8];
+static int ooo_nacks;
+
+static void sb_ooo_segment(struct udevice *dev, struct ip_tcp_hdr *tcp,
+			   u32 seq, const char *payload, int payload_len)
+{
+	struct eth_sandbox_priv *priv = dev_get_priv(dev);
+	struct ethernet_hdr *eth = (void *)tcp - ETHER_HDR_SIZE;
+	struct ethernet_hdr *eth_send;
+	struct ip_tcp_hdr *tcp_send;
+	int pkt_len;
+
+	eth_send = (void *)priv->recv_packet_buffer[priv->recv_packets];
+	memcpy(eth_send->et_dest, eth->et_src, ARP_HLEN);
+	memcpy(eth_send->et_src, priv->fake_host_hwaddr, ARP_HLEN);
+	eth_send->et_protlen = htons(PROT_IP);
+	tcp_send = (void *)eth_send + ETHER_HDR_SIZE;
+	tcp_send->tcp_src = tcp->tcp_dst;
+	tcp_send->tcp_dst = tcp->tcp_src;
+	tcp_send->tcp_seq = htonl(seq);
+	tcp_send->tcp_ack = tcp->tcp_seq;
+	tcp_send->tcp_flags = TCP_ACK;
+	memcpy((void *)tcp_send + IP_TCP_HDR_SIZE, payload, payload_len);
+
+	tcp_send->tcp_hlen = SHIFT_TO_TCPHDRLEN_FIELD(LEN_B_TO_DW(TCP_HDR_SIZE));
+	tcp_send->tcp_win = htons(PKTBUFSRX * TCP_MSS >> TCP_SCALE);
+	tcp_send->tcp_xsum = 0;
+	tcp_send->tcp_ugr = 0;
+	pkt_len = IP_TCP_HDR_SIZE + payload_len;
+	tcp_send->tcp_xsum = tcp_set_pseudo_header((uchar *)tcp_send,
+						   tcp->ip_src,
+						   tcp->ip_dst,
+						   pkt_len - IP_HDR_SIZE,
+						   pkt_len);
+	net_set_ip_header((uchar *)tcp_send,
+			  tcp->ip_src,
+			  tcp->ip_dst,
+			  pkt_len,
+			  IPPROTO_TCP);
+
+	priv->recv_packet_length[priv->recv_packets] =
+		ETHER_HDR_SIZE + pkt_len;
+	++priv->recv_packets;
+}
+
+/* Answer the request with the second half of the response first */
+static int sb_ooo_handler(struct udevice *dev, void *packet,
+			  unsigned int len)
+{
+	struct eth_sandbox_priv *priv = dev_get_priv(dev);
+	struct ethernet_hdr *eth = packet;
+	struct ip_tcp_hdr *tcp = packet + ETHER_HDR_SIZE;
+	const char *payload = "HTTP/1.1 200 OK\r\n"
+		"Content-Length: 40\r\n\r\n"
+		"<html><body>Out of order</body></html>\r\n";
+	int split = strlen(payload) - 20;
+	int req_len;
+
+	if (ntohs(eth->et_protlen) == PROT_ARP)
+		return sb_arp_handler(dev, packet, len);
+	if (ntohs(eth->et_protlen) != PROT_IP || tcp->ip_p != IPPROTO_TCP)
+		return -EPROTONOSUPPORT;
+	if (tcp->tcp_flags == TCP_SYN)
+		return sb_syn_handler(dev, packet, len);
+	if (!(tcp->tcp_flags & TCP_ACK))
+		return 0;
+
+	req_len = ntohs(tcp->ip_len) - IP_HDR_SIZE - (tcp->tcp_hlen >> 2);
+	if (!req_len) {
+		if (ooo_nacks < ARRAY_SIZE(ooo_acks))
+			ooo_acks[ooo_nacks++] = ntohl(tcp->tcp_ack);
+		return 0;
+	}
+
+	/* Don't allow the buffer to overrun */
+	if (priv->recv_packets + 2 > PKTBUFSRX)
+		return 0;
+
+	ooo_nacks = 0;
+	tcp->tcp_seq = htonl(ntohl(tcp->tcp_seq) + req_len);
+	sb_ooo_segment(dev, tcp, 1 + split, payload + split,
+		       strlen(payload) - split);
+	sb_ooo_segment(dev, tcp, 1, payload, split);
+
+	return 0;
+}
+
+static int net_test_wget_ooo(struct unit_test_state *uts)
+{
+	int total = strlen("HTTP/1.1 200 OK\r\nContent-Length: 40\r\n\r\n") +
+		40;
+
+	sandbox_eth_set_tx_handler(0, sb_ooo_handler);
+	sandbox_eth_set_priv(0, uts);
+
+	env_set("ethact", "eth@10002000");
+	env_set("ethrotate", "no");
+	env_set("loadaddr", "0x20000");
+	/* Do not pick up a connection left open by another test */
+	tcp_set_tcp_state(TCP_CLOSED);
+	ut_assertok(run_command("wget ${loadaddr} 1.1.2.2:/index.html", 0));
+
+	sandbox_eth_set_tx_handler(0, NULL);
+
+	/* The hole must not be acknowledged until it is filled */
+	ut_asserteq(2, ooo_nacks);
+	ut_asserteq(1, ooo_acks[0]);
+	ut_asserteq(1 + total, ooo_acks[1]);
+
+	ut_assertok(console_record_reset_enable());
+	run_command("md5sum ${loadaddr} ${filesize}", 0);
+	ut_assert_nextline("md5 for 00020000 ... 00020027 ==> 5184d528332c72e76e7a66ecdcfdba16");
+	ut_assertok(ut_check_console_end(uts));
+
+	return 0;
+}
+
+LIB_TEST(net_test_wget_ooo, 0);
+
+/* Body served by the keep-alive and resume tests, and how it is served */
+static const char ka_body[] =
+	"<html><body>This response is served in two parts</body></html>\n";
+static int ka_syns;		/* connections opened by the client */
+static int ka_requests;		/* requests received */
+static int ka_ranges;		/* requests for the part not yet sent */
+static u32 ka_seq;		/* server's next sequence number */
+static bool ka_stall;		/* send part of the first response only */
+static bool ka_stalled;		/* waiting for the client to give up */
+
+#define KA_SPLIT	20
+
+/* Answer each request on the connection it came in on, leaving it open */
+static int sb_ka_handler(struct udevice *dev, void *packet, unsigned int len)
+{
+	struct eth_sandbox_priv *priv = dev_get_priv(dev);
+	struct ethernet_hdr *eth = packet;
+	struct ip_tcp_hdr *tcp = packet + ETHER_HDR_SIZE;
+	int body_len = strlen(ka_body);
+	char buf[256];
+	int req_len, hdr_len;
+
+	if (ntohs(eth->et_protlen) == PROT_ARP)
+		return sb_arp_handler(dev, packet, len);
+	if (ntohs(eth->et_protlen) != PROT_IP || tcp->ip_p != IPPROTO_TCP)
+		return -EPROTONOSUPPORT;
+	if (tcp->tcp_flags & TCP_RST)
+		return 0;
+	if (tcp->tcp_flags == TCP_SYN) {
+		ka_syns++;
+		ka_seq = 1;
+		ka_stalled = false;
+		return sb_syn_handler(dev, packet, len);
+	}
+	if (!(tcp->tcp_flags & TCP_ACK))
+		return 0;
+
+	req_len = ntohs(tcp->ip_len) - IP_HDR_SIZE - (tcp->tcp_hlen >> 2);
+	if (!req_len) {
+		/* Let the client's timeouts expire straight away */
+		if (ka_stalled)
+			timer_test_add_offset(100000);
+		return 0;
+	}
+
+	/* Don't allow the buffer to overrun */
+	if (priv->recv_packets >= PKTBUFSRX)
+		return 0;
+
+	ka_requests++;
+	memcpy(buf, (void *)tcp + IP_HDR_SIZE + (tcp->tcp_hlen >> 2),
+	       min(req_len, (int)sizeof(buf) - 1));
+	buf[min(req_len, (int)sizeof(buf) - 1)] = '\0';
+	tcp->tcp_seq = htonl(ntohl(tcp->tcp_seq) + req_len);
+
+	if (strstr(buf, "\r\nRange: bytes=" __stringify(KA_SPLIT) "-\r\n")) {
+		ka_ranges++;
+		hdr_len = sprintf(buf, "HTTP/1.1 206 Partial Content\r\n"
+				  "Content-Range: bytes %d-%d/%d\r\n"
+				  "Content-Length: %d\r\n\r\n", KA_SPLIT,
+				  body_len - 1, body_len, body_len - KA_SPLIT);
+		strcpy(buf + hdr_len, ka_body + KA_SPLIT);
+	} else {
+		hdr_len = sprintf(buf, "HTTP/1.1 200 OK\r\n"
+				  "Content-Length: %d\r\n"
+				  "Accept-Ranges: bytes\r\n\r\n", body_len);
+		strcpy(buf + hdr_len, ka_body);
+		if (ka_stall) {
+			buf[hdr_len + KA_SPLIT] = '\0';
+			ka_stall = false;
+			ka_stalled = true;
+		}
+	}
+
+	sb_ooo_segment(dev, tcp, ka_seq, buf, strlen(buf));
+	ka_seq += strlen(buf);
+
+	return 0;
+}
+
+/* Fetch ka_body, after filling the place it goes with zeroes */
+static int sb_ka_wget(struct unit_test_state *uts)
+{
+	int body_len = strlen(ka_body);
+
+	memset(map_sysmem(0x20000, body_len), '\0', body_len);
+	ut_assertok(run_command("wget ${loadaddr} 1.1.2.2:/index.html", 0));
+	ut_asserteq(body_len, env_get_hex("filesize", 0));
+	ut_asserteq_mem(ka_body, map_sysmem(0x20000, body_len), body_len);
+
+	return 0;
+}
+
+static int net_test_wget_keep_alive(struct unit_test_state *uts)
+{
+	sandbox_eth_set_tx_handler(0, sb_ka_handler);
+	sandbox_eth_set_priv(0, uts);
+
+	env_set("ethact", "eth@10002000");
+	env_set("ethrotate", "no");
+	env_set("loadaddr", "0x20000");
+	tcp_set_tcp_state(TCP_CLOSED);
+	ka_syns = 0;
+	ka_requests = 0;
+	ka_ranges = 0;
+	ka_stall = false;
+	ut_assertok(sb_ka_wget(uts));
+	ut_asserteq(TCP_ESTABLISHED, tcp_get_tcp_state());
+
+	/* The second request goes on the connection the first one opened */
+	ut_assertok(sb_ka_wget(uts));
+	ut_asserteq(1, ka_syns);
+	ut_asserteq(2, ka_requests);
+	ut_asserteq(0, ka_ranges);
+
+	sandbox_eth_set_tx_handler(0, NULL);
+	tcp_set_tcp_state(TCP_CLOSED);
+
+	return 0;
+}
+
+LIB_TEST(net_test_wget_keep_alive, 0);
+
+static int net_test_wget_resume(struct unit_test_state *uts)
+{
+	sandbox_eth_set_tx_handler(0, sb_ka_handler);
+	sandbox_eth_set_priv(0, uts);
+
+	env_set("ethact", "eth@10002000");
+	env_set("ethrotate", "no");
+	env_set("loadaddr", "0x20000");
+	tcp_set_tcp_state(TCP_CLOSED);
+	ka_syns = 0;
+	ka_requests = 0;
+	ka_ranges = 0;
+	ka_stall = true;
+	ut_assertok(console_record_reset_enable());
+	ut_assertok(sb_ka_wget(uts));
+
+	/* Only the part which did not arrive is asked for again */
+	ut_assert_skip_to_line("Resuming at 0x%x", KA_SPLIT);
+	ut_asserteq(2, ka_syns);
+	ut_asserteq(2, ka_requests);
+	ut_asserteq(1, ka_ranges);
+
+	sandbox_eth_set_tx_handler(0, NULL);
+	tcp_set_tcp_state(TCP_CLOSED);
+
+	return 0;
+}
+
+LIB_TEST(net_test_wget_resume, 0);
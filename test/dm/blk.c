@@ -5,6 +5,7 @@
 
 #include <common.h>
 #include <blk.h>
+#include <blkmap.h>
 #include <dm.h>
 #include <part.h>
 #include <sandbox_host.h>
@@ -335,3 +336,252 @@ static int dm_test_blk_foreach(struct unit_test_state *uts)
 	return 0;
 }
 DM_TEST(dm_test_blk_foreach, UT_TESTF_SCAN_PDATA | UT_TESTF_SCAN_FDT);
+
+#define CACHE_BLKSZ	0x200
+
+static char cache_mem[32 * CACHE_BLKSZ];
+static char cache_buf[16 * CACHE_BLKSZ];
+
+/* Check that block @blk in cache_buf at @pos holds @val */
+static int check_cache_blk(struct unit_test_state *uts, int pos, int val)
+{
+	char expect[CACHE_BLKSZ];
+
+	memset(expect, val, sizeof(expect));
+	ut_asserteq_mem(expect, cache_buf + pos * CACHE_BLKSZ, CACHE_BLKSZ);
+
+	return 0;
+}
+
+/* Change the data behind the cache, so that cached blocks can be told apart */
+static void change_cache_mem(int val)
+{
+	int i;
+
+	for (i = 0; i < 32; i++)
+		memset(cache_mem + i * CACHE_BLKSZ, val + i, CACHE_BLKSZ);
+}
+
+/* Get the cache state of a block device */
+static int get_cache_stats(struct blk_desc *desc,
+			   struct block_cache_dev_stats *dstats)
+{
+	int i;
+
+	for (i = 0; !blkcache_dev_stats(i, dstats); i++) {
+		if (dstats->iftype == desc->uclass_id &&
+		    dstats->devnum == desc->devnum)
+			return 0;
+	}
+
+	return -ENOENT;
+}
+
+/* Test the block cache, including partial hits and per-device sizing */
+static int dm_test_blk_cache(struct unit_test_state *uts)
+{
+	struct block_cache_dev_stats dstats;
+	struct block_cache_stats stats;
+	struct udevice *dev, *blk;
+	struct blk_desc *desc;
+
+	ut_assertok(blkmap_create("cachetest", &dev));
+	ut_assertok(blk_get_from_parent(dev, &blk));
+	desc = dev_get_uclass_plat(blk);
+	ut_assertok(blkmap_map_mem(dev, 0, 32, cache_mem));
+	blkcache_configure(8, 32);
+	blkcache_stats(&stats);
+
+	/* Blocks 2-5 are cached */
+	change_cache_mem(0);
+	ut_asserteq(4, blk_read(blk, 2, 4, cache_buf));
+	ut_assertok(check_cache_blk(uts, 0, 2));
+
+	/* Blocks 3-5 come from the cache, 6 and 7 from the device */
+	change_cache_mem(0x40);
+	ut_asserteq(5, blk_read(blk, 3, 5, cache_buf));
+	ut_assertok(check_cache_blk(uts, 0, 3));
+	ut_assertok(check_cache_blk(uts, 2, 5));
+	ut_assertok(check_cache_blk(uts, 3, 0x46));
+	ut_assertok(check_cache_blk(uts, 4, 0x47));
+
+	/* Blocks 0 and 1 come from the device, 2 and 3 from the cache */
+	ut_asserteq(4, blk_read(blk, 0, 4, cache_buf));
+	ut_assertok(check_cache_blk(uts, 0, 0x40));
+	ut_assertok(check_cache_blk(uts, 1, 0x41));
+	ut_assertok(check_cache_blk(uts, 2, 2));
+	ut_assertok(check_cache_blk(uts, 3, 3));
+
+	/* All of these come from the cache */
+	ut_asserteq(8, blk_read(blk, 0, 8, cache_buf));
+	ut_assertok(check_cache_blk(uts, 5, 5));
+	ut_assertok(check_cache_blk(uts, 7, 0x47));
+
+	blkcache_stats(&stats);
+	ut_asserteq(1, stats.hits);
+	ut_asserteq(2, stats.partial);
+	ut_asserteq(1, stats.misses);
+	ut_assertok(get_cache_stats(desc, &dstats));
+	ut_asserteq(8, dstats.blocks);
+	ut_asserteq(false, dstats.configured);
+
+	/* Reads larger than an entry are not cached */
+	ut_asserteq(9, blk_read(blk, 16, 9, cache_buf));
+	ut_assertok(get_cache_stats(desc, &dstats));
+	ut_asserteq(8, dstats.blocks);
+
+	/* Room for two blocks only, so the least recently used one goes */
+	ut_assertok(blkcache_configure_dev(desc->uclass_id, desc->devnum, 1,
+					   2));
+	change_cache_mem(0);
+	ut_asserteq(1, blk_read(blk, 8, 1, cache_buf));
+	ut_asserteq(1, blk_read(blk, 9, 1, cache_buf));
+	ut_asserteq(1, blk_read(blk, 8, 1, cache_buf));
+	ut_asserteq(1, blk_read(blk, 10, 1, cache_buf));
+	ut_assertok(get_cache_stats(desc, &dstats));
+	ut_asserteq(2, dstats.blocks);
+	ut_asserteq(true, dstats.configured);
+
+	change_cache_mem(0x40);
+	ut_asserteq(3, blk_read(blk, 8, 3, cache_buf));
+	ut_assertok(check_cache_blk(uts, 0, 8));
+	ut_assertok(check_cache_blk(uts, 1, 0x49));
+	ut_assertok(check_cache_blk(uts, 2, 10));
+
+	/* A write drops the cache of the device */
+	ut_asserteq(1, blk_write(blk, 0, 1, cache_buf));
+	ut_assertok(get_cache_stats(desc, &dstats));
+	ut_asserteq(0, dstats.blocks);
+
+	ut_assertok(blkmap_destroy(dev));
+
+	return 0;
+}
+DM_TEST(dm_test_blk_cache, UT_TESTF_SCAN_PDATA | UT_TESTF_SCAN_FDT);
+
+/* Test that sequential reads are read ahead into the block cache */
+static int dm_test_blk_readahead(struct unit_test_state *uts)
+{
+	struct block_cache_stats stats;
+	struct udevice *dev, *blk;
+	int i;
+
+	if (!CONFIG_BLOCK_CACHE_READAHEAD)
+		return -EAGAIN;
+
+	ut_assertok(blkmap_create("ratest", &dev));
+	ut_assertok(blk_get_from_parent(dev, &blk));
+	ut_assertok(blkmap_map_mem(dev, 0, 32, cache_mem));
+	blkcache_configure(8, 32);
+	blkcache_stats(&stats);
+
+	/* This reads blocks 1-4 ahead */
+	change_cache_mem(0);
+	ut_asserteq(1, blk_read(blk, 0, 1, cache_buf));
+	ut_assertok(check_cache_blk(uts, 0, 0));
+
+	/* Reading block 3 uses up half the window, so 5-11 are read ahead */
+	change_cache_mem(0x40);
+	for (i = 1; i < 4; i++) {
+		ut_asserteq(1, blk_read(blk, i, 1, cache_buf));
+		ut_assertok(check_cache_blk(uts, 0, i));
+	}
+	ut_asserteq(2, blk_read(blk, 4, 2, cache_buf));
+	ut_assertok(check_cache_blk(uts, 0, 4));
+	ut_assertok(check_cache_blk(uts, 1, 0x45));
+
+	/* Nothing is read ahead for a read elsewhere */
+	ut_asserteq(1, blk_read(blk, 20, 1, cache_buf));
+	ut_assertok(check_cache_blk(uts, 0, 0x54));
+
+	blkcache_stats(&stats);
+	ut_asserteq(11, stats.ra_blocks);
+	ut_asserteq(5, stats.ra_hits);
+
+	/* Reading on from block 21 starts a new, small window */
+	change_cache_mem(0);
+	ut_asserteq(1, blk_read(blk, 21, 1, cache_buf));
+	ut_asserteq(1, blk_read(blk, 22, 1, cache_buf));
+	ut_assertok(check_cache_blk(uts, 0, 22));
+	blkcache_stats(&stats);
+	ut_asserteq(4, stats.ra_blocks);
+	ut_asserteq(1, stats.ra_hits);
+
+	ut_assertok(blkmap_destroy(dev));
+
+	return 0;
+}
+DM_TEST(dm_test_blk_readahead, UT_TESTF_SCAN_PDATA | UT_TESTF_SCAN_FDT);
+
+/* Test asynchronous requests, with and without support in the driver */
+static int dm_test_blk_async(struct unit_test_state *uts)
+{
+	struct blk_req req = {}, req2 = {};
+	struct udevice *dev, *blk;
+	struct blk_desc *desc;
+
+	/* blkmap has no submit() method, so requests complete at once */
+	ut_assertok(blkmap_create("async", &dev));
+	ut_assertok(blk_get_from_parent(dev, &blk));
+	ut_assertok(blkmap_map_mem(dev, 0, 32, cache_mem));
+	change_cache_mem(0);
+	req.start = 3;
+	req.blkcnt = 2;
+	req.buffer = cache_buf;
+	ut_assertok(blk_submit(blk, &req));
+	ut_asserteq(BLK_REQ_DONE, req.state);
+	ut_assertok(blk_poll(&req));
+	ut_asserteq(2, blk_wait(&req));
+	ut_assertok(check_cache_blk(uts, 0, 3));
+	ut_assertok(check_cache_blk(uts, 1, 4));
+	ut_assertok(blkmap_destroy(dev));
+
+	/* The sandbox MMC only transfers the data when polled */
+	ut_assertok(uclass_get_device(UCLASS_MMC, 0, &dev));
+	ut_assertok(blk_get_device_by_str("mmc", "0", &desc));
+	blk = desc->bdev;
+	change_cache_mem(0x10);
+	ut_asserteq(16, blk_write(blk, 0, 16, cache_mem));
+
+	memset(cache_buf, '\0', sizeof(cache_buf));
+	req.start = 2;
+	req.blkcnt = 4;
+	ut_assertok(blk_submit(blk, &req));
+	ut_asserteq(BLK_REQ_PENDING, req.state);
+	ut_assertok(check_cache_blk(uts, 0, 0));
+
+	/* Only one request can be in progress */
+	req2.start = 8;
+	req2.blkcnt = 1;
+	req2.buffer = cache_buf + 8 * CACHE_BLKSZ;
+	ut_asserteq(-EBUSY, blk_submit(blk, &req2));
+	ut_asserteq(BLK_REQ_IDLE, req2.state);
+
+	ut_assertok(blk_poll(&req));
+	ut_asserteq(BLK_REQ_DONE, req.state);
+	ut_asserteq(4, req.result);
+	ut_assertok(check_cache_blk(uts, 0, 0x12));
+	ut_assertok(check_cache_blk(uts, 3, 0x15));
+
+	/* The blocks are in the block cache now, so this completes at once */
+	memset(cache_buf, '\0', sizeof(cache_buf));
+	ut_assertok(blk_submit(blk, &req));
+	ut_asserteq(BLK_REQ_DONE, req.state);
+	ut_asserteq(4, blk_wait(&req));
+	ut_assertok(check_cache_blk(uts, 0, 0x12));
+
+	/* A synchronous read finishes the request in progress first */
+	req.start = 8;
+	req.blkcnt = 2;
+	ut_assertok(blk_submit(blk, &req));
+	ut_asserteq(BLK_REQ_PENDING, req.state);
+	ut_asserteq(1, blk_read(blk, 12, 1, cache_buf + 4 * CACHE_BLKSZ));
+	ut_asserteq(BLK_REQ_DONE, req.state);
+	ut_asserteq(2, blk_wait(&req));
+	ut_assertok(check_cache_blk(uts, 0, 0x18));
+	ut_assertok(check_cache_blk(uts, 1, 0x19));
+	ut_assertok(check_cache_blk(uts, 4, 0x1c));
+
+	return 0;
+}
+DM_TEST(dm_test_blk_async, UT_TESTF_SCAN_PDATA | UT_TESTF_SCAN_FDT);
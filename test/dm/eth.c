@@ -617,6 +617,115 @@ static int dm_test_eth_async_ping_reply(struct unit_test_state *uts)
 
 DM_TEST(dm_test_eth_async_ping_reply, UT_TESTF_SCAN_FDT);
 
+/* What sb_rx_split_handler() and sb_rx_split_tx_handler() saw */
+static struct {
+	uchar *data;
+	int len;
+	int frames;
+	int echo_replies;
+	bool consume;
+} rx_split;
+
+static bool sb_rx_split_handler(uchar *hdr, uchar *data, int len)
+{
+	rx_split.data = data;
+	rx_split.len = len;
+	rx_split.frames++;
+
+	return rx_split.consume;
+}
+
+static int sb_rx_split_tx_handler(struct udevice *dev, void *packet,
+				  unsigned int len)
+{
+	struct ip_udp_hdr *ip = packet + ETHER_HDR_SIZE;
+	struct icmp_hdr *icmp = (struct icmp_hdr *)&ip->udp_src;
+
+	if (ip->ip_p == IPPROTO_ICMP && icmp->type == ICMP_ECHO_REPLY)
+		rx_split.echo_replies++;
+
+	return 0;
+}
+
+/* Check receiving with header split */
+static int dm_test_eth_rx_split(struct unit_test_state *uts)
+{
+	int hdr_len = ETHER_HDR_SIZE + IP_HDR_SIZE;
+	struct in_addr old_ip = net_ip;
+	struct icmp_hdr *icmp;
+	struct udevice *dev;
+	uchar buf[64];
+	int i;
+
+	net_ip = string_to_ip("1.1.2.2");
+	sandbox_eth_set_tx_handler(0, sb_rx_split_tx_handler);
+	env_set("ethact", "eth@10002000");
+	ut_assertok(net_init());
+	ut_assertok(eth_init());
+	dev = eth_get_dev();
+	memset(&rx_split, '\0', sizeof(rx_split));
+
+	ut_asserteq(SANDBOX_ETH_SPLIT_BUFS,
+		    eth_rx_split_start(hdr_len, sb_rx_split_handler));
+	ut_asserteq(-EBUSY, eth_rx_split_start(hdr_len, sb_rx_split_handler));
+
+	/* The device starts out with its own buffers */
+	ut_asserteq(-ENOSPC, eth_rx_split_post(buf, sizeof(buf)));
+	rx_split.consume = true;
+	ut_assertok(sandbox_eth_recv_ping_req(dev));
+	eth_rx();
+	ut_asserteq(1, rx_split.frames);
+	ut_assert(rx_split.data != buf);
+
+	/* A buffer posted is used after the ones the device has */
+	ut_asserteq(-EINVAL, eth_rx_split_post(buf, PKTSIZE));
+	ut_assertok(eth_rx_split_post(buf, sizeof(buf)));
+	for (i = 1; i < SANDBOX_ETH_SPLIT_BUFS; i++) {
+		ut_assertok(sandbox_eth_recv_ping_req(dev));
+		eth_rx();
+		ut_assert(rx_split.data != buf);
+	}
+	ut_asserteq(SANDBOX_ETH_SPLIT_BUFS, rx_split.frames);
+
+	/* The ICMP header goes into the buffer posted */
+	ut_assertok(sandbox_eth_recv_ping_req(dev));
+	eth_rx();
+	ut_asserteq(SANDBOX_ETH_SPLIT_BUFS + 1, rx_split.frames);
+	ut_asserteq(ETHER_HDR_SIZE + IP_ICMP_HDR_SIZE, rx_split.len);
+	ut_asserteq_ptr(buf, rx_split.data);
+	icmp = (struct icmp_hdr *)buf;
+	ut_asserteq(ICMP_ECHO_REQUEST, icmp->type);
+	ut_asserteq(0, rx_split.echo_replies);
+
+	/* With no buffer posted, the frame is dropped */
+	ut_assertok(sandbox_eth_recv_ping_req(dev));
+	eth_rx();
+	ut_asserteq(SANDBOX_ETH_SPLIT_BUFS + 1, rx_split.frames);
+
+	/* A frame the handler leaves alone is processed as usual */
+	rx_split.consume = false;
+	ut_assertok(eth_rx_split_post(NULL, 0));
+	ut_assertok(sandbox_eth_recv_ping_req(dev));
+	eth_rx();
+	ut_asserteq(SANDBOX_ETH_SPLIT_BUFS + 2, rx_split.frames);
+	ut_asserteq(1, rx_split.echo_replies);
+
+	/* Once stopped, frames no longer go to the handler */
+	eth_rx_split_stop();
+	ut_assertok(sandbox_eth_recv_ping_req(dev));
+	eth_rx();
+	ut_asserteq(SANDBOX_ETH_SPLIT_BUFS + 2, rx_split.frames);
+	ut_asserteq(2, rx_split.echo_replies);
+
+	eth_halt();
+	sandbox_eth_set_tx_handler(0, NULL);
+	net_ip = old_ip;
+
+	return 0;
+}
+
+DM_TEST(dm_test_eth_rx_split, UT_TESTF_SCAN_FDT);
+
 #if IS_ENABLED(CONFIG_IPV6_ROUTER_DISCOVERY)
 
 static u8 ip6_ra_buf[] = {0x60, 0xf, 0xc5, 0x4a, 0x0, 0x38, 0x3a, 0xff, 0xfe,
@@ -7,6 +7,7 @@
 #include <dm.h>
 #include <mmc.h>
 #include <part.h>
+#include <asm/test.h>
 #include <dm/test.h>
 #include <test/test.h>
 #include <test/ut.h>
@@ -52,3 +53,45 @@ static int dm_test_mmc_blk(struct unit_test_state *uts)
 	return 0;
 }
 DM_TEST(dm_test_mmc_blk, UT_TESTF_SCAN_PDATA | UT_TESTF_SCAN_FDT);
+
+/* Multiple-block transfers use CMD23 rather than a stop command */
+static int dm_test_mmc_cmd23(struct unit_test_state *uts)
+{
+	uint set_count, stop_count, read_count, write_count;
+	char write[16 * 512], read[16 * 512];
+	struct blk_desc *dev_desc;
+	struct udevice *dev;
+	int i;
+
+	ut_assertok(blk_get_device_by_str("mmc", "0", &dev_desc));
+	dev = dev_get_parent(dev_desc->bdev);
+
+	set_count = sandbox_mmc_get_cmd_count(dev, MMC_CMD_SET_BLOCK_COUNT);
+	stop_count = sandbox_mmc_get_cmd_count(dev, MMC_CMD_STOP_TRANSMISSION);
+	read_count = sandbox_mmc_get_cmd_count(dev, MMC_CMD_READ_MULTIPLE_BLOCK);
+	write_count = sandbox_mmc_get_cmd_count(dev,
+						MMC_CMD_WRITE_MULTIPLE_BLOCK);
+
+	for (i = 0; i < sizeof(write); i++)
+		write[i] = i * 3;
+	ut_asserteq(16, blk_dwrite(dev_desc, 0x100, 16, write));
+	ut_asserteq(write_count + 1,
+		    sandbox_mmc_get_cmd_count(dev,
+					      MMC_CMD_WRITE_MULTIPLE_BLOCK));
+	ut_asserteq(set_count + 1,
+		    sandbox_mmc_get_cmd_count(dev, MMC_CMD_SET_BLOCK_COUNT));
+
+	ut_asserteq(16, blk_dread(dev_desc, 0x100, 16, read));
+	ut_asserteq_mem(write, read, sizeof(write));
+	read_count = sandbox_mmc_get_cmd_count(dev, MMC_CMD_READ_MULTIPLE_BLOCK) -
+		read_count;
+	ut_assert(read_count > 0);
+	ut_asserteq(set_count + 1 + read_count,
+		    sandbox_mmc_get_cmd_count(dev, MMC_CMD_SET_BLOCK_COUNT));
+
+	ut_asserteq(stop_count,
+		    sandbox_mmc_get_cmd_count(dev, MMC_CMD_STOP_TRANSMISSION));
+
+	return 0;
+}
+DM_TEST(dm_test_mmc_cmd23, UT_TESTF_SCAN_PDATA | UT_TESTF_SCAN_FDT);
@@ -6,6 +6,7 @@
 #include <common.h>
 #include <console.h>
 #include <dm.h>
+#include <malloc.h>
 #include <part.h>
 #include <usb.h>
 #include <asm/io.h>
@@ -85,6 +86,101 @@ static int dm_test_usb_flash(struct unit_test_state *uts)
 }
 DM_TEST(dm_test_usb_flash, UT_TESTF_SCAN_PDATA | UT_TESTF_SCAN_FDT);
 
+/*
+ * Test reads which are queued with the controller several commands at a time,
+ * followed by a read of the rest one command at a time
+ */
+static int dm_test_usb_flash_queue(struct unit_test_state *uts)
+{
+	/* Two rounds of queued commands and a bit */
+	const int count = 2 * 4 * 240 + 100;
+	const int start = 16;
+	struct udevice *dev, *blk;
+	char *buf, *cmp;
+	int i;
+
+	if (!IS_ENABLED(CONFIG_USB_STORAGE_BOT_QUEUE))
+		return -EAGAIN;
+
+	state_set_skip_delays(true);
+	ut_assertok(usb_init());
+	ut_assertok(uclass_get_device(UCLASS_MASS_STORAGE, 0, &dev));
+	ut_assertok(device_find_first_child_by_uclass(dev, UCLASS_BLK, &blk));
+
+	buf = malloc(count * 512);
+	ut_assertnonnull(buf);
+	cmp = malloc(count * 512);
+	ut_assertnonnull(cmp);
+	for (i = 0; i < count * 512; i++)
+		buf[i] = i * 7 + (i >> 9);
+	ut_asserteq(count, blk_write(blk, start, count, buf));
+
+	memset(cmp, '\0', count * 512);
+	ut_asserteq(count, blk_read(blk, start, count, cmp));
+	ut_asserteq_mem(buf, cmp, count * 512);
+
+	/* Put back what the other tests expect */
+	memset(buf, '\0', count * 512);
+	ut_asserteq(count, blk_write(blk, start, count, buf));
+	free(cmp);
+	free(buf);
+
+	ut_assertok(usb_stop());
+
+	return 0;
+}
+DM_TEST(dm_test_usb_flash_queue, UT_TESTF_SCAN_PDATA | UT_TESTF_SCAN_FDT);
+
+/*
+ * Test queued reads from a UAS device, which serves the commands out of order
+ * and offers fewer streams than asked for
+ */
+static int dm_test_usb_flash_uas(struct unit_test_state *uts)
+{
+	/* Two rounds of queued commands on two streams, and a bit */
+	const int count = 2 * 2 * 240 + 100;
+	const int start = 16;
+	struct udevice *dev, *blk, *emul;
+	char *buf, *cmp;
+	int i;
+
+	if (!IS_ENABLED(CONFIG_USB_STORAGE_UAS))
+		return -EAGAIN;
+
+	state_set_skip_delays(true);
+	ut_assertok(usb_init());
+	ut_assertok(uclass_get_device(UCLASS_MASS_STORAGE, 2, &dev));
+	ut_assertok(device_find_first_child_by_uclass(dev, UCLASS_BLK, &blk));
+	ut_assertok(uclass_get_device_by_name(UCLASS_USB_EMUL, "flash-stick@2",
+					      &emul));
+
+	buf = malloc(count * 512);
+	ut_assertnonnull(buf);
+	cmp = malloc(count * 512);
+	ut_assertnonnull(cmp);
+	for (i = 0; i < count * 512; i++)
+		buf[i] = i * 7 + (i >> 9);
+	ut_asserteq(count, blk_write(blk, start, count, buf));
+
+	memset(cmp, '\0', count * 512);
+	ut_asserteq(count, blk_read(blk, start, count, cmp));
+	ut_asserteq_mem(buf, cmp, count * 512);
+
+	/* Both rounds went out whole, without falling back to single reads */
+	ut_asserteq(2, sandbox_flash_get_queued(emul));
+
+	/* Put back what the other tests expect */
+	memset(buf, '\0', count * 512);
+	ut_asserteq(count, blk_write(blk, start, count, buf));
+	free(cmp);
+	free(buf);
+
+	ut_assertok(usb_stop());
+
+	return 0;
+}
+DM_TEST(dm_test_usb_flash_uas, UT_TESTF_SCAN_PDATA | UT_TESTF_SCAN_FDT);
+
 /* test that we can handle multiple storage devices */
 static int dm_test_usb_multi(struct unit_test_state *uts)
 {
@@ -196,3 +196,69 @@ static int dm_test_virtio_ring(struct unit_test_state *uts)
 	return 0;
 }
 DM_TEST(dm_test_virtio_ring, UT_TESTF_SCAN_PDATA | UT_TESTF_SCAN_FDT);
+
+/* Test that a chain of buffers takes one descriptor when indirect */
+static int dm_test_virtio_ring_indirect(struct unit_test_state *uts)
+{
+	struct udevice *bus, *dev;
+	struct virtio_dev_priv *uc_priv;
+	struct vring_desc *table;
+	struct virtqueue *vq;
+	struct virtio_sg sg[3];
+	struct virtio_sg *sgs[3];
+	unsigned int len;
+	u8 buffer[3][32];
+	int i;
+
+	ut_assertok(uclass_first_device_err(UCLASS_VIRTIO, &bus));
+	ut_assertok(device_find_first_child(bus, &dev));
+
+	/* fake the virtio device probe, as above */
+	uc_priv = dev_get_uclass_priv(bus);
+	uc_priv->vdev = dev;
+	__virtio_set_bit(bus, VIRTIO_RING_F_INDIRECT_DESC);
+
+	for (i = 0; i < 3; i++) {
+		sg[i].addr = buffer[i];
+		sg[i].length = sizeof(buffer[i]);
+		sgs[i] = &sg[i];
+	}
+
+	ut_assertok(virtio_find_vqs(dev, 1, &vq));
+	ut_assert(vq->indirect);
+	ut_asserteq(4, vq->num_free);
+
+	/* four chains of three buffers fit in a ring of four descriptors */
+	for (i = 0; i < 4; i++)
+		ut_assertok(virtqueue_add(vq, sgs, 1, 2));
+	ut_asserteq(0, vq->num_free);
+	ut_asserteq(-ENOSPC, virtqueue_add(vq, sgs, 1, 2));
+
+	ut_asserteq(VRING_DESC_F_INDIRECT,
+		    virtio16_to_cpu(dev, vq->vring.desc[0].flags));
+	ut_asserteq(3 * sizeof(struct vring_desc),
+		    virtio32_to_cpu(dev, vq->vring.desc[0].len));
+	table = (void *)(uintptr_t)virtio64_to_cpu(dev, vq->vring.desc[0].addr);
+	ut_asserteq_ptr(buffer[0],
+			(void *)(uintptr_t)virtio64_to_cpu(dev, table[0].addr));
+	ut_asserteq(VRING_DESC_F_NEXT,
+		    virtio16_to_cpu(dev, table[0].flags));
+	ut_asserteq(VRING_DESC_F_NEXT | VRING_DESC_F_WRITE,
+		    virtio16_to_cpu(dev, table[1].flags));
+	ut_asserteq(VRING_DESC_F_WRITE, virtio16_to_cpu(dev, table[2].flags));
+
+	/* the first buffer comes back and the descriptor is free again */
+	vq->vring.used->idx = 1;
+	vq->vring.used->ring[0].id = 0;
+	vq->vring.used->ring[0].len = 64;
+	ut_asserteq_ptr(buffer[0], virtqueue_get_buf(vq, &len));
+	ut_asserteq(64, len);
+	ut_asserteq(1, vq->num_free);
+	ut_assertnull(vq->vring_desc_shadow[0].indir_desc);
+
+	ut_assertok(virtio_del_vqs(dev));
+	__virtio_clear_bit(bus, VIRTIO_RING_F_INDIRECT_DESC);
+
+	return 0;
+}
+DM_TEST(dm_test_virtio_ring_indirect, UT_TESTF_SCAN_PDATA | UT_TESTF_SCAN_FDT);
@@ -8,6 +8,7 @@ import pytest
 import re
 from subprocess import call, check_call, check_output, CalledProcessError
 from fstest_defs import *
+from fstest_helpers import dx_hack_collisions
 import u_boot_utils as util
 # pylint: disable=E0611
 from tests import fs_helper
@@ -18,6 +19,7 @@ supported_fs_fat = ['fat12', 'fat16']
 supported_fs_mkdir = ['fat12', 'fat16', 'fat32']
 supported_fs_unlink = ['fat12', 'fat16', 'fat32']
 supported_fs_symlink = ['ext4']
+supported_fs_ext4 = ['ext4']
 
 #
 # Filesystem test specific setup
@@ -55,6 +57,7 @@ def pytest_configure(config):
     global supported_fs_mkdir
     global supported_fs_unlink
     global supported_fs_symlink
+    global supported_fs_ext4
 
     def intersect(listA, listB):
         return  [x for x in listA if x in listB]
@@ -68,6 +71,7 @@ def pytest_configure(config):
         supported_fs_mkdir =  intersect(supported_fs, supported_fs_mkdir)
         supported_fs_unlink =  intersect(supported_fs, supported_fs_unlink)
         supported_fs_symlink =  intersect(supported_fs, supported_fs_symlink)
+        supported_fs_ext4 =  intersect(supported_fs, supported_fs_ext4)
 
 def pytest_generate_tests(metafunc):
     """Parametrize fixtures, fs_obj_xxx
@@ -99,6 +103,9 @@ def pytest_generate_tests(metafunc):
     if 'fs_obj_symlink' in metafunc.fixturenames:
         metafunc.parametrize('fs_obj_symlink', supported_fs_symlink,
             indirect=True, scope='module')
+    if 'fs_obj_ext4' in metafunc.fixturenames:
+        metafunc.parametrize('fs_obj_ext4', supported_fs_ext4,
+            indirect=True, scope='module')
 
 #
 # Helper functions
@@ -672,3 +679,116 @@ def fs_obj_fat(request, u_boot_config):
     else:
         yield [fs_ubtype, fs_img]
     call('rm -f %s' % fs_img, shell=True)
+
+#
+# Fixture for ext4 test
+#
+@pytest.fixture()
+def fs_obj_ext4(request, u_boot_config):
+    """Set up a file system to be used in ext4 test.
+
+    Args:
+        request: Pytest request object.
+        u_boot_config: U-Boot configuration.
+
+    Return:
+        A fixture for ext4 test, i.e. a triplet of file system type,
+        volume file name and  a list of MD5 hashes.
+    """
+    fs_type = request.param
+    fs_img = ''
+
+    fs_ubtype = fstype_to_ubname(fs_type)
+    check_ubconfig(u_boot_config, fs_ubtype)
+
+    mount_dir = u_boot_config.persistent_data_dir + '/mnt'
+
+    sparse_file = mount_dir + '/sparse'
+    holes_file = mount_dir + '/holes'
+
+    try:
+
+        # 128MiB volume
+        fs_img = fs_helper.mk_fs(u_boot_config, fs_type, 0x8000000, '128MB')
+
+        # Index directories with the legacy hash, which takes no seed
+        check_call('tune2fs -E hash_alg=legacy %s' % fs_img, shell=True)
+    except CalledProcessError as err:
+        pytest.skip('Creating failed for filesystem: ' + fs_type + '. {}'.format(err))
+        return
+
+    try:
+        check_call('mkdir -p %s' % mount_dir, shell=True)
+    except CalledProcessError as err:
+        pytest.skip('Preparing mount folder failed for filesystem: ' + fs_type + '. {}'.format(err))
+        call('rm -f %s' % fs_img, shell=True)
+        return
+
+    try:
+        # Mount the image so we can populate it.
+        mount_fs(fs_type, fs_img, mount_dir)
+    except CalledProcessError as err:
+        pytest.skip('Mounting to folder failed for filesystem: ' + fs_type + '. {}'.format(err))
+        call('rmdir %s' % mount_dir, shell=True)
+        call('rm -f %s' % fs_img, shell=True)
+        return
+
+    try:
+        # Create a file of six 64KiB extents, 1MiB apart, which needs
+        # more extents than fit into the inode.
+        for i in range(0, 6):
+            check_call('dd if=/dev/urandom of=%s bs=64K seek=%d count=1 '
+                       'conv=notrunc' % (sparse_file, i * 16), shell=True)
+
+        # Create a 4MiB file with a single extent in the middle.
+        check_call('truncate -s 4M %s' % holes_file, shell=True)
+        check_call('dd if=/dev/urandom of=%s bs=64K seek=32 count=1 '
+                   'conv=notrunc' % holes_file, shell=True)
+
+        # Whole sparse file
+        out = check_output('dd if=%s bs=1K 2> /dev/null | md5sum'
+            % sparse_file, shell=True).decode()
+        md5val = [out.split()[0]]
+
+        # 72KiB at 0xff000: hole, first 64KiB of the second extent, hole
+        out = check_output('dd if=%s bs=1K skip=1020 count=72 2> /dev/null | md5sum'
+            % sparse_file, shell=True).decode()
+        md5val.append(out.split()[0])
+
+        # Whole file with holes
+        out = check_output('dd if=%s bs=1K 2> /dev/null | md5sum'
+            % holes_file, shell=True).decode()
+        md5val.append(out.split()[0])
+
+        # 128KiB at 0x1fe000: the extent and the holes either side
+        out = check_output('dd if=%s bs=1K skip=2040 count=128 2> /dev/null | md5sum'
+            % holes_file, shell=True).decode()
+        md5val.append(out.split()[0])
+
+        # Create a directory of names whose hashes collide in pairs. The
+        # pair with the lowest hash gets one file only, so that every
+        # other pair is split when the entries fill whole leaf blocks.
+        pairs = dx_hack_collisions(HTREE_PAIRS)
+        names = [pairs[0][0]] + [name for pair in pairs[1:] for name in pair]
+        check_call('mkdir %s/%s' % (mount_dir, HTREE_DIR), shell=True)
+        check_call('cd %s/%s && touch %s' % (mount_dir, HTREE_DIR,
+                   ' '.join(names)), shell=True)
+
+    except CalledProcessError:
+        pytest.skip('Setup failed for filesystem: ' + fs_type)
+        umount_fs(mount_dir)
+        return
+    else:
+        umount_fs(mount_dir)
+
+        # Rebuild the directory index with no free space in the leaves
+        e2fsck_conf = u_boot_config.persistent_data_dir + '/e2fsck.conf'
+        with open(e2fsck_conf, 'w') as fd:
+            fd.write('[options]\n\tindexed_dir_slack_percentage = 0\n')
+        if call('E2FSCK_CONFIG=%s fsck.ext4 -f -y -D %s'
+                % (e2fsck_conf, fs_img), shell=True) > 1:
+            pytest.skip('Indexing directories failed for filesystem: ' + fs_type)
+        yield [fs_ubtype, fs_img, md5val]
+    finally:
+        call('rmdir %s' % mount_dir, shell=True)
+        call('rm -f %s' % fs_img, shell=True)
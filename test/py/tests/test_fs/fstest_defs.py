@@ -12,5 +12,10 @@ MEDIUM_FILE='10MB.file'
 # $BIG_FILE is the name of the 2.5GB file in the file system image
 BIG_FILE='2.5GB.file'
 
+# $HTREE_DIR is the name of the hash-indexed directory in the ext4 image,
+# holding all but one of $HTREE_PAIRS pairs of names with colliding hashes
+HTREE_DIR='htree'
+HTREE_PAIRS=200
+
 ADDR=0x01000008
 LENGTH=0x00100000
@@ -3,6 +3,7 @@
 # Author: JJ Hiblot <jjhiblot@ti.com>
 #
 
+import string
 from subprocess import check_call, CalledProcessError
 
 def assert_fs_integrity(fs_type, fs_img):
@@ -11,3 +12,64 @@ def assert_fs_integrity(fs_type, fs_img):
             check_call('fsck.ext4 -n -f %s' % fs_img, shell=True)
     except CalledProcessError:
         raise
+
+def dx_hack_hash(name):
+    """Hash a name with the "legacy" hash of ext4 directory indexes.
+
+    Args:
+        name: File name.
+
+    Return:
+        The 32-bit hash, as it appears in the directory index.
+    """
+    hash0, hash1 = 0x12a3fe2d, 0x37abe8f9
+    for c in name.encode():
+        hash = (hash1 + (hash0 ^ (c * 7152373))) & 0xffffffff
+        if hash & 0x80000000:
+            hash = (hash - 0x7fffffff) & 0xffffffff
+        hash0, hash1 = hash, hash0
+    return (hash0 << 1) & 0xffffffff
+
+def dx_hack_collisions(count):
+    """Make up pairs of names with the same legacy ext4 hash.
+
+    Each name is a short prefix such as 'c0-' and three letters or digits.
+    Dozens of pairs collide among the names sharing a prefix, so only a
+    few prefixes are needed.
+
+    Args:
+        count: Number of pairs.
+
+    Return:
+        A list of pairs of names, sorted by their hash.
+    """
+    chars = [ord(c) for c in string.ascii_letters + string.digits]
+    pairs = []
+
+    def step(state, c):
+        hash0, hash1 = state
+        hash = (hash1 + (hash0 ^ (c * 7152373))) & 0xffffffff
+        if hash & 0x80000000:
+            hash = (hash - 0x7fffffff) & 0xffffffff
+        return hash, hash0
+
+    prefix = 0
+    while len(pairs) < count:
+        head = 'c%d-' % prefix
+        prefix += 1
+        state = (0x12a3fe2d, 0x37abe8f9)
+        for c in head.encode():
+            state = step(state, c)
+        seen = {}
+        for a in chars:
+            state_a = step(state, a)
+            for b in chars:
+                state_b = step(state_a, b)
+                for c in chars:
+                    hash = step(state_b, c)[0]
+                    name = head + chr(a) + chr(b) + chr(c)
+                    if hash in seen:
+                        pairs.append((seen.pop(hash), name))
+                    else:
+                        seen[hash] = name
+    return sorted(pairs[:count], key=lambda pair: dx_hack_hash(pair[0]))
@@ -3,6 +3,8 @@
 # Niel Fourie, DENX Software Engineering, lusus@denx.de
 
 import pytest
+import re
+from fstest_defs import *
 
 @pytest.mark.boardspec('sandbox')
 @pytest.mark.buildconfigspec('cmd_fs_generic')
@@ -11,3 +13,46 @@ def test_fstypes(u_boot_console):
     output = u_boot_console.run_command('fstypes')
     assert "Supported filesystems:" in output
     assert "sandbox" in output
+
+def bootstage_accum(u_boot_console, name):
+    """Return the time in microseconds accumulated by a bootstage record."""
+    output = u_boot_console.run_command('bootstage report')
+    m = re.search(r'^\s*([\d,]+)\s+%s\s*$' % name, output, re.M)
+    return int(m.group(1).replace(',', '')) if m else 0
+
+@pytest.mark.boardspec('sandbox')
+@pytest.mark.buildconfigspec('cmd_fs_generic')
+@pytest.mark.buildconfigspec('cmd_bootstage')
+@pytest.mark.buildconfigspec('fs_mount_cache')
+def test_fs_mount_cache(u_boot_console, fs_obj_fat):
+    """Test that a filesystem stays mounted until its device changes."""
+    fs_type,fs_img = fs_obj_fat
+    u_boot_console.run_command_list([
+        'host bind 0 %s' % fs_img,
+        'ls host 0:0 /'])
+
+    # Later commands on the same partition use the mounted filesystem
+    probe = bootstage_accum(u_boot_console, 'fs_probe')
+    saved = bootstage_accum(u_boot_console, 'fs_probe_saved')
+    u_boot_console.run_command_list([
+        'ls host 0:0 /',
+        'ls host 0:0 /'])
+    assert bootstage_accum(u_boot_console, 'fs_probe') == probe
+    assert bootstage_accum(u_boot_console, 'fs_probe_saved') > saved
+
+    # A write to the block device unmounts it, so the next command probes
+    output = u_boot_console.run_command(
+        'save host 0:0 %x /mount.tst 0x100' % ADDR)
+    assert '256 bytes written' in output
+    saved = bootstage_accum(u_boot_console, 'fs_probe_saved')
+    output = u_boot_console.run_command('ls host 0:0 /')
+    assert 'mount.tst' in output
+    assert bootstage_accum(u_boot_console, 'fs_probe_saved') == saved
+
+    # So does removing the device
+    u_boot_console.run_command_list([
+        'host unbind 0',
+        'host bind 0 %s' % fs_img])
+    output = u_boot_console.run_command('ls host 0:0 /')
+    assert 'mount.tst' in output
+    assert bootstage_accum(u_boot_console, 'fs_probe_saved') == saved
@@ -0,0 +1,106 @@
+# SPDX-License-Identifier:      GPL-2.0+
+#
+# U-Boot File System: ext4 Test
+
+"""
+This test verifies ext4 specific file system behaviour.
+"""
+
+import hashlib
+import os
+import pytest
+import re
+from subprocess import check_output
+from fstest_defs import *
+from fstest_helpers import assert_fs_integrity, dx_hack_collisions
+
+@pytest.mark.boardspec('sandbox')
+@pytest.mark.slow
+class TestFsExt4(object):
+    def test_fs_ext4_1(self, u_boot_console, fs_obj_ext4):
+        """
+        Test Case 1 - read files made of several extents and holes
+        """
+        fs_type,fs_img,md5val = fs_obj_ext4
+        with u_boot_console.log.section('Test Case 1 - extents and holes'):
+            for (name, length, offset, md5) in [
+                    ('sparse', 0x510000, 0, md5val[0]),
+                    ('sparse', 0x12000, 0xff000, md5val[1]),
+                    ('holes', 0x400000, 0, md5val[2]),
+                    ('holes', 0x20000, 0x1fe000, md5val[3])]:
+                output = u_boot_console.run_command_list([
+                    'host bind 0 %s' % fs_img,
+                    'mw.b %x ff %x' % (ADDR, length),
+                    '%sload host 0:0 %x /%s %x %x'
+                        % (fs_type, ADDR, name, length, offset),
+                    'md5sum %x %x' % (ADDR, length)])
+                assert('%d bytes read' % length in ''.join(output))
+                assert(md5 in ''.join(output))
+
+    def test_fs_ext4_2(self, u_boot_console, fs_obj_ext4):
+        """
+        Test Case 2 - look names up in a hash-indexed directory
+        """
+        fs_type,fs_img,md5val = fs_obj_ext4
+        pairs = dx_hack_collisions(HTREE_PAIRS)
+        names = [pairs[0][0]] + [name for pair in pairs[1:] for name in pair]
+        with u_boot_console.log.section('Test Case 2 - htree lookup'):
+            # Every name is found, including those which spill over into
+            # the next leaf block along with their hash
+            u_boot_console.run_command('host bind 0 %s' % fs_img)
+            for i in range(0, len(names), 40):
+                output = u_boot_console.run_command(
+                    'for f in %s; do %ssize host 0:0 /%s/${f} || '
+                    'echo missing:${f}; done'
+                    % (' '.join(names[i:i + 40]), fs_type, HTREE_DIR))
+                assert(not re.search(r'missing:\w', output))
+
+            # A name hashing like an existing one is not
+            output = u_boot_console.run_command_list([
+                '%ssize host 0:0 /%s/%s' % (fs_type, HTREE_DIR, pairs[0][1]),
+                'echo $?'])
+            assert(output[-1].strip() == '1')
+
+    @pytest.mark.requiredtool('debugfs')
+    def test_fs_ext4_3(self, u_boot_console, fs_obj_ext4):
+        """
+        Test Case 3 - write a file which needs more than four extents
+        """
+        fs_type,fs_img,md5val = fs_obj_ext4
+        with u_boot_console.log.section('Test Case 3 - write extent tree'):
+            data = os.urandom(0x40000)
+            path = os.path.join(u_boot_console.config.persistent_data_dir,
+                                'ext4_3.bin')
+            with open(path, 'wb') as fd:
+                fd.write(data)
+
+            # Shrink every other one of twelve 16KiB files to split free space
+            u_boot_console.run_command('host bind 0 %s' % fs_img)
+            for i in range(0, 12):
+                u_boot_console.run_command(
+                    '%swrite host 0:0 %x /h%02d 0x4000' % (fs_type, ADDR, i))
+            for i in range(1, 12, 2):
+                u_boot_console.run_command(
+                    '%swrite host 0:0 %x /h%02d 0x400' % (fs_type, ADDR, i))
+
+            output = u_boot_console.run_command_list([
+                'host load hostfs - %x %s' % (ADDR, path),
+                '%swrite host 0:0 %x /big 0x40000' % (fs_type, ADDR)])
+            assert('262144 bytes written' in ''.join(output))
+            output = check_output('debugfs -R "ex /big" %s' % fs_img,
+                                  shell=True).decode()
+            assert(len(re.findall(r'^\s*1/\s*1\s', output, re.M)) > 4)
+            assert_fs_integrity(fs_type, fs_img)
+
+            output = u_boot_console.run_command_list([
+                'mw.b %x 00 0x40000' % (ADDR + 0x40000),
+                '%sload host 0:0 %x /big' % (fs_type, ADDR + 0x40000),
+                'md5sum %x $filesize' % (ADDR + 0x40000),
+                'setenv filesize'])
+            assert(hashlib.md5(data).hexdigest() in ''.join(output))
+
+            # Replacing the file deletes it, freeing the extent tree too
+            output = u_boot_console.run_command(
+                '%swrite host 0:0 %x /big 0x400' % (fs_type, ADDR))
+            assert('1024 bytes written' in output)
+            assert_fs_integrity(fs_type, fs_img)
@@ -8,8 +8,61 @@
 This test verifies fat specific file system behaviour.
 """
 
+import hashlib
+import os
 import pytest
 import re
+import struct
+from fstest_defs import *
+
+def write_host_data(u_boot_console, name, size):
+    """Fill a host file with random data and load it at ADDR.
+
+    Args:
+        u_boot_console: U-Boot console.
+        name: Name of the file in the persistent data directory.
+        size: Number of bytes.
+
+    Return:
+        The data.
+    """
+    data = os.urandom(size)
+    path = os.path.join(u_boot_console.config.persistent_data_dir, name)
+    with open(path, 'wb') as fd:
+        fd.write(data)
+    u_boot_console.run_command('host load hostfs - %x %s' % (ADDR, path))
+    return data
+
+def fat_free_clusters(fs_img):
+    """Count the free clusters of a FAT12 or FAT16 image.
+
+    Args:
+        fs_img: Path of the image.
+
+    Return:
+        The number of free clusters.
+    """
+    with open(fs_img, 'rb') as fd:
+        boot = fd.read(512)
+        (sect_size, clust_size, reserved, fats, root_ents, total16,
+         fat_size) = struct.unpack_from('<HBHBHHxH', boot, 11)
+        total = total16 or struct.unpack_from('<I', boot, 32)[0]
+        data = (reserved + fats * fat_size +
+                (root_ents * 32 + sect_size - 1) // sect_size)
+        clusters = (total - data) // clust_size
+        fd.seek(reserved * sect_size)
+        fat = fd.read(fat_size * sect_size)
+
+    free = 0
+    for clust in range(2, clusters + 2):
+        if clusters < 4085:
+            entry = struct.unpack_from('<H', fat, clust * 3 // 2)[0]
+            entry = entry >> 4 if clust & 1 else entry & 0xfff
+        else:
+            entry = struct.unpack_from('<H', fat, clust * 2)[0]
+        if not entry:
+            free += 1
+    return free
 
 @pytest.mark.boardspec('sandbox')
 @pytest.mark.slow
@@ -23,3 +76,143 @@ class TestFsFat(object):
                 'host bind 0 %s' % fs_img,
                 'fatinfo host 0:0'])
             assert(re.search('Filesystem: %s' % fs_type.upper(), ''.join(output)))
+
+    def test_fs_fat2(self, u_boot_console, fs_obj_fat):
+        """Test reads at an offset from a file in several fragments."""
+        fs_type,fs_img = fs_obj_fat
+        with u_boot_console.log.section('Test Case 2 - read at offset'):
+            data = write_host_data(u_boot_console, 'fat2.bin', 0x100000)
+
+            # Grow the file past other files so that its chain is split
+            output = u_boot_console.run_command_list([
+                'host bind 0 %s' % fs_img,
+                '%swrite host 0:0 %x /frag 0x40000' % (fs_type, ADDR),
+                '%swrite host 0:0 %x /gap1 0x20000' % (fs_type, ADDR),
+                '%swrite host 0:0 %x /frag 0x40000 0x40000'
+                    % (fs_type, ADDR + 0x40000),
+                '%swrite host 0:0 %x /gap2 0x20000' % (fs_type, ADDR),
+                '%swrite host 0:0 %x /frag 0x80000 0x80000'
+                    % (fs_type, ADDR + 0x80000)])
+            assert('524288 bytes written' in ''.join(output))
+
+            dest = ADDR + 0x100000
+            for (offset, length) in [(0, 0x100000), (0x12345, 0x9abc),
+                                     (0x3f000, 0x2000), (0x7ffff, 0x3),
+                                     (0x7e001, 0x41fff), (0xfff00, 0x100)]:
+                expected = hashlib.md5(
+                    data[offset:offset + length]).hexdigest()
+                output = u_boot_console.run_command_list([
+                    '%sload host 0:0 %x /frag %x %x'
+                        % (fs_type, dest, length, offset),
+                    'md5sum %x %x' % (dest, length)])
+                assert('%d bytes read' % length in ''.join(output))
+                assert(expected in ''.join(output))
+
+    def test_fs_fat3(self, u_boot_console, fs_obj_fat):
+        """Test lookups in a directory which is written in between."""
+        fs_type,fs_img = fs_obj_fat
+        with u_boot_console.log.section('Test Case 3 - directory writes'):
+            data = write_host_data(u_boot_console, 'fat3.bin', 0x10000)
+            name = '/dcache/cached-file-%02d.bin'
+            files = {}
+
+            u_boot_console.run_command_list([
+                'host bind 0 %s' % fs_img,
+                '%smkdir host 0:0 /dcache' % fs_type])
+            for i in range(0, 40):
+                u_boot_console.run_command(
+                    '%swrite host 0:0 %x %s 0x200'
+                        % (fs_type, ADDR + i * 0x200, name % i))
+                files[name % i] = data[i * 0x200:(i + 1) * 0x200]
+
+            # Look every name up once, so that they are all cached
+            for (path, content) in files.items():
+                output = u_boot_console.run_command_list([
+                    '%sload host 0:0 %x %s' % (fs_type, ADDR + 0x10000, path),
+                    'md5sum %x $filesize' % (ADDR + 0x10000)])
+                assert(hashlib.md5(content).hexdigest() in ''.join(output))
+
+            # Remove, add and replace files in the same directory
+            output = u_boot_console.run_command_list([
+                '%srm host 0:0 %s' % (fs_type, name % 3),
+                '%swrite host 0:0 %x %s 0x300'
+                    % (fs_type, ADDR + 0x8000, name % 40),
+                '%swrite host 0:0 %x %s 0x400'
+                    % (fs_type, ADDR + 0x9000, name % 7)])
+            assert('1024 bytes written' in ''.join(output))
+            del files[name % 3]
+            files[name % 40] = data[0x8000:0x8300]
+            files[name % 7] = data[0x9000:0x9400]
+
+            for (path, content) in files.items():
+                output = u_boot_console.run_command_list([
+                    '%sload host 0:0 %x %s' % (fs_type, ADDR + 0x10000, path),
+                    'md5sum %x $filesize' % (ADDR + 0x10000)])
+                assert(hashlib.md5(content).hexdigest() in ''.join(output))
+
+            # Names are looked up without regard to case
+            output = u_boot_console.run_command_list([
+                '%sload host 0:0 %x %s'
+                    % (fs_type, ADDR + 0x10000, (name % 7).upper()),
+                'md5sum %x $filesize' % (ADDR + 0x10000)])
+            assert(hashlib.md5(files[name % 7]).hexdigest() in ''.join(output))
+
+            output = u_boot_console.run_command(
+                '%sload host 0:0 %x %s' % (fs_type, ADDR + 0x10000, name % 3))
+            assert('Failed to load' in output)
+            output = u_boot_console.run_command(
+                '%sls host 0:0 /dcache' % fs_type)
+            assert('40 file(s), 2 dir(s)' in output)
+
+            # All the names are cached now. Remove one and look names up
+            # again in the same command line, with the volume still mounted.
+            output = u_boot_console.run_command('; '.join([
+                '%srm host 0:0 %s' % (fs_type, name % 20),
+                '%sload host 0:0 %x %s' % (fs_type, ADDR + 0x10000, name % 21),
+                'md5sum %x $filesize' % (ADDR + 0x10000),
+                '%sload host 0:0 %x %s'
+                    % (fs_type, ADDR + 0x10000, name % 20)]))
+            assert(hashlib.md5(files[name % 21]).hexdigest() in output)
+            assert('Failed to load' in output)
+            output = u_boot_console.run_command(
+                '%sls host 0:0 /dcache' % fs_type)
+            assert('39 file(s), 2 dir(s)' in output)
+
+    def test_fs_fat4(self, u_boot_console, fs_obj_fat):
+        """Test that writing to a full volume fails cleanly."""
+        fs_type,fs_img = fs_obj_fat
+        with u_boot_console.log.section('Test Case 4 - volume full'):
+            # Files of an eighth of the volume, or less on large ones
+            size = min(os.path.getsize(fs_img) // 8, 0x1000000) & ~0xffff
+            full = None
+
+            u_boot_console.run_command('host bind 0 %s' % fs_img)
+            for i in range(0, 20):
+                free = fat_free_clusters(fs_img)
+                output = u_boot_console.run_command(
+                    '%swrite host 0:0 %x /fill%02d %x'
+                        % (fs_type, ADDR, i, size))
+                if 'no space left' in output:
+                    full = i
+                    break
+                assert('%d bytes written' % size in output)
+            assert(full)
+
+            # The clusters taken before space ran out are given back
+            assert(fat_free_clusters(fs_img) == free)
+            output = u_boot_console.run_command('%sls host 0:0 /' % fs_type)
+            assert('fill%02d' % (full - 1) in output)
+            assert('fill%02d' % full not in output)
+
+            # Once a file is removed, there is room for one more
+            output = u_boot_console.run_command_list([
+                '%srm host 0:0 /fill00' % fs_type,
+                '%swrite host 0:0 %x /fill%02d %x'
+                    % (fs_type, ADDR, full, size)])
+            assert('%d bytes written' % size in ''.join(output))
+
+            output = u_boot_console.run_command_list([
+                'md5sum %x %x' % (ADDR, size),
+                '%sload host 0:0 %x /fill01' % (fs_type, ADDR + size),
+                'md5sum %x $filesize' % (ADDR + size)])
+            assert(output[0].split()[-1] in output[2])
@@ -0,0 +1,113 @@
+# SPDX-License-Identifier: GPL-2.0
+
+import hashlib
+import os
+import shutil
+import pytest
+
+from sqfs_common import mksquashfs, check_mksquashfs_version
+
+# source directory and images used by this test
+SQFS_FRAG_DIR = 'sqfs_frag_dir'
+SQFS_FRAG_IMAGES = {
+        'frag_gzip' : '-comp gzip -always-use-fragments',
+        'frag_gzip_noF' : '-comp gzip -always-use-fragments -noF',
+        'frag_lzo' : '-comp lzo -always-use-fragments',
+        'frag_zstd' : '-comp zstd -always-use-fragments'
+}
+
+# sizes of the small files, which all end up in a single fragment block
+SQFS_FRAG_SIZES = [1, 100, 1000, 1500, 2048, 3000, 4000, 5555]
+
+def generate_sqfs_frag_dir(build_dir):
+    """ Generates the source directory of the fragment test images.
+
+    The directory holds a small file for each size in SQFS_FRAG_SIZES, named
+    after its size, and 'big', whose last 1000 bytes go in a fragment too.
+    All are random, so that reading the wrong part of a fragment block shows.
+
+    Args:
+        build_dir: u-boot's build-sandbox directory.
+
+    Returns:
+        A dictionary of the files' names and contents.
+    """
+    root = os.path.join(build_dir, SQFS_FRAG_DIR)
+    os.makedirs(root)
+
+    files = {'f%d' % size : os.urandom(size) for size in SQFS_FRAG_SIZES}
+    files['big'] = os.urandom(3 * 128 * 1024 + 1000)
+    for (name, content) in files.items():
+        with open(os.path.join(root, name), 'wb') as file:
+            file.write(content)
+
+    return files
+
+def sqfs_load_frag_files(u_boot_console, files, names):
+    """ Loads files one after the other and checks their contents.
+
+    Args:
+        u_boot_console: provides the means to interact with U-Boot's console.
+        files: dictionary of the files' names and contents.
+        names: files to load, in order.
+    """
+    for name in names:
+        out = u_boot_console.run_command_list([
+            'mw.b $kernel_addr_r ff {:x}'.format(len(files[name])),
+            'sqfsload host 0 $kernel_addr_r {}'.format(name),
+            'md5sum $kernel_addr_r {:x}'.format(len(files[name]))])
+        assert '{} bytes read'.format(len(files[name])) in ''.join(out)
+        assert hashlib.md5(files[name]).hexdigest() in ''.join(out)
+
+def sqfs_run_all_frag_tests(u_boot_console, files):
+    """ Loads the files sharing a fragment block in different orders.
+
+    Args:
+        u_boot_console: provides the means to interact with U-Boot's console.
+        files: dictionary of the files' names and contents.
+    """
+    small = ['f%d' % size for size in SQFS_FRAG_SIZES]
+
+    sqfs_load_frag_files(u_boot_console, files, small)
+    sqfs_load_frag_files(u_boot_console, files, list(reversed(small)))
+
+    # 'big' reads whole blocks as well as its own part of the fragment block
+    interleaved = []
+    for name in small:
+        interleaved += [name, 'big']
+    sqfs_load_frag_files(u_boot_console, files, interleaved)
+
+@pytest.mark.boardspec('sandbox')
+@pytest.mark.buildconfigspec('cmd_fs_generic')
+@pytest.mark.buildconfigspec('cmd_squashfs')
+@pytest.mark.buildconfigspec('fs_squashfs')
+@pytest.mark.requiredtool('mksquashfs')
+def test_sqfs_frag(u_boot_console):
+    """ Loads small files which share a fragment block.
+
+    First, it generates the SquashFS images, then it runs the test cases and
+    finally cleans the workspace, also if an exception is raised.
+
+    Args:
+        u_boot_console: provides the means to interact with U-Boot's console.
+    """
+    build_dir = u_boot_console.config.build_dir
+    src_dir = os.path.join(build_dir, SQFS_FRAG_DIR)
+
+    # setup test environment
+    check_mksquashfs_version()
+    files = generate_sqfs_frag_dir(build_dir)
+
+    try:
+        for (image, opts) in SQFS_FRAG_IMAGES.items():
+            image_path = os.path.join(build_dir, image)
+            mksquashfs(' '.join([src_dir, image_path, '-noappend', opts]))
+            u_boot_console.run_command('host bind 0 {}'.format(image_path))
+            sqfs_run_all_frag_tests(u_boot_console, files)
+    finally:
+        # clean test environment
+        for image in SQFS_FRAG_IMAGES:
+            image_path = os.path.join(build_dir, image)
+            if os.path.exists(image_path):
+                os.remove(image_path)
+        shutil.rmtree(src_dir)
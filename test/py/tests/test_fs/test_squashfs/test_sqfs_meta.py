@@ -0,0 +1,110 @@
+# SPDX-License-Identifier: GPL-2.0
+
+import hashlib
+import os
+import shutil
+import pytest
+
+from sqfs_common import mksquashfs, check_mksquashfs_version
+
+# source directory and images used by this test
+SQFS_META_DIR = 'sqfs_meta_dir'
+SQFS_META_IMAGES = {
+        'meta_gzip' : '-comp gzip',
+        'meta_zstd' : '-comp zstd',
+        'meta_gzip_noI' : '-comp gzip -noI'
+}
+
+# enough long names for the directory listing to take some 20 metadata blocks
+# of 8 KiB, and the inodes five of them
+SQFS_META_FILES = 1200
+SQFS_META_NAME = 'file-with-a-rather-long-name-%04d-' + 'x' * 80
+
+def generate_sqfs_meta_dir(build_dir):
+    """ Generates the source directory of the metadata test images.
+
+    The directory holds 'many/', with SQFS_META_FILES small files named after
+    SQFS_META_NAME, and 'many/zz/last', which comes after all of them. All
+    files are random, so that reading the wrong inode shows.
+
+    Args:
+        build_dir: u-boot's build-sandbox directory.
+
+    Returns:
+        A dictionary of the files' paths and contents.
+    """
+    root = os.path.join(build_dir, SQFS_META_DIR)
+    os.makedirs(os.path.join(root, 'many', 'zz'))
+
+    files = {'many/' + SQFS_META_NAME % i : os.urandom(16 + i)
+             for i in range(SQFS_META_FILES)}
+    files['many/zz/last'] = os.urandom(5000)
+    for (path, content) in files.items():
+        with open(os.path.join(root, path), 'wb') as file:
+            file.write(content)
+
+    return files
+
+def sqfs_run_all_meta_tests(u_boot_console, files):
+    """ Lists the large directory and loads files from all over it.
+
+    Args:
+        u_boot_console: provides the means to interact with U-Boot's console.
+        files: dictionary of the files' paths and contents.
+    """
+    out = u_boot_console.run_command('sqfsls host 0 many')
+    assert '{} file(s), 1 dir(s)'.format(SQFS_META_FILES) in out
+    for i in [0, 1, 255, 256, 257, 599, 1000, SQFS_META_FILES - 1]:
+        assert SQFS_META_NAME % i in out
+
+    out = u_boot_console.run_command('sqfsls host 0 many/zz')
+    assert 'last' in out
+
+    # the first and last files, each side of the boundaries between the
+    # 256-entry directory headers and some in between, in no particular order
+    paths = ['many/zz/last']
+    for i in [SQFS_META_FILES - 1, 0, 256, 255, 511, 512, 777, 3, 1100]:
+        paths.append('many/' + SQFS_META_NAME % i)
+    for path in paths:
+        out = u_boot_console.run_command_list([
+            'mw.b $kernel_addr_r ff {:x}'.format(len(files[path])),
+            'sqfsload host 0 $kernel_addr_r {}'.format(path),
+            'md5sum $kernel_addr_r {:x}'.format(len(files[path]))])
+        assert '{} bytes read'.format(len(files[path])) in ''.join(out)
+        assert hashlib.md5(files[path]).hexdigest() in ''.join(out)
+
+@pytest.mark.boardspec('sandbox')
+@pytest.mark.buildconfigspec('cmd_fs_generic')
+@pytest.mark.buildconfigspec('cmd_squashfs')
+@pytest.mark.buildconfigspec('fs_squashfs')
+@pytest.mark.requiredtool('mksquashfs')
+def test_sqfs_meta(u_boot_console):
+    """ Lists and loads files whose inodes and directory entries are spread
+    over many metadata blocks.
+
+    First, it generates the SquashFS images, then it runs the test cases and
+    finally cleans the workspace, also if an exception is raised.
+
+    Args:
+        u_boot_console: provides the means to interact with U-Boot's console.
+    """
+    build_dir = u_boot_console.config.build_dir
+    src_dir = os.path.join(build_dir, SQFS_META_DIR)
+
+    # setup test environment
+    check_mksquashfs_version()
+    files = generate_sqfs_meta_dir(build_dir)
+
+    try:
+        for (image, opts) in SQFS_META_IMAGES.items():
+            image_path = os.path.join(build_dir, image)
+            mksquashfs(' '.join([src_dir, image_path, '-noappend', opts]))
+            u_boot_console.run_command('host bind 0 {}'.format(image_path))
+            sqfs_run_all_meta_tests(u_boot_console, files)
+    finally:
+        # clean test environment
+        for image in SQFS_META_IMAGES:
+            image_path = os.path.join(build_dir, image)
+            if os.path.exists(image_path):
+                os.remove(image_path)
+        shutil.rmtree(src_dir)